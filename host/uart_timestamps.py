@@ -0,0 +1,113 @@
+#!/usr/bin/env python3
+#
+# Decode the timestamped UART bridge stream. The ESP32 must be configured
+# with:
+#
+#     CONFIG_ESP_UART_BRIDGE_ENABLED=y
+#     CONFIG_ESP_UART_BRIDGE_TIMESTAMPS=y
+#
+# Prints each line received from the target, prefixed with the time its
+# first byte was received, in seconds of esp_timer time. With --ticks, the
+# time is given as a DAP TIMESTAMP_GET() value instead, as returned with
+# DAP_Transfer timestamps, once a debugger has sent DAP commands.
+#
+#     ./uart_timestamps.py 192.168.1.5 4442
+#     ./uart_timestamps.py --ticks 192.168.1.5 4442
+#
+# See the top of main/uart_bridge.c for the record format.
+#
+
+import argparse
+import socket
+import sys
+
+RECORD_TIME = 1
+RECORD_CLOCK = 3
+RECORD_UNTIMED = 5
+
+
+class Decoder:
+    def __init__(self, sock):
+        self.sock = sock
+        self.buf = b""
+        self.time = 0
+        self.clock = None           # (us, ticks, hz) of the last clock record.
+
+    def fill(self):
+        data = self.sock.recv(4096)
+        if not data:
+            raise EOFError
+        self.buf += data
+
+    def data(self, n):
+        while len(self.buf) < n:
+            self.fill()
+        out = self.buf[:n]
+        self.buf = self.buf[n:]
+        return out
+
+    def varint(self):
+        v = 0
+        shift = 0
+        while True:
+            b = self.data(1)[0]
+            v |= (b & 0x7F) << shift
+            shift += 7
+            if b < 0x80:
+                return v
+
+    def ticks(self, us):
+        us0, ticks0, hz = self.clock
+        return (ticks0 + (us - us0) * hz // 1000000) & 0xFFFFFFFF
+
+    # Returns (time in us or None, data) for each data record.
+    def records(self):
+        while True:
+            kind = self.varint()
+            if kind & 1 == 0:
+                self.time += kind >> 1
+                yield self.time, self.data(self.varint())
+            elif kind == RECORD_TIME:
+                self.time = self.varint()
+            elif kind == RECORD_CLOCK:
+                self.clock = (self.varint(), self.varint(), self.varint())
+            elif kind == RECORD_UNTIMED:
+                yield None, self.data(self.varint())
+            else:
+                raise ValueError("unknown record %d" % kind)
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description="Decode the timestamped UART bridge stream.")
+    parser.add_argument("host")
+    parser.add_argument("port", type=int, nargs="?", default=4442)
+    parser.add_argument("--ticks", action="store_true",
+                        help="show DAP TIMESTAMP_GET() values")
+    args = parser.parse_args()
+
+    sock = socket.create_connection((args.host, args.port))
+    dec = Decoder(sock)
+    at_start = True
+    out = sys.stdout
+    try:
+        for t, data in dec.records():
+            for c in data.decode("utf-8", "replace"):
+                if at_start:
+                    if t is None:
+                        out.write("[%18s] " % "history")
+                    elif args.ticks and dec.clock is not None:
+                        out.write("[        0x%08x] " % dec.ticks(t))
+                    else:
+                        out.write("[%18.6f] " % (t / 1e6))
+                    at_start = False
+                out.write(c)
+                if c == "\n":
+                    at_start = True
+            out.flush()
+    except (EOFError, KeyboardInterrupt):
+        pass
+
+
+if __name__ == "__main__":
+    main()
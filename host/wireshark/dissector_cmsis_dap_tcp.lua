@@ -1,6 +1,7 @@
 -- SPDX-License-Identifier: GPL-2.0-or-later
 --
--- Wireshark packet dissector for the cmsis_dap_tcp protocol.
+-- Wireshark packet dissector for the cmsis_dap_tcp protocol, and for the DAP
+-- request trace exported by the probe (CONFIG_ESP_DAP_TRACE).
 -- Based on OpenOCD src/jtag/drivers/cmsis_dap_tcp.c (commit fcff4b7, 2025-09-01)
 -- and CMSIS-DAP spec v2.1.2.
 --
@@ -790,3 +791,70 @@ end
 -- Register the protocol on port 4441
 local tcp_port = DissectorTable.get("tcp.port")
 tcp_port:add(4441, cmsis_dap_tcp_proto)
+
+-- ---------------------------------------------------------------------------
+-- DAP request trace exported by the probe (main/dap_trace.c) as pcapng with
+-- link type USER0, one 20-byte little-endian record per packet:
+--   nc 192.168.1.5 4446 > dap_trace.pcapng
+-- ---------------------------------------------------------------------------
+
+local cmsis_dap_trace_proto = Proto("cmsis_dap_trace", "CMSIS-DAP-TRACE")
+
+local dap_trace_ack_enum = { [0x00] = "None" }
+for k, v in pairs(dap_transfer_resp_enum) do
+    dap_trace_ack_enum[k] = v
+end
+
+local f_trace_tick     = ProtoField.uint32("cmsis_dap_trace.tick",         "FreeRTOS tick",             base.DEC)
+local f_trace_start    = ProtoField.uint32("cmsis_dap_trace.start",        "Start (cycles)",            base.DEC)
+local f_trace_cycles   = ProtoField.uint32("cmsis_dap_trace.cycles",       "Duration (cycles)",         base.DEC)
+local f_trace_req_len  = ProtoField.uint16("cmsis_dap_trace.request_len",  "Request length",            base.DEC)
+local f_trace_resp_len = ProtoField.uint16("cmsis_dap_trace.response_len", "Response length",           base.DEC)
+local f_trace_dap_id   = ProtoField.uint8( "cmsis_dap_trace.dap_id",       "DAP ID",                    base.HEX, dap_id_enum)
+local f_trace_ack      = ProtoField.uint8( "cmsis_dap_trace.ack",          "Last transfer ACK",         base.HEX, dap_trace_ack_enum)
+local f_trace_waits    = ProtoField.uint8( "cmsis_dap_trace.waits",        "WAIT ACKs",                 base.DEC)
+local f_trace_reserved = ProtoField.uint8( "cmsis_dap_trace.reserved",     "Reserved",                  base.HEX)
+
+cmsis_dap_trace_proto.fields = {
+    f_trace_tick, f_trace_start, f_trace_cycles, f_trace_req_len,
+    f_trace_resp_len, f_trace_dap_id, f_trace_ack, f_trace_waits,
+    f_trace_reserved,
+}
+
+function cmsis_dap_trace_proto.dissector(buffer, pinfo, tree)
+    if buffer:len() < 20 then
+        return 0
+    end
+    pinfo.cols.protocol = cmsis_dap_trace_proto.name
+
+    local dap_id   = buffer(16, 1):uint()
+    local dap_name = dap_id_enum[dap_id] or string.format("Unknown (0x%02X)", dap_id)
+    local ack      = buffer(17, 1):uint()
+    local waits    = buffer(18, 1):uint()
+    local subtree  = tree:add(cmsis_dap_trace_proto, buffer(0, 20),
+        string.format("CMSIS-DAP Trace (%s)", dap_name))
+
+    subtree:add_le(f_trace_tick,     buffer(0, 4))
+    subtree:add_le(f_trace_start,    buffer(4, 4))
+    subtree:add_le(f_trace_cycles,   buffer(8, 4))
+    subtree:add_le(f_trace_req_len,  buffer(12, 2))
+    subtree:add_le(f_trace_resp_len, buffer(14, 2))
+    subtree:add(f_trace_dap_id,      buffer(16, 1))
+    subtree:add(f_trace_ack,         buffer(17, 1))
+    local waits_item = subtree:add(f_trace_waits, buffer(18, 1))
+    if waits > 0 then
+        waits_item:add_expert_info(PI_SEQUENCE, PI_NOTE,
+            string.format("%d WAIT responses", waits))
+    end
+    subtree:add(f_trace_reserved,    buffer(19, 1))
+
+    pinfo.cols.info = string.format("%s  req %d  rsp %d  ACK %s  WAITs %d  %d cycles",
+        dap_name, buffer(12, 2):le_uint(), buffer(14, 2):le_uint(),
+        dap_trace_ack_enum[ack] or string.format("0x%02X", ack), waits,
+        buffer(8, 4):le_uint())
+    return 20
+end
+
+-- Register the trace protocol for pcapng files of link type USER0
+local wtap_encap = DissectorTable.get("wtap_encap")
+wtap_encap:add(wtap.USER0, cmsis_dap_trace_proto)
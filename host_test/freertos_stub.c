@@ -0,0 +1,78 @@
+/*
+ * SPDX-FileCopyrightText: Brian Kuschak <bkuschak@gmail.com>
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * The few FreeRTOS and ESP-IDF functions used by the code under test. The
+ * host tests run in a single thread, so a mutex only checks that it is
+ * taken and given in pairs.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "soc/gpio_struct.h"
+
+gpio_dev_t GPIO;
+uint32_t esp_cpu_stub_cycles;
+
+static int mutexes_held;
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void)
+{
+    return calloc(1, sizeof(StaticSemaphore_t));
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutexStatic(StaticSemaphore_t *buf)
+{
+    buf->held = false;
+    return buf;
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t sem, TickType_t timeout)
+{
+    (void)timeout;
+    if(sem == NULL || sem->held) {
+        fprintf(stderr, "deadlock: mutex %p already held\n", (void *)sem);
+        abort();
+    }
+    sem->held = true;
+    mutexes_held++;
+    return pdTRUE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t sem)
+{
+    if(sem == NULL || !sem->held) {
+        fprintf(stderr, "mutex %p given but not held\n", (void *)sem);
+        abort();
+    }
+    sem->held = false;
+    mutexes_held--;
+    return pdTRUE;
+}
+
+int freertos_stub_mutexes_held(void)
+{
+    return mutexes_held;
+}
+
+BaseType_t xTaskNotify(TaskHandle_t task, uint32_t value,
+        eNotifyAction action)
+{
+    (void)task;
+    (void)value;
+    (void)action;
+    return pdPASS;
+}
+
+BaseType_t xTaskNotifyWait(uint32_t clear_on_entry, uint32_t clear_on_exit,
+        uint32_t *value, TickType_t timeout)
+{
+    (void)clear_on_entry;
+    (void)clear_on_exit;
+    (void)timeout;
+    *value = 0;
+    return pdFALSE;
+}
@@ -0,0 +1,20 @@
+#pragma once
+#include <stdint.h>
+#include <stdio.h>
+#include "sdkconfig.h"
+
+typedef int gpio_num_t;
+typedef int esp_err_t;
+
+enum { GPIO_MODE_INPUT, GPIO_MODE_OUTPUT, GPIO_DRIVE_CAP_0 };
+
+#define GPIO_NUM_NC                     (-1)
+#define GPIO_IS_VALID_GPIO(n)           ((n) >= 0 && (n) < 32)
+#define GPIO_IS_VALID_OUTPUT_GPIO(n)    GPIO_IS_VALID_GPIO(n)
+
+static inline esp_err_t gpio_reset_pin(gpio_num_t n) { (void)n; return 0; }
+static inline esp_err_t gpio_set_level(gpio_num_t n, uint32_t l)
+{ (void)n; (void)l; return 0; }
+static inline esp_err_t gpio_set_direction(gpio_num_t n, int m)
+{ (void)n; (void)m; return 0; }
+static inline esp_err_t gpio_pullup_en(gpio_num_t n) { (void)n; return 0; }
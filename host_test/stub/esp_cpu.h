@@ -0,0 +1,10 @@
+#pragma once
+#include <stdint.h>
+
+// Advanced by the tests.
+extern uint32_t esp_cpu_stub_cycles;
+
+static inline uint32_t esp_cpu_get_cycle_count(void)
+{
+    return esp_cpu_stub_cycles;
+}
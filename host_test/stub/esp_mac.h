@@ -0,0 +1,11 @@
+#pragma once
+#include <stdint.h>
+
+enum { ESP_MAC_WIFI_STA };
+
+static inline int esp_read_mac(uint8_t *mac, int type)
+{
+    (void)mac;
+    (void)type;
+    return 0;
+}
@@ -0,0 +1,7 @@
+#pragma once
+#include <stdint.h>
+
+static inline int64_t esp_timer_get_time(void)
+{
+    return 0;
+}
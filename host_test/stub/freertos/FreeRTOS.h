@@ -0,0 +1,15 @@
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef uint32_t UBaseType_t;
+typedef int32_t BaseType_t;
+typedef uint32_t TickType_t;
+
+#define pdTRUE                  1
+#define pdFALSE                 0
+#define pdPASS                  1
+#define portMAX_DELAY           0xffffffffU
+#define pdMS_TO_TICKS(ms)       (ms)
+#define configTICK_RATE_HZ      1000
+#define configMAX_PRIORITIES    25
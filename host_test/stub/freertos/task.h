@@ -0,0 +1,11 @@
+#pragma once
+#include "freertos/FreeRTOS.h"
+
+typedef void *TaskHandle_t;
+typedef enum { eNoAction, eSetBits, eIncrement, eSetValueWithOverwrite }
+        eNotifyAction;
+
+BaseType_t xTaskNotify(TaskHandle_t task, uint32_t value,
+        eNotifyAction action);
+BaseType_t xTaskNotifyWait(uint32_t clear_on_entry, uint32_t clear_on_exit,
+        uint32_t *value, TickType_t timeout);
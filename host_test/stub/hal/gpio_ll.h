@@ -0,0 +1,17 @@
+#pragma once
+#include <stdint.h>
+#include "soc/gpio_struct.h"
+
+static inline void gpio_ll_set_level(gpio_dev_t *d, uint32_t n, uint32_t l)
+{ (void)d; (void)n; (void)l; }
+static inline int gpio_ll_get_level(gpio_dev_t *d, uint32_t n)
+{ (void)d; (void)n; return 0; }
+static inline void gpio_ll_output_enable(gpio_dev_t *d, uint32_t n)
+{ (void)d; (void)n; }
+static inline void gpio_ll_output_disable(gpio_dev_t *d, uint32_t n)
+{ (void)d; (void)n; }
+static inline void gpio_ll_input_enable(gpio_dev_t *d, uint32_t n)
+{ (void)d; (void)n; }
+static inline void gpio_ll_set_drive_capability(gpio_dev_t *d, uint32_t n,
+        int c)
+{ (void)d; (void)n; (void)c; }
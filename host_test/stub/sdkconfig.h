@@ -0,0 +1,20 @@
+/*
+ * Configuration of the host tests, in place of the generated sdkconfig.h.
+ */
+#pragma once
+
+#define CONFIG_IDF_TARGET "linux"
+#define CONFIG_FREERTOS_NUMBER_OF_CORES 1
+#define CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ 160
+#define CONFIG_ESP_DAP_TASK_PRIORITY 5
+#define CONFIG_ESP_DAP_TCP_MAX_PKT_SIZE 512
+#define CONFIG_ESP_DAP_IO_PORT_WRITE_CYCLES 72
+#define CONFIG_ESP_DAP_DELAY_SLOW_CYCLES 5
+#define CONFIG_ESP_DAP_SWD_SUPPORTED 1
+#define CONFIG_ESP_DAP_GPIO_SWCLK_TCK 4
+#define CONFIG_ESP_DAP_GPIO_SWDIO_TMS 5
+
+#define CONFIG_ESP_DAP_SWO_UART 1
+#define CONFIG_ESP_DAP_SWO_UART_NUM 1
+#define CONFIG_ESP_DAP_GPIO_SWO 6
+#define CONFIG_ESP_DAP_SWO_BUFFER_SIZE 256
@@ -0,0 +1,3 @@
+#pragma once
+
+#define SOC_UART_BITRATE_MAX    5000000
@@ -0,0 +1,213 @@
+/*
+ * SPDX-FileCopyrightText: Brian Kuschak <bkuschak@gmail.com>
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * manchester.c on synthetic SWO Manchester pulse trains.
+ *
+ * Each train is built the way the RMT peripheral reports the line: idle
+ * low, a start bit, the data bytes LSB first and idle again, as the
+ * durations between edges. The checks cover several bit rates in one
+ * capture, jitter, slow drift within a packet and packets that must be
+ * rejected.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "manchester.h"
+
+static int failures;
+
+#define CHECK(cond)                                                         \
+    do {                                                                    \
+        if(!(cond)) {                                                       \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__,          \
+                    __LINE__, #cond);                                       \
+            failures++;                                                     \
+        }                                                                   \
+    } while(0)
+
+#define MAX_PULSES      4096
+
+// The pulse train.
+static int levels[MAX_PULSES];
+static uint32_t durations[MAX_PULSES];
+static int num_pulses;
+
+static void reset(void)
+{
+    num_pulses = 0;
+}
+
+// The line stays at 'level' for 'duration' more ticks.
+static void level(int level, uint32_t duration)
+{
+    if(num_pulses > 0 && levels[num_pulses - 1] == level) {
+        durations[num_pulses - 1] += duration;
+        return;
+    }
+    if(num_pulses == MAX_PULSES) {
+        CHECK(!"pulse train too long");
+        return;
+    }
+    levels[num_pulses] = level;
+    durations[num_pulses] = duration;
+    num_pulses++;
+}
+
+// One bit: high then low for a 1, low then high for a 0.
+static void bit(int value, uint32_t first_half, uint32_t second_half)
+{
+    level(value, first_half);
+    level(!value, second_half);
+}
+
+// A packet of 'len' bytes. The first half of each bit varies by up to
+// 'jitter' ticks, and the half-bit period grows by 'drift' ticks per byte.
+static void packet(const uint8_t *data, int len, uint32_t half,
+        uint32_t jitter, uint32_t drift)
+{
+    level(0, half * 4);
+    bit(1, half, half);
+    for(int i = 0; i < len; i++) {
+        for(int b = 0; b < 8; b++) {
+            uint32_t j = jitter ? (uint32_t)rand() % (2 * jitter + 1) : 0;
+            bit((data[i] >> b) & 1, half - jitter + j, half);
+        }
+        half += drift;
+    }
+    level(0, half * 4);
+}
+
+// Decode the train, ending with an idle line. Returns the number of bytes.
+static int decode(manchester_decoder_t *d, uint8_t *out, int max)
+{
+    int n = 0;
+
+    for(int i = 0; i < num_pulses; i++) {
+        int byte = manchester_decode_pulse(d, levels[i], durations[i]);
+        if(byte != MANCHESTER_NO_BYTE && n < max)
+            out[n++] = byte;
+    }
+    CHECK(manchester_decode_pulse(d, 0, MANCHESTER_IDLE) ==
+            MANCHESTER_NO_BYTE);
+    return n;
+}
+
+static void test_rates(void)
+{
+    static const uint32_t halves[] = { 4, 10, 25, 7, 100 };
+    manchester_decoder_t d;
+    uint8_t data[4];
+    uint8_t out[64];
+
+    // Packets at different rates in one capture, each measured from its
+    // start bit.
+    reset();
+    for(unsigned p = 0; p < sizeof(halves) / sizeof(halves[0]); p++) {
+        for(int i = 0; i < 4; i++)
+            data[i] = p * 37 + i * 91 + 5;
+        packet(data, 4, halves[p], halves[p] >= 10 ? 1 : 0, 0);
+    }
+    manchester_init(&d, 4, 1000);
+    CHECK(decode(&d, out, sizeof(out)) == 20);
+    for(unsigned p = 0; p < sizeof(halves) / sizeof(halves[0]); p++) {
+        for(int i = 0; i < 4; i++)
+            CHECK(out[p * 4 + i] == (uint8_t)(p * 37 + i * 91 + 5));
+    }
+    CHECK(d.packets == 5);
+    CHECK(d.errors == 0);
+    CHECK(d.last_half / 16 == 100);
+}
+
+static void test_all_bytes(void)
+{
+    manchester_decoder_t d;
+    uint8_t data[256];
+    uint8_t out[256];
+
+    // Every byte value, including runs of equal bits, i.e. full-bit pulses.
+    for(int i = 0; i < 256; i++)
+        data[i] = i;
+    reset();
+    packet(data, 128, 12, 2, 0);
+    packet(data + 128, 128, 12, 2, 0);
+    manchester_init(&d, 4, 1000);
+    CHECK(decode(&d, out, sizeof(out)) == 256);
+    for(int i = 0; i < 256; i++)
+        CHECK(out[i] == i);
+    CHECK(d.packets == 2);
+    CHECK(d.errors == 0);
+}
+
+static void test_drift(void)
+{
+    manchester_decoder_t d;
+    uint8_t data[32];
+    uint8_t out[32];
+
+    // The bit rate falls by 1 % a byte, 30 % over the packet.
+    for(int i = 0; i < 32; i++)
+        data[i] = i * 13;
+    reset();
+    packet(data, 32, 100, 0, 1);
+    manchester_init(&d, 4, 1000);
+    CHECK(decode(&d, out, sizeof(out)) == 32);
+    for(int i = 0; i < 32; i++)
+        CHECK(out[i] == (uint8_t)(i * 13));
+    CHECK(d.packets == 1);
+    CHECK(d.errors == 0);
+}
+
+static void test_errors(void)
+{
+    manchester_decoder_t d;
+    uint8_t data[2] = { 0x5a, 0xc3 };
+    uint8_t out[8];
+
+    manchester_init(&d, 4, 1000);
+
+    // A packet slower than the accepted range is ignored.
+    reset();
+    packet(data, 2, 2000, 0, 0);
+    CHECK(decode(&d, out, sizeof(out)) == 0);
+    CHECK(d.packets == 0);
+    CHECK(d.errors == 0);
+
+    // A pulse of three half-bit periods is invalid.
+    reset();
+    level(0, 40);
+    bit(1, 10, 10);
+    level(1, 30);
+    level(0, 40);
+    CHECK(decode(&d, out, sizeof(out)) == 0);
+    CHECK(d.errors == 1);
+
+    // A packet that ends in the middle of a byte is counted as an error,
+    // and the next one is decoded.
+    reset();
+    level(0, 40);
+    bit(1, 10, 10);
+    for(int b = 0; b < 5; b++)
+        bit(b & 1, 10, 10);
+    packet(data, 2, 10, 0, 0);
+    CHECK(decode(&d, out, sizeof(out)) == 2);
+    CHECK(out[0] == 0x5a && out[1] == 0xc3);
+    CHECK(d.errors == 2);
+    CHECK(d.packets == 1);
+}
+
+int main(void)
+{
+    srand(1);
+    test_rates();
+    test_all_bytes();
+    test_drift();
+    test_errors();
+
+    if(failures != 0) {
+        printf("test_manchester: %d checks failed\n", failures);
+        return 1;
+    }
+    printf("test_manchester: passed\n");
+    return 0;
+}
@@ -0,0 +1,289 @@
+/*
+ * SPDX-FileCopyrightText: Brian Kuschak <bkuschak@gmail.com>
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * SWO.c in UART mode, on the software UART of usart_sim.c.
+ *
+ * Drives the SWO commands the way a debugger does, feeds the line with a
+ * known byte sequence and checks that SWO_Data returns it in order through
+ * pauses of a full trace buffer, baud rate changes and restarts, and that
+ * the status reports the errors of the UART.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "DAP_config.h"
+#include "DAP.h"
+#include "Driver_USART.h"
+#include "freertos/semphr.h"
+#include "usart_sim.h"
+
+static int failures;
+
+#define CHECK(cond)                                                         \
+    do {                                                                    \
+        if(!(cond)) {                                                       \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__,          \
+                    __LINE__, #cond);                                       \
+            failures++;                                                     \
+        }                                                                   \
+    } while(0)
+
+// Bytes sent on the line and returned by SWO_Data so far.
+static uint32_t line_seq;
+static uint32_t data_seq;
+
+static uint8_t seq_byte(uint32_t n)
+{
+    return (uint8_t)(n * 7 + 3);
+}
+
+static void line(uint32_t num)
+{
+    uint8_t buf[USART_SIM_RING_SIZE];
+
+    while(num > 0) {
+        uint32_t n = num < sizeof(buf) ? num : sizeof(buf);
+        for(uint32_t i = 0; i < n; i++)
+            buf[i] = seq_byte(line_seq++);
+        usart_sim_line(buf, n);
+        num -= n;
+    }
+}
+
+// Commands are never called with the SWO lock held, and leave it free.
+static uint8_t cmd(uint32_t (*fn)(const uint8_t *, uint8_t *), uint8_t arg)
+{
+    uint8_t response[1];
+
+    CHECK(fn(&arg, response) == ((1U << 16) | 1U));
+    CHECK(freertos_stub_mutexes_held() == 0);
+    return response[0];
+}
+
+static uint32_t baudrate(uint32_t baud)
+{
+    uint8_t request[4] = { baud, baud >> 8, baud >> 16, baud >> 24 };
+    uint8_t response[4];
+
+    CHECK(SWO_Baudrate(request, response) == ((4U << 16) | 4U));
+    CHECK(freertos_stub_mutexes_held() == 0);
+    return response[0] | (response[1] << 8) | (response[2] << 16) |
+            ((uint32_t)response[3] << 24);
+}
+
+static uint8_t status(uint32_t *count)
+{
+    uint8_t response[5];
+
+    CHECK(SWO_Status(response) == 5U);
+    CHECK(freertos_stub_mutexes_held() == 0);
+    *count = response[1] | (response[2] << 8) | (response[3] << 16) |
+            ((uint32_t)response[4] << 24);
+    return response[0];
+}
+
+// Read up to 'max' bytes and check they continue the sequence. Returns the
+// number read.
+static uint32_t data(uint32_t max, uint8_t *st)
+{
+    uint8_t request[2] = { max, max >> 8 };
+    uint8_t response[DAP_PACKET_SIZE];
+
+    uint32_t ret = SWO_Data(request, response);
+    CHECK(freertos_stub_mutexes_held() == 0);
+    uint32_t count = response[1] | (response[2] << 8);
+    CHECK(ret == ((2U << 16) | (3U + count)));
+    CHECK(count <= max);
+    for(uint32_t i = 0; i < count; i++) {
+        if(response[3 + i] != seq_byte(data_seq)) {
+            fprintf(stderr, "byte %u: 0x%02x, expected 0x%02x\n",
+                    (unsigned)data_seq, response[3 + i],
+                    seq_byte(data_seq));
+            failures++;
+            break;
+        }
+        data_seq++;
+    }
+    if(st != NULL)
+        *st = response[0];
+    return count;
+}
+
+// Read until the trace buffer and the software UART are empty.
+static void drain(void)
+{
+    for(int i = 0; i < 100; i++) {
+        usart_sim_run();
+        if(data(DAP_PACKET_SIZE - 4U, NULL) == 0)
+            return;
+    }
+    CHECK(!"trace never drained");
+}
+
+static void test_setup(void)
+{
+    CHECK(cmd(SWO_Transport, 3U) == DAP_ERROR);
+    CHECK(cmd(SWO_Transport, 1U) == DAP_OK);
+    CHECK(cmd(SWO_Mode, DAP_SWO_MANCHESTER) == DAP_ERROR);
+    CHECK(baudrate(1000000U) == 0U);
+    CHECK(cmd(SWO_Mode, DAP_SWO_UART) == DAP_OK);
+    CHECK(baudrate(10000000U) == SWO_UART_MAX_BAUDRATE);
+    CHECK(baudrate(2000000U) == 2000000U);
+    CHECK(usart_sim_baudrate() == 2000000U);
+}
+
+static void test_capture(void)
+{
+    uint32_t count;
+    uint8_t st;
+
+    // Nothing is received before the capture starts.
+    line(10);
+    line_seq = 0;
+    CHECK(cmd(SWO_Control, DAP_SWO_CAPTURE_ACTIVE) == DAP_OK);
+    CHECK(status(&count) == DAP_SWO_CAPTURE_ACTIVE);
+    CHECK(count == 0U);
+    CHECK(cmd(SWO_Transport, 0U) == DAP_ERROR);
+
+    // Partly filled blocks count too.
+    line(100);
+    usart_sim_run();
+    CHECK(status(&count) == DAP_SWO_CAPTURE_ACTIVE);
+    CHECK(count == 100U);
+    CHECK(data(60U, &st) == 60U);
+    CHECK(st == DAP_SWO_CAPTURE_ACTIVE);
+    CHECK(status(&count) == DAP_SWO_CAPTURE_ACTIVE);
+    CHECK(count == 40U);
+    drain();
+    CHECK(data_seq == line_seq);
+}
+
+static void test_pause(void)
+{
+    uint32_t count;
+
+    // More than the trace buffer: the capture pauses and the rest waits in
+    // the UART, to be received once the host reads the trace.
+    line(SWO_BUFFER_SIZE + 200U);
+    usart_sim_run();
+    CHECK(status(&count) ==
+            (DAP_SWO_CAPTURE_ACTIVE | DAP_SWO_CAPTURE_PAUSED));
+    CHECK(count <= SWO_BUFFER_SIZE);
+    CHECK(count > SWO_BUFFER_SIZE / 2);
+    drain();
+    CHECK(data_seq == line_seq);
+    CHECK(status(&count) == DAP_SWO_CAPTURE_ACTIVE);
+    CHECK(count == 0U);
+}
+
+static void test_errors(void)
+{
+    uint32_t count;
+
+    // Error flags are reported once.
+    usart_sim_error(ARM_USART_EVENT_RX_FRAMING_ERROR);
+    CHECK(status(&count) ==
+            (DAP_SWO_CAPTURE_ACTIVE | DAP_SWO_STREAM_ERROR));
+    CHECK(status(&count) == DAP_SWO_CAPTURE_ACTIVE);
+
+    // The UART's ring overflows while its task does not run; what was
+    // buffered is still delivered.
+    line(USART_SIM_RING_SIZE + 10U);
+    line_seq -= 10U;
+    CHECK(status(&count) ==
+            (DAP_SWO_CAPTURE_ACTIVE | DAP_SWO_BUFFER_OVERRUN));
+    drain();
+    CHECK(data_seq == line_seq);
+}
+
+static void test_baudrate_change(void)
+{
+    uint32_t count;
+
+    // Bytes of the block being received are kept across the change.
+    line(10);
+    usart_sim_run();
+    CHECK(baudrate(115200U) == 115200U);
+    CHECK(status(&count) == DAP_SWO_CAPTURE_ACTIVE);
+    CHECK(count == 10U);
+    line(100);
+    drain();
+    CHECK(data_seq == line_seq);
+}
+
+static void test_timestamp(void)
+{
+    uint8_t request = 0x07U;
+    uint8_t response[13];
+    uint32_t index_before = line_seq;
+
+    // At least one block of the trace, 64 bytes, completes at this cycle
+    // count.
+    esp_cpu_stub_cycles = 12345U;
+    line(64);
+    usart_sim_run();
+    CHECK(SWO_ExtendedStatus(&request, response) == ((1U << 16) | 9U));
+    CHECK(freertos_stub_mutexes_held() == 0);
+    uint32_t index = response[5] | (response[6] << 8) |
+            (response[7] << 16) | ((uint32_t)response[8] << 24);
+    uint32_t tick = response[9] | (response[10] << 8) |
+            (response[11] << 16) | ((uint32_t)response[12] << 24);
+    CHECK(response[0] == DAP_SWO_CAPTURE_ACTIVE);
+    CHECK(index > index_before);
+    CHECK(index <= line_seq);
+    CHECK(tick == 12345U);
+    drain();
+}
+
+static void test_stop(void)
+{
+    uint32_t count;
+
+    // Captured bytes can still be read after the capture stops, and bytes
+    // sent after it are lost.
+    line(30);
+    usart_sim_run();
+    CHECK(cmd(SWO_Control, 0U) == DAP_OK);
+    CHECK(status(&count) == 0U);
+    CHECK(count == 30U);
+    line(20);
+    usart_sim_run();
+    CHECK(data(100U, NULL) == 30U);
+    CHECK(status(&count) == 0U);
+    CHECK(count == 0U);
+
+    // Restarting clears the trace.
+    line(5);
+    usart_sim_run();
+    CHECK(cmd(SWO_Control, DAP_SWO_CAPTURE_ACTIVE) == DAP_OK);
+    line(5);
+    usart_sim_run();
+    CHECK(cmd(SWO_Control, 0U) == DAP_OK);
+    CHECK(cmd(SWO_Control, DAP_SWO_CAPTURE_ACTIVE) == DAP_OK);
+    CHECK(status(&count) == DAP_SWO_CAPTURE_ACTIVE);
+    CHECK(count == 0U);
+
+    CHECK(cmd(SWO_Mode, DAP_SWO_OFF) == DAP_OK);
+    CHECK(status(&count) == 0U);
+    CHECK(cmd(SWO_Control, DAP_SWO_CAPTURE_ACTIVE) == DAP_ERROR);
+    CHECK(baudrate(115200U) == 0U);
+}
+
+int main(void)
+{
+    test_setup();
+    test_capture();
+    test_pause();
+    test_errors();
+    test_baudrate_change();
+    test_timestamp();
+    test_stop();
+
+    if(failures != 0) {
+        printf("test_swo: %d checks failed\n", failures);
+        return 1;
+    }
+    printf("test_swo: passed\n");
+    return 0;
+}
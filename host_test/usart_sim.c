@@ -0,0 +1,208 @@
+/*
+ * SPDX-FileCopyrightText: Brian Kuschak <bkuschak@gmail.com>
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Software UART for the host tests.
+ *
+ * Provides Driver_USART0 the way usart_esp32.c does on the ESP32, without
+ * the ESP-IDF UART driver: received bytes wait in a ring buffer until the
+ * test runs the receive task, which copies them into the buffer armed by
+ * Receive() and signals ARM_USART_EVENT_RECEIVE_COMPLETE. The callback runs
+ * from usart_sim_run(), never from a driver function, as it runs in the
+ * receive task on the ESP32.
+ */
+
+#include <stdbool.h>
+#include <string.h>
+#include "soc/soc_caps.h"
+#include "Driver_USART.h"
+#include "usart_sim.h"
+
+static ARM_USART_SignalEvent_t cb_event;
+static bool powered;
+static bool rx_enabled;
+static bool rx_busy;
+static uint8_t *rx_buf;
+static uint32_t rx_num;
+static uint32_t rx_cnt;
+static uint32_t baudrate;
+
+static uint8_t ring[USART_SIM_RING_SIZE];
+static uint32_t ring_head;
+static uint32_t ring_tail;
+
+void usart_sim_line(const uint8_t *data, uint32_t num)
+{
+    bool overflow = false;
+
+    if(!rx_enabled)
+        return;
+    for(uint32_t i = 0; i < num; i++) {
+        if(ring_head - ring_tail == USART_SIM_RING_SIZE) {
+            overflow = true;
+            continue;
+        }
+        ring[ring_head++ % USART_SIM_RING_SIZE] = data[i];
+    }
+    if(overflow && cb_event != NULL)
+        cb_event(ARM_USART_EVENT_RX_OVERFLOW);
+}
+
+void usart_sim_error(uint32_t event)
+{
+    if(rx_enabled && cb_event != NULL)
+        cb_event(event);
+}
+
+void usart_sim_run(void)
+{
+    while(rx_enabled && rx_busy && ring_head != ring_tail) {
+        while(rx_cnt < rx_num && ring_head != ring_tail)
+            rx_buf[rx_cnt++] = ring[ring_tail++ % USART_SIM_RING_SIZE];
+        if(rx_cnt < rx_num)
+            return;
+        rx_busy = false;
+        if(cb_event != NULL)
+            cb_event(ARM_USART_EVENT_RECEIVE_COMPLETE);
+    }
+}
+
+uint32_t usart_sim_baudrate(void)
+{
+    return baudrate;
+}
+
+static ARM_DRIVER_VERSION usart_get_version(void)
+{
+    return (ARM_DRIVER_VERSION) { ARM_USART_API_VERSION,
+            ARM_DRIVER_VERSION_MAJOR_MINOR(1, 0) };
+}
+
+static ARM_USART_CAPABILITIES usart_get_capabilities(void)
+{
+    return (ARM_USART_CAPABILITIES) { .asynchronous = 1 };
+}
+
+static int32_t usart_initialize(ARM_USART_SignalEvent_t cb)
+{
+    cb_event = cb;
+    return ARM_DRIVER_OK;
+}
+
+static int32_t usart_uninitialize(void)
+{
+    cb_event = NULL;
+    return ARM_DRIVER_OK;
+}
+
+static int32_t usart_power_control(ARM_POWER_STATE state)
+{
+    switch(state) {
+        case ARM_POWER_FULL:
+            powered = true;
+            return ARM_DRIVER_OK;
+        case ARM_POWER_OFF:
+            powered = false;
+            rx_enabled = false;
+            rx_busy = false;
+            ring_tail = ring_head;
+            return ARM_DRIVER_OK;
+        default:
+            return ARM_DRIVER_ERROR_UNSUPPORTED;
+    }
+}
+
+static int32_t usart_send(const void *data, uint32_t num)
+{
+    (void)data;
+    (void)num;
+    return ARM_DRIVER_ERROR_UNSUPPORTED;
+}
+
+static int32_t usart_receive(void *data, uint32_t num)
+{
+    if(data == NULL || num == 0)
+        return ARM_DRIVER_ERROR_PARAMETER;
+    if(!powered)
+        return ARM_DRIVER_ERROR;
+    if(rx_busy)
+        return ARM_DRIVER_ERROR_BUSY;
+    rx_buf = data;
+    rx_num = num;
+    rx_cnt = 0;
+    rx_busy = true;
+    return ARM_DRIVER_OK;
+}
+
+static int32_t usart_transfer(const void *data_out, void *data_in,
+        uint32_t num)
+{
+    (void)data_out;
+    (void)data_in;
+    (void)num;
+    return ARM_DRIVER_ERROR_UNSUPPORTED;
+}
+
+static uint32_t usart_get_tx_count(void)
+{
+    return 0;
+}
+
+static uint32_t usart_get_rx_count(void)
+{
+    return rx_cnt;
+}
+
+static int32_t usart_control(uint32_t control, uint32_t arg)
+{
+    switch(control & ARM_USART_CONTROL_Msk) {
+        case ARM_USART_MODE_ASYNCHRONOUS:
+            if(arg == 0 || arg > SOC_UART_BITRATE_MAX)
+                return ARM_USART_ERROR_BAUDRATE;
+            baudrate = arg;
+            return ARM_DRIVER_OK;
+        case ARM_USART_CONTROL_RX:
+            rx_enabled = arg != 0;
+            if(!rx_enabled)
+                ring_tail = ring_head;
+            return ARM_DRIVER_OK;
+        case ARM_USART_ABORT_RECEIVE:
+            rx_busy = false;
+            return ARM_DRIVER_OK;
+        default:
+            return ARM_DRIVER_ERROR_UNSUPPORTED;
+    }
+}
+
+static ARM_USART_STATUS usart_get_status(void)
+{
+    return (ARM_USART_STATUS) { .rx_busy = rx_busy };
+}
+
+static int32_t usart_set_modem_control(ARM_USART_MODEM_CONTROL control)
+{
+    (void)control;
+    return ARM_DRIVER_ERROR_UNSUPPORTED;
+}
+
+static ARM_USART_MODEM_STATUS usart_get_modem_status(void)
+{
+    return (ARM_USART_MODEM_STATUS) { 0 };
+}
+
+ARM_DRIVER_USART Driver_USART0 = {
+    usart_get_version,
+    usart_get_capabilities,
+    usart_initialize,
+    usart_uninitialize,
+    usart_power_control,
+    usart_send,
+    usart_receive,
+    usart_transfer,
+    usart_get_tx_count,
+    usart_get_rx_count,
+    usart_control,
+    usart_get_status,
+    usart_set_modem_control,
+    usart_get_modem_status,
+};
@@ -0,0 +1,31 @@
+#ifndef USART_SIM_H
+#define USART_SIM_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Size of the software UART's receive ring, like the ESP-IDF driver's.
+#define USART_SIM_RING_SIZE     512
+
+// Bytes arriving on the line. They are buffered in the ring and passed on
+// by usart_sim_run().
+void usart_sim_line(const uint8_t *data, uint32_t num);
+
+// Signal ARM_USART_EVENT_RX_* error events.
+void usart_sim_error(uint32_t event);
+
+// Run the receive task: copy the ring into the armed buffers, signalling
+// ARM_USART_EVENT_RECEIVE_COMPLETE for each one filled.
+void usart_sim_run(void);
+
+// Baud rate of the last successful ARM_USART_MODE_ASYNCHRONOUS control.
+uint32_t usart_sim_baudrate(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // USART_SIM_H
@@ -185,8 +185,7 @@ static uint8_t DAP_Info(uint8_t id, uint8_t *info) {
 // Delay for specified time
 //    delay:  delay time in ms
 void Delayms(uint32_t delay) {
-  delay *= ((CPU_CLOCK/1000U) + (DELAY_SLOW_CYCLES-1U)) / DELAY_SLOW_CYCLES;
-  PIN_DELAY_SLOW(delay);
+  DAP_SLEEP_US(delay * 1000U);
 }
 
 
@@ -200,9 +199,8 @@ static uint32_t DAP_Delay(const uint8_t *request, uint8_t *response) {
 
   delay  = (uint32_t)(*(request+0)) |
            (uint32_t)(*(request+1) << 8);
-  delay *= ((CPU_CLOCK/1000000U) + (DELAY_SLOW_CYCLES-1U)) / DELAY_SLOW_CYCLES;
 
-  PIN_DELAY_SLOW(delay);
+  DAP_SLEEP_US(delay);
 
   *response = DAP_OK;
   return ((2U << 16) | 1U);
@@ -247,6 +245,13 @@ static uint32_t DAP_Connect(const uint8_t *request, uint8_t *response) {
     port = *request;
   }
 
+#if (DAP_SWD != 0)
+  SWD_TargetInvalidate();
+#endif
+#if (DAP_JTAG != 0)
+  JTAG_IR_Invalidate();
+#endif
+
   switch (port) {
 #if (DAP_SWD != 0)
     case DAP_PORT_SWD:
@@ -277,6 +282,12 @@ static uint32_t DAP_Disconnect(uint8_t *response) {
 
   DAP_Data.debug_port = DAP_PORT_DISABLED;
   PORT_OFF();
+#if (DAP_SWD != 0)
+  // Multi-drop targets are configured per debug session
+  DAP_Data.swd_conf.targets = 0U;
+  DAP_Data.swd_conf.host_targetsel = 0U;
+  SWD_TargetInvalidate();
+#endif
 
   *response = DAP_OK;
   return (1U);
@@ -289,6 +300,12 @@ static uint32_t DAP_Disconnect(uint8_t *response) {
 static uint32_t DAP_ResetTarget(uint8_t *response) {
 
   *(response+1) = RESET_TARGET();
+#if (DAP_SWD != 0)
+  SWD_TargetInvalidate();
+#endif
+#if (DAP_JTAG != 0)
+  JTAG_IR_Invalidate();
+#endif
   *(response+0) = DAP_OK;
   return (2U);
 }
@@ -336,6 +353,20 @@ static uint32_t DAP_SWJ_Pins(const uint8_t *request, uint8_t *response) {
   if ((select & (1U << DAP_SWJ_nRESET)) != 0U){
     PIN_nRESET_OUT(value >> DAP_SWJ_nRESET);
   }
+#if (DAP_SWD != 0)
+  // Clocking SWCLK/SWDIO by hand or resetting can deselect the target
+  if ((select & ((1U << DAP_SWJ_SWCLK_TCK) | (1U << DAP_SWJ_SWDIO_TMS) |
+                 (1U << DAP_SWJ_nRESET))) != 0U) {
+    SWD_TargetInvalidate();
+  }
+#endif
+#if (DAP_JTAG != 0)
+  // Clocking TCK/TMS by hand or resetting can change the TAP IR
+  if ((select & ((1U << DAP_SWJ_SWCLK_TCK) | (1U << DAP_SWJ_SWDIO_TMS) |
+                 (1U << DAP_SWJ_nTRST)     | (1U << DAP_SWJ_nRESET))) != 0U) {
+    JTAG_IR_Invalidate();
+  }
+#endif
 
   if (wait != 0U) {
 #if (TIMESTAMP_CLOCK != 0U)
@@ -417,6 +448,7 @@ static uint32_t DAP_SWJ_Clock(const uint8_t *request, uint8_t *response) {
   }
 
   Set_Clock_Delay(clock);
+  CLOCK_FALLBACK_RESET();
 
   *response = DAP_OK;
 #else
@@ -427,6 +459,27 @@ static uint32_t DAP_SWJ_Clock(const uint8_t *request, uint8_t *response) {
 }
 
 
+#if (DAP_SWD != 0)
+// Check a raw sequence sent by the host for a TARGETSEL request
+// Such a host manages multi-drop itself, so SWD_Transfer must not recover
+// from protocol errors with a line reset that deselects its target.
+//   data:  sequence bits (LSB first)
+//   count: number of bits
+static void SWD_TargetSelCheck(const uint8_t *data, uint32_t count) {
+  uint32_t bits = 0U;
+  uint32_t n;
+
+  for (n = 0U; n < count; n++) {
+    bits = (bits >> 1) | (((uint32_t)(data[n >> 3] >> (n & 7U)) & 1U) << 7);
+    if ((n >= 7U) && (bits == 0x99U)) {
+      DAP_Data.swd_conf.host_targetsel = 1U;
+      return;
+    }
+  }
+}
+#endif
+
+
 // Process SWJ Sequence command and prepare response
 //   request:  pointer to request data
 //   response: pointer to response data
@@ -442,6 +495,13 @@ static uint32_t DAP_SWJ_Sequence(const uint8_t *request, uint8_t *response) {
 
 #if ((DAP_SWD != 0) || (DAP_JTAG != 0))
   SWJ_Sequence(count, request);
+#if (DAP_SWD != 0)
+  SWD_TargetSelCheck(request, count);
+  SWD_TargetInvalidate();
+#endif
+#if (DAP_JTAG != 0)
+  JTAG_IR_Invalidate();
+#endif
   *response = DAP_OK;
 #else
   *response = DAP_ERROR;
@@ -489,6 +549,7 @@ static uint32_t DAP_SWD_Sequence(const uint8_t *request, uint8_t *response) {
 
 #if (DAP_SWD != 0)
   *response++ = DAP_OK;
+  SWD_TargetInvalidate();
 #else
   *response++ = DAP_ERROR;
 #endif
@@ -502,6 +563,11 @@ static uint32_t DAP_SWD_Sequence(const uint8_t *request, uint8_t *response) {
     if (count == 0U) {
       count = 64U;
     }
+#if (DAP_SWD != 0)
+    if ((sequence_info & SWD_SEQUENCE_DIN) == 0U) {
+      SWD_TargetSelCheck(request, count);
+    }
+#endif
     count = (count + 7U) / 8U;
 #if (DAP_SWD != 0)
     if ((sequence_info & SWD_SEQUENCE_DIN) != 0U) {
@@ -544,6 +610,7 @@ static uint32_t DAP_JTAG_Sequence(const uint8_t *request, uint8_t *response) {
 
 #if (DAP_JTAG != 0)
   *response++ = DAP_OK;
+  JTAG_IR_Invalidate();
 #else
   *response++ = DAP_ERROR;
 #endif
@@ -589,6 +656,7 @@ static uint32_t DAP_JTAG_Configure(const uint8_t *request, uint8_t *response) {
 
   count = *request++;
   DAP_Data.jtag_dev.count = (uint8_t)count;
+  JTAG_IR_Invalidate();
 
   bits = 0U;
   for (n = 0U; n < count; n++) {
@@ -632,7 +700,9 @@ static uint32_t DAP_JTAG_IDCode(const uint8_t *request, uint8_t *response) {
   }
 
   // Select JTAG chain
-  JTAG_IR(JTAG_IDCODE);
+  if (DAP_Data.jtag_dev.ir[DAP_Data.jtag_dev.index] != JTAG_IDCODE) {
+    JTAG_IR(JTAG_IDCODE);
+  }
 
   // Read IDCODE register
   data = JTAG_ReadIDCode();
@@ -691,6 +761,7 @@ static uint32_t DAP_SWD_Transfer(const uint8_t *request, uint8_t *response) {
   uint32_t  match_retry;
   uint32_t  retry;
   uint32_t  data;
+  uint32_t  index;
 #if (TIMESTAMP_CLOCK != 0U)
   uint32_t  timestamp;
 #endif
@@ -707,11 +778,19 @@ static uint32_t DAP_SWD_Transfer(const uint8_t *request, uint8_t *response) {
   post_read   = 0U;
   check_write = 0U;
 
-  request++;            // Ignore DAP index
+  index = *request++;   // DAP index selects the multi-drop target
 
   request_count = *request++;
 
+  if (request_count != 0U) {
+    response_value = SWD_SelectTarget(index);
+    if (response_value != DAP_TRANSFER_OK) {
+      goto cancel;
+    }
+  }
+
   while (request_count != 0) {
+    DAP_YIELD();
     request_count--;
     request_value = *request++;
     if ((request_value & DAP_TRANSFER_RnW) != 0U) {
@@ -893,6 +972,7 @@ static uint32_t DAP_SWD_Transfer(const uint8_t *request, uint8_t *response) {
     }
   }
 
+cancel:
   while (request_count != 0) {
     // Process canceled requests
     request_count--;
@@ -976,7 +1056,6 @@ static uint32_t DAP_JTAG_Transfer(const uint8_t *request, uint8_t *response) {
 
   DAP_TransferAbort = 0U;
 
-  ir        = 0U;
   post_read = 0U;
 
   // Device index (JTAP TAP)
@@ -985,9 +1064,13 @@ static uint32_t DAP_JTAG_Transfer(const uint8_t *request, uint8_t *response) {
     goto end;
   }
 
+  // IR left over from the previous command (JTAG_IR keeps it up to date)
+  ir = DAP_Data.jtag_dev.ir[DAP_Data.jtag_dev.index];
+
   request_count = *request++;
 
   while (request_count != 0) {
+    DAP_YIELD();
     request_count--;
     request_value = *request++;
     request_ir = (request_value & DAP_TRANSFER_APnDP) ? JTAG_APACC : JTAG_DPACC;
@@ -1299,6 +1382,7 @@ static uint32_t DAP_SWD_TransferBlock(const uint8_t *request, uint8_t *response)
   uint8_t  *response_head;
   uint32_t  retry;
   uint32_t  data;
+  uint32_t  index;
 
   response_count = 0U;
   response_value = 0U;
@@ -1307,7 +1391,7 @@ static uint32_t DAP_SWD_TransferBlock(const uint8_t *request, uint8_t *response)
 
   DAP_TransferAbort = 0U;
 
-  request++;            // Ignore DAP index
+  index = *request++;   // DAP index selects the multi-drop target
 
   request_count = (uint32_t)(*(request+0) << 0) |
                   (uint32_t)(*(request+1) << 8);
@@ -1316,6 +1400,11 @@ static uint32_t DAP_SWD_TransferBlock(const uint8_t *request, uint8_t *response)
     goto end;
   }
 
+  response_value = SWD_SelectTarget(index);
+  if (response_value != DAP_TRANSFER_OK) {
+    goto end;
+  }
+
   request_value = *request++;
   if ((request_value & DAP_TRANSFER_RnW) != 0U) {
     // Read register block
@@ -1330,6 +1419,7 @@ static uint32_t DAP_SWD_TransferBlock(const uint8_t *request, uint8_t *response)
       }
     }
     while (request_count--) {
+      DAP_YIELD();
       // Read DP/AP register
       if ((request_count == 0U) && ((request_value & DAP_TRANSFER_APnDP) != 0U)) {
         // Last AP read
@@ -1352,6 +1442,7 @@ static uint32_t DAP_SWD_TransferBlock(const uint8_t *request, uint8_t *response)
   } else {
     // Write register block
     while (request_count--) {
+      DAP_YIELD();
       // Load data
       data = (uint32_t)(*(request+0) <<  0) |
              (uint32_t)(*(request+1) <<  8) |
@@ -1424,7 +1515,9 @@ static uint32_t DAP_JTAG_TransferBlock(const uint8_t *request, uint8_t *response
 
   // Select JTAG chain
   ir = (request_value & DAP_TRANSFER_APnDP) ? JTAG_APACC : JTAG_DPACC;
-  JTAG_IR(ir);
+  if (DAP_Data.jtag_dev.ir[DAP_Data.jtag_dev.index] != ir) {
+    JTAG_IR(ir);
+  }
 
   if ((request_value & DAP_TRANSFER_RnW) != 0U) {
     // Post read
@@ -1437,6 +1530,7 @@ static uint32_t DAP_JTAG_TransferBlock(const uint8_t *request, uint8_t *response
     }
     // Read register block
     while (request_count--) {
+      DAP_YIELD();
       // Read DP/AP register
       if (request_count == 0U) {
         // Last read
@@ -1462,6 +1556,7 @@ static uint32_t DAP_JTAG_TransferBlock(const uint8_t *request, uint8_t *response
   } else {
     // Write register block
     while (request_count--) {
+      DAP_YIELD();
       // Load data
       data = (uint32_t)(*(request+0) <<  0) |
              (uint32_t)(*(request+1) <<  8) |
@@ -1545,7 +1640,13 @@ static uint32_t DAP_TransferBlock(const uint8_t *request, uint8_t *response) {
 static uint32_t DAP_SWD_WriteAbort(const uint8_t *request, uint8_t *response) {
   uint32_t data;
 
-  // Load data (Ignore DAP index)
+  // Select the multi-drop target by DAP index
+  if (SWD_SelectTarget(*request) != DAP_TRANSFER_OK) {
+    *response = DAP_ERROR;
+    return (1U);
+  }
+
+  // Load data
   data = (uint32_t)(*(request+1) <<  0) |
          (uint32_t)(*(request+2) <<  8) |
          (uint32_t)(*(request+3) << 16) |
@@ -1576,7 +1677,9 @@ static uint32_t DAP_JTAG_WriteAbort(const uint8_t *request, uint8_t *response) {
   }
 
   // Select JTAG chain
-  JTAG_IR(JTAG_ABORT);
+  if (DAP_Data.jtag_dev.ir[DAP_Data.jtag_dev.index] != JTAG_ABORT) {
+    JTAG_IR(JTAG_ABORT);
+  }
 
   // Load data
   data = (uint32_t)(*(request+1) <<  0) |
@@ -1642,6 +1745,8 @@ __WEAK uint32_t DAP_ProcessVendorCommand(const uint8_t *request, uint8_t *respon
 uint32_t DAP_ProcessCommand(const uint8_t *request, uint8_t *response) {
   uint32_t num;
 
+  WAIT_BACKOFF_COMMAND(*request);
+
   if ((*request >= ID_DAP_Vendor0) && (*request <= ID_DAP_Vendor31)) {
     return DAP_ProcessVendorCommand(request, response);
   }
@@ -1803,9 +1908,14 @@ void DAP_Setup(void) {
 #if (DAP_SWD != 0)
   DAP_Data.swd_conf.turnaround  = 1U;
   DAP_Data.swd_conf.data_phase  = 0U;
+  DAP_Data.swd_conf.targets     = 0U;
+  DAP_Data.swd_conf.host_targetsel = 0U;
+  DAP_Data.swd_conf.select_target = SWD_SELECT_UNKNOWN;
+  SWD_TargetInvalidate();
 #endif
 #if (DAP_JTAG != 0)
   DAP_Data.jtag_dev.count = 0U;
+  JTAG_IR_Invalidate();
 #endif
 
   // Sets DAP_Data.fast_clock and DAP_Data.clock_delay.
@@ -209,6 +209,7 @@
 #define DP_SELECT                       0x08U   // Select Register (JTAG R/W & SW W)
 #define DP_RESEND                       0x08U   // Resend (SW Read Only)
 #define DP_RDBUFF                       0x0CU   // Read Buffer (Read Only)
+#define DP_TARGETSEL                    0x0CU   // Target Select (SW Write Only)
 
 // JTAG IR Codes
 #define JTAG_ABORT                      0x08U
@@ -216,6 +217,11 @@
 #define JTAG_APACC                      0x0BU
 #define JTAG_IDCODE                     0x0EU
 #define JTAG_BYPASS                     0x0FU
+#define JTAG_IR_UNKNOWN                 0x00U   // IR contents not known
+
+// SWD Multi-drop
+#define SWD_TARGET_UNKNOWN              0xFFU   // Selected target not known
+#define SWD_SELECT_UNKNOWN              0xFEU   // DP SELECT not known for any target
 
 // JTAG Sequence Info
 #define JTAG_SEQUENCE_TCK               0x3FU   // TCK count
@@ -249,6 +255,12 @@ typedef struct {
   struct {                                      // SWD Configuration
     uint8_t    turnaround;                      // Turnaround period
     uint8_t    data_phase;                      // Always generate Data Phase
+    uint8_t    targets;                         // Multi-drop targets with a TARGETSEL value (bit per DAP index)
+    uint8_t    target;                          // Selected target (SWD_TARGET_UNKNOWN if not known)
+    uint32_t   targetsel[DAP_SWD_TARGET_CNT];   // TARGETSEL value per DAP index
+    uint32_t   select;                          // Last DP SELECT value written (see SELECT_TRACK)
+    uint8_t    select_target;                   // Target it was written to (SWD_SELECT_UNKNOWN if none)
+    uint8_t    host_targetsel;                  // Host sent a TARGETSEL in a raw sequence
   } swd_conf;
 #endif
 #if (DAP_JTAG != 0)
@@ -259,6 +271,7 @@ typedef struct {
     uint8_t   ir_length[DAP_JTAG_DEV_CNT];      // IR Length in bits
     uint16_t  ir_before[DAP_JTAG_DEV_CNT];      // Bits before IR
     uint16_t  ir_after [DAP_JTAG_DEV_CNT];      // Bits after IR
+    uint8_t   ir       [DAP_JTAG_DEV_CNT];      // Current IR (JTAG_IR_UNKNOWN if not known)
 #endif
   } jtag_dev;
 #endif
@@ -278,10 +291,13 @@ extern void     SWJ_Sequence    (uint32_t count, const uint8_t *data);
 extern void     SWD_Sequence    (uint32_t info,  const uint8_t *swdo, uint8_t *swdi);
 extern void     JTAG_Sequence   (uint32_t info,  const uint8_t *tdi,  uint8_t *tdo);
 extern void     JTAG_IR         (uint32_t ir);
+extern void     JTAG_IR_Invalidate (void);
 extern uint32_t JTAG_ReadIDCode (void);
 extern void     JTAG_WriteAbort (uint32_t data);
 extern uint8_t  JTAG_Transfer   (uint32_t request, uint32_t *data);
 extern uint8_t  SWD_Transfer    (uint32_t request, uint32_t *data);
+extern uint8_t  SWD_SelectTarget (uint32_t index);
+extern void     SWD_TargetInvalidate (void);
 
 extern void     Delayms         (uint32_t delay);
 
@@ -318,6 +334,7 @@ extern uint32_t UART_Transfer  (const uint8_t *request, uint8_t *response);
 extern uint8_t  USB_COM_PORT_Activate (uint32_t cmd);
 
 extern uint32_t DAP_ProcessVendorCommand (const uint8_t *request, uint8_t *response);
+extern uint8_t  DAP_HaltCore             (uint32_t apsel, uint32_t *dhcsr);
 extern uint32_t DAP_ProcessCommand       (const uint8_t *request, uint8_t *response);
 extern uint32_t DAP_ExecuteCommand       (const uint8_t *request, uint8_t *response);
 
@@ -45,6 +45,7 @@
 #include <esp_cpu.h>
 #include <esp_mac.h>
 #include <soc/gpio_struct.h>
+#include <soc/soc_caps.h>
 #include <string.h>
 
 // Board-specific defines come from the sdkconfig file.
@@ -70,6 +71,53 @@
 #define GPIO_LED                CONFIG_ESP_DAP_GPIO_LED
 #endif
 
+// SWD/JTAG pin maps. Map 0 is the set of pins above, map 1 an optional second
+// set. An extra map, following the fixed ones, can be configured at runtime.
+// Only SWCLK/TCK, SWDIO/TMS, TDI and TDO are part of a map.
+#ifdef CONFIG_ESP_DAP_PIN_MAP_COUNT
+#define PIN_MAP_COUNT           CONFIG_ESP_DAP_PIN_MAP_COUNT
+#else
+#define PIN_MAP_COUNT           1
+#endif
+
+#ifdef CONFIG_ESP_DAP_PIN_MAP_RUNTIME
+#define PIN_MAP_RUNTIME         1
+#else
+#define PIN_MAP_RUNTIME         0
+#endif
+#define PIN_MAP_RUNTIME_INDEX   PIN_MAP_COUNT
+
+#define PIN_MAP0_SWCLK_TCK      GPIO_SWCLK_TCK
+#define PIN_MAP0_SWDIO_TMS      GPIO_SWDIO_TMS
+#define PIN_MAP0_TDI            GPIO_TDI
+#define PIN_MAP0_TDO            GPIO_TDO
+
+#if PIN_MAP_COUNT > 1
+#define PIN_MAP1_SWCLK_TCK      CONFIG_ESP_DAP_PIN_MAP1_GPIO_SWCLK_TCK
+#define PIN_MAP1_SWDIO_TMS      CONFIG_ESP_DAP_PIN_MAP1_GPIO_SWDIO_TMS
+#ifdef CONFIG_ESP_DAP_JTAG_SUPPORTED
+#define PIN_MAP1_TDI            CONFIG_ESP_DAP_PIN_MAP1_GPIO_TDI
+#define PIN_MAP1_TDO            CONFIG_ESP_DAP_PIN_MAP1_GPIO_TDO
+#endif
+#endif
+
+// PIN_ACTIVE() gives the pins of the currently selected map. With a single
+// map these are constants. Otherwise they are read from RAM (PIN_MAPR_*),
+// and SW_DP.c / JTAG_DP.c dispatch to transfer functions built with the
+// constant pins of the selected map instead.
+#if (PIN_MAP_COUNT > 1) || (PIN_MAP_RUNTIME != 0)
+#include "pin_map.h"
+#define PIN_MAPR_SWCLK_TCK      (pin_map.swclk_tck)
+#define PIN_MAPR_SWDIO_TMS      (pin_map.swdio_tms)
+#define PIN_MAPR_TDI            (pin_map.tdi)
+#define PIN_MAPR_TDO            (pin_map.tdo)
+#define PIN_MAP_INDEX           pin_map_index
+#define PIN_ACTIVE(pin)         PIN_MAPR_##pin
+#else
+#define PIN_MAP_INDEX           0U
+#define PIN_ACTIVE(pin)         PIN_MAP0_##pin
+#endif
+
 /**************************************************************************************************
 \defgroup DAP_Config_Debug_gr CMSIS-DAP Debug Unit Information
 \ingroup DAP_ConfigIO_gr
@@ -86,9 +134,25 @@ This information includes:
 
 #include <esp_timer.h>
 #include "device_config.h"
+#include "dap_yield.h"
 #ifdef CONFIG_ESP_DAP_LED_RGB
 #include "ws2812_led.h"
 #endif
+#if defined(CONFIG_ESP_DAP_CRITICAL_SECTIONS) || defined(CONFIG_ESP_DAP_JITTER_HISTOGRAM)
+#include "bitbang.h"
+#endif
+#ifdef CONFIG_ESP_DAP_WAIT_BACKOFF
+#include "wait_backoff.h"
+#endif
+#ifdef CONFIG_ESP_DAP_CLOCK_FALLBACK
+#include "clock_fallback.h"
+#endif
+#ifdef CONFIG_ESP_DAP_TRACE
+#include "dap_trace.h"
+#endif
+#ifdef CONFIG_ESP_CPU_USAGE
+#include "cpu_usage.h"
+#endif
 
 /// Processor Clock of the Cortex-M MCU used in the Debug Unit.
 /// This value is used to calculate the SWD/JTAG clock speed.
@@ -127,6 +191,10 @@ This information includes:
 /// This setting impacts the RAM requirements of the Debug Unit. Valid range is 1 .. 255.
 #define DAP_JTAG_DEV_CNT        8U              ///< Maximum number of JTAG devices on scan chain.
 
+/// Configure maximum number of SWD multi-drop targets, addressed by the DAP index of transfer
+/// commands. Valid range is 1 .. 8.
+#define DAP_SWD_TARGET_CNT      8U              ///< Maximum number of SWD multi-drop targets.
+
 /// Default communication mode on the Debug Access Port.
 /// Used for the command \ref DAP_Connect when Port Default mode is selected.
 #define DAP_DEFAULT_PORT        1U              ///< Default JTAG/SWJ Port Mode: 1 = SWD, 2 = JTAG.
@@ -152,39 +220,84 @@ This information includes:
 
 /// Indicate that UART Serial Wire Output (SWO) trace is available.
 /// This information is returned by the command \ref DAP_Info as part of <b>Capabilities</b>.
+#ifdef CONFIG_ESP_DAP_SWO_UART
+#define SWO_UART                1               ///< SWO UART:  1 = available, 0 = not available.
+#else
 #define SWO_UART                0               ///< SWO UART:  1 = available, 0 = not available.
+#endif
 
 /// USART Driver instance number for the UART SWO.
+/// Driver_USART0 is provided by usart_esp32.c on top of the ESP-IDF UART driver.
 #define SWO_UART_DRIVER         0               ///< USART Driver instance number (Driver_USART#).
 
 /// Maximum SWO UART Baudrate.
-#define SWO_UART_MAX_BAUDRATE   10000000U       ///< SWO UART Maximum Baudrate in Hz.
+/// Highest bit rate the ESP32 UART can receive, e.g. 5 MBd on ESP32-C6.
+#define SWO_UART_MAX_BAUDRATE   SOC_UART_BITRATE_MAX ///< SWO UART Maximum Baudrate in Hz.
 
 /// Indicate that Manchester Serial Wire Output (SWO) trace is available.
 /// This information is returned by the command \ref DAP_Info as part of <b>Capabilities</b>.
+#ifdef CONFIG_ESP_DAP_SWO_MANCHESTER
+#define SWO_MANCHESTER          1               ///< SWO Manchester:  1 = available, 0 = not available.
+#else
 #define SWO_MANCHESTER          0               ///< SWO Manchester:  1 = available, 0 = not available.
+#endif
+
+/// Maximum SWO Manchester Baudrate.
+/// Limited by the 25 ns resolution of the RMT pulse capture in swo_manchester.c.
+#define SWO_MANCHESTER_MAX_BAUDRATE 2000000U    ///< SWO Manchester Maximum Baudrate in Hz.
 
 /// SWO Trace Buffer Size.
+#ifdef CONFIG_ESP_DAP_SWO_BUFFER_SIZE
+#define SWO_BUFFER_SIZE         CONFIG_ESP_DAP_SWO_BUFFER_SIZE ///< SWO Trace Buffer Size in bytes (must be 2^n).
+#else
 #define SWO_BUFFER_SIZE         4096U           ///< SWO Trace Buffer Size in bytes (must be 2^n).
+#endif
+#if ((SWO_BUFFER_SIZE & (SWO_BUFFER_SIZE - 1)) != 0)
+#error "CONFIG_ESP_DAP_SWO_BUFFER_SIZE must be a power of 2."
+#endif
 
 /// SWO Streaming Trace.
+/// The trace is streamed to a client of the TCP port CONFIG_ESP_DAP_SWO_TCP_PORT (swo_stream.c).
+#ifdef CONFIG_ESP_DAP_SWO_STREAM
+#define SWO_STREAM              1               ///< SWO Streaming Trace: 1 = available, 0 = not available.
+#else
 #define SWO_STREAM              0               ///< SWO Streaming Trace: 1 = available, 0 = not available.
+#endif
 
 /// Clock frequency of the Test Domain Timer. Timer value is returned with \ref TIMESTAMP_GET.
 #define TIMESTAMP_CLOCK         CPU_CLOCK       ///< Timestamp clock in Hz (0 = timestamps not supported).
 
 /// Indicate that UART Communication Port is available.
 /// This information is returned by the command \ref DAP_Info as part of <b>Capabilities</b>.
+#ifdef CONFIG_ESP_DAP_UART
+#define DAP_UART                1               ///< DAP UART:  1 = available, 0 = not available.
+#else
 #define DAP_UART                0               ///< DAP UART:  1 = available, 0 = not available.
+#endif
 
 /// USART Driver instance number for the UART Communication Port.
+/// Driver_USART1 is provided by usart_esp32.c on top of the ESP-IDF UART driver.
 #define DAP_UART_DRIVER         1               ///< USART Driver instance number (Driver_USART#).
 
 /// UART Receive Buffer Size.
+#ifdef CONFIG_ESP_DAP_UART_RX_BUFFER_SIZE
+#define DAP_UART_RX_BUFFER_SIZE CONFIG_ESP_DAP_UART_RX_BUFFER_SIZE ///< Uart Receive Buffer Size in bytes (must be 2^n).
+#else
 #define DAP_UART_RX_BUFFER_SIZE 1024U           ///< Uart Receive Buffer Size in bytes (must be 2^n).
+#endif
+#if ((DAP_UART_RX_BUFFER_SIZE & (DAP_UART_RX_BUFFER_SIZE - 1)) != 0)
+#error "CONFIG_ESP_DAP_UART_RX_BUFFER_SIZE must be a power of 2."
+#endif
 
 /// UART Transmit Buffer Size.
+#ifdef CONFIG_ESP_DAP_UART_TX_BUFFER_SIZE
+#define DAP_UART_TX_BUFFER_SIZE CONFIG_ESP_DAP_UART_TX_BUFFER_SIZE ///< Uart Transmit Buffer Size in bytes (must be 2^n).
+#else
 #define DAP_UART_TX_BUFFER_SIZE 1024U           ///< Uart Transmit Buffer Size in bytes (must be 2^n).
+#endif
+#if ((DAP_UART_TX_BUFFER_SIZE & (DAP_UART_TX_BUFFER_SIZE - 1)) != 0)
+#error "CONFIG_ESP_DAP_UART_TX_BUFFER_SIZE must be a power of 2."
+#endif
 
 /// Indicate that UART Communication via USB COM Port is available.
 /// This information is returned by the command \ref DAP_Info as part of <b>Capabilities</b>.
@@ -384,18 +497,18 @@ Configures the DAP Hardware I/O pins for JTAG mode:
 __STATIC_INLINE void PORT_JTAG_SETUP (void)
 {
 #if DAP_JTAG
-    gpio_set_level(GPIO_SWCLK_TCK, 1);
-    gpio_set_level(GPIO_SWDIO_TMS, 1);
-    gpio_set_level(GPIO_TDI, 1);
-    gpio_set_direction(GPIO_SWCLK_TCK, GPIO_MODE_OUTPUT);
-    gpio_set_direction(GPIO_SWDIO_TMS, GPIO_MODE_OUTPUT);
-    gpio_set_direction(GPIO_TDI, GPIO_MODE_OUTPUT);
-    gpio_set_direction(GPIO_TDO, GPIO_MODE_INPUT);
+    gpio_set_level(PIN_ACTIVE(SWCLK_TCK), 1);
+    gpio_set_level(PIN_ACTIVE(SWDIO_TMS), 1);
+    gpio_set_level(PIN_ACTIVE(TDI), 1);
+    gpio_set_direction(PIN_ACTIVE(SWCLK_TCK), GPIO_MODE_OUTPUT);
+    gpio_set_direction(PIN_ACTIVE(SWDIO_TMS), GPIO_MODE_OUTPUT);
+    gpio_set_direction(PIN_ACTIVE(TDI), GPIO_MODE_OUTPUT);
+    gpio_set_direction(PIN_ACTIVE(TDO), GPIO_MODE_INPUT);
 
     // Set weakest drive strength to improve signal integrity.
-    gpio_ll_set_drive_capability(gpio_dev_ptr, GPIO_SWCLK_TCK, GPIO_DRIVE_CAP_0);
-    gpio_ll_set_drive_capability(gpio_dev_ptr, GPIO_SWDIO_TMS, GPIO_DRIVE_CAP_0);
-    gpio_ll_set_drive_capability(gpio_dev_ptr, GPIO_TDI, GPIO_DRIVE_CAP_0);
+    gpio_ll_set_drive_capability(gpio_dev_ptr, PIN_ACTIVE(SWCLK_TCK), GPIO_DRIVE_CAP_0);
+    gpio_ll_set_drive_capability(gpio_dev_ptr, PIN_ACTIVE(SWDIO_TMS), GPIO_DRIVE_CAP_0);
+    gpio_ll_set_drive_capability(gpio_dev_ptr, PIN_ACTIVE(TDI), GPIO_DRIVE_CAP_0);
 #endif
 
 #ifdef GPIO_NTRST
@@ -427,21 +540,21 @@ __STATIC_INLINE void PORT_SWD_SETUP (void)
 {
 #if DAP_SWD
     // SWCLK as output low.
-    gpio_set_level(GPIO_SWCLK_TCK, 0);
-    gpio_set_direction(GPIO_SWCLK_TCK, GPIO_MODE_OUTPUT);
+    gpio_set_level(PIN_ACTIVE(SWCLK_TCK), 0);
+    gpio_set_direction(PIN_ACTIVE(SWCLK_TCK), GPIO_MODE_OUTPUT);
 
     // SWD as output low.
-    gpio_pullup_en(GPIO_SWDIO_TMS);
-    gpio_set_level(GPIO_SWDIO_TMS, 0);
-    gpio_set_direction(GPIO_SWDIO_TMS, GPIO_MODE_OUTPUT);
+    gpio_pullup_en(PIN_ACTIVE(SWDIO_TMS));
+    gpio_set_level(PIN_ACTIVE(SWDIO_TMS), 0);
+    gpio_set_direction(PIN_ACTIVE(SWDIO_TMS), GPIO_MODE_OUTPUT);
 
     // Set weakest drive strength to improve signal integrity.
-    gpio_ll_set_drive_capability(gpio_dev_ptr, GPIO_SWCLK_TCK, GPIO_DRIVE_CAP_0);
-    gpio_ll_set_drive_capability(gpio_dev_ptr, GPIO_SWDIO_TMS, GPIO_DRIVE_CAP_0);
+    gpio_ll_set_drive_capability(gpio_dev_ptr, PIN_ACTIVE(SWCLK_TCK), GPIO_DRIVE_CAP_0);
+    gpio_ll_set_drive_capability(gpio_dev_ptr, PIN_ACTIVE(SWDIO_TMS), GPIO_DRIVE_CAP_0);
 #endif
 
 #ifdef GPIO_TDI
-    gpio_reset_pin(GPIO_TDI);
+    gpio_reset_pin(PIN_ACTIVE(TDI));
 #endif
 
 #ifdef GPIO_NTRST
@@ -463,14 +576,14 @@ Disables the DAP Hardware I/O pins which configures:
 __STATIC_INLINE void PORT_OFF (void)
 {
 #ifdef GPIO_SWCLK_TCK
-    gpio_reset_pin(GPIO_SWCLK_TCK);
+    gpio_reset_pin(PIN_ACTIVE(SWCLK_TCK));
 #endif
 #ifdef GPIO_SWDIO_TMS
-    gpio_reset_pin(GPIO_SWDIO_TMS);
+    gpio_reset_pin(PIN_ACTIVE(SWDIO_TMS));
 #endif
 #if DAP_JTAG
-    gpio_reset_pin(GPIO_TDI);
-    gpio_reset_pin(GPIO_TDO);
+    gpio_reset_pin(PIN_ACTIVE(TDI));
+    gpio_reset_pin(PIN_ACTIVE(TDO));
 #endif
 #ifdef GPIO_NTRST
     gpio_reset_pin(GPIO_NTRST);
@@ -481,6 +594,43 @@ __STATIC_INLINE void PORT_OFF (void)
 }
 
 
+// Generic GPIO access ------------------------------------
+
+/** Bit-banged pin access by GPIO number.
+Used by SW_DP.c and JTAG_DP.c to build their transfer functions once for each pin map. With a
+constant \a gpio these compile to the same code as the fixed-pin functions below.
+*/
+__STATIC_FORCEINLINE uint32_t PIN_GPIO_IN (uint32_t gpio)
+{
+    return gpio_ll_get_level(gpio_dev_ptr, gpio);
+}
+
+__STATIC_FORCEINLINE void     PIN_GPIO_OUT (uint32_t gpio, uint32_t bit)
+{
+    gpio_ll_set_level(gpio_dev_ptr, gpio, bit & 1);
+}
+
+/// Same as \ref PIN_GPIO_OUT, for the SWCLK/TCK clock pin.
+__STATIC_FORCEINLINE void     PIN_GPIO_CLK (uint32_t gpio, uint32_t bit)
+{
+    gpio_ll_set_level(gpio_dev_ptr, gpio, bit & 1);
+#ifdef CONFIG_ESP_DAP_JITTER_HISTOGRAM
+    bitbang_jitter_edge();
+#endif
+}
+
+__STATIC_FORCEINLINE void     PIN_GPIO_OUT_ENABLE (uint32_t gpio)
+{
+    gpio_ll_output_enable(gpio_dev_ptr, gpio);
+}
+
+__STATIC_FORCEINLINE void     PIN_GPIO_OUT_DISABLE (uint32_t gpio)
+{
+    gpio_ll_output_disable(gpio_dev_ptr, gpio);
+    gpio_ll_input_enable(gpio_dev_ptr, gpio);
+}
+
+
 // SWCLK/TCK I/O pin -------------------------------------
 
 /** SWCLK/TCK I/O pin: Get Input.
@@ -488,7 +638,7 @@ __STATIC_INLINE void PORT_OFF (void)
 */
 __STATIC_FORCEINLINE uint32_t PIN_SWCLK_TCK_IN  (void)
 {
-    return gpio_ll_get_level(gpio_dev_ptr, GPIO_SWCLK_TCK);
+    return gpio_ll_get_level(gpio_dev_ptr, PIN_ACTIVE(SWCLK_TCK));
 }
 
 /** SWCLK/TCK I/O pin: Set Output to High.
@@ -496,7 +646,10 @@ Set the SWCLK/TCK DAP hardware I/O pin to high level.
 */
 __STATIC_FORCEINLINE void     PIN_SWCLK_TCK_SET (void)
 {
-    gpio_ll_set_level(gpio_dev_ptr, GPIO_SWCLK_TCK, 1);
+    gpio_ll_set_level(gpio_dev_ptr, PIN_ACTIVE(SWCLK_TCK), 1);
+#ifdef CONFIG_ESP_DAP_JITTER_HISTOGRAM
+    bitbang_jitter_edge();
+#endif
 }
 
 /** SWCLK/TCK I/O pin: Set Output to Low.
@@ -505,7 +658,10 @@ Set the SWCLK/TCK DAP hardware I/O pin to low level.
 __STATIC_FORCEINLINE void     PIN_SWCLK_TCK_CLR (void)
 {
 #ifdef GPIO_SWCLK_TCK
-    gpio_ll_set_level(gpio_dev_ptr, GPIO_SWCLK_TCK, 0);
+    gpio_ll_set_level(gpio_dev_ptr, PIN_ACTIVE(SWCLK_TCK), 0);
+#endif
+#ifdef CONFIG_ESP_DAP_JITTER_HISTOGRAM
+    bitbang_jitter_edge();
 #endif
 }
 
@@ -518,7 +674,7 @@ __STATIC_FORCEINLINE void     PIN_SWCLK_TCK_CLR (void)
 __STATIC_FORCEINLINE uint32_t PIN_SWDIO_TMS_IN  (void)
 {
 #ifdef GPIO_SWDIO_TMS
-    return gpio_ll_get_level(gpio_dev_ptr, GPIO_SWDIO_TMS);
+    return gpio_ll_get_level(gpio_dev_ptr, PIN_ACTIVE(SWDIO_TMS));
 #else
     return 0;
 #endif
@@ -530,7 +686,7 @@ Set the SWDIO/TMS DAP hardware I/O pin to high level.
 __STATIC_FORCEINLINE void     PIN_SWDIO_TMS_SET (void)
 {
 #ifdef GPIO_SWDIO_TMS
-    gpio_ll_set_level(gpio_dev_ptr, GPIO_SWDIO_TMS, 1);
+    gpio_ll_set_level(gpio_dev_ptr, PIN_ACTIVE(SWDIO_TMS), 1);
 #endif
 }
 
@@ -540,7 +696,7 @@ Set the SWDIO/TMS DAP hardware I/O pin to low level.
 __STATIC_FORCEINLINE void     PIN_SWDIO_TMS_CLR (void)
 {
 #ifdef GPIO_SWDIO_TMS
-    gpio_ll_set_level(gpio_dev_ptr, GPIO_SWDIO_TMS, 0);
+    gpio_ll_set_level(gpio_dev_ptr, PIN_ACTIVE(SWDIO_TMS), 0);
 #endif
 }
 
@@ -550,7 +706,7 @@ __STATIC_FORCEINLINE void     PIN_SWDIO_TMS_CLR (void)
 __STATIC_FORCEINLINE uint32_t PIN_SWDIO_IN      (void)
 {
 #ifdef GPIO_SWDIO_TMS
-    return gpio_ll_get_level(gpio_dev_ptr, GPIO_SWDIO_TMS);
+    return gpio_ll_get_level(gpio_dev_ptr, PIN_ACTIVE(SWDIO_TMS));
 #else
     return 0;
 #endif
@@ -562,7 +718,7 @@ __STATIC_FORCEINLINE uint32_t PIN_SWDIO_IN      (void)
 __STATIC_FORCEINLINE void     PIN_SWDIO_OUT     (uint32_t bit)
 {
 #ifdef GPIO_SWDIO_TMS
-    gpio_ll_set_level(gpio_dev_ptr, GPIO_SWDIO_TMS, bit & 1);
+    gpio_ll_set_level(gpio_dev_ptr, PIN_ACTIVE(SWDIO_TMS), bit & 1);
 #endif
 }
 
@@ -573,7 +729,7 @@ called prior \ref PIN_SWDIO_OUT function calls.
 __STATIC_FORCEINLINE void     PIN_SWDIO_OUT_ENABLE  (void)
 {
 #ifdef GPIO_SWDIO_TMS
-    gpio_ll_output_enable(gpio_dev_ptr, GPIO_SWDIO_TMS);
+    gpio_ll_output_enable(gpio_dev_ptr, PIN_ACTIVE(SWDIO_TMS));
 #endif
 }
 
@@ -584,8 +740,8 @@ called prior \ref PIN_SWDIO_IN function calls.
 __STATIC_FORCEINLINE void     PIN_SWDIO_OUT_DISABLE (void)
 {
 #ifdef GPIO_SWDIO_TMS
-    gpio_ll_output_disable(gpio_dev_ptr, GPIO_SWDIO_TMS);
-    gpio_ll_input_enable(gpio_dev_ptr, GPIO_SWDIO_TMS);
+    gpio_ll_output_disable(gpio_dev_ptr, PIN_ACTIVE(SWDIO_TMS));
+    gpio_ll_input_enable(gpio_dev_ptr, PIN_ACTIVE(SWDIO_TMS));
 #endif
 }
 
@@ -598,7 +754,7 @@ __STATIC_FORCEINLINE void     PIN_SWDIO_OUT_DISABLE (void)
 __STATIC_FORCEINLINE uint32_t PIN_TDI_IN  (void)
 {
 #ifdef GPIO_TDI
-    return gpio_ll_get_level(gpio_dev_ptr, GPIO_TDI);
+    return gpio_ll_get_level(gpio_dev_ptr, PIN_ACTIVE(TDI));
 #else
     return 0;
 #endif
@@ -610,7 +766,7 @@ __STATIC_FORCEINLINE uint32_t PIN_TDI_IN  (void)
 __STATIC_FORCEINLINE void     PIN_TDI_OUT (uint32_t bit)
 {
 #ifdef GPIO_TDI
-    gpio_ll_set_level(gpio_dev_ptr, GPIO_TDI, bit & 1);
+    gpio_ll_set_level(gpio_dev_ptr, PIN_ACTIVE(TDI), bit & 1);
 #endif
 }
 
@@ -623,7 +779,7 @@ __STATIC_FORCEINLINE void     PIN_TDI_OUT (uint32_t bit)
 __STATIC_FORCEINLINE uint32_t PIN_TDO_IN  (void)
 {
 #ifdef GPIO_TDO
-    return gpio_ll_get_level(gpio_dev_ptr, GPIO_TDO);
+    return gpio_ll_get_level(gpio_dev_ptr, PIN_ACTIVE(TDO));
 #else
     return 0;
 #endif
@@ -772,6 +928,131 @@ __STATIC_INLINE uint32_t TIMESTAMP_GET (void)
 ///@}
 
 
+//**************************************************************************************************
+/**
+\defgroup DAP_Config_Transfer_gr CMSIS-DAP Transfer Hooks
+\ingroup DAP_ConfigIO_gr
+@{
+Called around each bit-banged SWD/JTAG transfer.
+
+\ref TRANSFER_BEGIN may mask interrupts for the duration of the transfer, so that the SWCLK/TCK
+period is not stretched by interrupt handlers. \ref TRANSFER_END restores them. Both are empty
+unless CONFIG_ESP_DAP_CRITICAL_SECTIONS or CONFIG_ESP_DAP_JITTER_HISTOGRAM is enabled.
+*/
+
+#if defined(CONFIG_ESP_DAP_CRITICAL_SECTIONS) || defined(CONFIG_ESP_DAP_JITTER_HISTOGRAM)
+/// Start of a transfer of approximately \a bits clock cycles. Returns state for \ref TRANSFER_END.
+#define TRANSFER_BEGIN(bits)    bitbang_transfer_begin(bits)
+/// End of a transfer.
+#define TRANSFER_END(state)     bitbang_transfer_end(state)
+#else
+#define TRANSFER_BEGIN(bits)    (0U)
+#define TRANSFER_END(state)     ((void)(state))
+#endif
+
+/**
+\ref WAIT_BACKOFF_BEFORE returns the number of idle cycles to clock before a transfer that retries
+a request answered with WAIT. \ref WAIT_BACKOFF_AFTER records the ACK of each transfer and
+\ref WAIT_BACKOFF_COMMAND the start of each DAP command. All are empty unless
+CONFIG_ESP_DAP_WAIT_BACKOFF is enabled.
+*/
+
+#ifdef CONFIG_ESP_DAP_WAIT_BACKOFF
+/// Idle cycles to insert before a transfer of \a request.
+#define WAIT_BACKOFF_BEFORE(request)                    wait_backoff_before(request)
+/// Result of a transfer of \a bits clock cycles.
+#define WAIT_BACKOFF_AFTER(request, data, ack, bits)    wait_backoff_after(request, data, ack, bits)
+/// Start of DAP command \a id.
+#define WAIT_BACKOFF_COMMAND(id)                        wait_backoff_command(id)
+#else
+#define WAIT_BACKOFF_BEFORE(request)                    (0U)
+#define WAIT_BACKOFF_AFTER(request, data, ack, bits)    ((void)(bits))
+#define WAIT_BACKOFF_COMMAND(id)                        ((void)0)
+#endif
+
+/**
+SWD_Transfer retries a transfer that failed with a parity or protocol error up to
+\ref CLOCK_FALLBACK_RETRIES times. \ref CLOCK_FALLBACK_ERROR lowers SWCLK after repeated errors,
+\ref CLOCK_FALLBACK_OK raises it again after a run of clean transfers, and
+\ref CLOCK_FALLBACK_RESET restores the rate set by DAP_SWJ_Clock. All are empty and no transfer is
+retried unless CONFIG_ESP_DAP_CLOCK_FALLBACK is enabled.
+*/
+
+#ifdef CONFIG_ESP_DAP_CLOCK_FALLBACK
+/// Number of retries after a parity or protocol error.
+#define CLOCK_FALLBACK_RETRIES      CONFIG_ESP_DAP_CLOCK_FALLBACK_RETRIES
+/// Transfer completed without parity or protocol error.
+#define CLOCK_FALLBACK_OK()         clock_fallback_ok()
+/// Transfer failed with \a ack, a parity or protocol error.
+#define CLOCK_FALLBACK_ERROR(ack)   clock_fallback_error(ack)
+/// Host set the SWJ clock.
+#define CLOCK_FALLBACK_RESET()      clock_fallback_reset()
+#else
+#define CLOCK_FALLBACK_RETRIES      0U
+#define CLOCK_FALLBACK_OK()         ((void)0)
+#define CLOCK_FALLBACK_ERROR(ack)   ((void)(ack))
+#define CLOCK_FALLBACK_RESET()      ((void)0)
+#endif
+
+/**
+\ref SELECT_TRACK records each DP SELECT value written by SWD_Transfer, so that DAP_HaltCore
+can restore it after halting the target outside of a DAP command, and DAP_MultiCore after
+selecting the APs of other cores.
+*/
+
+/// Result \a ack of a transfer of \a request.
+#define SELECT_TRACK(request, data, ack)                                   \
+  do {                                                                     \
+    if (((ack) == DAP_TRANSFER_OK) && (((request) & 0x0FU) == DP_SELECT)) {\
+      DAP_Data.swd_conf.select        = *(data);                           \
+      DAP_Data.swd_conf.select_target = DAP_Data.swd_conf.target;          \
+    }                                                                      \
+  } while (0)
+
+/**
+\ref DAP_TRACE_ACK records the ACK of each transfer, and counts WAIT ACKs, for the record of the
+current DAP request. It is empty unless CONFIG_ESP_DAP_TRACE is enabled.
+*/
+
+#ifdef CONFIG_ESP_DAP_TRACE
+/// Result \a ack of a transfer.
+#define DAP_TRACE_ACK(ack)          dap_trace_ack(ack)
+#else
+#define DAP_TRACE_ACK(ack)          ((void)0)
+#endif
+
+/**
+\ref DAP_CPU_USAGE answers vendor command 0x83 with the CPU usage of the cores and tasks of the
+Debug Unit. It responds DAP_ERROR unless CONFIG_ESP_CPU_USAGE is enabled.
+*/
+
+#ifdef CONFIG_ESP_CPU_USAGE
+/// Process \a request into \a response. Returns the request and response lengths.
+#define DAP_CPU_USAGE(request, response) \
+  cpu_usage_vendor(request, response, DAP_PACKET_SIZE - 1U)
+#else
+#define DAP_CPU_USAGE(request, response) \
+  (*(response) = DAP_ERROR, (1U << 16) | 1U)
+#endif
+
+/**
+\ref DAP_SLEEP_US implements DAP_Delay and Delayms as a blocking sleep. \ref DAP_YIELD is called
+between transfers of long commands and lets other tasks run once the current time slice has ended.
+It is empty unless CONFIG_ESP_DAP_YIELD is enabled.
+*/
+
+/// Sleep for at least \a us microseconds.
+#define DAP_SLEEP_US(us)            dap_sleep_us(us)
+#ifdef CONFIG_ESP_DAP_YIELD
+/// Safe point between transfers.
+#define DAP_YIELD()                 dap_yield_check()
+#else
+#define DAP_YIELD()                 ((void)0)
+#endif
+
+///@}
+
+
 //**************************************************************************************************
 /**
 \defgroup DAP_Config_Initialization_gr CMSIS-DAP Initialization
@@ -37,8 +37,423 @@
 The file DAP_vendor.c provides template source code for extension of a Debug Unit with
 Vendor Commands. Copy this file to the project folder of the Debug Unit and add the
 file to the MDK-ARM project under the file group Configuration.
+
+Vendor commands of this Debug Unit:
+ - ID_DAP_Vendor1: configure the TARGETSEL value of an SWD multi-drop target.
+ - ID_DAP_Vendor2: halt or resume several Cortex-M cores at the same time.
+ - ID_DAP_Vendor3: CPU usage of the Debug Unit, see \ref DAP_CPU_USAGE.
+
+DAP_HaltCore() halts a core on behalf of the UART trigger, between DAP commands.
 */
 
+
+// Process SWD Multi-drop Target command
+// Transfers with this DAP index select the target first, unless it is
+// already selected.
+//   request:  DAP index, TARGETSEL value (0 removes the target)
+//   return:   DAP_OK or DAP_ERROR
+static uint8_t DAP_SWD_TargetSel(const uint8_t *request) {
+#if (DAP_SWD != 0)
+  uint32_t index;
+  uint32_t value;
+
+  index = *request;
+  value = (uint32_t)(*(request+1) <<  0) |
+          (uint32_t)(*(request+2) <<  8) |
+          (uint32_t)(*(request+3) << 16) |
+          (uint32_t)(*(request+4) << 24);
+
+  if (index >= DAP_SWD_TARGET_CNT) {
+    return (DAP_ERROR);
+  }
+  if (value == 0U) {
+    DAP_Data.swd_conf.targets &= (uint8_t)~(1U << index);
+  } else {
+    DAP_Data.swd_conf.targetsel[index] = value;
+    DAP_Data.swd_conf.targets |= (uint8_t)(1U << index);
+  }
+  if (DAP_Data.swd_conf.target == index) {
+    SWD_TargetInvalidate();
+  }
+  return (DAP_OK);
+#else
+  return (DAP_ERROR);
+#endif
+}
+
+
+// Multi-core halt/resume
+#define MC_CORE_MAX         8U          // Cores per command
+
+#if (DAP_SWD != 0)
+
+#define MC_RESUME           0x01U       // Mode: resume instead of halt
+#define MC_CONFIRM_RETRY    100U        // DHCSR reads until halt/resume is seen
+
+// MEM-AP registers (request address bits A[3:2])
+#define AP_CSW              0x00U
+#define AP_TAR              0x04U
+#define AP_DRW              0x0CU
+#define AP_CSW_SIZE_ADDRINC 0x37U       // Size[2:0] and AddrInc[5:4]
+#define AP_CSW_SIZE_WORD    0x02U
+
+// Cortex-M Debug Halting Control and Status Register
+#define DHCSR_ADDR          0xE000EDF0U
+#define DHCSR_DBGKEY        0xA05F0000U
+#define DHCSR_C_DEBUGEN     0x00000001U
+#define DHCSR_C_HALT        0x00000002U
+#define DHCSR_S_HALT        0x00020000U
+
+// CoreSight CTI registers. Cortex-M CTIs drive the core halt request from
+// trigger output 0 and the restart request from trigger output 1.
+#define CTI_CONTROL         0x000U
+#define CTI_INTACK          0x010U
+#define CTI_APPPULSE        0x01CU
+#define CTI_OUTEN0          0x0A0U
+#define CTI_OUTEN1          0x0A4U
+#define CTI_GATE            0x140U
+#define CTI_LAR             0xFB0U
+#define CTI_LAR_KEY         0xC5ACCE55U
+#define CTI_CH_HALT         0x01U       // Channel 0 -> trigger output 0
+#define CTI_CH_RESTART      0x02U       // Channel 1 -> trigger output 1
+
+typedef struct {
+  uint32_t index;                       // DAP index (multi-drop target)
+  uint32_t apsel;                       // MEM-AP of the core
+  uint32_t cti;                         // CTI base address, 0 = no CTI
+  uint32_t csw;                         // Saved CSW
+  uint32_t tar;                         // Saved TAR
+} MC_Core;
+
+
+// SWD Transfer with retries after WAIT
+static uint8_t MC_Transfer(uint32_t request, uint32_t *data) {
+  uint32_t retry;
+  uint8_t  ack;
+
+  retry = DAP_Data.transfer.retry_count;
+  do {
+    ack = SWD_Transfer(request, data);
+  } while ((ack == DAP_TRANSFER_WAIT) && retry-- && !DAP_TransferAbort);
+  return (ack);
+}
+
+// Read AP register (posted read followed by RDBUFF)
+static uint8_t MC_ReadAP(uint32_t reg, uint32_t *data) {
+  uint8_t ack;
+
+  ack = MC_Transfer(DAP_TRANSFER_APnDP | DAP_TRANSFER_RnW | reg, NULL);
+  if (ack != DAP_TRANSFER_OK) {
+    return (ack);
+  }
+  return (MC_Transfer(DP_RDBUFF | DAP_TRANSFER_RnW, data));
+}
+
+// Write AP register
+static uint8_t MC_WriteAP(uint32_t reg, uint32_t data) {
+  return (MC_Transfer(DAP_TRANSFER_APnDP | reg, &data));
+}
+
+// Write memory word and wait until the write has completed
+static uint8_t MC_WriteMem(uint32_t addr, uint32_t data) {
+  uint8_t ack;
+
+  ack = MC_WriteAP(AP_TAR, addr);
+  if (ack == DAP_TRANSFER_OK) {
+    ack = MC_WriteAP(AP_DRW, data);
+  }
+  if (ack == DAP_TRANSFER_OK) {
+    ack = MC_Transfer(DP_RDBUFF | DAP_TRANSFER_RnW, NULL);
+  }
+  return (ack);
+}
+
+// Read memory word
+static uint8_t MC_ReadMem(uint32_t addr, uint32_t *data) {
+  uint8_t ack;
+
+  ack = MC_WriteAP(AP_TAR, addr);
+  if (ack == DAP_TRANSFER_OK) {
+    ack = MC_ReadAP(AP_DRW, data);
+  }
+  return (ack);
+}
+
+// Select the core's multi-drop target and MEM-AP
+static uint8_t MC_Select(const MC_Core *core) {
+  uint32_t select;
+  uint8_t  ack;
+
+  ack = SWD_SelectTarget(core->index);
+  if (ack == DAP_TRANSFER_OK) {
+    select = core->apsel << 24;
+    ack = MC_Transfer(DP_SELECT, &select);
+  }
+  return (ack);
+}
+
+// CTI setup: unlock, enable, open channels 0 and 1, route them to halt and
+// restart, and clear pending trigger outputs
+static const uint32_t MC_CTI_Setup[][2] = {
+  { CTI_LAR,     CTI_LAR_KEY                   },
+  { CTI_CONTROL, 1U                            },
+  { CTI_GATE,    CTI_CH_HALT | CTI_CH_RESTART  },
+  { CTI_OUTEN0,  CTI_CH_HALT                   },
+  { CTI_OUTEN1,  CTI_CH_RESTART                },
+  { CTI_INTACK,  3U                            },
+};
+
+// Save CSW and TAR, set 32-bit accesses, and set up the CTI
+static uint8_t MC_Prepare(MC_Core *core) {
+  uint32_t n;
+  uint8_t  ack;
+
+  ack = MC_Select(core);
+  if (ack == DAP_TRANSFER_OK) {
+    ack = MC_ReadAP(AP_CSW, &core->csw);
+  }
+  if (ack == DAP_TRANSFER_OK) {
+    ack = MC_ReadAP(AP_TAR, &core->tar);
+  }
+  if (ack == DAP_TRANSFER_OK) {
+    ack = MC_WriteAP(AP_CSW, (core->csw & ~AP_CSW_SIZE_ADDRINC) | AP_CSW_SIZE_WORD);
+  }
+  if (core->cti != 0U) {
+    for (n = 0U; (n < (sizeof(MC_CTI_Setup) / sizeof(MC_CTI_Setup[0]))) && (ack == DAP_TRANSFER_OK); n++) {
+      ack = MC_WriteMem(core->cti + MC_CTI_Setup[n][0], MC_CTI_Setup[n][1]);
+    }
+  }
+  return (ack);
+}
+
+
+// Process Multi-core Halt/Resume command and prepare response
+// Halts or resumes a set of cores with as little skew as possible. Cores
+// with a CTI are stopped or started together by one CTI channel pulse.
+// Cores without CTI get back-to-back DHCSR writes. Then DHCSR of every core
+// is read back. CSW and TAR of each MEM-AP are restored, and so is the DP
+// SELECT value last written by the host (see SELECT_TRACK) when it was
+// written to the target still selected, multi-drop or not. Otherwise DP
+// SELECT is left unknown, so that DAP_HaltCore does not take the value
+// written here for the host's.
+//   request:  mode (bit 0: resume), core count, per core: DAP index,
+//             APSEL, CTI base address (4 bytes, 0 = no CTI)
+//   response: status (DAP_ERROR also when a core did not halt or resume in
+//             time), number of cores done, per core: DHCSR (4 bytes) and
+//             timestamp of the halt/resume (4 bytes)
+//   return:   number of bytes in response (lower 16 bits)
+//             number of bytes in request (upper 16 bits)
+static uint32_t DAP_MultiCore(const uint8_t *request, uint8_t *response) {
+  MC_Core   core[MC_CORE_MAX];
+  uint32_t  timestamp[MC_CORE_MAX];
+  uint32_t  mode;
+  uint32_t  count;
+  uint32_t  first_cti;
+  uint32_t  select;
+  uint32_t  select_target;
+  uint32_t  dhcsr = 0U;
+  uint32_t  n, k;
+  uint8_t  *response_head;
+  uint8_t   status;
+  uint8_t   ack;
+
+  mode  = *request++;
+  count = *request++;
+  response_head = response;
+  *(response+0) = DAP_ERROR;
+  *(response+1) = 0U;
+  response += 2;
+
+  if ((count == 0U) || (count > MC_CORE_MAX)) {
+    // The core list cannot be trusted, nor its length
+    return ((2U << 16) | 2U);
+  }
+  if (DAP_Data.debug_port != DAP_PORT_SWD) {
+    goto end;
+  }
+
+  // DP SELECT of the target selected by the host, if known
+  select        = DAP_Data.swd_conf.select;
+  select_target = DAP_Data.swd_conf.select_target;
+  if (select_target != DAP_Data.swd_conf.target) {
+    select_target = SWD_SELECT_UNKNOWN;
+  }
+  status = DAP_OK;
+
+  first_cti = MC_CORE_MAX;
+  for (n = 0U; n < count; n++) {
+    core[n].index = *request++;
+    core[n].apsel = *request++;
+    core[n].cti   = (uint32_t)(*(request+0) <<  0) |
+                    (uint32_t)(*(request+1) <<  8) |
+                    (uint32_t)(*(request+2) << 16) |
+                    (uint32_t)(*(request+3) << 24);
+    request += 4;
+    if ((core[n].cti != 0U) && (first_cti == MC_CORE_MAX)) {
+      first_cti = n;
+    }
+  }
+
+  // Set up all cores, then point TAR to the register written in the fast path
+  for (n = 0U; n < count; n++) {
+    if (MC_Prepare(&core[n]) != DAP_TRANSFER_OK) {
+      goto restore;
+    }
+  }
+  for (n = 0U; n < count; n++) {
+    if ((core[n].cti == 0U) || (n == first_cti)) {
+      if ((MC_Select(&core[n]) != DAP_TRANSFER_OK) ||
+          (MC_WriteAP(AP_TAR, (core[n].cti != 0U) ? (core[n].cti + CTI_APPPULSE) : DHCSR_ADDR) != DAP_TRANSFER_OK)) {
+        goto restore;
+      }
+    }
+  }
+
+  // Fast path: one CTI pulse for all cores with CTI, DHCSR writes for the others
+  if (first_cti != MC_CORE_MAX) {
+    if ((MC_Select(&core[first_cti]) != DAP_TRANSFER_OK) ||
+        (MC_WriteAP(AP_DRW, (mode & MC_RESUME) ? CTI_CH_RESTART : CTI_CH_HALT) != DAP_TRANSFER_OK) ||
+        (MC_Transfer(DP_RDBUFF | DAP_TRANSFER_RnW, NULL) != DAP_TRANSFER_OK)) {
+      goto restore;
+    }
+    for (n = 0U; n < count; n++) {
+      timestamp[n] = TIMESTAMP_GET();
+    }
+  }
+  for (n = 0U; n < count; n++) {
+    if (core[n].cti == 0U) {
+      if ((MC_Select(&core[n]) != DAP_TRANSFER_OK) ||
+          (MC_WriteAP(AP_DRW, DHCSR_DBGKEY | DHCSR_C_DEBUGEN |
+                              ((mode & MC_RESUME) ? 0U : DHCSR_C_HALT)) != DAP_TRANSFER_OK) ||
+          (MC_Transfer(DP_RDBUFF | DAP_TRANSFER_RnW, NULL) != DAP_TRANSFER_OK)) {
+        goto restore;
+      }
+      timestamp[n] = TIMESTAMP_GET();
+    }
+  }
+
+  // Read back DHCSR, acknowledge the CTI triggers and restore CSW and TAR
+  for (n = 0U; n < count; n++) {
+    if (MC_Select(&core[n]) != DAP_TRANSFER_OK) {
+      goto restore;
+    }
+    for (k = MC_CONFIRM_RETRY; k; k--) {
+      ack = MC_ReadMem(DHCSR_ADDR, &dhcsr);
+      if (ack != DAP_TRANSFER_OK) {
+        goto restore;
+      }
+      if (((dhcsr & DHCSR_S_HALT) != 0U) == ((mode & MC_RESUME) == 0U)) {
+        break;
+      }
+    }
+    if (k == 0U) {
+      status = DAP_ERROR;
+    }
+    if ((core[n].cti != 0U) &&
+        (MC_WriteMem(core[n].cti + CTI_INTACK, 3U) != DAP_TRANSFER_OK)) {
+      goto restore;
+    }
+    if ((MC_WriteAP(AP_CSW, core[n].csw) != DAP_TRANSFER_OK) ||
+        (MC_WriteAP(AP_TAR, core[n].tar) != DAP_TRANSFER_OK)) {
+      goto restore;
+    }
+    *response++ = (uint8_t) dhcsr;
+    *response++ = (uint8_t)(dhcsr >>  8);
+    *response++ = (uint8_t)(dhcsr >> 16);
+    *response++ = (uint8_t)(dhcsr >> 24);
+    *response++ = (uint8_t) timestamp[n];
+    *response++ = (uint8_t)(timestamp[n] >>  8);
+    *response++ = (uint8_t)(timestamp[n] >> 16);
+    *response++ = (uint8_t)(timestamp[n] >> 24);
+    *(response_head+1) = (uint8_t)(n + 1U);
+  }
+  *response_head = status;
+
+restore:
+  // Forget the DP SELECT values written above, then put back the host's
+  // (tracked again by SELECT_TRACK). Without a TARGETSEL value for it, the
+  // host's target cannot be selected again once another one was.
+  DAP_Data.swd_conf.select_target = SWD_SELECT_UNKNOWN;
+  if ((select_target != SWD_SELECT_UNKNOWN) &&
+      ((SWD_SelectTarget(select_target) != DAP_TRANSFER_OK) ||
+       (DAP_Data.swd_conf.target != select_target) ||
+       (MC_Transfer(DP_SELECT, &select) != DAP_TRANSFER_OK))) {
+    *response_head = DAP_ERROR;
+  }
+
+end:
+  return (((2U + (count * 6U)) << 16) | (uint32_t)(response - response_head));
+}
+
+
+// Halt the core of the selected target outside of a DAP command
+// Used by the UART trigger. The caller keeps DAP commands from running
+// meanwhile. CSW, TAR and DP SELECT are restored, so the state cached by the
+// host stays valid; sticky errors caused by the halt are cleared.
+//   apsel:  MEM-AP of the core
+//   dhcsr:  DHCSR read back after the halt
+//   return: DAP_TRANSFER_OK, the ACK of the failed transfer, or
+//           DAP_TRANSFER_ERROR when SWD is not connected or DP SELECT is
+//           not known
+uint8_t DAP_HaltCore(uint32_t apsel, uint32_t *dhcsr) {
+  MC_Core  core;
+  uint32_t select;
+  uint32_t abort;
+  uint8_t  ack;
+
+  if ((DAP_Data.debug_port != DAP_PORT_SWD) ||
+      (DAP_Data.swd_conf.select_target != DAP_Data.swd_conf.target)) {
+    return (DAP_TRANSFER_ERROR);
+  }
+  select = DAP_Data.swd_conf.select;
+
+  core.index = DAP_Data.swd_conf.target;
+  core.apsel = apsel;
+  core.cti   = 0U;
+  ack = MC_Prepare(&core);
+  if (ack == DAP_TRANSFER_OK) {
+    ack = MC_WriteMem(DHCSR_ADDR, DHCSR_DBGKEY | DHCSR_C_DEBUGEN | DHCSR_C_HALT);
+  }
+  if (ack == DAP_TRANSFER_OK) {
+    ack = MC_ReadMem(DHCSR_ADDR, dhcsr);
+  }
+  if (ack == DAP_TRANSFER_OK) {
+    ack = MC_WriteAP(AP_CSW, core.csw);
+  }
+  if (ack == DAP_TRANSFER_OK) {
+    ack = MC_WriteAP(AP_TAR, core.tar);
+  }
+  if (ack != DAP_TRANSFER_OK) {
+    abort = 0x1EU;                      // Clear all sticky flags
+    MC_Transfer(DP_ABORT, &abort);
+  }
+  DAP_Data.swd_conf.select_target = SWD_SELECT_UNKNOWN;
+  MC_Transfer(DP_SELECT, &select);
+  return (ack);
+}
+
+#else
+
+uint8_t DAP_HaltCore(uint32_t apsel, uint32_t *dhcsr) {
+  (void)apsel;
+  (void)dhcsr;
+  return (DAP_TRANSFER_ERROR);
+}
+
+static uint32_t DAP_MultiCore(const uint8_t *request, uint8_t *response) {
+  uint32_t count = *(request+1);
+
+  *(response+0) = DAP_ERROR;
+  *(response+1) = 0U;
+  if (count > MC_CORE_MAX) {
+    count = 0U;
+  }
+  return (((2U + (count * 6U)) << 16) | 2U);
+}
+
+#endif
+
+
 /** Process DAP Vendor Command and prepare Response Data
 \param request   pointer to request data
 \param response  pointer to response data
@@ -61,9 +476,17 @@ uint32_t DAP_ProcessVendorCommand(const uint8_t *request, uint8_t *response) {
 #endif
       break;
 
-    case ID_DAP_Vendor1:  break;
-    case ID_DAP_Vendor2:  break;
-    case ID_DAP_Vendor3:  break;
+    case ID_DAP_Vendor1:         // SWD multi-drop target
+      num += 5U << 16;
+      *response++ = DAP_SWD_TargetSel(request);
+      num++;
+      break;
+    case ID_DAP_Vendor2:         // Multi-core halt/resume
+      num += DAP_MultiCore(request, response);
+      break;
+    case ID_DAP_Vendor3:         // CPU usage
+      num += DAP_CPU_USAGE(request, response);
+      break;
     case ID_DAP_Vendor4:  break;
     case ID_DAP_Vendor5:  break;
     case ID_DAP_Vendor6:  break;
@@ -31,10 +31,18 @@
 
 // JTAG Macros
 
-#define PIN_TCK_SET PIN_SWCLK_TCK_SET
-#define PIN_TCK_CLR PIN_SWCLK_TCK_CLR
-#define PIN_TMS_SET PIN_SWDIO_TMS_SET
-#define PIN_TMS_CLR PIN_SWDIO_TMS_CLR
+// Pins used by the JTAG macros. JTAG_PIN() is redefined before each
+// instantiation of the IR and transfer functions below, once for every pin
+// map. The TDI/TDO macros take the place of the DAP_config.h functions in
+// this file.
+#define JTAG_PIN(pin) PIN_ACTIVE(pin)
+
+#define PIN_TCK_SET()   PIN_GPIO_CLK(JTAG_PIN(SWCLK_TCK), 1U)
+#define PIN_TCK_CLR()   PIN_GPIO_CLK(JTAG_PIN(SWCLK_TCK), 0U)
+#define PIN_TMS_SET()   PIN_GPIO_OUT(JTAG_PIN(SWDIO_TMS), 1U)
+#define PIN_TMS_CLR()   PIN_GPIO_OUT(JTAG_PIN(SWDIO_TMS), 0U)
+#define PIN_TDI_OUT(bit) PIN_GPIO_OUT(JTAG_PIN(TDI), bit)
+#define PIN_TDO_IN()    PIN_GPIO_IN(JTAG_PIN(TDO))
 
 #define JTAG_CYCLE_TCK()                \
   PIN_TCK_CLR();                        \
@@ -109,6 +117,17 @@ void JTAG_Sequence (uint32_t info, const uint8_t *tdi, uint8_t *tdo) {
 }
 
 
+// Generate JTAG Idle Cycles in Run-Test/Idle, e.g. to back off after WAIT
+//   cycles: number of idle cycles
+//   return: none
+static void JTAG_Idle (uint32_t cycles) {
+  PIN_TMS_CLR();
+  for (; cycles; cycles--) {
+    JTAG_CYCLE_TCK();
+  }
+}
+
+
 // JTAG Set IR
 //   ir:     IR value
 //   return: none
@@ -251,15 +270,202 @@ exit:
 }
 
 
+// JTAG Set IR (single device on the scan chain, no bypass bits)
+//   ir:     IR value
+//   return: none
+#define JTAG_IR_SingleFunction(speed) /**/                                      \
+static void JTAG_IR_Single##speed (uint32_t ir) {                               \
+  uint32_t n;                                                                   \
+                                                                                \
+  PIN_TMS_SET();                                                                \
+  JTAG_CYCLE_TCK();                         /* Select-DR-Scan */                \
+  JTAG_CYCLE_TCK();                         /* Select-IR-Scan */                \
+  PIN_TMS_CLR();                                                                \
+  JTAG_CYCLE_TCK();                         /* Capture-IR */                    \
+  JTAG_CYCLE_TCK();                         /* Shift-IR */                      \
+                                                                                \
+  for (n = DAP_Data.jtag_dev.ir_length[0] - 1U; n; n--) {                       \
+    JTAG_CYCLE_TDI(ir);                     /* Set IR bits (except last) */     \
+    ir >>= 1;                                                                   \
+  }                                                                             \
+  PIN_TMS_SET();                                                                \
+  JTAG_CYCLE_TDI(ir);                       /* Set last IR bit & Exit1-IR */    \
+                                                                                \
+  JTAG_CYCLE_TCK();                         /* Update-IR */                     \
+  PIN_TMS_CLR();                                                                \
+  JTAG_CYCLE_TCK();                         /* Idle */                          \
+  PIN_TDI_OUT(1U);                                                              \
+}
+
+
+// JTAG Transfer I/O (single device on the scan chain, no bypass bits)
+//   request: A[3:2] RnW APnDP
+//   data:    DATA[31:0]
+//   return:  ACK[2:0]
+#define JTAG_TransferSingleFunction(speed)  /**/                                \
+static uint8_t JTAG_TransferSingle##speed (uint32_t request, uint32_t *data) {  \
+  uint32_t ack;                                                                 \
+  uint32_t bit;                                                                 \
+  uint32_t val;                                                                 \
+  uint32_t n;                                                                   \
+                                                                                \
+  PIN_TMS_SET();                                                                \
+  JTAG_CYCLE_TCK();                         /* Select-DR-Scan */                \
+  PIN_TMS_CLR();                                                                \
+  JTAG_CYCLE_TCK();                         /* Capture-DR */                    \
+  JTAG_CYCLE_TCK();                         /* Shift-DR */                      \
+                                                                                \
+  JTAG_CYCLE_TDIO(request >> 1, bit);       /* Set RnW, Get ACK.0 */            \
+  ack  = bit << 1;                                                              \
+  JTAG_CYCLE_TDIO(request >> 2, bit);       /* Set A2,  Get ACK.1 */            \
+  ack |= bit << 0;                                                              \
+  JTAG_CYCLE_TDIO(request >> 3, bit);       /* Set A3,  Get ACK.2 */            \
+  ack |= bit << 2;                                                              \
+                                                                                \
+  if (ack != DAP_TRANSFER_OK) {                                                 \
+    /* Exit on error */                                                         \
+    PIN_TMS_SET();                                                              \
+    JTAG_CYCLE_TCK();                       /* Exit1-DR */                      \
+    goto exit;                                                                  \
+  }                                                                             \
+                                                                                \
+  if (request & DAP_TRANSFER_RnW) {                                             \
+    /* Read Transfer */                                                         \
+    val = 0U;                                                                   \
+    for (n = 31U; n; n--) {                                                     \
+      JTAG_CYCLE_TDO(bit);                  /* Get D0..D30 */                   \
+      val  |= bit << 31;                                                        \
+      val >>= 1;                                                                \
+    }                                                                           \
+    PIN_TMS_SET();                                                              \
+    JTAG_CYCLE_TDO(bit);                    /* Get D31 & Exit1-DR */            \
+    val |= bit << 31;                                                           \
+    if (data) { *data = val; }                                                  \
+  } else {                                                                      \
+    /* Write Transfer */                                                        \
+    val = *data;                                                                \
+    for (n = 31U; n; n--) {                                                     \
+      JTAG_CYCLE_TDI(val);                  /* Set D0..D30 */                   \
+      val >>= 1;                                                                \
+    }                                                                           \
+    PIN_TMS_SET();                                                              \
+    JTAG_CYCLE_TDI(val);                    /* Set D31 & Exit1-DR */            \
+  }                                                                             \
+                                                                                \
+exit:                                                                           \
+  JTAG_CYCLE_TCK();                         /* Update-DR */                     \
+  PIN_TMS_CLR();                                                                \
+  JTAG_CYCLE_TCK();                         /* Idle */                          \
+  PIN_TDI_OUT(1U);                                                              \
+                                                                                \
+  /* Capture Timestamp */                                                       \
+  if (request & DAP_TRANSFER_TIMESTAMP) {                                       \
+    DAP_Data.timestamp = TIMESTAMP_GET();                                       \
+  }                                                                             \
+                                                                                \
+  /* Idle cycles */                                                             \
+  n = DAP_Data.transfer.idle_cycles;                                            \
+  while (n--) {                                                                 \
+    JTAG_CYCLE_TCK();                       /* Idle */                          \
+  }                                                                             \
+                                                                                \
+  return ((uint8_t)ack);                                                        \
+}
+
+
+// Pin map 0: constant pins
+#undef  JTAG_PIN
+#define JTAG_PIN(pin) PIN_MAP0_##pin
+
 #undef  PIN_DELAY
 #define PIN_DELAY() PIN_DELAY_FAST()
 JTAG_IR_Function(Fast)
+JTAG_IR_SingleFunction(Fast)
 JTAG_TransferFunction(Fast)
+JTAG_TransferSingleFunction(Fast)
 
 #undef  PIN_DELAY
 #define PIN_DELAY() PIN_DELAY_SLOW(DAP_Data.clock_delay)
 JTAG_IR_Function(Slow)
+JTAG_IR_SingleFunction(Slow)
 JTAG_TransferFunction(Slow)
+JTAG_TransferSingleFunction(Slow)
+
+#if (PIN_MAP_COUNT > 1)
+// Pin map 1: constant pins
+#undef  JTAG_PIN
+#define JTAG_PIN(pin) PIN_MAP1_##pin
+
+#undef  PIN_DELAY
+#define PIN_DELAY() PIN_DELAY_FAST()
+JTAG_IR_Function(Fast1)
+JTAG_IR_SingleFunction(Fast1)
+JTAG_TransferFunction(Fast1)
+JTAG_TransferSingleFunction(Fast1)
+
+#undef  PIN_DELAY
+#define PIN_DELAY() PIN_DELAY_SLOW(DAP_Data.clock_delay)
+JTAG_IR_Function(Slow1)
+JTAG_IR_SingleFunction(Slow1)
+JTAG_TransferFunction(Slow1)
+JTAG_TransferSingleFunction(Slow1)
+#endif
+
+#if (PIN_MAP_RUNTIME != 0)
+// Runtime pin map: pins read from RAM
+#undef  JTAG_PIN
+#define JTAG_PIN(pin) PIN_MAPR_##pin
+
+#undef  PIN_DELAY
+#define PIN_DELAY() PIN_DELAY_FAST()
+JTAG_IR_Function(FastR)
+JTAG_IR_SingleFunction(FastR)
+JTAG_TransferFunction(FastR)
+JTAG_TransferSingleFunction(FastR)
+
+#undef  PIN_DELAY
+#define PIN_DELAY() PIN_DELAY_SLOW(DAP_Data.clock_delay)
+JTAG_IR_Function(SlowR)
+JTAG_IR_SingleFunction(SlowR)
+JTAG_TransferFunction(SlowR)
+JTAG_TransferSingleFunction(SlowR)
+#endif
+
+#undef  JTAG_PIN
+#define JTAG_PIN(pin) PIN_ACTIVE(pin)
+
+
+// Select the IR function for the scan chain, clock speed and pin map.
+#define JTAG_IR_Select(map)                     \
+  if (DAP_Data.jtag_dev.count == 1U) {          \
+    if (DAP_Data.fast_clock) {                  \
+      JTAG_IR_SingleFast##map(ir);              \
+    } else {                                    \
+      JTAG_IR_SingleSlow##map(ir);              \
+    }                                           \
+  } else {                                      \
+    if (DAP_Data.fast_clock) {                  \
+      JTAG_IR_Fast##map(ir);                    \
+    } else {                                    \
+      JTAG_IR_Slow##map(ir);                    \
+    }                                           \
+  }
+
+// Select the transfer function for the scan chain, clock speed and pin map.
+#define JTAG_TransferSelect(map)                         \
+  if (DAP_Data.jtag_dev.count == 1U) {                   \
+    if (DAP_Data.fast_clock) {                           \
+      ack = JTAG_TransferSingleFast##map(request, data); \
+    } else {                                             \
+      ack = JTAG_TransferSingleSlow##map(request, data); \
+    }                                                    \
+  } else {                                               \
+    if (DAP_Data.fast_clock) {                           \
+      ack = JTAG_TransferFast##map(request, data);       \
+    } else {                                             \
+      ack = JTAG_TransferSlow##map(request, data);       \
+    }                                                    \
+  }
 
 
 // JTAG Read IDCODE register
@@ -343,13 +549,52 @@ void JTAG_WriteAbort (uint32_t data) {
 
 
 // JTAG Set IR
+// The selected device now holds the new IR value. All other devices on the
+// chain were shifted all ones, which is BYPASS.
 //   ir:     IR value
 //   return: none
 void JTAG_IR (uint32_t ir) {
-  if (DAP_Data.fast_clock) {
-    JTAG_IR_Fast(ir);
-  } else {
-    JTAG_IR_Slow(ir);
+  uint32_t state;
+  uint32_t n;
+
+  n = DAP_Data.jtag_dev.index;
+  state = TRANSFER_BEGIN(6U + DAP_Data.jtag_dev.ir_before[n] +
+                         DAP_Data.jtag_dev.ir_length[n] +
+                         DAP_Data.jtag_dev.ir_after[n]);
+  switch (PIN_MAP_INDEX) {
+#if (PIN_MAP_COUNT > 1)
+    case 1U:
+      JTAG_IR_Select(1)
+      break;
+#endif
+#if (PIN_MAP_RUNTIME != 0)
+    case PIN_MAP_RUNTIME_INDEX:
+      JTAG_IR_Select(R)
+      break;
+#endif
+    default:
+      JTAG_IR_Select()
+      break;
+  }
+  TRANSFER_END(state);
+
+  for (n = 0U; n < DAP_Data.jtag_dev.count; n++) {
+    DAP_Data.jtag_dev.ir[n] = JTAG_BYPASS;
+  }
+  DAP_Data.jtag_dev.ir[DAP_Data.jtag_dev.index] = (uint8_t)ir;
+}
+
+
+// JTAG Invalidate IR
+// Called whenever the TAP state may have been changed behind our back
+// (raw sequences, pin changes, reset, chain reconfiguration), so that the
+// next transfer shifts the IR again.
+//   return: none
+void JTAG_IR_Invalidate (void) {
+  uint32_t n;
+
+  for (n = 0U; n < DAP_JTAG_DEV_CNT; n++) {
+    DAP_Data.jtag_dev.ir[n] = JTAG_IR_UNKNOWN;
   }
 }
 
@@ -359,11 +604,40 @@ void JTAG_IR (uint32_t ir) {
 //   data:    DATA[31:0]
 //   return:  ACK[2:0]
 uint8_t  JTAG_Transfer(uint32_t request, uint32_t *data) {
-  if (DAP_Data.fast_clock) {
-    return JTAG_TransferFast(request, data);
-  } else {
-    return JTAG_TransferSlow(request, data);
+  uint32_t state;
+  uint32_t bits;
+  uint32_t idle;
+  uint8_t  ack;
+
+  /* Back off before retrying after WAIT */
+  idle = WAIT_BACKOFF_BEFORE(request);
+  if (idle != 0U) {
+    JTAG_Idle(idle);
+  }
+
+  /* TAP moves, ACK, data, bypass bits and idle cycles */
+  bits = 6U + 3U + 32U + DAP_Data.jtag_dev.count +
+         DAP_Data.transfer.idle_cycles;
+  state = TRANSFER_BEGIN(bits);
+  switch (PIN_MAP_INDEX) {
+#if (PIN_MAP_COUNT > 1)
+    case 1U:
+      JTAG_TransferSelect(1)
+      break;
+#endif
+#if (PIN_MAP_RUNTIME != 0)
+    case PIN_MAP_RUNTIME_INDEX:
+      JTAG_TransferSelect(R)
+      break;
+#endif
+    default:
+      JTAG_TransferSelect()
+      break;
   }
+  TRANSFER_END(state);
+  WAIT_BACKOFF_AFTER(request, data, ack, bits);
+  DAP_TRACE_ACK(ack);
+  return (ack);
 }
 
 
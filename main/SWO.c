@@ -30,10 +30,16 @@
 #if (SWO_UART != 0)
 #include "Driver_USART.h"
 #endif
+#if (SWO_MANCHESTER != 0)
+#include "swo_manchester.h"
+#endif
+#if ((SWO_UART != 0) || (SWO_MANCHESTER != 0))
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#endif
 #if (SWO_STREAM != 0)
-#include "cmsis_os2.h"
-#define   osObjectsExternal
-#include "osObjects.h"
+#include "swo_stream.h"
 #endif
 
 #if (SWO_STREAM != 0)
@@ -54,6 +60,12 @@ static uint8_t USART_Ready = 0U;
 
 #endif  /* (SWO_UART != 0) */
 
+#if (SWO_MANCHESTER != 0)
+
+static uint8_t Manchester_Ready = 0U;
+
+#endif  /* (SWO_MANCHESTER != 0) */
+
 
 #if ((SWO_UART != 0) || (SWO_MANCHESTER != 0))
 
@@ -93,11 +105,34 @@ static uint8_t  GetTraceStatus (void);
 static void     SetTraceError  (uint8_t flag);
 
 #if (SWO_STREAM != 0)
-extern osThreadId_t      SWO_ThreadId;
+extern TaskHandle_t      SWO_ThreadId;
 static volatile uint8_t  TransferBusy = 0U; /* Transfer Busy Flag */
 static          uint32_t TransferSize;      /* Current Transfer Size */
+static volatile uint8_t  TransferAbort = 0U; /* Transfer Abort Flag */
 #endif
 
+// The capture callbacks run in a task of usart_esp32.c or swo_manchester.c
+// rather than in an interrupt, possibly on the other core, so the trace
+// state is serialized with the SWO commands and the SWO thread by a mutex.
+// It is created by the first SWO command, before a callback is registered
+// or the SWO thread is notified. The driver functions take their own lock
+// and never call the callbacks with it held, so they may be called with
+// TraceLock held. swo_stream.c calls SWO_TransferComplete() with its lock
+// held, so TraceLock is released before calling into swo_stream.c.
+static StaticSemaphore_t TraceLockBuf;
+static SemaphoreHandle_t TraceLock = NULL;
+
+static void LockTrace (void) {
+  if (TraceLock == NULL) {
+    TraceLock = xSemaphoreCreateMutexStatic(&TraceLockBuf);
+  }
+  xSemaphoreTake(TraceLock, portMAX_DELAY);
+}
+
+static void UnlockTrace (void) {
+  xSemaphoreGive(TraceLock);
+}
+
 
 #if (SWO_UART != 0)
 
@@ -109,6 +144,8 @@ static void USART_Callback (uint32_t event) {
   uint32_t count;
   uint32_t num;
 
+  LockTrace();
+
   if (event &  ARM_USART_EVENT_RECEIVE_COMPLETE) {
 #if (TIMESTAMP_CLOCK != 0U)
     TraceTimestamp.tick = TIMESTAMP_GET();
@@ -133,7 +170,7 @@ static void USART_Callback (uint32_t event) {
 #if (SWO_STREAM != 0)
     if (TraceTransport == 2U) {
       if (count >= (USB_BLOCK_SIZE - (index_o & (USB_BLOCK_SIZE - 1U)))) {
-        osThreadFlagsSet(SWO_ThreadId, 1U);
+        xTaskNotify(SWO_ThreadId, 1U, eSetBits);
       }
     }
 #endif
@@ -146,6 +183,7 @@ static void USART_Callback (uint32_t event) {
                ARM_USART_EVENT_RX_PARITY_ERROR)) {
     SetTraceError(DAP_SWO_STREAM_ERROR);
   }
+  UnlockTrace();
 }
 
 // Enable or disable SWO Mode (UART)
@@ -276,36 +314,150 @@ __WEAK uint32_t SWO_GetCount_UART (void) {
 
 #if (SWO_MANCHESTER != 0)
 
+// Manchester Capture Callback function
+//   event: event mask
+static void Manchester_Callback (uint32_t event) {
+  uint32_t index_i;
+  uint32_t index_o;
+  uint32_t count;
+  uint32_t num;
+
+  LockTrace();
+
+  if (event &  SWO_MANCHESTER_EVENT_RECEIVE_COMPLETE) {
+#if (TIMESTAMP_CLOCK != 0U)
+    TraceTimestamp.tick = TIMESTAMP_GET();
+#endif
+    index_o  = TraceIndexO;
+    index_i  = TraceIndexI;
+    index_i += TraceBlockSize;
+    TraceIndexI = index_i;
+#if (TIMESTAMP_CLOCK != 0U)
+    TraceTimestamp.index = index_i;
+#endif
+    num   = TRACE_BLOCK_SIZE - (index_i & (TRACE_BLOCK_SIZE - 1U));
+    count = index_i - index_o;
+    if (count <= (SWO_BUFFER_SIZE - num)) {
+      index_i &= SWO_BUFFER_SIZE - 1U;
+      TraceBlockSize = num;
+      swo_manchester_receive(&TraceBuf[index_i], num);
+    } else {
+      TraceStatus = DAP_SWO_CAPTURE_ACTIVE | DAP_SWO_CAPTURE_PAUSED;
+    }
+    TraceUpdate = 1U;
+#if (SWO_STREAM != 0)
+    if (TraceTransport == 2U) {
+      if (count >= (USB_BLOCK_SIZE - (index_o & (USB_BLOCK_SIZE - 1U)))) {
+        xTaskNotify(SWO_ThreadId, 1U, eSetBits);
+      }
+    }
+#endif
+  }
+  if (event &  SWO_MANCHESTER_EVENT_OVERFLOW) {
+    SetTraceError(DAP_SWO_BUFFER_OVERRUN);
+  }
+  if (event &  SWO_MANCHESTER_EVENT_ERROR) {
+    SetTraceError(DAP_SWO_STREAM_ERROR);
+  }
+  UnlockTrace();
+}
+
 // Enable or disable SWO Mode (Manchester)
 //   enable: enable flag
 //   return: 1 - Success, 0 - Error
 __WEAK uint32_t SWO_Mode_Manchester (uint32_t enable) {
-  return (0U);
+
+  Manchester_Ready = 0U;
+
+  if (enable != 0U) {
+    if (swo_manchester_start(Manchester_Callback) != 0) {
+      return (0U);
+    }
+  } else {
+    swo_manchester_stop();
+  }
+  return (1U);
 }
 
 // Configure SWO Baudrate (Manchester)
 //   baudrate: requested baudrate
 //   return:   actual baudrate or 0 when not configured
 __WEAK uint32_t SWO_Baudrate_Manchester (uint32_t baudrate) {
-  return (0U);
+  uint32_t index;
+  uint32_t num;
+
+  if (baudrate > SWO_MANCHESTER_MAX_BAUDRATE) {
+    baudrate = SWO_MANCHESTER_MAX_BAUDRATE;
+  }
+
+  if (TraceStatus & DAP_SWO_CAPTURE_ACTIVE) {
+    swo_manchester_enable_rx(0U);
+    if (swo_manchester_rx_busy()) {
+      TraceIndexI += swo_manchester_rx_count();
+      swo_manchester_abort_receive();
+    }
+  }
+
+  // The bit rate is measured from each packet's start bit.
+  swo_manchester_set_baudrate(baudrate);
+  Manchester_Ready = 1U;
+
+  if (TraceStatus & DAP_SWO_CAPTURE_ACTIVE) {
+    if ((TraceStatus & DAP_SWO_CAPTURE_PAUSED) == 0U) {
+      index = TraceIndexI & (SWO_BUFFER_SIZE - 1U);
+      num = TRACE_BLOCK_SIZE - (index & (TRACE_BLOCK_SIZE - 1U));
+      TraceBlockSize = num;
+      swo_manchester_receive(&TraceBuf[index], num);
+    }
+    swo_manchester_enable_rx(1U);
+  }
+
+  return (baudrate);
 }
 
 // Control SWO Capture (Manchester)
 //   active: active flag
 //   return: 1 - Success, 0 - Error
 __WEAK uint32_t SWO_Control_Manchester (uint32_t active) {
-  return (0U);
+
+  if (active) {
+    if (!Manchester_Ready) {
+      return (0U);
+    }
+    TraceBlockSize = 1U;
+    if (swo_manchester_receive(&TraceBuf[0], 1U) != 0) {
+      return (0U);
+    }
+    swo_manchester_enable_rx(1U);
+  } else {
+    swo_manchester_enable_rx(0U);
+    if (swo_manchester_rx_busy()) {
+      TraceIndexI += swo_manchester_rx_count();
+      swo_manchester_abort_receive();
+    }
+  }
+  return (1U);
 }
 
 // Start SWO Capture (Manchester)
 //   buf: pointer to buffer for capturing
 //   num: number of bytes to capture
 __WEAK void SWO_Capture_Manchester (uint8_t *buf, uint32_t num) {
+  TraceBlockSize = num;
+  swo_manchester_receive(buf, num);
 }
 
 // Get SWO Pending Trace Count (Manchester)
 //   return: number of pending trace data bytes
 __WEAK uint32_t SWO_GetCount_Manchester (void) {
+  uint32_t count;
+
+  if (swo_manchester_rx_busy()) {
+    count = swo_manchester_rx_count();
+  } else {
+    count = 0U;
+  }
+  return (count);
 }
 
 #endif  /* (SWO_MANCHESTER != 0) */
@@ -315,10 +467,11 @@ __WEAK uint32_t SWO_GetCount_Manchester (void) {
 static void ClearTrace (void) {
 
 #if (SWO_STREAM != 0)
+  // The transfer stays busy until SWO_Control() has aborted it, outside
+  // the lock, and its completion is ignored meanwhile.
   if (TraceTransport == 2U) {
     if (TransferBusy != 0U) {
-      SWO_AbortTransfer();
-      TransferBusy = 0U;
+      TransferAbort = 1U;
     }
   }
 #endif
@@ -426,6 +579,7 @@ uint32_t SWO_Transport (const uint8_t *request, uint8_t *response) {
   uint8_t  transport;
   uint32_t result;
 
+  LockTrace();
   if ((TraceStatus & DAP_SWO_CAPTURE_ACTIVE) == 0U) {
     transport = *request;
     switch (transport) {
@@ -444,6 +598,7 @@ uint32_t SWO_Transport (const uint8_t *request, uint8_t *response) {
   } else {
     result = 0U;
   }
+  UnlockTrace();
 
   if (result != 0U) {
     *response = DAP_OK;
@@ -466,6 +621,7 @@ uint32_t SWO_Mode (const uint8_t *request, uint8_t *response) {
 
   mode = *request;
 
+  LockTrace();
   switch (TraceMode) {
 #if (SWO_UART != 0)
     case DAP_SWO_UART:
@@ -506,6 +662,7 @@ uint32_t SWO_Mode (const uint8_t *request, uint8_t *response) {
   }
 
   TraceStatus = 0U;
+  UnlockTrace();
 
   if (result != 0U) {
     *response = DAP_OK;
@@ -530,6 +687,7 @@ uint32_t SWO_Baudrate (const uint8_t *request, uint8_t *response) {
              (uint32_t)(*(request+2) << 16) |
              (uint32_t)(*(request+3) << 24);
 
+  LockTrace();
   switch (TraceMode) {
 #if (SWO_UART != 0)
     case DAP_SWO_UART:
@@ -549,6 +707,7 @@ uint32_t SWO_Baudrate (const uint8_t *request, uint8_t *response) {
   if (baudrate == 0U) {
     TraceStatus = 0U;
   }
+  UnlockTrace();
 
   *response++ = (uint8_t)(baudrate >>  0);
   *response++ = (uint8_t)(baudrate >>  8);
@@ -567,9 +726,14 @@ uint32_t SWO_Baudrate (const uint8_t *request, uint8_t *response) {
 uint32_t SWO_Control (const uint8_t *request, uint8_t *response) {
   uint8_t  active;
   uint32_t result;
+#if (SWO_STREAM != 0)
+  uint8_t  abort;
+  uint8_t  notify;
+#endif
 
   active = *request & DAP_SWO_CAPTURE_ACTIVE;
 
+  LockTrace();
   if (active != (TraceStatus & DAP_SWO_CAPTURE_ACTIVE)) {
     if (active) {
       ClearTrace();
@@ -591,15 +755,28 @@ uint32_t SWO_Control (const uint8_t *request, uint8_t *response) {
     }
     if (result != 0U) {
       TraceStatus = active;
-#if (SWO_STREAM != 0)
-      if (TraceTransport == 2U) {
-        osThreadFlagsSet(SWO_ThreadId, 1U);
-      }
-#endif
     }
   } else {
     result = 1U;
   }
+#if (SWO_STREAM != 0)
+  abort = TransferAbort;
+  notify = (result != 0U) && (TraceTransport == 2U);
+#endif
+  UnlockTrace();
+
+#if (SWO_STREAM != 0)
+  if (abort != 0U) {
+    SWO_AbortTransfer();
+    LockTrace();
+    TransferAbort = 0U;
+    TransferBusy  = 0U;
+    UnlockTrace();
+  }
+  if (notify) {
+    xTaskNotify(SWO_ThreadId, 1U, eSetBits);
+  }
+#endif
 
   if (result != 0U) {
     *response = DAP_OK;
@@ -618,8 +795,10 @@ uint32_t SWO_Status (uint8_t *response) {
   uint8_t  status;
   uint32_t count;
 
+  LockTrace();
   status = GetTraceStatus();
   count  = GetTraceCount();
+  UnlockTrace();
 
   *response++ = status;
   *response++ = (uint8_t)(count >>  0);
@@ -649,6 +828,7 @@ uint32_t SWO_ExtendedStatus (const uint8_t *request, uint8_t *response) {
   num = 0U;
   cmd = *request;
 
+  LockTrace();
   if (cmd & 0x01U) {
     status = GetTraceStatus();
     *response++ = status;
@@ -682,6 +862,7 @@ uint32_t SWO_ExtendedStatus (const uint8_t *request, uint8_t *response) {
     num += 4U;
   }
 #endif
+  UnlockTrace();
 
   return ((1U << 16) | num);
 }
@@ -698,6 +879,7 @@ uint32_t SWO_Data (const uint8_t *request, uint8_t *response) {
   uint32_t index;
   uint32_t n, i;
 
+  LockTrace();
   status = GetTraceStatus();
   count  = GetTraceCount();
 
@@ -727,6 +909,7 @@ uint32_t SWO_Data (const uint8_t *request, uint8_t *response) {
     TraceIndexO = index + count;
     ResumeTrace();
   }
+  UnlockTrace();
 
   return ((2U << 16) | (3U + count));
 }
@@ -736,10 +919,14 @@ uint32_t SWO_Data (const uint8_t *request, uint8_t *response) {
 
 // SWO Data Transfer complete callback
 void SWO_TransferComplete (void) {
-  TraceIndexO += TransferSize;
-  TransferBusy = 0U;
-  ResumeTrace();
-  osThreadFlagsSet(SWO_ThreadId, 1U);
+  LockTrace();
+  if (TransferAbort == 0U) {
+    TraceIndexO += TransferSize;
+    TransferBusy = 0U;
+    ResumeTrace();
+  }
+  UnlockTrace();
+  xTaskNotify(SWO_ThreadId, 1U, eSetBits);
 }
 
 // SWO Thread
@@ -749,17 +936,22 @@ __NO_RETURN void SWO_Thread (void *argument) {
   uint32_t count;
   uint32_t index;
   uint32_t i, n;
+  uint8_t *buf;
   (void)   argument;
 
-  timeout = osWaitForever;
+  timeout = portMAX_DELAY;
 
   for (;;) {
-    flags = osThreadFlagsWait(1U, osFlagsWaitAny, timeout);
+    if (xTaskNotifyWait(0U, 1U, &flags, timeout) != pdTRUE) {
+      flags = 0U;                           /* Timeout */
+    }
+    buf = NULL;
+    LockTrace();
     if (TraceStatus & DAP_SWO_CAPTURE_ACTIVE) {
-      timeout = SWO_STREAM_TIMEOUT;
+      timeout = pdMS_TO_TICKS(SWO_STREAM_TIMEOUT);
     } else {
-      timeout = osWaitForever;
-      flags   = osFlagsErrorTimeout;
+      timeout = portMAX_DELAY;
+      flags   = 0U;
     }
     if (TransferBusy == 0U) {
       count = GetTraceCount();
@@ -769,7 +961,7 @@ __NO_RETURN void SWO_Thread (void *argument) {
         if (count > n) {
           count = n;
         }
-        if (flags != osFlagsErrorTimeout) {
+        if (flags != 0U) {
           i = index & (USB_BLOCK_SIZE - 1U);
           if (i == 0U) {
             count &= ~(USB_BLOCK_SIZE - 1U);
@@ -785,10 +977,14 @@ __NO_RETURN void SWO_Thread (void *argument) {
         if (count != 0U) {
           TransferSize = count;
           TransferBusy = 1U;
-          SWO_QueueTransfer(&TraceBuf[index], count);
+          buf = &TraceBuf[index];
         }
       }
     }
+    UnlockTrace();
+    if (buf != NULL) {
+      SWO_QueueTransfer(buf, count);
+    }
   }
 }
 
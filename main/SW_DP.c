@@ -31,8 +31,17 @@
 
 // SW Macros
 
-#define PIN_SWCLK_SET PIN_SWCLK_TCK_SET
-#define PIN_SWCLK_CLR PIN_SWCLK_TCK_CLR
+// Pins used by the SW macros. SWD_PIN() is redefined before each
+// instantiation of the transfer functions below, once for every pin map.
+// The SWDIO macros take the place of the DAP_config.h functions in this file.
+#define SWD_PIN(pin)  PIN_ACTIVE(pin)
+
+#define PIN_SWCLK_SET()               PIN_GPIO_CLK(SWD_PIN(SWCLK_TCK), 1U)
+#define PIN_SWCLK_CLR()               PIN_GPIO_CLK(SWD_PIN(SWCLK_TCK), 0U)
+#define PIN_SWDIO_IN()                PIN_GPIO_IN(SWD_PIN(SWDIO_TMS))
+#define PIN_SWDIO_OUT(bit)            PIN_GPIO_OUT(SWD_PIN(SWDIO_TMS), bit)
+#define PIN_SWDIO_OUT_ENABLE()        PIN_GPIO_OUT_ENABLE(SWD_PIN(SWDIO_TMS))
+#define PIN_SWDIO_OUT_DISABLE()       PIN_GPIO_OUT_DISABLE(SWD_PIN(SWDIO_TMS))
 
 #define SW_CLOCK_CYCLE()                \
   PIN_SWCLK_CLR();                      \
@@ -126,6 +135,69 @@ void SWD_Sequence (uint32_t info, const uint8_t *swdo, uint8_t *swdi) {
 #endif
 
 
+// Generate SWD Idle Cycles (SWDIO low), e.g. to back off after WAIT
+//   cycles: number of idle cycles
+//   return: none
+#if (DAP_SWD != 0)
+static void SWD_Idle (uint32_t cycles) {
+  PIN_SWDIO_OUT(0U);
+  for (; cycles; cycles--) {
+    SW_CLOCK_CYCLE();
+  }
+  PIN_SWDIO_OUT(1U);
+}
+
+
+// Generate SWD Line Reset (at least 50 cycles SWDIO high, then 2 idle cycles)
+//   return: none
+static void SWD_LineReset (void) {
+  uint32_t n;
+
+  PIN_SWDIO_OUT(1U);
+  for (n = 51U; n; n--) {
+    SW_CLOCK_CYCLE();
+  }
+  SWD_Idle(2U);
+}
+
+
+// Write SWD multi-drop TARGETSEL register (not acknowledged by the targets)
+//   data:   TARGETSEL value
+//   return: none
+static void SWD_WriteTargetSel (uint32_t data) {
+  uint32_t parity;
+  uint32_t n;
+
+  /* Packet Request: DP write to TARGETSEL */
+  SW_WRITE_BIT(1U);                     /* Start Bit */
+  SW_WRITE_BIT(0U);                     /* APnDP Bit */
+  SW_WRITE_BIT(0U);                     /* RnW Bit */
+  SW_WRITE_BIT(1U);                     /* A2 Bit */
+  SW_WRITE_BIT(1U);                     /* A3 Bit */
+  SW_WRITE_BIT(0U);                     /* Parity Bit */
+  SW_WRITE_BIT(0U);                     /* Stop Bit */
+  SW_WRITE_BIT(1U);                     /* Park Bit */
+
+  /* Turnaround, ACK (not driven) and turnaround */
+  PIN_SWDIO_OUT_DISABLE();
+  for (n = (2U * DAP_Data.swd_conf.turnaround) + 3U; n; n--) {
+    SW_CLOCK_CYCLE();
+  }
+  PIN_SWDIO_OUT_ENABLE();
+
+  /* Write data */
+  parity = 0U;
+  for (n = 32U; n; n--) {
+    SW_WRITE_BIT(data);                 /* Write WDATA[0:31] */
+    parity += data;
+    data >>= 1;
+  }
+  SW_WRITE_BIT(parity);                 /* Write Parity Bit */
+  SWD_Idle(2U);
+}
+#endif
+
+
 #if (DAP_SWD != 0)
 
 
@@ -261,6 +333,10 @@ static uint8_t SWD_Transfer##speed (uint32_t request, uint32_t *data) {
 }
 
 
+// Pin map 0: constant pins
+#undef  SWD_PIN
+#define SWD_PIN(pin)  PIN_MAP0_##pin
+
 #undef  PIN_DELAY
 #define PIN_DELAY() PIN_DELAY_FAST()
 SWD_TransferFunction(Fast)
@@ -269,17 +345,183 @@ SWD_TransferFunction(Fast)
 #define PIN_DELAY() PIN_DELAY_SLOW(DAP_Data.clock_delay)
 SWD_TransferFunction(Slow)
 
+#if (PIN_MAP_COUNT > 1)
+// Pin map 1: constant pins
+#undef  SWD_PIN
+#define SWD_PIN(pin)  PIN_MAP1_##pin
+
+#undef  PIN_DELAY
+#define PIN_DELAY() PIN_DELAY_FAST()
+SWD_TransferFunction(Fast1)
+
+#undef  PIN_DELAY
+#define PIN_DELAY() PIN_DELAY_SLOW(DAP_Data.clock_delay)
+SWD_TransferFunction(Slow1)
+#endif
+
+#if (PIN_MAP_RUNTIME != 0)
+// Runtime pin map: pins read from RAM
+#undef  SWD_PIN
+#define SWD_PIN(pin)  PIN_MAPR_##pin
+
+#undef  PIN_DELAY
+#define PIN_DELAY() PIN_DELAY_FAST()
+SWD_TransferFunction(FastR)
+
+#undef  PIN_DELAY
+#define PIN_DELAY() PIN_DELAY_SLOW(DAP_Data.clock_delay)
+SWD_TransferFunction(SlowR)
+#endif
+
+#undef  SWD_PIN
+#define SWD_PIN(pin)  PIN_ACTIVE(pin)
+
+
+// Select the transfer function for the clock speed and pin map.
+#define SWD_TransferSelect(map)                 \
+  if (DAP_Data.fast_clock) {                    \
+    ack = SWD_TransferFast##map(request, data); \
+  } else {                                      \
+    ack = SWD_TransferSlow##map(request, data); \
+  }
+
+
+// SWD Transfer I/O using the active pin map
+//   request: A[3:2] RnW APnDP
+//   data:    DATA[31:0]
+//   return:  ACK[2:0]
+static uint8_t SWD_TransferMap(uint32_t request, uint32_t *data) {
+  uint8_t ack;
+
+  switch (PIN_MAP_INDEX) {
+#if (PIN_MAP_COUNT > 1)
+    case 1U:
+      SWD_TransferSelect(1)
+      break;
+#endif
+#if (PIN_MAP_RUNTIME != 0)
+    case PIN_MAP_RUNTIME_INDEX:
+      SWD_TransferSelect(R)
+      break;
+#endif
+    default:
+      SWD_TransferSelect()
+      break;
+  }
+  return (ack);
+}
+
+
+// SWD Reconnect after a line reset: select the multi-drop target and read DPIDR
+//   target: DAP index of the multi-drop target, SWD_TARGET_UNKNOWN for none
+//   return: ACK[2:0] of the DPIDR read
+static uint8_t SWD_Reconnect(uint32_t target) {
+  uint32_t val;
+
+  SWD_LineReset();
+  if (target != SWD_TARGET_UNKNOWN) {
+    SWD_WriteTargetSel(DAP_Data.swd_conf.targetsel[target]);
+  }
+  return (SWD_TransferMap(DAP_TRANSFER_RnW | DP_IDCODE, &val));
+}
+
 
 // SWD Transfer I/O
 //   request: A[3:2] RnW APnDP
 //   data:    DATA[31:0]
 //   return:  ACK[2:0]
 uint8_t  SWD_Transfer(uint32_t request, uint32_t *data) {
-  if (DAP_Data.fast_clock) {
-    return SWD_TransferFast(request, data);
-  } else {
-    return SWD_TransferSlow(request, data);
+  uint32_t state;
+  uint32_t bits;
+  uint32_t idle;
+  uint32_t retry;
+  uint32_t xfer;
+  uint8_t  ack;
+
+  /* Back off before retrying after WAIT */
+  idle = WAIT_BACKOFF_BEFORE(request);
+  if (idle != 0U) {
+    SWD_Idle(idle);
+  }
+
+  /* Request, ACK, data + parity, turnarounds and idle cycles */
+  bits = 8U + 3U + 33U + (2U * DAP_Data.swd_conf.turnaround) +
+         DAP_Data.transfer.idle_cycles;
+  xfer = request;
+  for (retry = 0U; ; retry++) {
+    state = TRANSFER_BEGIN(bits);
+    ack = SWD_TransferMap(xfer, data);
+    TRANSFER_END(state);
+    if ((ack == DAP_TRANSFER_OK) || (ack == DAP_TRANSFER_WAIT) || (ack == DAP_TRANSFER_FAULT)) {
+      CLOCK_FALLBACK_OK();
+      break;
+    }
+
+    /* Parity or protocol error, possibly at a lower clock from now on */
+    CLOCK_FALLBACK_ERROR(ack);
+    if (retry == CLOCK_FALLBACK_RETRIES) {
+      break;
+    }
+    if (ack == DAP_TRANSFER_ERROR) {
+      /* Read data parity error: an AP read must not be repeated, */
+      /* read its data again from DP RESEND instead */
+      if (xfer & DAP_TRANSFER_APnDP) {
+        xfer = (xfer & ~0x0FU) | DAP_TRANSFER_RnW | DP_RESEND;
+      }
+    } else {
+      /* Protocol error: the request may have reached an AP, or the */
+      /* last read data held by RESEND may be lost by the recovery */
+      if ((xfer & DAP_TRANSFER_APnDP) || (xfer != request)) {
+        break;
+      }
+      /* Recover with a line reset and DPIDR read, unless the target */
+      /* would be left deselected: a multi-drop target we did not */
+      /* select, or the host manages multi-drop with its own TARGETSEL */
+      if ((DAP_Data.swd_conf.target == SWD_TARGET_UNKNOWN) &&
+          ((DAP_Data.swd_conf.targets != 0U) ||
+           (DAP_Data.swd_conf.host_targetsel != 0U))) {
+        break;
+      }
+      if (SWD_Reconnect(DAP_Data.swd_conf.target) != DAP_TRANSFER_OK) {
+        SWD_TargetInvalidate();
+        break;
+      }
+    }
+  }
+  WAIT_BACKOFF_AFTER(request, data, ack, bits);
+  SELECT_TRACK(request, data, ack);
+  DAP_TRACE_ACK(ack);
+  return (ack);
+}
+
+
+// SWD Select Multi-drop Target
+// Selects the target configured for a DAP index with a line reset, a
+// TARGETSEL write and a DPIDR read. Nothing is done when the target is
+// already selected, or when no TARGETSEL value is configured for the index.
+//   index:  DAP index
+//   return: ACK[2:0] of the DPIDR read, DAP_TRANSFER_OK if nothing was done
+uint8_t SWD_SelectTarget (uint32_t index) {
+  uint8_t ack;
+
+  if ((index == DAP_Data.swd_conf.target) || (index >= DAP_SWD_TARGET_CNT) ||
+      ((DAP_Data.swd_conf.targets & (1U << index)) == 0U)) {
+    return (DAP_TRANSFER_OK);
   }
+
+  ack = SWD_Reconnect(index);
+  DAP_Data.swd_conf.target = (ack == DAP_TRANSFER_OK) ? (uint8_t)index : SWD_TARGET_UNKNOWN;
+  return (ack);
+}
+
+
+// SWD Invalidate Multi-drop Target
+// Called whenever the target selection may have been changed behind our
+// back (raw sequences, pin changes, reset), so that the next transfer to a
+// multi-drop target selects it again.
+//   return: none
+void SWD_TargetInvalidate (void) {
+  DAP_Data.swd_conf.target = SWD_TARGET_UNKNOWN;
 }
 
 
@@ -38,6 +38,8 @@
 
 //#include "cmsis_os2.h"    // BK
 #include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
 
 #define UART_RX_BLOCK_SIZE    32U   /* Uart Rx Block Size (must be 2^n) */
 
@@ -78,6 +80,13 @@ static volatile uint8_t  UartErrorParity = 0U;
 // UART Transmit
 static uint32_t UartTxNum = 0U;
 
+// The USART callback runs in a task of usart_esp32.c rather than in an
+// interrupt, possibly on the other core, so it is serialized with the
+// UART commands by a mutex.
+static SemaphoreHandle_t UartLock = NULL;
+#define UART_LOCK()     xSemaphoreTake(UartLock, portMAX_DELAY)
+#define UART_UNLOCK()   xSemaphoreGive(UartLock)
+
 // Function prototypes
 static uint8_t  UART_Init (void);
 static void     UART_Uninit (void);
@@ -95,6 +104,7 @@ static void     UART_Transmit (void);
 // USART Driver Callback function
 //   event: event mask
 static void USART_Callback (uint32_t event) {
+  UART_LOCK();
   if (event &  ARM_USART_EVENT_SEND_COMPLETE) {
     UartTxIndexO += UartTxNum;
     UartTransmitActive = 0U;
@@ -113,6 +123,7 @@ static void USART_Callback (uint32_t event) {
   if (event &  ARM_USART_EVENT_RX_PARITY_ERROR) {
     UartErrorParity = 1U;
   }
+  UART_UNLOCK();
 }
 
 // Init UART
@@ -121,6 +132,15 @@ static uint8_t UART_Init (void) {
   int32_t status;
   uint8_t ret = DAP_ERROR;
 
+  if (UartLock == NULL) {
+    UartLock = xSemaphoreCreateMutex();
+    if (UartLock == NULL) {
+      return (DAP_ERROR);
+    }
+  }
+
+  // A callback of the previous session may still be running
+  UART_LOCK();
   UartConfigured = 0U;
   UartReceiveEnabled = 0U;
   UartTransmitEnabled = 0U;
@@ -133,6 +153,7 @@ static uint8_t UART_Init (void) {
   UartRxIndexI = 0U;
   UartRxIndexO = 0U;
   UartTxNum = 0U;
+  UART_UNLOCK();
 
   status = pUSART->Initialize(USART_Callback);
   if (status == ARM_DRIVER_OK) {
@@ -318,9 +339,11 @@ uint32_t UART_Transport (const uint8_t *request, uint8_t *response) {
 #endif
           break;
         case DAP_UART_TRANSPORT_DAP_COMMAND:
+          UART_LOCK();
           UART_Receive_Disable();
           UART_Transmit_Disable();
           UART_Uninit();
+          UART_UNLOCK();
           UartTransport = DAP_UART_TRANSPORT_NONE;
           ret= DAP_OK;
           break;
@@ -340,9 +363,11 @@ uint32_t UART_Transport (const uint8_t *request, uint8_t *response) {
           ret = DAP_OK;
           break;
         case DAP_UART_TRANSPORT_DAP_COMMAND:
+          UART_LOCK();
           UART_Receive_Disable();
           UART_Transmit_Disable();
           UART_Uninit();
+          UART_UNLOCK();
           UartTransport = DAP_UART_TRANSPORT_NONE;
 #if (DAP_UART_USB_COM_PORT != 0)
           if (USB_COM_PORT_Activate(1U) == 0U) {
@@ -401,6 +426,7 @@ uint32_t UART_Configure (const uint8_t *request, uint8_t *response) {
              DAP_UART_CFG_ERROR_STOP_BITS;
     baudrate = 0U;  // baudrate error
   } else {
+    UART_LOCK();
 
     status   = 0U;
     control  = *request;
@@ -439,6 +465,7 @@ uint32_t UART_Configure (const uint8_t *request, uint8_t *response) {
           break;
       }
     }
+    UART_UNLOCK();
   }
 
   *response++ = status;
@@ -463,7 +490,8 @@ uint32_t UART_Control (const uint8_t *request, uint8_t *response) {
   if (UartTransport != DAP_UART_TRANSPORT_DAP_COMMAND) {
     ret = DAP_ERROR;
   } else {
- 
+    UART_LOCK();
+
     control = *request;
 
     if ((control & DAP_UART_CONTROL_RX_DISABLE) != 0U) {
@@ -501,6 +529,7 @@ uint32_t UART_Control (const uint8_t *request, uint8_t *response) {
     if ((control & DAP_UART_CONTROL_TX_BUF_FLUSH) != 0U) {
       UART_Transmit_Flush();
     }
+    UART_UNLOCK();
   }
 
   *response = ret;
@@ -523,6 +552,7 @@ uint32_t UART_Status (uint8_t *response) {
     tx_cnt = 0U;
     status = 0U;
   } else {
+    UART_LOCK();
 
     rx_cnt  = UartRxIndexI - UartRxIndexO;
     rx_cnt += pUSART->GetRxCount();
@@ -540,6 +570,7 @@ uint32_t UART_Status (uint8_t *response) {
     }
 
     status = UART_Get_Status();
+    UART_UNLOCK();
   }
 
   *response++ = status;
@@ -575,6 +606,7 @@ uint32_t UART_Transfer (const uint8_t *request, uint8_t *response) {
     rx_cnt = 0U;
     tx_cnt = 0U;
   } else {
+    UART_LOCK();
 
     // RX Data
     rx_cnt = ((uint32_t)(*(request+0) << 0)  |
@@ -638,6 +670,7 @@ uint32_t UART_Transfer (const uint8_t *request, uint8_t *response) {
     }
 
     status = UART_Get_Status();
+    UART_UNLOCK();
   }
 
   *response++ = status;
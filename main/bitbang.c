@@ -0,0 +1,126 @@
+/*
+ * SPDX-FileCopyrightText: Brian Kuschak <bkuschak@gmail.com>
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Timing control for the bit-banged SWD/JTAG transfers.
+ *
+ * With CONFIG_ESP_DAP_CRITICAL_SECTIONS, each transfer runs with interrupts
+ * masked on the current core, so WiFi and lwIP interrupts cannot stretch a
+ * SWCLK/TCK period in the middle of it. Transfers that would hold interrupts
+ * off longer than CONFIG_ESP_DAP_CRITICAL_MAX_US at the current clock rate
+ * (slow clocks, many idle cycles, long JTAG chains) run unmasked.
+ *
+ * With CONFIG_ESP_DAP_JITTER_HISTOGRAM, the length of every SWCLK/TCK
+ * half-period inside a transfer is measured with the CPU cycle counter and
+ * collected into a log2 histogram. Comparing the histogram with critical
+ * sections enabled and disabled shows what the masking buys.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include "freertos/FreeRTOS.h"
+#include "DAP_config.h"
+#include "DAP.h"
+#include "bitbang.h"
+
+#ifdef CONFIG_ESP_DAP_CRITICAL_SECTIONS
+#define CRITICAL_MAX_CYCLES \
+    ((uint64_t)CONFIG_ESP_DAP_CRITICAL_MAX_US * (CPU_CLOCK / 1000000U))
+
+static bool critical_enabled = true;
+static bool masked;
+static unsigned long count_masked;
+static unsigned long count_unmasked;
+#endif
+
+struct bitbang_jitter bitbang_jitter = {
+    .min = UINT32_MAX,
+};
+
+#ifdef CONFIG_ESP_DAP_CRITICAL_SECTIONS
+// CPU cycles needed to clock 'bits' bits at the current SWJ clock rate.
+static uint64_t transfer_cycles(uint32_t bits)
+{
+    uint32_t half_period = IO_PORT_WRITE_CYCLES;
+
+    if (!DAP_Data.fast_clock)
+        half_period += DAP_Data.clock_delay * DELAY_SLOW_CYCLES;
+    return (uint64_t)bits * 2 * half_period;
+}
+#endif
+
+uint32_t bitbang_transfer_begin(uint32_t bits)
+{
+#ifdef CONFIG_ESP_DAP_JITTER_HISTOGRAM
+    bitbang_jitter.state = BITBANG_JITTER_ARMED;
+#endif
+#ifdef CONFIG_ESP_DAP_CRITICAL_SECTIONS
+    if (critical_enabled && transfer_cycles(bits) <= CRITICAL_MAX_CYCLES) {
+        masked = true;
+        count_masked++;
+        return portSET_INTERRUPT_MASK_FROM_ISR();
+    }
+    count_unmasked++;
+#endif
+    return 0;
+}
+
+void bitbang_transfer_end(uint32_t state)
+{
+#ifdef CONFIG_ESP_DAP_JITTER_HISTOGRAM
+    bitbang_jitter.state = BITBANG_JITTER_IDLE;
+#endif
+#ifdef CONFIG_ESP_DAP_CRITICAL_SECTIONS
+    if (masked) {
+        masked = false;
+        portCLEAR_INTERRUPT_MASK_FROM_ISR(state);
+    }
+#endif
+}
+
+void bitbang_set_critical(bool enable)
+{
+#ifdef CONFIG_ESP_DAP_CRITICAL_SECTIONS
+    critical_enabled = enable;
+    count_masked = 0;
+    count_unmasked = 0;
+#endif
+}
+
+void bitbang_jitter_clear(void)
+{
+    memset(bitbang_jitter.hist, 0, sizeof(bitbang_jitter.hist));
+    bitbang_jitter.min = UINT32_MAX;
+    bitbang_jitter.max = 0;
+}
+
+void bitbang_print_status(void)
+{
+#ifdef CONFIG_ESP_DAP_CRITICAL_SECTIONS
+    printf("SWD/JTAG critical sections: %s, max %d us. Masked transfers: "
+            "%lu, unmasked: %lu.\n", critical_enabled ? "on" : "off",
+            CONFIG_ESP_DAP_CRITICAL_MAX_US, count_masked, count_unmasked);
+#endif
+#ifdef CONFIG_ESP_DAP_JITTER_HISTOGRAM
+    // Copy first, the DAP task keeps updating it while we print.
+    struct bitbang_jitter j = bitbang_jitter;
+
+    if (j.max == 0) {
+        printf("SWCLK/TCK half-period histogram: no data.\n");
+        return;
+    }
+    printf("SWCLK/TCK half-period histogram (CPU cycles at %d MHz):\n",
+            CPU_CLOCK / 1000000);
+    for (int i = 0; i < BITBANG_JITTER_BINS; i++) {
+        if (j.hist[i] == 0)
+            continue;
+        if (i == BITBANG_JITTER_BINS - 1)
+            printf("  %6lu -       : %"PRIu32"\n", 1UL << i, j.hist[i]);
+        else
+            printf("  %6lu - %6lu: %"PRIu32"\n", 1UL << i,
+                    (1UL << (i + 1)) - 1, j.hist[i]);
+    }
+    printf("  min %"PRIu32", max %"PRIu32" cycles.\n", j.min, j.max);
+#endif
+}
@@ -0,0 +1,70 @@
+#ifndef BITBANG_H
+#define BITBANG_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "sdkconfig.h"
+#include "esp_cpu.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Half-period histogram has log2 bins: bin n counts half-periods of
+// 2^n .. 2^(n+1)-1 CPU cycles. The last bin also counts anything longer.
+#define BITBANG_JITTER_BINS     16
+
+#define BITBANG_JITTER_IDLE     0   // Not inside a transfer.
+#define BITBANG_JITTER_ARMED    1   // Inside a transfer, no edge seen yet.
+#define BITBANG_JITTER_RUNNING  2   // Inside a transfer, 'last' is valid.
+
+struct bitbang_jitter {
+    uint32_t state;
+    uint32_t last;                  // Cycle count at the previous edge.
+    uint32_t min;
+    uint32_t max;
+    uint32_t hist[BITBANG_JITTER_BINS];
+};
+
+extern struct bitbang_jitter bitbang_jitter;
+
+// Called around every bit-banged SWD/JTAG transfer. 'bits' is the approximate
+// number of SWCLK/TCK cycles in the transfer. The value returned by
+// bitbang_transfer_begin() must be passed to bitbang_transfer_end().
+uint32_t bitbang_transfer_begin(uint32_t bits);
+void bitbang_transfer_end(uint32_t state);
+
+void bitbang_set_critical(bool enable);
+void bitbang_jitter_clear(void);
+void bitbang_print_status(void);
+
+// Record the time since the previous SWCLK/TCK edge of the current transfer.
+static inline void bitbang_jitter_edge(void)
+{
+#ifdef CONFIG_ESP_DAP_JITTER_HISTOGRAM
+    uint32_t now = esp_cpu_get_cycle_count();
+
+    if (bitbang_jitter.state == BITBANG_JITTER_RUNNING) {
+        uint32_t delta = now - bitbang_jitter.last;
+        uint32_t bin = 31 - __builtin_clz(delta | 1);
+        if (bin >= BITBANG_JITTER_BINS)
+            bin = BITBANG_JITTER_BINS - 1;
+        bitbang_jitter.hist[bin]++;
+        if (delta < bitbang_jitter.min)
+            bitbang_jitter.min = delta;
+        if (delta > bitbang_jitter.max)
+            bitbang_jitter.max = delta;
+    }
+    else if (bitbang_jitter.state == BITBANG_JITTER_IDLE) {
+        return;
+    }
+    bitbang_jitter.last = now;
+    bitbang_jitter.state = BITBANG_JITTER_RUNNING;
+#endif
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // BITBANG_H
@@ -0,0 +1,187 @@
+/*
+ * SPDX-FileCopyrightText: Brian Kuschak <bkuschak@gmail.com>
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Automatic SWCLK fallback after parity and protocol errors.
+ *
+ * With long or noisy wires, read data parity errors and invalid ACKs become
+ * more likely as the clock rate goes up. SWD_Transfer retries a failed
+ * transfer up to CONFIG_ESP_DAP_CLOCK_FALLBACK_RETRIES times. After
+ * CONFIG_ESP_DAP_CLOCK_FALLBACK_ERRORS consecutive errors, the clock is
+ * lowered by one step: from the fast delay to the shortest slow delay, then
+ * about half the clock rate per step, for at most
+ * CONFIG_ESP_DAP_CLOCK_FALLBACK_STEPS steps below the rate set by the host.
+ *
+ * After CONFIG_ESP_DAP_CLOCK_FALLBACK_CLEAN consecutive clean transfers the
+ * clock is raised again by one step. If errors return before the next clean
+ * run completes, the clean run needed for the next attempt is doubled, so
+ * that a marginal link settles at the fastest rate it can sustain.
+ *
+ * Without a target every ACK is invalid, and a lower clock would not help.
+ * So a protocol error only counts once the target gives a valid ACK again,
+ * which on a noisy link is usually the retry of the same transfer. A run of
+ * protocol errors longer than the attempts of one transfer means the target
+ * was gone, and does not count at all.
+ *
+ * Setting the clock with DAP_SWJ_Clock restores the requested rate.
+ */
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <inttypes.h>
+#include "DAP_config.h"
+#include "DAP.h"
+#include "clock_fallback.h"
+#include "dlog.h"
+
+#define ERRORS_TO_STEP      CONFIG_ESP_DAP_CLOCK_FALLBACK_ERRORS
+#define MAX_STEPS           CONFIG_ESP_DAP_CLOCK_FALLBACK_STEPS
+#define CLEAN_TO_PROBE      CONFIG_ESP_DAP_CLOCK_FALLBACK_CLEAN
+#define CLEAN_TO_PROBE_MAX  (CLEAN_TO_PROBE << 8)
+#define MAX_UNCONFIRMED     (CLOCK_FALLBACK_RETRIES + 1U)
+
+static struct {
+    uint8_t  nominal_fast;      // Clock set by the host.
+    uint32_t nominal_delay;
+    uint32_t step;              // Steps below the nominal clock.
+    uint32_t errors;            // Consecutive errors.
+    uint32_t unconfirmed;       // Protocol errors since the last valid ACK.
+    uint32_t clean;             // Consecutive clean transfers.
+    uint32_t clean_to_probe;    // Clean transfers before stepping up.
+    bool     probing;           // Stepped up, clean run not complete yet.
+
+    uint32_t parity_errors;
+    uint32_t protocol_errors;
+    uint32_t ignored_errors;    // Protocol errors while the target was gone.
+    uint32_t steps_down;
+    uint32_t steps_up;
+} fb = {
+    .clean_to_probe = CLEAN_TO_PROBE,
+};
+
+static uint32_t clock_khz(uint8_t fast, uint32_t delay)
+{
+    uint32_t cycles = IO_PORT_WRITE_CYCLES +
+            (fast ? DELAY_FAST_CYCLES : delay * DELAY_SLOW_CYCLES);
+
+    return CPU_CLOCK / 2U / cycles / 1000U;
+}
+
+static void apply_step(void)
+{
+    uint8_t fast = fb.nominal_fast;
+    uint32_t delay = fb.nominal_delay;
+
+    for (uint32_t i = 0; i < fb.step; i++) {
+        if (fast) {
+            fast = 0U;
+            delay = 1U;
+        }
+        else {
+            delay = (delay * 2U) + 1U;
+        }
+    }
+    DAP_Data.fast_clock = fast;
+    DAP_Data.clock_delay = delay;
+}
+
+static void step_down(bool parity)
+{
+    if (fb.step == 0) {
+        fb.nominal_fast = DAP_Data.fast_clock;
+        fb.nominal_delay = DAP_Data.clock_delay;
+    }
+    if (fb.probing) {
+        // The faster clock did not hold up. Wait longer before trying again.
+        fb.probing = false;
+        if (fb.clean_to_probe < CLEAN_TO_PROBE_MAX)
+            fb.clean_to_probe *= 2;
+    }
+    fb.step++;
+    fb.steps_down++;
+    apply_step();
+    DLOG_WARN(DLOG_DAP, "clock_fallback: repeated %s errors, SWCLK lowered "
+            "to %lu kHz.\n", parity ? "parity" : "protocol",
+            (unsigned long)clock_khz(DAP_Data.fast_clock,
+                DAP_Data.clock_delay));
+}
+
+static void step_up(void)
+{
+    fb.step--;
+    fb.steps_up++;
+    fb.probing = (fb.step != 0);
+    apply_step();
+    DLOG_INFO(DLOG_DAP, "clock_fallback: SWCLK raised to %lu kHz.\n",
+            (unsigned long)clock_khz(DAP_Data.fast_clock,
+                DAP_Data.clock_delay));
+}
+
+void clock_fallback_ok(void)
+{
+    if (fb.unconfirmed != 0) {
+        // The target is there, so the protocol errors were errors of the
+        // link.
+        if (fb.unconfirmed <= MAX_UNCONFIRMED) {
+            fb.protocol_errors += fb.unconfirmed;
+            fb.errors += fb.unconfirmed;
+        }
+        else {
+            fb.ignored_errors += fb.unconfirmed;
+        }
+        fb.unconfirmed = 0;
+        if (fb.errors >= ERRORS_TO_STEP && fb.step < MAX_STEPS) {
+            fb.errors = 0;
+            step_down(false);
+            return;
+        }
+    }
+
+    fb.errors = 0;
+    if (fb.step == 0)
+        return;
+
+    if (++fb.clean >= fb.clean_to_probe) {
+        fb.clean = 0;
+        step_up();
+    }
+}
+
+void clock_fallback_error(uint32_t ack)
+{
+    fb.clean = 0;
+    if (ack != DAP_TRANSFER_ERROR) {
+        // Counted by clock_fallback_ok(), if the target answers again.
+        fb.unconfirmed++;
+        return;
+    }
+
+    // A parity error follows a valid ACK.
+    fb.parity_errors++;
+    if (++fb.errors >= ERRORS_TO_STEP && fb.step < MAX_STEPS) {
+        fb.errors = 0;
+        step_down(true);
+    }
+}
+
+void clock_fallback_reset(void)
+{
+    fb.step = 0;
+    fb.errors = 0;
+    fb.unconfirmed = 0;
+    fb.clean = 0;
+    fb.clean_to_probe = CLEAN_TO_PROBE;
+    fb.probing = false;
+}
+
+void clock_fallback_print_status(void)
+{
+    printf("SWCLK fallback: %lu kHz, %lu steps below requested. Parity "
+            "errors: %lu, protocol errors: %lu (%lu more without a target), "
+            "steps down: %lu, up: %lu.\n",
+            (unsigned long)clock_khz(DAP_Data.fast_clock, DAP_Data.clock_delay),
+            (unsigned long)fb.step, (unsigned long)fb.parity_errors,
+            (unsigned long)fb.protocol_errors,
+            (unsigned long)(fb.ignored_errors + fb.unconfirmed),
+            (unsigned long)fb.steps_down, (unsigned long)fb.steps_up);
+}
@@ -0,0 +1,27 @@
+#ifndef CLOCK_FALLBACK_H
+#define CLOCK_FALLBACK_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Called by SWD_Transfer after a transfer without parity or protocol error.
+void clock_fallback_ok(void);
+
+// Called by SWD_Transfer after a parity error (DAP_TRANSFER_ERROR) or a
+// protocol error (invalid ACK). Lowers SWCLK after repeated errors. Protocol
+// errors only count once the target gives a valid ACK again.
+void clock_fallback_error(uint32_t ack);
+
+// Called when the host sets the SWJ clock.
+void clock_fallback_reset(void);
+
+void clock_fallback_print_status(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // CLOCK_FALLBACK_H
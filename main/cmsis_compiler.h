@@ -2,5 +2,6 @@
 #define CMSIS_COMPILER_H
 
 #define __STATIC_INLINE static inline
+#define __NO_RETURN     __attribute__((__noreturn__))
 
 #endif
@@ -17,8 +17,27 @@
 #include <netdb.h>
 #include <arpa/inet.h>
 
+#ifdef CONFIG_ESP_UART_BRIDGE_TIMESTAMPS
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "DAP_config.h"
+#endif
 #include "DAP.h"
 #include "cmsis_dap_tcp.h"
+#include "dap_yield.h"
+#ifdef CONFIG_ESP_DAP_TRACE
+#include "dap_trace.h"
+#endif
+
+#ifdef CMSIS_DAP_LOCK
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#endif
+
+#ifdef CONFIG_ESP_DAP_FETCH_STALL_COUNTER
+#include "xtensa_perfmon_access.h"
+#include "xtensa_perfmon_masks.h"
+#endif
 
 #if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
 #define le_to_h_u16(a)  (a)
@@ -80,6 +99,89 @@ static int client_port;
 static volatile bool client_connected;
 static const int listener_port = CONFIG_ESP_DAP_TCP_PORT;
 
+#ifdef CMSIS_DAP_LOCK
+// Held while a DAP command runs, so that DAP_HaltCore() or a pin map change
+// never happens in the middle of one.
+static SemaphoreHandle_t dap_lock;
+
+void cmsis_dap_lock_init(void)
+{
+    if(dap_lock == NULL)
+        dap_lock = xSemaphoreCreateMutex();
+}
+
+void cmsis_dap_lock(void)
+{
+    if(dap_lock != NULL)
+        xSemaphoreTake(dap_lock, portMAX_DELAY);
+}
+
+void cmsis_dap_unlock(void)
+{
+    if(dap_lock != NULL)
+        xSemaphoreGive(dap_lock);
+}
+#endif
+
+#ifdef CONFIG_ESP_UART_BRIDGE_TIMESTAMPS
+// TIMESTAMP_GET() is the cycle counter of the core running this task, and
+// the cores' counters are not in step, so the UART bridge cannot read it
+// itself. Sample it with esp_timer here, at most every CLOCK_SAMPLE_TICKS
+// while DAP commands run.
+#define CLOCK_SAMPLE_TICKS      (TIMESTAMP_CLOCK / 10)
+
+static portMUX_TYPE clock_mux = portMUX_INITIALIZER_UNLOCKED;
+static struct cmsis_dap_clock clock_sample;
+static uint32_t clock_seq;
+
+static void cmsis_dap_sample_clock(void)
+{
+    uint32_t ticks = TIMESTAMP_GET();
+    if (clock_seq != 0 && ticks - clock_sample.ticks < CLOCK_SAMPLE_TICKS)
+        return;
+
+    // Only this task writes the sample.
+    int64_t us = esp_timer_get_time();
+    ticks = TIMESTAMP_GET();
+    portENTER_CRITICAL(&clock_mux);
+    clock_sample.us = us;
+    clock_sample.ticks = ticks;
+    clock_sample.hz = TIMESTAMP_CLOCK;
+    if (++clock_seq == 0)
+        clock_seq = 1;
+    portEXIT_CRITICAL(&clock_mux);
+}
+
+uint32_t cmsis_dap_get_clock(struct cmsis_dap_clock *clock)
+{
+    portENTER_CRITICAL(&clock_mux);
+    *clock = clock_sample;
+    uint32_t seq = clock_seq;
+    portEXIT_CRITICAL(&clock_mux);
+    return seq;
+}
+#endif
+
+#ifdef CONFIG_ESP_DAP_FETCH_STALL_COUNTER
+// Performance counters are per core, so this only works because the task is
+// pinned. Counts the cycles the CPU spent waiting for instruction fetches
+// (flash cache misses) while executing DAP commands.
+#define FETCH_STALL_PERFMON_ID  0
+
+static uint64_t fetch_stall_cycles;
+static unsigned long fetch_stall_commands;
+static unsigned long total_commands;
+
+static void fetch_stall_init(void)
+{
+    xtensa_perfmon_stop();
+    xtensa_perfmon_init(FETCH_STALL_PERFMON_ID, XTPERF_CNT_I_STALL,
+            XTPERF_MASK_I_STALL_ICM | XTPERF_MASK_I_STALL_IUNC, 1, -1);
+    xtensa_perfmon_reset(FETCH_STALL_PERFMON_ID);
+    xtensa_perfmon_start();
+}
+#endif
+
 
 // ---------------------------------------------------------------------------
 // Use our own receive buffer to accumulate from the socket until a complete
@@ -101,7 +203,8 @@ static int msgbuf_add(struct msgbuf_t *buf, int sock)
     if (n < 0) {
         if (errno == EAGAIN || errno == EWOULDBLOCK)
             return 0;       // no new data
-        perror("cmsis_dap_tcp: socket read error");
+        DLOG_ERROR(DLOG_DAP, "cmsis_dap_tcp: socket read error: %s\n",
+                strerror(errno));
         return -1;
     }
     if (n == 0) {
@@ -127,14 +230,14 @@ static int msgbuf_parse(struct msgbuf_t *buf,
     tmp.length = le_to_h_u16(tmp.length);
 
     if (tmp.signature != DAP_PKT_HDR_SIGNATURE) {
-        fprintf(stderr, "cmsis_dap_tcp: Invalid header signature 0x%08lx\n",
-                tmp.signature);
+        DLOG_ERROR(DLOG_DAP, "cmsis_dap_tcp: Invalid header signature "
+                "0x%08lx\n", tmp.signature);
         return -EINVAL;
     }
 
     if (tmp.packet_type != DAP_PKT_TYPE_REQUEST) {
-        fprintf(stderr, "cmsis_dap_tcp: Unrecognized packet type 0x%02hx\n",
-                tmp.packet_type);
+        DLOG_ERROR(DLOG_DAP, "cmsis_dap_tcp: Unrecognized packet type "
+                "0x%02hx\n", tmp.packet_type);
         return -EINVAL;
     }
 
@@ -166,7 +269,8 @@ static int send_dap_response(int sock, const uint8_t *payload, uint16_t len)
 {
     if (len > DAP_PKT_SIZE) {
         errno = EMSGSIZE;
-        perror("cmsis_dap_tcp: response too large for buffer");
+        DLOG_ERROR(DLOG_DAP, "cmsis_dap_tcp: response too large for "
+                "buffer: %s\n", strerror(errno));
         return -1;
     }
 
@@ -189,12 +293,13 @@ static int send_dap_response(int sock, const uint8_t *payload, uint16_t len)
                 continue;   // retry
             }
             else if (errno == EAGAIN || errno == EWOULDBLOCK) {
-                perror("cmsis_dap_tcp: socket write would block, dropping "
-                        "client");
+                DLOG_ERROR(DLOG_DAP, "cmsis_dap_tcp: socket write would block, "
+                        "dropping client: %s\n", strerror(errno));
                 return -1;
             }
             else {
-                perror("cmsis_dap_tcp: socket write error");
+                DLOG_ERROR(DLOG_DAP, "cmsis_dap_tcp: socket write error: "
+                        "%s\n", strerror(errno));
                 return -1;
             }
         }
@@ -209,7 +314,35 @@ static int process_dap_request(int sock, const uint8_t *request, uint16_t len)
     // DAP_ProcessCommand returns:
     //   number of bytes in response (lower 16 bits)
     //   number of bytes in request (upper 16 bits)
+#ifdef CONFIG_ESP_DAP_YIELD
+    dap_yield_begin();
+#endif
+#ifdef CMSIS_DAP_LOCK
+    cmsis_dap_lock();
+#endif
+#ifdef CONFIG_ESP_UART_BRIDGE_TIMESTAMPS
+    cmsis_dap_sample_clock();
+#endif
+#ifdef CONFIG_ESP_DAP_TRACE
+    dap_trace_begin();
+#endif
+#ifdef CONFIG_ESP_DAP_FETCH_STALL_COUNTER
+    uint32_t stalls = xtensa_perfmon_value(FETCH_STALL_PERFMON_ID);
     int ret = DAP_ProcessCommand(request, response);
+    stalls = xtensa_perfmon_value(FETCH_STALL_PERFMON_ID) - stalls;
+    fetch_stall_cycles += stalls;
+    if (stalls)
+        fetch_stall_commands++;
+    total_commands++;
+#else
+    int ret = DAP_ProcessCommand(request, response);
+#endif
+#ifdef CONFIG_ESP_DAP_TRACE
+    dap_trace_end(request, ret);
+#endif
+#ifdef CMSIS_DAP_LOCK
+    cmsis_dap_unlock();
+#endif
     int request_len __attribute__((unused)) = (ret>>16) & 0xFFFF;
     int response_len = ret & 0xFFFF;
     LOG_DEBUG("processed command. Request len: %d, response len: %d.",
@@ -241,8 +374,8 @@ static void set_keepalives(int fd)
     val = CONFIG_ESP_DAP_TCP_KEEPALIVE_TIMEOUT;
     setsockopt(fd, IPPROTO_TCP, TCP_KEEPCNT, &val, sizeof(val));
 
-    LOG_DEBUG("cmsis_dap_tcp: Using TCP keepalives with %d second "
-            "timeout.", CONFIG_ESP_UART_BRIDGE_KEEPALIVE_TIMEOUT);
+    LOG_DEBUG("Using TCP keepalives with %d second timeout.",
+            CONFIG_ESP_DAP_TCP_KEEPALIVE_TIMEOUT);
 #endif
 }
 
@@ -255,6 +388,11 @@ void cmsis_dap_print_status(void)
     else {
         printf("cmsis_dap_tcp: listening on port %d.\n", listener_port);
     }
+#ifdef CONFIG_ESP_DAP_FETCH_STALL_COUNTER
+    printf("cmsis_dap_tcp: %llu instruction fetch stall cycles in %lu of %lu "
+            "commands.\n", fetch_stall_cycles, fetch_stall_commands,
+            total_commands);
+#endif
 }
 
 void cmsis_dap_tcp_task(void *arg __attribute__((unused)))
@@ -271,7 +409,8 @@ void cmsis_dap_tcp_task(void *arg __attribute__((unused)))
 
     listener_fd = socket(AF_INET6, SOCK_STREAM, 0);
     if(listener_fd < 0) {
-        perror("cmsis_dap_tcp: Failed to create listening socket.");
+        DLOG_ERROR(DLOG_DAP, "cmsis_dap_tcp: Failed to create listening "
+                "socket: %s\n", strerror(errno));
         vTaskDelete(NULL);
         return;
     }
@@ -279,7 +418,8 @@ void cmsis_dap_tcp_task(void *arg __attribute__((unused)))
     int no = 0;
     if (setsockopt(listener_fd, IPPROTO_IPV6, IPV6_V6ONLY, &no, sizeof(no)) <
             0) {
-        perror("cmsis_dap_tcp: failed to disable IPV6_V6ONLY for socket");
+        DLOG_ERROR(DLOG_DAP, "cmsis_dap_tcp: failed to disable IPV6_V6ONLY "
+                "for socket: %s\n", strerror(errno));
     }
     LOG_DEBUG("Listening on IPv4/IPv6 socket.");
 #else
@@ -291,7 +431,8 @@ void cmsis_dap_tcp_task(void *arg __attribute__((unused)))
 
     listener_fd = socket(AF_INET, SOCK_STREAM, 0);
     if(listener_fd < 0) {
-        perror("cmsis_dap_tcp: Failed to create listening socket.");
+        DLOG_ERROR(DLOG_DAP, "cmsis_dap_tcp: Failed to create listening "
+                "socket: %s\n", strerror(errno));
         vTaskDelete(NULL);
         return;
     }
@@ -302,26 +443,33 @@ void cmsis_dap_tcp_task(void *arg __attribute__((unused)))
     setsockopt(listener_fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
 
     if (bind(listener_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
-        perror("cmsis_dap_tcp: failed to bind socket");
+        DLOG_ERROR(DLOG_DAP, "cmsis_dap_tcp: failed to bind socket: %s\n",
+                strerror(errno));
         close(listener_fd);
         vTaskDelete(NULL);
         return;
     }
 
     if(listen(listener_fd, 1) < 0) {
-        perror("cmsis_dap_tcp: failed to listen on socket");
+        DLOG_ERROR(DLOG_DAP, "cmsis_dap_tcp: failed to listen on socket: "
+                "%s\n", strerror(errno));
         close(listener_fd);
         vTaskDelete(NULL);
         return;
     }
 
     set_nonblocking(listener_fd);
-    fprintf(stdout, "cmsis_dap_tcp: maximum packet size is %d bytes.\n",
+    DLOG_INFO(DLOG_DAP, "cmsis_dap_tcp: maximum packet size is %d bytes.\n",
             DAP_PKT_SIZE);
-    fprintf(stdout, "cmsis_dap_tcp: listening on port %d.\n", listener_port);
+    DLOG_INFO(DLOG_DAP, "cmsis_dap_tcp: listening on port %d.\n",
+            listener_port);
 
     msgbuf_init(&buf);
 
+#ifdef CONFIG_ESP_DAP_FETCH_STALL_COUNTER
+    fetch_stall_init();
+#endif
+
     // Only one active client at a time is allowed.
     int client_fd = -1;
     int run __attribute__((unused)) = 0;
@@ -342,7 +490,8 @@ void cmsis_dap_tcp_task(void *arg __attribute__((unused)))
         if (sel < 0) {
             if (errno == EINTR)
                 continue;
-            perror("cmsis_dap_tcp: select error");
+            DLOG_ERROR(DLOG_DAP, "cmsis_dap_tcp: select error: %s\n",
+                    strerror(errno));
             break;
         }
 
@@ -355,13 +504,15 @@ void cmsis_dap_tcp_task(void *arg __attribute__((unused)))
             if(new_fd < 0) {
                 if(errno != EAGAIN && errno != EWOULDBLOCK) {
                     // Just ignore error for now.
-                    perror("cmsis_dap_tcp: accept error");
+                    DLOG_ERROR(DLOG_DAP, "cmsis_dap_tcp: accept error: "
+                            "%s\n", strerror(errno));
                 }
             }
             else {
                 if (client_fd >= 0) {
-                    fprintf(stderr, "cmsis_dap_tcp: dropping new connection. "
-                            "Another client is already connected.\n");
+                    DLOG_WARN(DLOG_DAP, "cmsis_dap_tcp: dropping new "
+                            "connection. Another client is already "
+                            "connected.\n");
                     close(new_fd);
                     continue;   // restart select() loop
                 }
@@ -384,7 +535,7 @@ void cmsis_dap_tcp_task(void *arg __attribute__((unused)))
                     client_port = ntohs(s->sin6_port);
                 }
 #endif
-                fprintf(stdout, "cmsis_dap_tcp: client connected %s:%d\n",
+                DLOG_INFO(DLOG_DAP, "cmsis_dap_tcp: client connected %s:%d\n",
                         client_ip_str, client_port);
                 fcntl(new_fd, F_SETFL, O_NONBLOCK);
                 set_keepalives(new_fd);
@@ -399,7 +550,8 @@ void cmsis_dap_tcp_task(void *arg __attribute__((unused)))
         if (client_fd >= 0 && FD_ISSET(client_fd, &read_fds)) {
             if (msgbuf_add(&buf, client_fd) < 0) {
                 if(errno != ENOSPC) {
-                    fprintf(stdout, "cmsis_dap_tcp: client disconnected.\n");
+                    DLOG_INFO(DLOG_DAP, "cmsis_dap_tcp: client "
+                            "disconnected.\n");
                     close(client_fd);
                     client_fd = -1;
                     client_connected = false;
@@ -425,7 +577,7 @@ void cmsis_dap_tcp_task(void *arg __attribute__((unused)))
                 // If we cannot process the request and response, just close
                 // the connection.
                 if(ret < 0) {
-                    fprintf(stdout, "cmsis_dap_tcp: disconnecting.\n");
+                    DLOG_INFO(DLOG_DAP, "cmsis_dap_tcp: disconnecting.\n");
                     close(client_fd);
                     client_fd = -1;
                     client_connected = false;
@@ -436,7 +588,7 @@ void cmsis_dap_tcp_task(void *arg __attribute__((unused)))
         }
     }
 
-    fprintf(stdout, "cmsis_dap_tcp: shutting down.\n");
+    DLOG_INFO(DLOG_DAP, "cmsis_dap_tcp: shutting down.\n");
     client_connected = false;
 
     if (client_fd >= 0) close(client_fd);
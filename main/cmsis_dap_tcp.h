@@ -1,29 +1,46 @@
 #ifndef CMSIS_DAP_TCP_H
 #define CMSIS_DAP_TCP_H
 
+#include <stdint.h>
+#include "sdkconfig.h"
+#include "dlog.h"
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
-//#define DEBUG_PRINTING
-
-#ifdef DEBUG_PRINTING
-#define LOG_DEBUG(...) \
-{ \
-    fprintf(stderr, "cmsis_dap_tcp: "); \
-    fprintf(stderr, ##__VA_ARGS__); \
-    fprintf(stderr, "\n"); \
-}
-
-#else
-#define LOG_DEBUG(...) { }
-#endif
+// Enabled at runtime with 'log dap debug'.
+#define LOG_DEBUG(fmt, ...) \
+    DLOG_DEBUG(DLOG_DAP, "cmsis_dap_tcp: " fmt "\n", ##__VA_ARGS__)
 
 // Task that runs the TCP server and processes requests and responses.
 void cmsis_dap_tcp_task(void* arg);
 
 void cmsis_dap_print_status(void);
 
+// Keep DAP commands from running while the caller uses the DAP engine, e.g.
+// DAP_HaltCore(), or changes its pins. cmsis_dap_lock_init() must be called
+// before the task is started.
+#if defined(CONFIG_ESP_UART_BRIDGE_TRIGGER) || \
+    (CONFIG_ESP_DAP_PIN_MAP_COUNT > 1) || defined(CONFIG_ESP_DAP_PIN_MAP_RUNTIME)
+#define CMSIS_DAP_LOCK
+#endif
+void cmsis_dap_lock_init(void);
+void cmsis_dap_lock(void);
+void cmsis_dap_unlock(void);
+
+// An esp_timer time and the TIMESTAMP_GET() value of the same instant, as
+// used by the DAP commands.
+struct cmsis_dap_clock {
+    int64_t us;
+    uint32_t ticks;
+    uint32_t hz;                // TIMESTAMP_CLOCK.
+};
+
+// Copy the latest sample taken by the CMSIS-DAP task. Returns its sequence
+// number, which changes with each sample, or 0 before the first one.
+uint32_t cmsis_dap_get_clock(struct cmsis_dap_clock *clock);
+
 #ifdef __cplusplus
 }
 #endif
@@ -1,159 +1,384 @@
 /*
  * SPDX-FileCopyrightText: Brian Kuschak <bkuschak@gmail.com>
- * SPDX-FileCopyrightText: 2010-2022 Espressif Systems (Shanghai) CO LTD
  * SPDX-License-Identifier: Apache-2.0
  *
- * Optional: for debugging, show CPU usage for each task.
+ * Optional: for debugging, sample the CPU usage of each task.
  *
  * Requires:
  *     CONFIG_FREERTOS_USE_TRACE_FACILITY=y
  *     CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS=y
- *     CONFIG_FREERTOS_RUN_TIME_COUNTER_TYPE_U64=y
  *
- * Adapted from:
- *     esp-idf/examples/system/freertos/real_time_stats
+ * Once a second, uxTaskGetSystemState() fills a static snapshot of up to
+ * CONFIG_ESP_CPU_USAGE_MAX_TASKS tasks. Each task is looked up by its handle
+ * in a hash table, which keeps its run time at the previous sample, its
+ * stack high water mark and its usage over the last
+ * CONFIG_ESP_CPU_USAGE_HISTORY samples. The usage of a core is that of its
+ * idle task, subtracted from 100%. Usage is in percent of one core, like
+ * top. Nothing is allocated.
+ *
+ * Sampling itself perturbs what it measures, so it only runs on demand: the
+ * 'top' console command and vendor command 0x83 start it, and it stops when
+ * neither has been used for CONFIG_ESP_CPU_USAGE_HISTORY samples. Until then
+ * the task waits for a notification and costs nothing.
  */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <inttypes.h>
 #include "sdkconfig.h"
 #include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
 #include "freertos/task.h"
+#include "DAP.h"
+#include "cpu_usage.h"
 
+#define MAX_TASKS           CONFIG_ESP_CPU_USAGE_MAX_TASKS
+#define HISTORY             CONFIG_ESP_CPU_USAGE_HISTORY
+#define NUM_CORES           CONFIG_FREERTOS_NUMBER_OF_CORES
+#define HASH_SIZE           (2 * MAX_TASKS)
+#define SAMPLE_TICKS        pdMS_TO_TICKS(1000)
 
-/* Real time CPU usage display taken from:
- * https://github.com/espressif/esp-idf/blob/master/examples/system/freertos/real_time_stats/main/real_time_stats_example_main.c
- */
-#define STATS_TICKS         pdMS_TO_TICKS(1000)
+struct task_entry {
+    TaskHandle_t handle;            // NULL if free.
+    char name[configMAX_TASK_NAME_LEN];
+    configRUN_TIME_COUNTER_TYPE run_time;   // At the last sample.
+    uint32_t stack_free;            // High water mark.
+    uint32_t seen;                  // Last sample it was found in.
+    uint32_t first;                 // First sample with a usage.
+    uint8_t usage[HISTORY];         // Percent of one core, per sample.
+};
 
-// Increase this if print_real_time_stats returns ESP_ERR_INVALID_SIZE
-#define ARRAY_SIZE_OFFSET   5
+// Usage of a task or core over the history.
+struct usage {
+    uint8_t now;
+    uint8_t avg;
+    uint8_t max;
+};
 
-/**
- *
- * @brief   Function to print the CPU usage of tasks over a given duration.
- *
- * This function will measure and print the CPU usage of tasks over a specified
- * number of ticks (i.e. real time stats). This is implemented by simply
- * calling uxTaskGetSystemState() twice separated by a delay, then calculating
- * the differences of task run times before and after the delay.
- *
- * @note    If any tasks are added or removed during the delay, the stats of
- *          those tasks will not be printed.
- * @note    This function should be called from a high priority task to
- *          minimize inaccuracies with delays.
- * @note    When running in dual core mode, each core will correspond to 50% of
- *          the run time.
- *
- * @param   xTicksToWait    Period of stats measurement
- *
- * @return
- *  - ESP_OK                Success
- *  - ESP_ERR_NO_MEM        Insufficient memory to allocated internal arrays
- *  - ESP_ERR_INVALID_SIZE  Insufficient array size for uxTaskGetSystemState.
- *                          Trying increasing ARRAY_SIZE_OFFSET
- *  - ESP_ERR_INVALID_STATE Delay duration too short
- */
-static esp_err_t print_real_time_stats(TickType_t xTicksToWait)
+struct row {
+    char name[configMAX_TASK_NAME_LEN];
+    struct usage usage;
+    uint32_t stack_free;
+};
+
+static TaskStatus_t snapshot[MAX_TASKS];
+static struct task_entry tasks[MAX_TASKS];
+static uint8_t hash_table[HASH_SIZE];   // Index in tasks + 1, or 0.
+static uint8_t core_usage[NUM_CORES][HISTORY];
+static struct row rows[MAX_TASKS];      // For cpu_usage_print().
+
+static SemaphoreHandle_t lock;          // Protects the above.
+static TaskHandle_t sampler;
+static configRUN_TIME_COUNTER_TYPE last_total;
+static uint32_t samples;                // Taken since boot.
+static uint32_t last_query;             // Value of samples then.
+static uint32_t count_overflows;        // Samples with too many tasks.
+static bool running;
+
+static unsigned cpu_usage_hash(TaskHandle_t handle)
 {
-    TaskStatus_t *start_array = NULL, *end_array = NULL;
-    UBaseType_t start_array_size, end_array_size;
-    configRUN_TIME_COUNTER_TYPE start_run_time, end_run_time;
-    esp_err_t ret;
-
-    // Allocate array to store current task states
-    start_array_size = uxTaskGetNumberOfTasks() + ARRAY_SIZE_OFFSET;
-    start_array = malloc(sizeof(TaskStatus_t) * start_array_size);
-    if (start_array == NULL) {
-        ret = ESP_ERR_NO_MEM;
-        goto exit;
-    }
-    // Get current task states
-    start_array_size = uxTaskGetSystemState(start_array, start_array_size,
-            &start_run_time);
-    if (start_array_size == 0) {
-        ret = ESP_ERR_INVALID_SIZE;
-        goto exit;
-    }
-
-    vTaskDelay(xTicksToWait);
-
-    // Allocate array to store tasks states post delay
-    end_array_size = uxTaskGetNumberOfTasks() + ARRAY_SIZE_OFFSET;
-    end_array = malloc(sizeof(TaskStatus_t) * end_array_size);
-    if (end_array == NULL) {
-        ret = ESP_ERR_NO_MEM;
-        goto exit;
-    }
-    // Get post delay task states
-    end_array_size = uxTaskGetSystemState(end_array, end_array_size,
-            &end_run_time);
-    if (end_array_size == 0) {
-        ret = ESP_ERR_INVALID_SIZE;
-        goto exit;
-    }
-
-    // Calculate total_elapsed_time in units of run time stats clock period.
-    uint32_t total_elapsed_time = (end_run_time - start_run_time);
-    if (total_elapsed_time == 0) {
-        ret = ESP_ERR_INVALID_STATE;
-        goto exit;
-    }
-
-    printf("| TASK             | RUN TIME | PERCENTAGE\n");
-    // Match each task in start_array to those in the end_array
-    for (int i = 0; i < start_array_size; i++) {
-        int k = -1;
-        for (int j = 0; j < end_array_size; j++) {
-            if (start_array[i].xHandle == end_array[j].xHandle) {
-                k = j;
-                // Mark that task have been matched by overwriting their
-                // handles
-                start_array[i].xHandle = NULL;
-                end_array[j].xHandle = NULL;
-                break;
-            }
+    // TCBs are word aligned.
+    return ((uintptr_t)handle >> 2) % HASH_SIZE;
+}
+
+// Find the entry of a task, or add it if 'add' is set. NULL if not found, or
+// if the table is full.
+static struct task_entry *cpu_usage_find(TaskHandle_t handle, bool add)
+{
+    unsigned h = cpu_usage_hash(handle);
+    for(int i = 0; i < HASH_SIZE; i++, h = (h + 1) % HASH_SIZE) {
+        if(hash_table[h] == 0)
+            break;
+        struct task_entry *t = &tasks[hash_table[h] - 1];
+        if(t->handle == handle)
+            return t;
+    }
+    if(!add)
+        return NULL;
+
+    for(int i = 0; i < MAX_TASKS; i++) {
+        if(tasks[i].handle == NULL) {
+            // There is always an empty slot at 'h': the table is twice the
+            // number of entries.
+            hash_table[h] = i + 1;
+            tasks[i].handle = handle;
+            return &tasks[i];
         }
-        // Check if matching task found
-        if (k >= 0) {
-            uint32_t task_elapsed_time = end_array[k].ulRunTimeCounter -
-                start_array[i].ulRunTimeCounter;
-            uint32_t percentage_time = (task_elapsed_time * 100UL) /
-                (total_elapsed_time * CONFIG_FREERTOS_NUMBER_OF_CORES);
-            printf("| %-16s | %8"PRIu32" | %3"PRIu32"%%\n",
-                    start_array[i].pcTaskName, task_elapsed_time,
-                    percentage_time);
+    }
+    return NULL;
+}
+
+// Forget the tasks that were deleted, and rebuild the hash table.
+static void cpu_usage_remove_deleted(void)
+{
+    memset(hash_table, 0, sizeof(hash_table));
+    for(int i = 0; i < MAX_TASKS; i++) {
+        struct task_entry *t = &tasks[i];
+        if(t->handle == NULL)
+            continue;
+        if(t->seen != samples) {
+            t->handle = NULL;
+            continue;
         }
+        unsigned h = cpu_usage_hash(t->handle);
+        while(hash_table[h] != 0)
+            h = (h + 1) % HASH_SIZE;
+        hash_table[h] = i + 1;
+    }
+}
+
+// Take a snapshot and compute the usage since the last one. The first one
+// after sampling starts only records the run times.
+static void cpu_usage_sample(bool record)
+{
+    configRUN_TIME_COUNTER_TYPE total;
+    UBaseType_t n = uxTaskGetSystemState(snapshot, MAX_TASKS, &total);
+    if(n == 0) {
+        count_overflows++;
+        return;
     }
+    configRUN_TIME_COUNTER_TYPE elapsed = total - last_total;
+    last_total = total;
+    if(elapsed == 0)
+        record = false;
 
-    // Print unmatched tasks
-    for (int i = 0; i < start_array_size; i++) {
-        if (start_array[i].xHandle != NULL) {
-            printf("| %-16s | Deleted\n", start_array[i].pcTaskName);
+    xSemaphoreTake(lock, portMAX_DELAY);
+    unsigned slot = samples % HISTORY;
+    bool deleted = false;
+    for(UBaseType_t i = 0; i < n; i++) {
+        const TaskStatus_t *s = &snapshot[i];
+        struct task_entry *t = cpu_usage_find(s->xHandle, false);
+        configRUN_TIME_COUNTER_TYPE run_time = 0;
+        if(t == NULL) {
+            // A new task has run for its whole run time since the last
+            // sample. If deleted tasks still fill the table, it is added
+            // by the next sample.
+            if((t = cpu_usage_find(s->xHandle, true)) == NULL)
+                continue;
+            strlcpy(t->name, s->pcTaskName, sizeof(t->name));
+            memset(t->usage, 0, sizeof(t->usage));
+            t->first = samples;
         }
+        else {
+            run_time = t->run_time;
+        }
+
+        if(record) {
+            uint64_t percent = (uint64_t)(s->ulRunTimeCounter - run_time) *
+                100 / elapsed;
+            t->usage[slot] = percent > 100 ? 100 : percent;
+        }
+        t->run_time = s->ulRunTimeCounter;
+        t->stack_free = s->usStackHighWaterMark;
+        t->seen = samples;
+    }
+
+    for(int c = 0; record && c < NUM_CORES; c++) {
+        struct task_entry *idle = cpu_usage_find(
+                xTaskGetIdleTaskHandleForCore(c), false);
+        core_usage[c][slot] = idle ? 100 - idle->usage[slot] : 0;
+    }
+
+    for(int i = 0; i < MAX_TASKS; i++) {
+        if(tasks[i].handle != NULL && tasks[i].seen != samples)
+            deleted = true;
+    }
+    if(deleted)
+        cpu_usage_remove_deleted();
+    if(record)
+        samples++;
+    else {
+        // The next sample has the same number, so tasks deleted before it
+        // would look seen.
+        for(int i = 0; i < MAX_TASKS; i++)
+            tasks[i].seen = samples - 1;
+    }
+    xSemaphoreGive(lock);
+}
+
+// Usage over the last 'count' samples of 'history'.
+static struct usage cpu_usage_summary(const uint8_t *history, uint32_t count)
+{
+    struct usage u = { 0 };
+    if(count > HISTORY)
+        count = HISTORY;
+    if(count == 0)
+        return u;
+
+    unsigned sum = 0;
+    for(uint32_t i = 0; i < count; i++) {
+        uint8_t p = history[(samples - 1 - i) % HISTORY];
+        sum += p;
+        if(p > u.max)
+            u.max = p;
     }
-    for (int i = 0; i < end_array_size; i++) {
-        if (end_array[i].xHandle != NULL) {
-            printf("| %-16s | Created\n", end_array[i].pcTaskName);
+    u.now = history[(samples - 1) % HISTORY];
+    u.avg = sum / count;
+    return u;
+}
+
+static struct usage cpu_usage_task_summary(const struct task_entry *t)
+{
+    return cpu_usage_summary(t->usage, samples - t->first);
+}
+
+void cpu_usage_query(void)
+{
+    last_query = samples;
+    if(!running) {
+        running = true;
+        if(sampler != NULL)
+            xTaskNotifyGive(sampler);
+    }
+}
+
+void cpu_usage_stop(void)
+{
+    running = false;
+}
+
+static int cpu_usage_compare(const void *a, const void *b)
+{
+    const struct row *ra = a, *rb = b;
+    if(ra->usage.now != rb->usage.now)
+        return rb->usage.now - ra->usage.now;
+    return rb->usage.avg - ra->usage.avg;
+}
+
+void cpu_usage_print(void)
+{
+    if(lock == NULL) {
+        printf("cpu_usage: not started.\n");
+        return;
+    }
+
+    // Copy the rows, so the lock is not held while printing.
+    int n = 0;
+    struct usage cores[NUM_CORES];
+    xSemaphoreTake(lock, portMAX_DELAY);
+    uint32_t count = samples;
+    for(int c = 0; c < NUM_CORES; c++)
+        cores[c] = cpu_usage_summary(core_usage[c], count);
+    for(int i = 0; i < MAX_TASKS; i++) {
+        const struct task_entry *t = &tasks[i];
+        if(t->handle == NULL)
+            continue;
+        memcpy(rows[n].name, t->name, sizeof(rows[n].name));
+        rows[n].usage = cpu_usage_task_summary(t);
+        rows[n].stack_free = t->stack_free;
+        n++;
+    }
+    xSemaphoreGive(lock);
+
+    cpu_usage_print_status();
+    if(count == 0)
+        return;
+    printf("| CORE | NOW  | AVG  | MAX\n");
+    for(int c = 0; c < NUM_CORES; c++) {
+        printf("| %4d | %3u%% | %3u%% | %3u%%\n", c, cores[c].now,
+                cores[c].avg, cores[c].max);
+    }
+    qsort(rows, n, sizeof(rows[0]), cpu_usage_compare);
+    printf("| TASK             | NOW  | AVG  | MAX  | STACK FREE\n");
+    for(int i = 0; i < n; i++) {
+        printf("| %-16s | %3u%% | %3u%% | %3u%% | %" PRIu32 "\n",
+                rows[i].name, rows[i].usage.now, rows[i].usage.avg,
+                rows[i].usage.max, rows[i].stack_free);
+    }
+}
+
+void cpu_usage_print_status(void)
+{
+    uint32_t count = samples < HISTORY ? samples : HISTORY;
+    printf("cpu_usage: %s, history of %" PRIu32 " samples of 1 s",
+            running ? "sampling" : "stopped", count);
+    if(count_overflows != 0) {
+        printf(", %" PRIu32 " samples lost, over %d tasks", count_overflows,
+                MAX_TASKS);
+    }
+    printf(".\n");
+}
+
+uint32_t cpu_usage_vendor(const uint8_t *request, uint8_t *response,
+        uint32_t max)
+{
+    uint32_t first = *request;
+    uint8_t *p = response;
+    uint8_t *end = response + max;
+
+    cpu_usage_query();
+    if(lock == NULL || max < 4U + 3U * NUM_CORES) {
+        *p++ = DAP_ERROR;
+        return (1U << 16) | 1U;
+    }
+
+    xSemaphoreTake(lock, portMAX_DELAY);
+    *p++ = DAP_OK;
+    *p++ = NUM_CORES;
+    for(int c = 0; c < NUM_CORES; c++) {
+        struct usage u = cpu_usage_summary(core_usage[c], samples);
+        *p++ = u.now;
+        *p++ = u.avg;
+        *p++ = u.max;
+    }
+    uint8_t *total = p++;
+    uint8_t *count = p++;
+    bool full = false;
+    *total = 0;
+    *count = 0;
+    for(int i = 0; i < MAX_TASKS; i++) {
+        const struct task_entry *t = &tasks[i];
+        if(t->handle == NULL)
+            continue;
+        // Tasks after the first that does not fit are only counted, so the
+        // host gets a contiguous range and asks again from its end.
+        if((*total)++ < first || full)
+            continue;
+        size_t len = strnlen(t->name, sizeof(t->name));
+        if(p + 6 + len > end) {
+            full = true;
+            continue;
         }
+        struct usage u = cpu_usage_task_summary(t);
+        uint16_t stack_free = t->stack_free > UINT16_MAX ? UINT16_MAX :
+            t->stack_free;
+        *p++ = u.now;
+        *p++ = u.avg;
+        *p++ = u.max;
+        *p++ = stack_free & 0xFF;
+        *p++ = stack_free >> 8;
+        memcpy(p, t->name, len);
+        p += len;
+        *p++ = '\0';
+        (*count)++;
     }
-    ret = ESP_OK;
+    xSemaphoreGive(lock);
 
-exit:    // Common return path
-    free(start_array);
-    free(end_array);
-    return ret;
+    return (1U << 16) | (uint32_t)(p - response);
 }
 
-void cpu_usage_task(void *arg)
+void cpu_usage_task(void* __attribute__((unused)) arg)
 {
-    // Print real time stats periodically
-    while (1) {
-        printf("\n");
-        if (print_real_time_stats(STATS_TICKS) != ESP_OK) {
-            perror("Error getting real time stats");
+    lock = xSemaphoreCreateMutex();
+    if(lock == NULL) {
+        printf("cpu_usage: out of memory\n");
+        vTaskDelete(NULL);
+        return;
+    }
+    sampler = xTaskGetCurrentTaskHandle();
+
+    while(1) {
+        while(!running)
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+        cpu_usage_sample(false);
+        TickType_t wake = xTaskGetTickCount();
+        while(running && samples - last_query < HISTORY) {
+            vTaskDelayUntil(&wake, SAMPLE_TICKS);
+            if(running)
+                cpu_usage_sample(true);
         }
-        vTaskDelay(pdMS_TO_TICKS(1000));
+        running = false;
     }
 }
@@ -1,15 +1,39 @@
 #ifndef CPU_USAGE_H
 #define CPU_USAGE_H
 
+#include <stdint.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
-// Priority fot the task.
+// Priority for the task.
 #define CPU_USAGE_TASK_PRIO     3
 
+// Task that samples the run time of each task once a second, while someone
+// looks at the result.
 void cpu_usage_task(void* arg);
 
+// Start sampling, or keep sampling for another CONFIG_ESP_CPU_USAGE_HISTORY
+// seconds. Called by the 'top' command and the vendor command.
+void cpu_usage_query(void);
+
+// Stop sampling. The history is kept.
+void cpu_usage_stop(void);
+
+// Print the usage of each core and task, busiest tasks first.
+void cpu_usage_print(void);
+
+void cpu_usage_print_status(void);
+
+// Vendor command 0x83: the usage of each core, and of the tasks from the
+// index in the request on, as many as fit in 'max' bytes.
+//   request:  first task index
+//   return:   number of bytes in response (lower 16 bits)
+//             number of bytes in request (upper 16 bits)
+uint32_t cpu_usage_vendor(const uint8_t *request, uint8_t *response,
+        uint32_t max);
+
 #ifdef __cplusplus
 }
 #endif
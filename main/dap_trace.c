@@ -0,0 +1,350 @@
+/*
+ * SPDX-FileCopyrightText: Brian Kuschak <bkuschak@gmail.com>
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Binary trace of DAP requests.
+ *
+ * 'log dap debug' prints every packet, which slows the probe down too much
+ * to look into a slowdown seen in normal use, and is rate limited. Instead,
+ * the CMSIS-DAP task writes a 20-byte record of each request into a ring of
+ * CONFIG_ESP_DAP_TRACE_RECORDS entries: the command ID, the request and
+ * response lengths, the ACK of the last SWD/JTAG transfer, the number of
+ * WAIT ACKs, and the start and duration in TIMESTAMP_GET() cycles. That is
+ * a few loads and stores per request, and two per transfer.
+ *
+ * The 'dap_trace' console command prints the last records. A client of
+ * CONFIG_ESP_DAP_TRACE_TCP_PORT receives all of them as a pcapng file, with
+ * the records as packets of link type USER0, which the CMSIS-DAP-TRACE
+ * protocol in host/wireshark/dissector_cmsis_dap_tcp.lua decodes:
+ *
+ *     nc 192.168.1.5 4446 > dap_trace.pcapng
+ *
+ * The cycle counter wraps every few seconds, so each record also holds the
+ * FreeRTOS tick count, which tells how many times it wrapped between two
+ * records. The cycle counters of the two cores are not in step, so the
+ * times are only exact if the CMSIS-DAP task is pinned to a core
+ * (CONFIG_ESP_DAP_DEDICATED_CORE), or on a single-core chip.
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/unistd.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "netdb.h"
+#include "DAP_config.h"
+#include "DAP.h"
+#include "dap_trace.h"
+#include "dlog.h"
+
+#define NUM_RECORDS         CONFIG_ESP_DAP_TRACE_RECORDS
+#define SEND_CHUNK_SIZE     1460
+#define CYCLES_PER_US       (TIMESTAMP_CLOCK / 1000000)
+#define CYCLES_PER_TICK     ((uint64_t)TIMESTAMP_CLOCK / configTICK_RATE_HZ)
+
+// pcapng blocks, see https://www.ietf.org/archive/id/draft-ietf-opsawg-pcapng
+#define PCAPNG_SHB          0x0A0D0D0A
+#define PCAPNG_IDB          0x00000001
+#define PCAPNG_EPB          0x00000006
+#define PCAPNG_BOM          0x1A2B3C4D
+#define LINKTYPE_USER0      147
+#define IF_TSRESOL          9
+#define EPB_SIZE            (32 + sizeof(struct dap_trace_record))
+
+#if (NUM_RECORDS & (NUM_RECORDS - 1)) != 0
+#error "CONFIG_ESP_DAP_TRACE_RECORDS must be a power of 2."
+#endif
+
+uint8_t dap_trace_ack_last;
+uint8_t dap_trace_waits;
+
+static struct dap_trace_record records[NUM_RECORDS];
+static uint32_t head;               // Records written since boot.
+static uint32_t first;              // First record since the last clear.
+static volatile bool enabled = true;
+static uint32_t begin_tick;
+static uint32_t begin_cycles;
+static unsigned long count_exports;
+
+// Turns the record times into nanoseconds since boot.
+struct dap_trace_clock {
+    bool started;
+    uint32_t tick;
+    uint32_t start;
+    uint64_t base_ns;
+    uint64_t cycles;                // Since the first record.
+};
+
+static const char *dap_trace_name(uint8_t id)
+{
+    switch(id) {
+        case ID_DAP_Info:               return "Info";
+        case ID_DAP_HostStatus:         return "HostStatus";
+        case ID_DAP_Connect:            return "Connect";
+        case ID_DAP_Disconnect:         return "Disconnect";
+        case ID_DAP_TransferConfigure:  return "TransferConfigure";
+        case ID_DAP_Transfer:           return "Transfer";
+        case ID_DAP_TransferBlock:      return "TransferBlock";
+        case ID_DAP_TransferAbort:      return "TransferAbort";
+        case ID_DAP_WriteABORT:         return "WriteABORT";
+        case ID_DAP_Delay:              return "Delay";
+        case ID_DAP_ResetTarget:        return "ResetTarget";
+        case ID_DAP_SWJ_Pins:           return "SWJ_Pins";
+        case ID_DAP_SWJ_Clock:          return "SWJ_Clock";
+        case ID_DAP_SWJ_Sequence:       return "SWJ_Sequence";
+        case ID_DAP_SWD_Configure:      return "SWD_Configure";
+        case ID_DAP_SWD_Sequence:       return "SWD_Sequence";
+        case ID_DAP_JTAG_Sequence:      return "JTAG_Sequence";
+        case ID_DAP_JTAG_Configure:     return "JTAG_Configure";
+        case ID_DAP_JTAG_IDCODE:        return "JTAG_IDCODE";
+        case ID_DAP_SWO_Transport:      return "SWO_Transport";
+        case ID_DAP_SWO_Mode:           return "SWO_Mode";
+        case ID_DAP_SWO_Baudrate:       return "SWO_Baudrate";
+        case ID_DAP_SWO_Control:        return "SWO_Control";
+        case ID_DAP_SWO_Status:         return "SWO_Status";
+        case ID_DAP_SWO_ExtendedStatus: return "SWO_ExtendedStatus";
+        case ID_DAP_SWO_Data:           return "SWO_Data";
+        case ID_DAP_UART_Transport:     return "UART_Transport";
+        case ID_DAP_UART_Configure:     return "UART_Configure";
+        case ID_DAP_UART_Control:       return "UART_Control";
+        case ID_DAP_UART_Status:        return "UART_Status";
+        case ID_DAP_UART_Transfer:      return "UART_Transfer";
+        case ID_DAP_QueueCommands:      return "QueueCommands";
+        case ID_DAP_ExecuteCommands:    return "ExecuteCommands";
+        default:
+            if(id >= ID_DAP_Vendor0 && id <= ID_DAP_Vendor31)
+                return "Vendor";
+            return "?";
+    }
+}
+
+void dap_trace_begin(void)
+{
+    begin_tick = xTaskGetTickCount();
+    dap_trace_ack_last = 0;
+    dap_trace_waits = 0;
+    begin_cycles = TIMESTAMP_GET();
+}
+
+void dap_trace_end(const uint8_t *request, uint32_t ret)
+{
+    uint32_t end = TIMESTAMP_GET();
+    if(!enabled)
+        return;
+
+    // Only this task writes records. Readers check 'head' after copying one.
+    struct dap_trace_record *r = &records[head % NUM_RECORDS];
+    r->tick = begin_tick;
+    r->start = begin_cycles;
+    r->cycles = end - begin_cycles;
+    r->request_len = ret >> 16;
+    r->response_len = ret & 0xFFFF;
+    r->command = request[0];
+    r->ack = dap_trace_ack_last;
+    r->waits = dap_trace_waits;
+    r->reserved = 0;
+    __atomic_store_n(&head, head + 1, __ATOMIC_RELEASE);
+}
+
+void dap_trace_enable(bool on)
+{
+    enabled = on;
+}
+
+void dap_trace_clear(void)
+{
+    first = __atomic_load_n(&head, __ATOMIC_ACQUIRE);
+}
+
+// Index of the oldest record still in the ring.
+static uint32_t dap_trace_oldest(void)
+{
+    uint32_t h = __atomic_load_n(&head, __ATOMIC_ACQUIRE);
+    uint32_t f = first;
+
+    if(h - f > NUM_RECORDS)
+        f = h - NUM_RECORDS;
+    return f;
+}
+
+// Copy record 'i'. Returns false if it has been overwritten meanwhile.
+static bool dap_trace_get(uint32_t i, struct dap_trace_record *r)
+{
+    *r = records[i % NUM_RECORDS];
+    return __atomic_load_n(&head, __ATOMIC_ACQUIRE) - i < NUM_RECORDS;
+}
+
+static uint64_t dap_trace_time_ns(struct dap_trace_clock *c,
+        const struct dap_trace_record *r)
+{
+    if(!c->started) {
+        c->started = true;
+        c->base_ns = (uint64_t)r->tick * (1000000000 / configTICK_RATE_HZ);
+    }
+    else {
+        // The ticks give the elapsed time to within a tick, which is much
+        // less than the period of the cycle counter.
+        uint64_t coarse = (uint64_t)(r->tick - c->tick) * CYCLES_PER_TICK;
+        uint32_t fine = r->start - c->start;
+        int64_t wraps = ((int64_t)(coarse - fine) + (1LL << 31)) >> 32;
+        if(wraps < 0)
+            wraps = 0;
+        c->cycles += ((uint64_t)wraps << 32) + fine;
+    }
+    c->tick = r->tick;
+    c->start = r->start;
+    return c->base_ns + c->cycles * 1000 / CYCLES_PER_US;
+}
+
+void dap_trace_print(unsigned count)
+{
+    uint32_t h = __atomic_load_n(&head, __ATOMIC_ACQUIRE);
+    uint32_t i = dap_trace_oldest();
+    struct dap_trace_clock clock = { 0 };
+    struct dap_trace_record r;
+
+    if(h - i > count)
+        i = h - count;
+    printf("        Time (s)  Command            Request  Response  ACK  "
+            "WAITs  Duration (us)\n");
+    for(; i != h; i++) {
+        if(!dap_trace_get(i, &r))
+            continue;
+        uint64_t us = dap_trace_time_ns(&clock, &r) / 1000;
+        uint32_t duration = (uint64_t)r.cycles * 100 / CYCLES_PER_US;
+        printf("%9" PRIu64 ".%06" PRIu64 "  %-18s %7u  %8u  %3u  %5u  "
+                "%10" PRIu32 ".%02" PRIu32 "\n", us / 1000000, us % 1000000,
+                dap_trace_name(r.command), r.request_len, r.response_len,
+                r.ack, r.waits, duration / 100, duration % 100);
+    }
+}
+
+void dap_trace_print_status(void)
+{
+    uint32_t h = __atomic_load_n(&head, __ATOMIC_ACQUIRE);
+
+    printf("DAP trace: %s, %" PRIu32 " requests recorded, last %" PRIu32
+            " kept. Export on port %d: %lu files sent.\n",
+            enabled ? "on" : "off", h - first, h - dap_trace_oldest(),
+            CONFIG_ESP_DAP_TRACE_TCP_PORT, count_exports);
+}
+
+// Returns false if the connection failed.
+static bool send_all(int fd, const uint8_t *buf, size_t len)
+{
+    while(len > 0) {
+        int ret = send(fd, buf, len, 0);
+        if(ret < 0 && errno == EINTR)
+            continue;
+        if(ret <= 0) {
+            DLOG_ERROR(DLOG_TRACE, "DAP trace: send error: "
+                    "%s\n", strerror(errno));
+            return false;
+        }
+        buf += ret;
+        len -= ret;
+    }
+    return true;
+}
+
+// Append a 32-bit value in host order, which pcapng readers accept with the
+// byte-order magic.
+static uint8_t *put32(uint8_t *p, uint32_t v)
+{
+    memcpy(p, &v, 4);
+    return p + 4;
+}
+
+// Send the section and interface headers, then each record still in the
+// ring as an enhanced packet block.
+static bool dap_trace_export(int fd)
+{
+    static uint8_t buf[SEND_CHUNK_SIZE];
+    uint8_t *p = buf;
+
+    p = put32(p, PCAPNG_SHB);
+    p = put32(p, 28);
+    p = put32(p, PCAPNG_BOM);
+    p = put32(p, 1);                    // Version 1.0.
+    p = put32(p, 0xFFFFFFFF);           // Section length unknown.
+    p = put32(p, 0xFFFFFFFF);
+    p = put32(p, 28);
+
+    p = put32(p, PCAPNG_IDB);
+    p = put32(p, 32);
+    p = put32(p, LINKTYPE_USER0);       // And 16 reserved bits.
+    p = put32(p, 0);                    // No snapshot length.
+    p = put32(p, 9 | (1 << 16));        // if_tsresol, 1 byte:
+    p = put32(p, IF_TSRESOL);           // nanoseconds.
+    p = put32(p, 0);                    // End of options.
+    p = put32(p, 32);
+
+    uint32_t h = __atomic_load_n(&head, __ATOMIC_ACQUIRE);
+    struct dap_trace_clock clock = { 0 };
+    struct dap_trace_record r;
+
+    for(uint32_t i = dap_trace_oldest(); i != h; i++) {
+        if(!dap_trace_get(i, &r))
+            continue;
+        uint64_t ns = dap_trace_time_ns(&clock, &r);
+        if((size_t)(p - buf) + EPB_SIZE > sizeof(buf)) {
+            if(!send_all(fd, buf, p - buf))
+                return false;
+            p = buf;
+        }
+        p = put32(p, PCAPNG_EPB);
+        p = put32(p, EPB_SIZE);
+        p = put32(p, 0);                // Interface.
+        p = put32(p, ns >> 32);
+        p = put32(p, ns);
+        p = put32(p, sizeof(r));
+        p = put32(p, sizeof(r));
+        memcpy(p, &r, sizeof(r));       // A multiple of 4 bytes.
+        p += sizeof(r);
+        p = put32(p, EPB_SIZE);
+    }
+    return send_all(fd, buf, p - buf);
+}
+
+void dap_trace_task(void* __attribute__((unused)) arg)
+{
+    int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if(listen_fd < 0) {
+        DLOG_ERROR(DLOG_TRACE, "DAP trace: failed to create socket: "
+                "%s\n", strerror(errno));
+        vTaskDelete(NULL);
+        return;
+    }
+
+    struct sockaddr_in server_addr = {
+        .sin_family = AF_INET,
+        .sin_addr.s_addr = INADDR_ANY,
+        .sin_port = htons(CONFIG_ESP_DAP_TRACE_TCP_PORT),
+    };
+    if(bind(listen_fd, (struct sockaddr*)&server_addr,
+                sizeof(server_addr)) < 0 || listen(listen_fd, 1) < 0) {
+        DLOG_ERROR(DLOG_TRACE, "DAP trace: failed to listen: "
+                "%s\n", strerror(errno));
+        close(listen_fd);
+        vTaskDelete(NULL);
+        return;
+    }
+    DLOG_INFO(DLOG_TRACE, "DAP trace: listening on port %d.\n",
+            CONFIG_ESP_DAP_TRACE_TCP_PORT);
+
+    while(1) {
+        int fd = accept(listen_fd, NULL, NULL);
+        if(fd < 0) {
+            DLOG_ERROR(DLOG_TRACE, "DAP trace: accept error: "
+                    "%s\n", strerror(errno));
+            vTaskDelay(pdMS_TO_TICKS(100));
+            continue;
+        }
+        if(dap_trace_export(fd))
+            count_exports++;
+        close(fd);
+    }
+}
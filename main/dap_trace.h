@@ -0,0 +1,58 @@
+#ifndef DAP_TRACE_H
+#define DAP_TRACE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// One DAP request, as exported. Multi-byte fields are little endian.
+struct dap_trace_record {
+    uint32_t tick;              // xTaskGetTickCount() at the start.
+    uint32_t start;             // TIMESTAMP_GET() at the start.
+    uint32_t cycles;            // Duration in TIMESTAMP_GET() ticks.
+    uint16_t request_len;
+    uint16_t response_len;
+    uint8_t command;            // First command ID of the request.
+    uint8_t ack;                // ACK of the last SWD/JTAG transfer, or 0.
+    uint8_t waits;              // WAIT ACKs, up to 255.
+    uint8_t reserved;
+} __attribute__((__packed__));
+
+// Updated by DAP_TRACE_ACK() in SW_DP.c and JTAG_DP.c.
+extern uint8_t dap_trace_ack_last;
+extern uint8_t dap_trace_waits;
+
+// Called after each SWD/JTAG transfer with its ACK.
+static inline void dap_trace_ack(uint32_t ack)
+{
+    dap_trace_ack_last = ack;
+    if(ack == 2U && dap_trace_waits != UINT8_MAX)   // DAP_TRANSFER_WAIT
+        dap_trace_waits++;
+}
+
+// Called by the CMSIS-DAP task around each DAP request. 'ret' is the return
+// value of DAP_ProcessCommand().
+void dap_trace_begin(void);
+void dap_trace_end(const uint8_t *request, uint32_t ret);
+
+// Stop or restart recording, and forget the recorded requests.
+void dap_trace_enable(bool on);
+void dap_trace_clear(void);
+
+// Print the last 'count' records.
+void dap_trace_print(unsigned count);
+
+void dap_trace_print_status(void);
+
+// Task that sends the records as pcapng to each client of
+// CONFIG_ESP_DAP_TRACE_TCP_PORT.
+void dap_trace_task(void *arg);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // DAP_TRACE_H
@@ -0,0 +1,134 @@
+/*
+ * SPDX-FileCopyrightText: Brian Kuschak <bkuschak@gmail.com>
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Sleeping and cooperative yielding for the CMSIS-DAP task.
+ *
+ * DAP_Delay and Delayms sleep on an esp_timer instead of spinning, so other
+ * tasks can use the CPU in the meantime.
+ *
+ * With CONFIG_ESP_DAP_YIELD, long DAP commands such as a large
+ * DAP_TransferBlock also give up the CPU between transfers, where the SWD/JTAG
+ * bus is idle and stopping the clock is harmless. Once a time slice of
+ * CONFIG_ESP_DAP_YIELD_SLICE_US has run out, the task yields to other tasks
+ * of the same priority, like the UART bridge. If a single request keeps
+ * running for longer than BUSY_SLEEP_MS, the task sleeps for one tick, so
+ * lower priority tasks like the console get to run too.
+ *
+ * Time slices are measured with the cycle counter, which each core has its
+ * own of. The CMSIS-DAP task must therefore stay on one core, and main.c
+ * pins it when this option is enabled on a multi-core chip.
+ */
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <inttypes.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+#include "esp_rom_sys.h"
+#include "DAP_config.h"
+#include "dap_yield.h"
+
+// Shorter delays busy-wait, as a task switch would take about as long.
+#define MIN_SLEEP_US        50
+
+#define CYCLES_PER_US       (CPU_CLOCK / 1000000U)
+#define BUSY_SLEEP_MS       100
+
+uint32_t dap_yield_deadline;
+
+static esp_timer_handle_t sleep_timer;
+static TaskHandle_t sleep_task;
+static bool sleep_timer_failed;
+
+#ifdef CONFIG_ESP_DAP_YIELD
+#define SLICE_CYCLES        (CONFIG_ESP_DAP_YIELD_SLICE_US * CYCLES_PER_US)
+#define BUSY_SLEEP_CYCLES   (BUSY_SLEEP_MS * 1000U * CYCLES_PER_US)
+
+static uint32_t busy_since;
+static uint32_t yields;
+static uint32_t sleeps;
+#endif
+
+static void sleep_timer_cb(void *arg)
+{
+    xTaskNotifyGive(sleep_task);
+}
+
+static bool sleep_timer_init(void)
+{
+    const esp_timer_create_args_t args = {
+        .callback = sleep_timer_cb,
+        .name = "dap_sleep",
+    };
+
+    if (sleep_timer != NULL)
+        return true;
+    if (sleep_timer_failed)
+        return false;
+
+    esp_err_t ret = esp_timer_create(&args, &sleep_timer);
+    if (ret != ESP_OK) {
+        fprintf(stderr, "dap_yield: esp_timer_create failed: %s. "
+                "Delays will busy-wait.\n", esp_err_to_name(ret));
+        sleep_timer_failed = true;
+        return false;
+    }
+    return true;
+}
+
+void dap_sleep_us(uint32_t us)
+{
+    if (us < MIN_SLEEP_US || !sleep_timer_init()) {
+        esp_rom_delay_us(us);
+        return;
+    }
+
+    sleep_task = xTaskGetCurrentTaskHandle();
+    ulTaskNotifyTake(pdTRUE, 0);
+    esp_timer_start_once(sleep_timer, us);
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+#ifdef CONFIG_ESP_DAP_YIELD
+    // Other tasks just ran.
+    dap_yield_begin();
+#endif
+}
+
+void dap_yield_begin(void)
+{
+#ifdef CONFIG_ESP_DAP_YIELD
+    uint32_t now = esp_cpu_get_cycle_count();
+
+#if portNUM_PROCESSORS > 1
+    // The cycle counts would be of different cores.
+    configASSERT(xTaskGetCoreID(NULL) != tskNO_AFFINITY);
+#endif
+    busy_since = now;
+    dap_yield_deadline = now + SLICE_CYCLES;
+#endif
+}
+
+void dap_yield(void)
+{
+#ifdef CONFIG_ESP_DAP_YIELD
+    if (esp_cpu_get_cycle_count() - busy_since >= BUSY_SLEEP_CYCLES) {
+        vTaskDelay(1);
+        sleeps++;
+        dap_yield_begin();
+        return;
+    }
+    taskYIELD();
+    yields++;
+    dap_yield_deadline = esp_cpu_get_cycle_count() + SLICE_CYCLES;
+#endif
+}
+
+void dap_yield_print_status(void)
+{
+#ifdef CONFIG_ESP_DAP_YIELD
+    printf("DAP yield: %d us slices. Yields: %"PRIu32", sleeps: %"PRIu32".\n",
+            CONFIG_ESP_DAP_YIELD_SLICE_US, yields, sleeps);
+#endif
+}
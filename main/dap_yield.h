@@ -0,0 +1,39 @@
+#ifndef DAP_YIELD_H
+#define DAP_YIELD_H
+
+#include <stdint.h>
+#include "sdkconfig.h"
+#include "esp_cpu.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Sleep for at least 'us' microseconds. Other tasks run while waiting,
+// except for very short delays, which busy-wait.
+void dap_sleep_us(uint32_t us);
+
+// Cycle count at which the current time slice ends.
+extern uint32_t dap_yield_deadline;
+
+// Start a new time slice. Called before each DAP request from the host.
+void dap_yield_begin(void);
+
+// Let other tasks run. Called by dap_yield_check() when the slice has ended.
+void dap_yield(void);
+
+void dap_yield_print_status(void);
+
+// Called at safe points of long DAP commands, i.e. between SWD/JTAG
+// transfers. Yields once the current time slice has ended.
+static inline void dap_yield_check(void)
+{
+    if ((int32_t)(esp_cpu_get_cycle_count() - dap_yield_deadline) >= 0)
+        dap_yield();
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // DAP_YIELD_H
@@ -0,0 +1,248 @@
+/*
+ * SPDX-FileCopyrightText: Brian Kuschak <bkuschak@gmail.com>
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Deferred logging.
+ *
+ * printf() to the USB-Serial console blocks the caller while the console is
+ * slow, or has no host. DLOG() instead stores the format string pointer and
+ * the arguments, unformatted, in a ring of CONFIG_ESP_DLOG_RECORDS records,
+ * and a task of the lowest priority formats and prints them. A writer
+ * reserves a record with a compare-and-swap of 'head' and publishes it by
+ * setting its sequence number, so writers never wait for each other or for
+ * the log task. When the ring is full, messages are dropped and counted.
+ * The %s arguments are copied into the record, so they may be buffers of
+ * the caller, like a client address.
+ *
+ * Each subsystem has a level, changed at runtime with the 'log' console
+ * command, and may log at most CONFIG_ESP_DLOG_RATE_LIMIT messages a
+ * second. The log task reports how many messages were dropped or
+ * suppressed.
+ */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "sdkconfig.h"
+#include "dlog.h"
+
+#define NUM_RECORDS         CONFIG_ESP_DLOG_RECORDS
+#define RATE_LIMIT          CONFIG_ESP_DLOG_RATE_LIMIT
+#define POLL_MS             10
+#define TASK_STACK          3072
+#define TASK_PRIO           1
+
+#if (NUM_RECORDS & (NUM_RECORDS - 1)) != 0
+#error "CONFIG_ESP_DLOG_RECORDS must be a power of 2."
+#endif
+
+struct record {
+    uint32_t seq;                   // Index + 1 once written.
+    const char *fmt;
+    uintptr_t args[DLOG_MAX_ARGS];
+    uint8_t str_args;               // Bit n: argument n is copied to 'str'.
+    char str[DLOG_STR_LEN];         // The copies, each NUL-terminated.
+};
+
+struct subsys {
+    const char *name;
+    uint32_t window;                // Second of the current count.
+    uint32_t count;                 // Messages in that second.
+    uint32_t suppressed;
+    uint32_t reported;              // Suppressed messages already reported.
+};
+
+uint8_t dlog_levels[DLOG_NUM_SUBSYS] = {
+    [0 ... DLOG_NUM_SUBSYS - 1] = CONFIG_ESP_DLOG_DEFAULT_LEVEL,
+};
+
+static const char *const level_names[] = {
+    [DLOG_LEVEL_OFF]    = "off",
+    [DLOG_LEVEL_ERROR]  = "error",
+    [DLOG_LEVEL_WARN]   = "warn",
+    [DLOG_LEVEL_INFO]   = "info",
+    [DLOG_LEVEL_DEBUG]  = "debug",
+};
+
+static struct subsys subsystems[DLOG_NUM_SUBSYS] = {
+    [DLOG_MAIN]     = { .name = "main" },
+    [DLOG_DAP]      = { .name = "dap" },
+    [DLOG_BRIDGE]   = { .name = "bridge" },
+    [DLOG_TRACE]    = { .name = "trace" },
+};
+
+static struct record ring[NUM_RECORDS];
+static uint32_t head;               // Records reserved since boot.
+static uint32_t tail;               // Records printed since boot.
+static uint32_t count_dropped;
+static uint32_t reported_dropped;
+
+// Where the string after 'p' in r->str starts.
+static char *dlog_next_str(struct record *r, char *p)
+{
+    char *next = p + strlen(p) + 1;
+    return next < r->str + sizeof(r->str) ? next : p;
+}
+
+// Bitmap of the %s arguments of 'fmt'.
+static uint8_t dlog_find_str(const char *fmt, unsigned nargs)
+{
+    uint8_t mask = 0;
+    unsigned arg = 0;
+    while((fmt = strchr(fmt, '%')) != NULL) {
+        fmt++;
+        if(*fmt == '%') {
+            fmt++;
+            continue;
+        }
+        // Skip flags, width, precision and length; '*' takes an argument.
+        while(*fmt && strchr("-+ #0123456789.*hljztL", *fmt)) {
+            if(*fmt == '*')
+                arg++;
+            fmt++;
+        }
+        if(arg >= nargs)
+            break;
+        if(*fmt == 's')
+            mask |= 1 << arg;
+        arg++;
+    }
+    return mask;
+}
+
+void dlog_write(uint8_t subsys, const char *fmt, unsigned nargs,
+        const uintptr_t *args)
+{
+    struct subsys *s = &subsystems[subsys];
+
+    // Racing writers may let a few more through at the start of a second.
+    uint32_t window = xTaskGetTickCount() / configTICK_RATE_HZ;
+    if(s->window != window) {
+        s->window = window;
+        s->count = 0;
+    }
+    if(__atomic_add_fetch(&s->count, 1, __ATOMIC_RELAXED) > RATE_LIMIT) {
+        __atomic_add_fetch(&s->suppressed, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    uint32_t h = __atomic_load_n(&head, __ATOMIC_RELAXED);
+    do {
+        if(h - __atomic_load_n(&tail, __ATOMIC_ACQUIRE) >= NUM_RECORDS) {
+            __atomic_add_fetch(&count_dropped, 1, __ATOMIC_RELAXED);
+            return;
+        }
+    } while(!__atomic_compare_exchange_n(&head, &h, h + 1, true,
+                __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+
+    struct record *r = &ring[h % NUM_RECORDS];
+    r->fmt = fmt;
+    memcpy(r->args, args, nargs * sizeof(args[0]));
+    r->str_args = dlog_find_str(fmt, nargs);
+    char *p = r->str;
+    for(unsigned i = 0; i < nargs; i++) {
+        if(!(r->str_args & (1 << i)))
+            continue;
+        // Truncated to the space left. The last byte is kept as an empty
+        // string for the arguments that do not fit.
+        const char *str = args[i] ? (const char *)args[i] : "(null)";
+        size_t room = r->str + sizeof(r->str) - 1 - p;
+        size_t n = room ? strnlen(str, room - 1) : 0;
+        memcpy(p, str, n);
+        p[n] = '\0';
+        p = dlog_next_str(r, p);
+    }
+    __atomic_store_n(&r->seq, h + 1, __ATOMIC_RELEASE);
+}
+
+static void dlog_report_losses(void)
+{
+    uint32_t dropped = count_dropped;
+    if(dropped != reported_dropped) {
+        printf("log: %" PRIu32 " messages dropped, ring full.\n",
+                dropped - reported_dropped);
+        reported_dropped = dropped;
+    }
+    for(int i = 0; i < DLOG_NUM_SUBSYS; i++) {
+        struct subsys *s = &subsystems[i];
+        uint32_t suppressed = s->suppressed;
+        if(suppressed != s->reported) {
+            printf("log: %" PRIu32 " %s messages suppressed, over %d a "
+                    "second.\n", suppressed - s->reported, s->name,
+                    RATE_LIMIT);
+            s->reported = suppressed;
+        }
+    }
+}
+
+static void dlog_task(void* __attribute__((unused)) arg)
+{
+    while(1) {
+        struct record *r = &ring[tail % NUM_RECORDS];
+        if(__atomic_load_n(&r->seq, __ATOMIC_ACQUIRE) != tail + 1) {
+            dlog_report_losses();
+            vTaskDelay(pdMS_TO_TICKS(POLL_MS));
+            continue;
+        }
+
+        struct record copy = *r;
+        __atomic_store_n(&tail, tail + 1, __ATOMIC_RELEASE);
+        char *p = copy.str;
+        for(int i = 0; i < DLOG_MAX_ARGS; i++) {
+            if(copy.str_args & (1 << i)) {
+                copy.args[i] = (uintptr_t)p;
+                p = dlog_next_str(&copy, p);
+            }
+        }
+
+        // Unused arguments are ignored.
+        printf(copy.fmt, copy.args[0], copy.args[1], copy.args[2],
+                copy.args[3], copy.args[4], copy.args[5]);
+    }
+}
+
+void dlog_init(void)
+{
+    if(xTaskCreate(dlog_task, "dlog", TASK_STACK, NULL, TASK_PRIO, NULL) !=
+            pdPASS)
+        printf("log: failed to create task\n");
+}
+
+static int dlog_find(const char *const *names, int n, const char *name)
+{
+    for(int i = 0; i < n; i++) {
+        if(strcmp(names[i], name) == 0)
+            return i;
+    }
+    return -1;
+}
+
+bool dlog_set_level(const char *subsys, const char *level)
+{
+    int l = dlog_find(level_names, DLOG_LEVEL_DEBUG + 1, level);
+    if(l < 0)
+        return false;
+
+    bool found = false;
+    for(int i = 0; i < DLOG_NUM_SUBSYS; i++) {
+        if(strcmp(subsys, "all") == 0 ||
+                strcmp(subsys, subsystems[i].name) == 0) {
+            dlog_levels[i] = l;
+            found = true;
+        }
+    }
+    return found;
+}
+
+void dlog_print_status(void)
+{
+    printf("log:");
+    for(int i = 0; i < DLOG_NUM_SUBSYS; i++) {
+        printf(" %s %s,", subsystems[i].name,
+                level_names[dlog_levels[i]]);
+    }
+    printf(" %" PRIu32 " messages queued, %" PRIu32 " dropped.\n",
+            __atomic_load_n(&head, __ATOMIC_RELAXED) - tail, count_dropped);
+}
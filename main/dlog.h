@@ -0,0 +1,94 @@
+#ifndef DLOG_H
+#define DLOG_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum dlog_subsys {
+    DLOG_MAIN,
+    DLOG_DAP,
+    DLOG_BRIDGE,
+    DLOG_TRACE,
+    DLOG_NUM_SUBSYS
+};
+
+enum dlog_level {
+    DLOG_LEVEL_OFF,
+    DLOG_LEVEL_ERROR,
+    DLOG_LEVEL_WARN,
+    DLOG_LEVEL_INFO,
+    DLOG_LEVEL_DEBUG,
+};
+
+#define DLOG_MAX_ARGS       6
+#define DLOG_STR_LEN        64      // Fits an IPv6 address and more.
+
+// Level of each subsystem, changed with dlog_set_level().
+extern uint8_t dlog_levels[DLOG_NUM_SUBSYS];
+
+// Queue a message for the log task, which prints it with printf(). The %s
+// arguments are copied, up to DLOG_STR_LEN bytes in all, but 'fmt' must stay
+// valid, e.g. a string literal. Arguments are stored as uintptr_t, so 64-bit
+// integers and floating point values cannot be logged. Never blocks: the
+// message is dropped if the ring is full, or the subsystem logged too much
+// this second.
+#define DLOG(subsys, level, fmt, ...)                                       \
+    do {                                                                    \
+        if(0)                                                               \
+            dlog_check_format(fmt, ##__VA_ARGS__);                          \
+        if((level) <= dlog_levels[subsys])                                  \
+            dlog_write((subsys), (fmt), DLOG_NARGS(__VA_ARGS__),            \
+                    (const uintptr_t[]){ 0, DLOG_CASTS(__VA_ARGS__) } + 1); \
+    } while(0)
+
+#define DLOG_ERROR(subsys, fmt, ...) \
+    DLOG(subsys, DLOG_LEVEL_ERROR, fmt, ##__VA_ARGS__)
+#define DLOG_WARN(subsys, fmt, ...) \
+    DLOG(subsys, DLOG_LEVEL_WARN, fmt, ##__VA_ARGS__)
+#define DLOG_INFO(subsys, fmt, ...) \
+    DLOG(subsys, DLOG_LEVEL_INFO, fmt, ##__VA_ARGS__)
+#define DLOG_DEBUG(subsys, fmt, ...) \
+    DLOG(subsys, DLOG_LEVEL_DEBUG, fmt, ##__VA_ARGS__)
+
+// Start the log task. Messages queued before are printed then.
+void dlog_init(void);
+
+// Set the level of a subsystem by name, or of all of them with "all".
+// Returns false if the subsystem or level is unknown.
+bool dlog_set_level(const char *subsys, const char *level);
+
+void dlog_print_status(void);
+
+void dlog_write(uint8_t subsys, const char *fmt, unsigned nargs,
+        const uintptr_t *args);
+
+// Only used for its format checks.
+static inline __attribute__((format(printf, 1, 2)))
+void dlog_check_format(const char *fmt, ...)
+{
+    (void)fmt;
+}
+
+#define DLOG_NARGS_(_0, _1, _2, _3, _4, _5, _6, n, ...) n
+#define DLOG_NARGS(...)     DLOG_NARGS_(0, ##__VA_ARGS__, 6, 5, 4, 3, 2, 1, 0)
+#define DLOG_CAT_(a, b)     a##b
+#define DLOG_CAT(a, b)      DLOG_CAT_(a, b)
+#define DLOG_CASTS(...) \
+    DLOG_CAT(DLOG_CAST_, DLOG_NARGS(__VA_ARGS__))(__VA_ARGS__)
+#define DLOG_CAST_0()
+#define DLOG_CAST_1(a)      (uintptr_t)(a)
+#define DLOG_CAST_2(a, ...) (uintptr_t)(a), DLOG_CAST_1(__VA_ARGS__)
+#define DLOG_CAST_3(a, ...) (uintptr_t)(a), DLOG_CAST_2(__VA_ARGS__)
+#define DLOG_CAST_4(a, ...) (uintptr_t)(a), DLOG_CAST_3(__VA_ARGS__)
+#define DLOG_CAST_5(a, ...) (uintptr_t)(a), DLOG_CAST_4(__VA_ARGS__)
+#define DLOG_CAST_6(a, ...) (uintptr_t)(a), DLOG_CAST_5(__VA_ARGS__)
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // DLOG_H
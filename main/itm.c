@@ -0,0 +1,338 @@
+/*
+ * SPDX-FileCopyrightText: Brian Kuschak <bkuschak@gmail.com>
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * ITM/DWT packet decoder for the SWO stream.
+ *
+ * Raw SWO from a Cortex-M is a mix of ITM stimulus port writes, timestamps,
+ * sync packets and DWT hardware packets. Sending all of it over WiFi is
+ * wasteful when the host only wants a few stimulus ports. When enabled with
+ * itm_configure(), the SWO stream carries frames instead of raw SWO:
+ *
+ *     <channel> <length> <payload...>
+ *
+ * Channels 0 to 31 carry the data written to the selected stimulus ports.
+ * Consecutive writes to the same port are merged into one frame of up to
+ * 255 bytes. Timestamps and DWT data trace packets are forwarded raw on
+ * their own channels if requested, and an empty frame on ITM_CH_OVERFLOW
+ * marks trace lost by the target. Sync packets are dropped. DWT exception
+ * trace, PC sampling and event counter packets are only counted; the counts
+ * are shown by the 'itm' console command.
+ *
+ * The decoder has no ESP-IDF dependencies.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "sdkconfig.h"
+#include "itm.h"
+
+#define MAX_PACKET          8       // Header plus up to 7 payload bytes.
+#define OUT_RESERVE         (2 + MAX_PACKET)
+#define MAX_EXCEPTIONS      128
+#define SYNC_ZEROS          5       // A sync packet is 47 zero bits and a 1.
+
+// Header bytes.
+#define HDR_OVERFLOW        0x70
+#define HDR_GTS1            0x94
+#define HDR_GTS2            0xB4
+
+// DWT hardware source packet discriminators.
+#define DWT_EVENT_COUNTER   0
+#define DWT_EXCEPTION       1
+#define DWT_PC_SAMPLE       2
+#define DWT_DATA_TRACE_MIN  8
+#define DWT_DATA_TRACE_MAX  23
+
+enum {
+    KIND_SOFTWARE,      // Stimulus port write.
+    KIND_HARDWARE,      // DWT packet.
+    KIND_TIMESTAMP,
+    KIND_EXTENSION,
+    KIND_RESERVED,
+};
+
+static const char *const event_names[] = {
+    "CPI", "EXC", "SLEEP", "LSU", "FOLD", "CYC"
+};
+
+static struct {
+    uint32_t ports;
+    uint32_t forward;
+} config = {
+    .ports = CONFIG_ESP_DAP_SWO_ITM_PORTS,
+};
+
+static struct {
+    uint8_t pkt[MAX_PACKET];
+    uint8_t len;        // Packet bytes received, 0 while waiting for a header.
+    uint8_t need;       // Payload bytes still expected.
+    bool cont;          // Payload ends with a byte without bit 7 set.
+    uint8_t kind;
+    uint8_t zeros;      // Consecutive zero bytes.
+} parser;
+
+static struct {
+    uint8_t *buf;
+    size_t size;
+    size_t len;
+    size_t frame;       // Offset of the open frame.
+    int ch;             // Channel of the open frame, or -1.
+} out;
+
+static struct {
+    unsigned long bytes_in;
+    unsigned long bytes_out;
+    unsigned long syncs;
+    unsigned long overflows;
+    unsigned long stimulus[32];
+    unsigned long timestamps;
+    unsigned long extensions;
+    unsigned long reserved;
+    unsigned long exc_enter[MAX_EXCEPTIONS];
+    unsigned long exc_enter_other;
+    unsigned long exc_exit;
+    unsigned long exc_return;
+    unsigned long pc_samples;
+    unsigned long pc_sleep;
+    unsigned long events[6];
+    unsigned long data_trace;
+} count;
+
+void itm_configure(uint32_t ports, uint32_t forward)
+{
+    config.ports = ports;
+    config.forward = forward;
+}
+
+bool itm_enabled(void)
+{
+    return config.ports != 0;
+}
+
+void itm_reset(void)
+{
+    memset(&parser, 0, sizeof(parser));
+}
+
+void itm_clear_counters(void)
+{
+    memset(&count, 0, sizeof(count));
+}
+
+// Append 'n' bytes to a frame of channel 'ch'.
+static void emit(int ch, const uint8_t *data, size_t n)
+{
+    if(out.ch != ch || out.buf[out.frame + 1] + n > 255) {
+        out.frame = out.len;
+        out.buf[out.len++] = ch;
+        out.buf[out.len++] = 0;
+        out.ch = ch;
+    }
+    memcpy(out.buf + out.len, data, n);
+    out.len += n;
+    out.buf[out.frame + 1] += n;
+}
+
+static void hardware_packet(void)
+{
+    uint8_t disc = parser.pkt[0] >> 3;
+    const uint8_t *p = &parser.pkt[1];
+
+    if(disc == DWT_EVENT_COUNTER) {
+        for(int i = 0; i < 6; i++) {
+            if(p[0] & (1 << i))
+                count.events[i]++;
+        }
+    }
+    else if(disc == DWT_EXCEPTION && parser.len >= 3) {
+        unsigned num = p[0] | ((p[1] & 1) << 8);
+        switch((p[1] >> 4) & 3) {
+            case 1:
+                if(num < MAX_EXCEPTIONS)
+                    count.exc_enter[num]++;
+                else
+                    count.exc_enter_other++;
+                break;
+            case 2:
+                count.exc_exit++;
+                break;
+            case 3:
+                count.exc_return++;
+                break;
+        }
+    }
+    else if(disc == DWT_PC_SAMPLE) {
+        // A 1 byte payload means the core was sleeping.
+        if(parser.len == 2)
+            count.pc_sleep++;
+        else
+            count.pc_samples++;
+    }
+    else if(disc >= DWT_DATA_TRACE_MIN && disc <= DWT_DATA_TRACE_MAX) {
+        count.data_trace++;
+        if(config.forward & ITM_FWD_DATA_TRACE)
+            emit(ITM_CH_DATA_TRACE, parser.pkt, parser.len);
+    }
+    else {
+        count.reserved++;
+    }
+}
+
+static void packet_done(void)
+{
+    switch(parser.kind) {
+        case KIND_SOFTWARE: {
+            unsigned port = parser.pkt[0] >> 3;
+            count.stimulus[port]++;
+            if(config.ports & (1U << port))
+                emit(ITM_CH_STIMULUS(port), &parser.pkt[1], parser.len - 1);
+            break;
+        }
+        case KIND_HARDWARE:
+            hardware_packet();
+            break;
+        case KIND_TIMESTAMP:
+            count.timestamps++;
+            if(config.forward & ITM_FWD_TIMESTAMPS)
+                emit(ITM_CH_TIMESTAMP, parser.pkt, parser.len);
+            break;
+        case KIND_EXTENSION:
+            count.extensions++;
+            break;
+        default:
+            count.reserved++;
+            break;
+    }
+    parser.len = 0;
+}
+
+static void parse_header(uint8_t b)
+{
+    if(b == 0x00) {
+        if(parser.zeros < 255)
+            parser.zeros++;
+        return;
+    }
+    if(b == 0x80 && parser.zeros >= SYNC_ZEROS) {
+        parser.zeros = 0;
+        count.syncs++;
+        return;
+    }
+    parser.zeros = 0;
+
+    if(b == HDR_OVERFLOW) {
+        count.overflows++;
+        emit(ITM_CH_OVERFLOW, NULL, 0);
+        out.ch = -1;
+        return;
+    }
+
+    parser.pkt[0] = b;
+    parser.len = 1;
+    parser.cont = false;
+    if(b & 0x03) {
+        // Source packet with 1, 2 or 4 payload bytes.
+        parser.kind = (b & 0x04) ? KIND_HARDWARE : KIND_SOFTWARE;
+        parser.need = ((b & 0x03) == 3) ? 4 : (b & 0x03);
+        return;
+    }
+    if(b == HDR_GTS1 || b == HDR_GTS2) {
+        parser.kind = KIND_TIMESTAMP;
+        parser.cont = true;
+        return;
+    }
+    if((b & 0x0F) == 0x00) {
+        // Local timestamp, with payload if bit 7 is set.
+        parser.kind = KIND_TIMESTAMP;
+        parser.cont = (b & 0x80) != 0;
+    }
+    else if((b & 0x0B) == 0x08) {
+        parser.kind = KIND_EXTENSION;
+        parser.cont = (b & 0x80) != 0;
+    }
+    else {
+        parser.kind = KIND_RESERVED;
+    }
+    if(!parser.cont)
+        packet_done();
+}
+
+static void parse_byte(uint8_t b)
+{
+    if(parser.len == 0) {
+        parse_header(b);
+        return;
+    }
+
+    // Excess continuation bytes are dropped.
+    if(parser.len < MAX_PACKET)
+        parser.pkt[parser.len++] = b;
+
+    if(parser.cont) {
+        if((b & 0x80) == 0)
+            packet_done();
+    }
+    else if(--parser.need == 0) {
+        packet_done();
+    }
+}
+
+size_t itm_filter(const uint8_t *in, size_t len, uint8_t *out_buf,
+        size_t out_size, size_t *out_len)
+{
+    size_t i;
+
+    out.buf = out_buf;
+    out.size = out_size;
+    out.len = 0;
+    out.ch = -1;
+
+    // Each byte completes at most one packet, which needs OUT_RESERVE bytes.
+    for(i = 0; i < len && out.len + OUT_RESERVE <= out.size; i++)
+        parse_byte(in[i]);
+
+    count.bytes_in += i;
+    count.bytes_out += out.len;
+    *out_len = out.len;
+    return i;
+}
+
+void itm_print_status(void)
+{
+    if(!itm_enabled()) {
+        printf("ITM: off, SWO is streamed raw.\n");
+        return;
+    }
+
+    printf("ITM: forwarding stimulus ports 0x%08lx%s%s. In: %lu bytes, out: "
+            "%lu bytes.\n", (unsigned long)config.ports,
+            (config.forward & ITM_FWD_TIMESTAMPS) ? ", timestamps" : "",
+            (config.forward & ITM_FWD_DATA_TRACE) ? ", data trace" : "",
+            count.bytes_in, count.bytes_out);
+    printf("  %lu syncs, %lu overflows, %lu timestamps, %lu extension, "
+            "%lu reserved packets.\n", count.syncs, count.overflows,
+            count.timestamps, count.extensions, count.reserved);
+    for(int i = 0; i < 32; i++) {
+        if(count.stimulus[i] != 0) {
+            printf("  stimulus port %d: %lu writes%s\n", i, count.stimulus[i],
+                    (config.ports & (1U << i)) ? "" : " (dropped)");
+        }
+    }
+    for(int i = 0; i < MAX_EXCEPTIONS; i++) {
+        if(count.exc_enter[i] != 0)
+            printf("  exception %d: %lu entries\n", i, count.exc_enter[i]);
+    }
+    if(count.exc_enter_other != 0) {
+        printf("  exceptions >= %d: %lu entries\n", MAX_EXCEPTIONS,
+                count.exc_enter_other);
+    }
+    printf("  exception exits: %lu, returns: %lu. PC samples: %lu, "
+            "sleeping: %lu. Data trace: %lu.\n", count.exc_exit,
+            count.exc_return, count.pc_samples, count.pc_sleep,
+            count.data_trace);
+    printf("  DWT counter wraps:");
+    for(int i = 0; i < 6; i++)
+        printf(" %s %lu", event_names[i], count.events[i]);
+    printf("\n");
+}
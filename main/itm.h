@@ -0,0 +1,42 @@
+#ifndef ITM_H
+#define ITM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Channels of the framed output. Each frame is <channel> <length> followed
+// by 'length' (0 to 255) payload bytes.
+#define ITM_CH_STIMULUS(port)   (port)  // Stimulus port 0 to 31 data.
+#define ITM_CH_TIMESTAMP        32      // Raw local/global timestamp packets.
+#define ITM_CH_DATA_TRACE       33      // Raw DWT data trace packets.
+#define ITM_CH_OVERFLOW         34      // Empty frame: the target lost trace.
+
+// Packet types forwarded in addition to the selected stimulus ports.
+#define ITM_FWD_TIMESTAMPS      (1U << 0)
+#define ITM_FWD_DATA_TRACE      (1U << 1)
+
+// Start decoding, or forward raw SWO if 'ports' is 0.
+void itm_configure(uint32_t ports, uint32_t forward);
+bool itm_enabled(void);
+
+// Forget any partially received packet, e.g. when a new client connects.
+void itm_reset(void);
+
+// Decode SWO data from 'in' and append frames to 'out'. Returns the number
+// of input bytes consumed, which is less than 'len' if 'out' is full.
+size_t itm_filter(const uint8_t *in, size_t len, uint8_t *out,
+        size_t out_size, size_t *out_len);
+
+void itm_clear_counters(void);
+void itm_print_status(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // ITM_H
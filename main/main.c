@@ -43,6 +43,7 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <inttypes.h>
 #include "sdkconfig.h"
@@ -76,12 +77,77 @@
 
 #include "DAP.h"
 #include "cmsis_dap_tcp.h"
+#include "dlog.h"
 #include "uart_bridge.h"
 
+#ifdef CONFIG_ESP_UART_BRIDGE_HISTORY
+#include "uart_history.h"
+#endif
+
+#ifdef CONFIG_ESP_UART_BRIDGE_TRIGGER
+#include "uart_trigger.h"
+#endif
+
 #ifdef CONFIG_ESP_DAP_LED_RGB
 #include "ws2812_led.h"
 #endif
 
+#ifdef CONFIG_ESP_DAP_DEDICATED_CORE
+#define CMSIS_DAP_TASK_CORE     1
+#if defined(CONFIG_ESP_WIFI_TASK_PINNED_TO_CORE_1) || \
+    defined(CONFIG_LWIP_TCPIP_TASK_AFFINITY_CPU1)
+#warning "WiFi or lwIP is pinned to the same core as the CMSIS-DAP task"
+#endif
+#elif defined(CONFIG_ESP_DAP_YIELD)
+// dap_yield measures time slices with the cycle counter of the core.
+#define CMSIS_DAP_TASK_CORE     (portNUM_PROCESSORS - 1)
+#else
+#define CMSIS_DAP_TASK_CORE     tskNO_AFFINITY
+#endif
+
+#if (CONFIG_ESP_DAP_PIN_MAP_COUNT > 1) || defined(CONFIG_ESP_DAP_PIN_MAP_RUNTIME)
+#define HAVE_PIN_MAPS
+#include "pin_map.h"
+#endif
+
+#if defined(CONFIG_ESP_DAP_CRITICAL_SECTIONS) || \
+    defined(CONFIG_ESP_DAP_JITTER_HISTOGRAM)
+#define HAVE_BITBANG_STATUS
+#include "bitbang.h"
+#endif
+
+#ifdef CONFIG_ESP_DAP_WAIT_BACKOFF
+#include "wait_backoff.h"
+#endif
+
+#ifdef CONFIG_ESP_DAP_CLOCK_FALLBACK
+#include "clock_fallback.h"
+#endif
+
+#ifdef CONFIG_ESP_DAP_YIELD
+#include "dap_yield.h"
+#endif
+
+#if defined(CONFIG_ESP_DAP_SWO_UART) || defined(CONFIG_ESP_DAP_UART)
+#include "usart_esp32.h"
+#endif
+
+#ifdef CONFIG_ESP_DAP_SWO_MANCHESTER
+#include "swo_manchester.h"
+#endif
+
+#ifdef CONFIG_ESP_DAP_SWO_STREAM
+#include "swo_stream.h"
+#endif
+
+#ifdef CONFIG_ESP_DAP_SWO_ITM
+#include "itm.h"
+#endif
+
+#ifdef CONFIG_ESP_DAP_TRACE
+#include "dap_trace.h"
+#endif
+
 #ifdef CONFIG_ESP_WIFI_CONSOLE_COMMANDS
 #define NVS_NAMESPACE           "wifi_config"
 #define NVS_KEY_SSID            "ssid"
@@ -392,9 +458,371 @@ static int status_cmd_handler(int argc, char **argv)
 
     cmsis_dap_print_status();
 
+#ifdef CONFIG_ESP_DAP_WAIT_BACKOFF
+    wait_backoff_print_status();
+#endif
+
+#ifdef CONFIG_ESP_DAP_CLOCK_FALLBACK
+    clock_fallback_print_status();
+#endif
+
+#ifdef CONFIG_ESP_DAP_YIELD
+    dap_yield_print_status();
+#endif
+
 #ifdef CONFIG_ESP_UART_BRIDGE_ENABLED
     uart_bridge_print_status();
 #endif
+
+#ifdef CONFIG_ESP_UART_BRIDGE_TRIGGER
+    uart_trigger_print_status();
+#endif
+
+#if defined(CONFIG_ESP_DAP_SWO_UART) || defined(CONFIG_ESP_DAP_UART)
+    usart_esp32_print_status();
+#endif
+
+#ifdef CONFIG_ESP_DAP_SWO_MANCHESTER
+    swo_manchester_print_status();
+#endif
+
+#ifdef CONFIG_ESP_DAP_SWO_STREAM
+    swo_stream_print_status();
+#endif
+
+#ifdef CONFIG_ESP_DAP_SWO_ITM
+    itm_print_status();
+#endif
+
+#ifdef CONFIG_ESP_DAP_TRACE
+    dap_trace_print_status();
+#endif
+
+#ifdef CONFIG_ESP_CPU_USAGE
+    cpu_usage_print_status();
+#endif
+
+    dlog_print_status();
+    return 0;
+}
+
+#ifdef HAVE_PIN_MAPS
+// Pins command argument structure.
+static struct {
+    struct arg_int *values;
+    struct arg_end *end;
+} pins_args;
+
+static int pins_cmd_handler(int argc, char **argv)
+{
+    int nerrors = arg_parse(argc, argv, (void **) &pins_args);
+    if (nerrors != 0 || pins_args.values->count == 3) {
+        if (nerrors != 0)
+            arg_print_errors(stderr, pins_args.end, argv[0]);
+        printf("Usage: pins [<map> | <swclk> <swdio> [<tdi> <tdo>]]\n");
+        return 1;
+    }
+
+    int *v = pins_args.values->ival;
+    int ret = 0;
+
+    if (pins_args.values->count == 1) {
+        ret = pin_map_select(v[0]);
+    }
+    else if (pins_args.values->count >= 2) {
+        // Unspecified TDI/TDO keep their current values.
+        struct pin_map pins = pin_map;
+        pins.swclk_tck = v[0];
+        pins.swdio_tms = v[1];
+        if (pins_args.values->count == 4) {
+            pins.tdi = v[2];
+            pins.tdo = v[3];
+        }
+        ret = pin_map_set_runtime(&pins);
+    }
+    pin_map_print_status();
+    return ret < 0 ? 1 : 0;
+}
+#endif
+
+#ifdef HAVE_BITBANG_STATUS
+// Jitter command argument structure.
+static struct {
+    struct arg_str *action;
+    struct arg_end *end;
+} jitter_args;
+
+static int jitter_cmd_handler(int argc, char **argv)
+{
+    int nerrors = arg_parse(argc, argv, (void **) &jitter_args);
+    if (nerrors != 0) {
+        arg_print_errors(stderr, jitter_args.end, argv[0]);
+        printf("Usage: jitter [clear|on|off]\n");
+        return 1;
+    }
+
+    if (jitter_args.action->count > 0) {
+        const char *action = jitter_args.action->sval[0];
+
+        if (strcmp(action, "clear") == 0) {
+#ifdef CONFIG_ESP_DAP_JITTER_HISTOGRAM
+            bitbang_jitter_clear();
+#else
+            printf("jitter: no histogram, CONFIG_ESP_DAP_JITTER_HISTOGRAM "
+                    "is disabled.\n");
+            return 1;
+#endif
+        }
+        else if (strcmp(action, "on") == 0 || strcmp(action, "off") == 0) {
+#ifdef CONFIG_ESP_DAP_CRITICAL_SECTIONS
+            bitbang_set_critical(strcmp(action, "on") == 0);
+#else
+            printf("jitter: no interrupt masking, "
+                    "CONFIG_ESP_DAP_CRITICAL_SECTIONS is disabled.\n");
+            return 1;
+#endif
+        }
+        else {
+            printf("Usage: jitter [clear|on|off]\n");
+            return 1;
+        }
+    }
+    bitbang_print_status();
+    return 0;
+}
+#endif
+
+#ifdef CONFIG_ESP_DAP_SWO_ITM
+// ITM command argument structure.
+static struct {
+    struct arg_str *args;
+    struct arg_end *end;
+} itm_args;
+
+static int itm_cmd_handler(int argc, char **argv)
+{
+    int nerrors = arg_parse(argc, argv, (void **) &itm_args);
+    if (nerrors != 0) {
+        arg_print_errors(stderr, itm_args.end, argv[0]);
+        printf("Usage: itm [off | clear | <port mask> [ts] [data]]\n");
+        return 1;
+    }
+
+    int n = itm_args.args->count;
+    const char **args = itm_args.args->sval;
+
+    if (n == 1 && strcmp(args[0], "off") == 0) {
+        itm_configure(0, 0);
+    }
+    else if (n == 1 && strcmp(args[0], "clear") == 0) {
+        itm_clear_counters();
+    }
+    else if (n > 0) {
+        char *end;
+        uint32_t ports = strtoul(args[0], &end, 0);
+        uint32_t forward = 0;
+
+        if (*end != '\0' || ports == 0) {
+            printf("Usage: itm [off | clear | <port mask> [ts] [data]]\n");
+            return 1;
+        }
+        for (int i = 1; i < n; i++) {
+            if (strcmp(args[i], "ts") == 0) {
+                forward |= ITM_FWD_TIMESTAMPS;
+            }
+            else if (strcmp(args[i], "data") == 0) {
+                forward |= ITM_FWD_DATA_TRACE;
+            }
+            else {
+                printf("Usage: itm [off | clear | <port mask> [ts] "
+                        "[data]]\n");
+                return 1;
+            }
+        }
+        itm_configure(ports, forward);
+    }
+    itm_print_status();
+    return 0;
+}
+#endif
+
+#ifdef CONFIG_ESP_UART_BRIDGE_HISTORY
+// History command argument structure.
+static struct {
+    struct arg_str *replay;
+    struct arg_end *end;
+} history_args;
+
+static int history_cmd_handler(int argc, char **argv)
+{
+    int nerrors = arg_parse(argc, argv, (void **) &history_args);
+    if (nerrors != 0) {
+        arg_print_errors(stderr, history_args.end, argv[0]);
+        printf("Usage: history [<KiB> | <seconds>s]\n");
+        return 1;
+    }
+
+    if (history_args.replay->count > 0) {
+        char *end;
+        unsigned long n = strtoul(history_args.replay->sval[0], &end, 10);
+
+        if (strcmp(end, "s") == 0 && n > 0) {
+            uart_history_set_replay(0, n);
+        }
+        else if (*end == '\0') {
+            uart_history_set_replay(n, 0);
+        }
+        else {
+            printf("Usage: history [<KiB> | <seconds>s]\n");
+            return 1;
+        }
+    }
+    uart_bridge_print_history();
+    return 0;
+}
+#endif
+
+#ifdef CONFIG_ESP_UART_BRIDGE_TRIGGER
+// Trigger command argument structure.
+static struct {
+    struct arg_str *args;
+    struct arg_end *end;
+} trigger_args;
+
+static int trigger_cmd_handler(int argc, char **argv)
+{
+    int nerrors = arg_parse(argc, argv, (void **) &trigger_args);
+    if (nerrors != 0) {
+        arg_print_errors(stderr, trigger_args.end, argv[0]);
+        printf("Usage: trigger [arm | off | clear | add <pattern>]\n");
+        return 1;
+    }
+
+    int n = trigger_args.args->count;
+    const char **args = trigger_args.args->sval;
+
+    if (n == 1 && strcmp(args[0], "arm") == 0) {
+        uart_trigger_arm(true);
+    }
+    else if (n == 1 && strcmp(args[0], "off") == 0) {
+        uart_trigger_arm(false);
+    }
+    else if (n == 1 && strcmp(args[0], "clear") == 0) {
+        uart_trigger_clear();
+    }
+    else if (n == 2 && strcmp(args[0], "add") == 0) {
+        if (!uart_trigger_add(args[1])) {
+            printf("Pattern does not fit.\n");
+            return 1;
+        }
+    }
+    else if (n > 0) {
+        printf("Usage: trigger [arm | off | clear | add <pattern>]\n");
+        return 1;
+    }
+    uart_trigger_print_status();
+    return 0;
+}
+#endif
+
+#ifdef CONFIG_ESP_DAP_TRACE
+// DAP trace command argument structure.
+static struct {
+    struct arg_str *action;
+    struct arg_end *end;
+} dap_trace_args;
+
+static int dap_trace_cmd_handler(int argc, char **argv)
+{
+    int nerrors = arg_parse(argc, argv, (void **) &dap_trace_args);
+    if (nerrors != 0) {
+        arg_print_errors(stderr, dap_trace_args.end, argv[0]);
+        printf("Usage: dap_trace [<count> | on | off | clear]\n");
+        return 1;
+    }
+
+    if (dap_trace_args.action->count > 0) {
+        const char *action = dap_trace_args.action->sval[0];
+        char *end;
+        unsigned long count = strtoul(action, &end, 0);
+
+        if (strcmp(action, "on") == 0) {
+            dap_trace_enable(true);
+        }
+        else if (strcmp(action, "off") == 0) {
+            dap_trace_enable(false);
+        }
+        else if (strcmp(action, "clear") == 0) {
+            dap_trace_clear();
+        }
+        else if (*end == '\0' && end != action) {
+            dap_trace_print(count);
+        }
+        else {
+            printf("Usage: dap_trace [<count> | on | off | clear]\n");
+            return 1;
+        }
+    }
+    dap_trace_print_status();
+    return 0;
+}
+#endif
+
+#ifdef CONFIG_ESP_CPU_USAGE
+// Top command argument structure.
+static struct {
+    struct arg_str *action;
+    struct arg_end *end;
+} top_args;
+
+static int top_cmd_handler(int argc, char **argv)
+{
+    int nerrors = arg_parse(argc, argv, (void **) &top_args);
+    if (nerrors != 0) {
+        arg_print_errors(stderr, top_args.end, argv[0]);
+        printf("Usage: top [off]\n");
+        return 1;
+    }
+
+    if (top_args.action->count > 0) {
+        if (strcmp(top_args.action->sval[0], "off") != 0) {
+            printf("Usage: top [off]\n");
+            return 1;
+        }
+        cpu_usage_stop();
+        cpu_usage_print_status();
+        return 0;
+    }
+    cpu_usage_query();
+    cpu_usage_print();
+    return 0;
+}
+#endif
+
+// Log command argument structure.
+static struct {
+    struct arg_str *subsys;
+    struct arg_str *level;
+    struct arg_end *end;
+} log_args;
+
+static int log_cmd_handler(int argc, char **argv)
+{
+    int nerrors = arg_parse(argc, argv, (void **) &log_args);
+    if (nerrors != 0 || log_args.subsys->count != log_args.level->count) {
+        if (nerrors != 0)
+            arg_print_errors(stderr, log_args.end, argv[0]);
+        printf("Usage: log [<subsystem>|all <level>]\n");
+        return 1;
+    }
+
+    if (log_args.subsys->count > 0 &&
+            !dlog_set_level(log_args.subsys->sval[0],
+                log_args.level->sval[0])) {
+        printf("Unknown subsystem or level.\n");
+        return 1;
+    }
+    dlog_print_status();
     return 0;
 }
 
@@ -406,6 +834,41 @@ static int help_cmd_handler(int argc, char **argv)
            "credentials.\n");
     printf("  reboot - Restart the device.\n");
     printf("  status - Report network status.\n");
+#ifdef HAVE_PIN_MAPS
+    printf("  pins [<map> | <swclk> <swdio> [<tdi> <tdo>]] - Show or select "
+           "the SWD/JTAG\n    pin map, or set the runtime pin map.\n");
+#endif
+#ifdef HAVE_BITBANG_STATUS
+    printf("  jitter [clear|on|off] - Show SWD/JTAG timing, clear the "
+           "histogram or\n    enable/disable interrupt masking during "
+           "transfers.\n");
+#endif
+#ifdef CONFIG_ESP_DAP_SWO_ITM
+    printf("  itm [off | clear | <port mask> [ts] [data]] - Show ITM packet "
+           "counts, stream\n    raw SWO, or forward only the stimulus ports "
+           "in the mask, optionally\n    with timestamps and data trace.\n");
+#endif
+#ifdef CONFIG_ESP_UART_BRIDGE_HISTORY
+    printf("  history [<KiB> | <seconds>s] - Show the UART bridge history, or "
+           "replay the\n    last KiB or seconds of it to new clients.\n");
+#endif
+#ifdef CONFIG_ESP_UART_BRIDGE_TRIGGER
+    printf("  trigger [arm | off | clear | add <pattern>] - Show the UART "
+           "trigger, arm or\n    disarm it, or change the patterns that halt "
+           "the target.\n");
+#endif
+#ifdef CONFIG_ESP_DAP_TRACE
+    printf("  dap_trace [<count> | on | off | clear] - Show the DAP request "
+           "trace, print\n    the last requests, or stop, restart or clear "
+           "the trace.\n");
+#endif
+#ifdef CONFIG_ESP_CPU_USAGE
+    printf("  top [off] - Show the CPU usage of each core and task, and "
+           "keep sampling it,\n    or stop sampling.\n");
+#endif
+    printf("  log [<subsystem>|all <level>] - Show the log levels, or set "
+           "the level of\n    main, dap, bridge or all to off, error, warn, "
+           "info or debug.\n");
     return 0;
 }
 
@@ -482,6 +945,127 @@ static void commands_init(void)
     };
     printf("Enabling console commands.\n");
     ESP_ERROR_CHECK(esp_console_cmd_register(&wifi_cmd));
+
+#ifdef HAVE_PIN_MAPS
+    pins_args.values = arg_intn(NULL, NULL, "<n>", 0, 4, "Pin map number, "
+            "or GPIO numbers for the runtime pin map");
+    pins_args.end = arg_end(4);
+
+    const esp_console_cmd_t pins_cmd = {
+        .command = "pins",
+        .help = "Show or select the SWD/JTAG pin map",
+        .hint = NULL,
+        .func = &pins_cmd_handler,
+        .argtable = &pins_args
+    };
+    ESP_ERROR_CHECK(esp_console_cmd_register(&pins_cmd));
+#endif
+
+#ifdef HAVE_BITBANG_STATUS
+    jitter_args.action =
+        arg_str0(NULL, NULL, "[clear|on|off]", "Clear histogram, or enable "
+                "/ disable interrupt masking");
+    jitter_args.end = arg_end(1);
+
+    const esp_console_cmd_t jitter_cmd = {
+        .command = "jitter",
+        .help = "Show SWD/JTAG clock timing",
+        .hint = NULL,
+        .func = &jitter_cmd_handler,
+        .argtable = &jitter_args
+    };
+    ESP_ERROR_CHECK(esp_console_cmd_register(&jitter_cmd));
+#endif
+
+#ifdef CONFIG_ESP_DAP_SWO_ITM
+    itm_args.args = arg_strn(NULL, NULL, "<arg>", 0, 3, "off, clear, or "
+            "stimulus port mask followed by ts and/or data");
+    itm_args.end = arg_end(3);
+
+    const esp_console_cmd_t itm_cmd = {
+        .command = "itm",
+        .help = "Show or configure the SWO ITM decoder",
+        .hint = NULL,
+        .func = &itm_cmd_handler,
+        .argtable = &itm_args
+    };
+    ESP_ERROR_CHECK(esp_console_cmd_register(&itm_cmd));
+#endif
+
+#ifdef CONFIG_ESP_UART_BRIDGE_HISTORY
+    history_args.replay = arg_str0(NULL, NULL, "<replay>", "KiB, or "
+            "seconds followed by 's', to replay on connect");
+    history_args.end = arg_end(1);
+
+    const esp_console_cmd_t history_cmd = {
+        .command = "history",
+        .help = "Show or configure the UART bridge history",
+        .hint = NULL,
+        .func = &history_cmd_handler,
+        .argtable = &history_args
+    };
+    ESP_ERROR_CHECK(esp_console_cmd_register(&history_cmd));
+#endif
+
+#ifdef CONFIG_ESP_UART_BRIDGE_TRIGGER
+    trigger_args.args = arg_strn(NULL, NULL, "<arg>", 0, 2, "arm, off, "
+            "clear, or add followed by a pattern");
+    trigger_args.end = arg_end(2);
+
+    const esp_console_cmd_t trigger_cmd = {
+        .command = "trigger",
+        .help = "Show or configure the UART pattern trigger",
+        .hint = NULL,
+        .func = &trigger_cmd_handler,
+        .argtable = &trigger_args
+    };
+    ESP_ERROR_CHECK(esp_console_cmd_register(&trigger_cmd));
+#endif
+
+#ifdef CONFIG_ESP_DAP_TRACE
+    dap_trace_args.action = arg_str0(NULL, NULL, "<action>", "count of "
+            "requests to print, on, off or clear");
+    dap_trace_args.end = arg_end(1);
+
+    const esp_console_cmd_t dap_trace_cmd = {
+        .command = "dap_trace",
+        .help = "Show the DAP request trace",
+        .hint = NULL,
+        .func = &dap_trace_cmd_handler,
+        .argtable = &dap_trace_args
+    };
+    ESP_ERROR_CHECK(esp_console_cmd_register(&dap_trace_cmd));
+#endif
+
+#ifdef CONFIG_ESP_CPU_USAGE
+    top_args.action = arg_str0(NULL, NULL, "<action>", "off to stop "
+            "sampling");
+    top_args.end = arg_end(1);
+
+    const esp_console_cmd_t top_cmd = {
+        .command = "top",
+        .help = "Show the CPU usage of each task",
+        .hint = NULL,
+        .func = &top_cmd_handler,
+        .argtable = &top_args
+    };
+    ESP_ERROR_CHECK(esp_console_cmd_register(&top_cmd));
+#endif
+
+    log_args.subsys = arg_str0(NULL, NULL, "<subsystem>", "main, dap, "
+            "bridge, trace or all");
+    log_args.level = arg_str0(NULL, NULL, "<level>", "off, error, warn, "
+            "info or debug");
+    log_args.end = arg_end(2);
+
+    const esp_console_cmd_t log_cmd = {
+        .command = "log",
+        .help = "Show or set the log levels",
+        .hint = NULL,
+        .func = &log_cmd_handler,
+        .argtable = &log_args
+    };
+    ESP_ERROR_CHECK(esp_console_cmd_register(&log_cmd));
     ESP_ERROR_CHECK(esp_console_start_repl(repl));
 }
 #endif
@@ -491,14 +1075,15 @@ static void event_handler(void* arg, esp_event_base_t event_base,
 {
     if (event_base == WIFI_EVENT) {
         if (event_id == WIFI_EVENT_STA_START) {
-            printf("Attempting to connect to WiFi SSID: '%s'\n", wifi_ssid);
+            DLOG_INFO(DLOG_MAIN, "Attempting to connect to WiFi SSID: "
+                    "'%s'\n", wifi_ssid);
             esp_wifi_connect();
         }
         else if (event_id == WIFI_EVENT_STA_CONNECTED) {
             int rssi = 0;
             esp_wifi_sta_get_rssi(&rssi);
-            printf("Connected to WiFi SSID: '%s'. RSSI: %d dBm\n", wifi_ssid,
-                    rssi);
+            DLOG_INFO(DLOG_MAIN, "Connected to WiFi SSID: '%s'. RSSI: %d "
+                    "dBm\n", wifi_ssid, rssi);
             wifi_connected = true;
         }
         else if (event_id == WIFI_EVENT_STA_DISCONNECTED) {
@@ -514,19 +1099,22 @@ static void event_handler(void* arg, esp_event_base_t event_base,
                 reboot();       // Does not return.
             }
             if (wifi_retry_num < CONFIG_ESP_MAXIMUM_RETRY) {
-                printf("Retrying connection to WiFi SSID: '%s'\n", wifi_ssid);
+                DLOG_WARN(DLOG_MAIN, "Retrying connection to WiFi SSID: "
+                        "'%s'\n", wifi_ssid);
                 esp_wifi_connect();
                 wifi_retry_num++;
             }
             else {
-                printf("Failed to connect to WiFi SSID: '%s'.\n", wifi_ssid);
+                DLOG_ERROR(DLOG_MAIN, "Failed to connect to WiFi SSID: "
+                        "'%s'.\n", wifi_ssid);
                 xEventGroupSetBits(wifi_event_group, WIFI_FAIL_BIT);
             }
         }
     }
     else if (event_base == IP_EVENT && event_id == IP_EVENT_STA_GOT_IP) {
         ip_event_got_ip_t* event = (ip_event_got_ip_t*) event_data;
-        printf("IP address: " IPSTR "\n", IP2STR(&event->ip_info.ip));
+        DLOG_INFO(DLOG_MAIN, "IP address: " IPSTR "\n",
+                IP2STR(&event->ip_info.ip));
         wifi_retry_num = 0;
         xEventGroupSetBits(wifi_event_group, WIFI_CONNECTED_BIT);
     }
@@ -535,9 +1123,12 @@ static void event_handler(void* arg, esp_event_base_t event_base,
         ip_event_got_ip6_t* event = (ip_event_got_ip6_t*) event_data;
         esp_ip6_addr_type_t ipv6_type =
             esp_netif_ip6_get_addr_type(&event->ip6_info.ip);
-        printf("IPv6 address (%s): " IPV6STR "\n",
+        // IPV6STR takes more arguments than DLOG() does.
+        char ip_str[40];
+        esp_ip6addr_ntoa(&event->ip6_info.ip, ip_str, sizeof(ip_str));
+        DLOG_INFO(DLOG_MAIN, "IPv6 address (%s): %s\n",
                 (ipv6_type == ESP_IP6_ADDR_IS_LINK_LOCAL) ? "link-local" :
-                "global", IPV62STR(event->ip6_info.ip));
+                "global", ip_str);
     }
 #endif
 }
@@ -583,12 +1174,13 @@ int wifi_init(void)
         wifi_ssid = stored_ssid;
         wifi_password = stored_password;
         wifi_auth_mode = stored_auth_mode;
-        printf("Using WiFi credentials from flash.\n");
+        DLOG_INFO(DLOG_MAIN, "Using WiFi credentials from flash.\n");
     } else {
-        printf("Using WiFi credentials from hardcoded CONFIG.\n");
+        DLOG_INFO(DLOG_MAIN, "Using WiFi credentials from hardcoded "
+                "CONFIG.\n");
     }
 #else
-    printf("Using WiFi credentials from hardcoded CONFIG.\n");
+    DLOG_INFO(DLOG_MAIN, "Using WiFi credentials from hardcoded CONFIG.\n");
 #endif
 
     wifi_config_t wifi_config = {
@@ -623,14 +1215,16 @@ int wifi_init(void)
 #ifdef CONFIG_ESP_DAP_DISABLE_WIFI_POWER_SAVE
         // Disable power-save to improve WiFi performance.
         // https://github.com/espressif/arduino-esp32/issues/1484
-        printf("Disabling WiFi power savings to improve performance.\n");
+        DLOG_INFO(DLOG_MAIN, "Disabling WiFi power savings to improve "
+                "performance.\n");
         esp_wifi_set_ps(WIFI_PS_NONE);
 #endif
 #ifdef CONFIG_LWIP_IPV6
         // Trigger IPv6 SLAAC auto-configuration, after IPv4 is up.
         esp_err_t err = esp_netif_create_ip6_linklocal(sta_netif);
         if (err != ESP_OK)
-            perror("Failed to create IPv6 link local address");
+            DLOG_ERROR(DLOG_MAIN, "Failed to create IPv6 link local "
+                    "address: %s\n", esp_err_to_name(err));
 #endif
         return 0;   // Success.
     }
@@ -642,6 +1236,9 @@ void app_main(void)
     // Initialize the JTAG/SWD port pins.
     DAP_Setup();
 
+    // Print the messages of the other tasks.
+    dlog_init();
+
     printf("CMSIS-DAP TCP running on ESP32\n");
     printf("ESP-IDF version: %s\n", IDF_VER);
 
@@ -693,10 +1290,20 @@ void app_main(void)
     }
     ESP_ERROR_CHECK(ret);
 
+#ifdef CMSIS_DAP_LOCK
+    // Before the console and the UART bridge can use it.
+    cmsis_dap_lock_init();
+#endif
+
 #ifdef CONFIG_ESP_WIFI_CONSOLE_COMMANDS
     commands_init();
 #endif
 
+#ifdef CONFIG_ESP_UART_BRIDGE_ENABLED
+    // Start receiving from the UART before WiFi is up, for the history.
+    bool uart_bridge_ok = (uart_bridge_init() == 0);
+#endif
+
     /* Initialize WiFi and connect to AP. If unable to connect after retries,
      * then force a reboot in an attempt to recover.
      */
@@ -706,13 +1313,25 @@ void app_main(void)
     }
 
 #ifdef CONFIG_ESP_UART_BRIDGE_ENABLED
-    xTaskCreate(uart_bridge_task, "uart_bridge_task", 4096, NULL, 5, NULL);
+    if (uart_bridge_ok) {
+        xTaskCreate(uart_bridge_task, "uart_bridge_task", 4096, NULL, 5,
+                NULL);
+    }
+#endif
+
+#ifdef CONFIG_ESP_DAP_SWO_STREAM
+    xTaskCreate(swo_stream_task, "swo_stream_task", 4096, NULL, 5, NULL);
+#endif
+
+#ifdef CONFIG_ESP_DAP_TRACE
+    xTaskCreate(dap_trace_task, "dap_trace_task", 3072, NULL, 2, NULL);
 #endif
 
-    xTaskCreate(cmsis_dap_tcp_task, "cmsis_dap_tcp_task", 4096, NULL, 5, NULL);
+    xTaskCreatePinnedToCore(cmsis_dap_tcp_task, "cmsis_dap_tcp_task", 4096,
+            NULL, CONFIG_ESP_DAP_TASK_PRIORITY, NULL, CMSIS_DAP_TASK_CORE);
     cmsis_dap_tcp_initialized = true;
 
-#ifdef CONFIG_ESP_PRINT_CPU_USAGE
+#ifdef CONFIG_ESP_CPU_USAGE
     xTaskCreatePinnedToCore(cpu_usage_task, "cpu_usage", 4096, NULL,
             CPU_USAGE_TASK_PRIO, NULL, tskNO_AFFINITY);
 #endif
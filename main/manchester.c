@@ -0,0 +1,116 @@
+/*
+ * SPDX-FileCopyrightText: Brian Kuschak <bkuschak@gmail.com>
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * SWO Manchester decoder.
+ *
+ * An SWO Manchester packet starts from the idle (low) line with a start bit,
+ * followed by the data bytes, LSB first, and ends with the line low for at
+ * least one bit period. Each bit has a transition in the middle of its bit
+ * period: high to low for a 1, low to high for a 0. The start bit is a 1, so
+ * the first pulse of every packet is high for exactly half a bit period. The
+ * decoder measures that pulse to find the bit rate of each packet, then
+ * tracks small drifts over the rest of the packet.
+ *
+ * The input is the sequence of pulse durations between edges, in arbitrary
+ * time units (ticks). Once locked, a pulse of about one half-bit period
+ * moves from the middle of a bit to the bit boundary or back; a pulse of a
+ * full bit period moves from the middle of one bit to the middle of the
+ * next. The level of a pulse that ends in the middle of a bit is the value
+ * of that bit.
+ */
+
+#include <stdbool.h>
+#include "manchester.h"
+
+enum {
+    STATE_IDLE,         // Waiting for a start bit.
+    STATE_MID,          // At the middle of a bit.
+    STATE_BOUNDARY,     // At a bit boundary.
+};
+
+void manchester_init(manchester_decoder_t *d, uint32_t min_half,
+        uint32_t max_half)
+{
+    *d = (manchester_decoder_t) {
+        .min_half = min_half,
+        .max_half = max_half,
+        .state = STATE_IDLE,
+    };
+}
+
+static void end_packet(manchester_decoder_t *d, bool ok)
+{
+    if(ok && d->nbits == 0) {
+        d->packets++;
+        d->last_half = d->half;
+    }
+    else {
+        d->errors++;
+    }
+    d->state = STATE_IDLE;
+}
+
+// Follow slow drifts of the bit rate within a packet.
+static void track(manchester_decoder_t *d, uint32_t half)
+{
+    d->half += ((int32_t)half - (int32_t)d->half) / 8;
+}
+
+int manchester_decode_pulse(manchester_decoder_t *d, int level,
+        uint32_t duration)
+{
+    uint32_t t;
+    uint32_t h = d->half;
+
+    if(d->state == STATE_IDLE) {
+        // The first half of the start bit.
+        if(level && duration >= d->min_half && duration <= d->max_half) {
+            d->half = duration * 16;
+            d->byte = 0;
+            d->nbits = 0;
+            d->state = STATE_MID;
+        }
+        return MANCHESTER_NO_BYTE;
+    }
+
+    t = (duration > UINT32_MAX / 16) ? UINT32_MAX : duration * 16;
+
+    if(!level && (t > h * 5 / 2 ||
+                (d->state == STATE_BOUNDARY && t >= h * 3 / 2))) {
+        // The line went idle.
+        end_packet(d, true);
+        return MANCHESTER_NO_BYTE;
+    }
+    if(t < h / 2 || t > h * 5 / 2) {
+        end_packet(d, false);
+        return MANCHESTER_NO_BYTE;
+    }
+
+    if(t < h * 3 / 2) {
+        // Half a bit period.
+        track(d, t);
+        if(d->state == STATE_MID) {
+            d->state = STATE_BOUNDARY;
+            return MANCHESTER_NO_BYTE;
+        }
+        d->state = STATE_MID;
+    }
+    else {
+        // A full bit period, only possible from the middle of a bit.
+        if(d->state == STATE_BOUNDARY) {
+            end_packet(d, false);
+            return MANCHESTER_NO_BYTE;
+        }
+        track(d, t / 2);
+    }
+
+    d->byte |= (level ? 1 : 0) << d->nbits;
+    if(++d->nbits < 8)
+        return MANCHESTER_NO_BYTE;
+
+    int byte = d->byte;
+    d->byte = 0;
+    d->nbits = 0;
+    return byte;
+}
@@ -0,0 +1,51 @@
+#ifndef MANCHESTER_H
+#define MANCHESTER_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Returned by manchester_decode_pulse() when no byte was completed.
+#define MANCHESTER_NO_BYTE      (-1)
+
+// Pulse duration that ends the current packet, e.g. at the end of a
+// captured frame.
+#define MANCHESTER_IDLE         UINT32_MAX
+
+// Decoder for SWO Manchester packets. Has no hardware dependencies, so it
+// can be fed with recorded pulse trains on any machine.
+typedef struct {
+    // Configuration.
+    uint32_t min_half;      // Shortest accepted half-bit period, in ticks.
+    uint32_t max_half;      // Longest accepted half-bit period, in ticks.
+
+    // State.
+    uint8_t state;
+    uint8_t byte;           // Bits received so far, LSB first.
+    uint8_t nbits;
+    uint32_t half;          // Half-bit period of this packet, ticks * 16.
+
+    // Statistics.
+    uint32_t packets;       // Packets decoded without error.
+    uint32_t errors;        // Packets with invalid timing or a partial byte.
+    uint32_t last_half;     // Half-bit period of the last good packet, ticks * 16.
+} manchester_decoder_t;
+
+// Initialize the decoder. Half-bit periods outside [min_half, max_half]
+// ticks are not accepted as the start of a packet.
+void manchester_init(manchester_decoder_t *d, uint32_t min_half,
+        uint32_t max_half);
+
+// Feed one pulse, i.e. the line stayed at 'level' (0 or 1) for 'duration'
+// ticks. Returns the next data byte if this pulse completed one, otherwise
+// MANCHESTER_NO_BYTE.
+int manchester_decode_pulse(manchester_decoder_t *d, int level,
+        uint32_t duration);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // MANCHESTER_H
@@ -0,0 +1,135 @@
+/*
+ * SPDX-FileCopyrightText: Brian Kuschak <bkuschak@gmail.com>
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Selection of the GPIO pins used for SWD/JTAG.
+ *
+ * SW_DP.c and JTAG_DP.c compile a separate set of transfer functions with
+ * constant GPIO numbers for each pin map fixed at compile time, so any of
+ * them runs as fast as the single-map build. The runtime map uses transfer
+ * functions that read the GPIO numbers from 'pin_map' instead, which is a
+ * little slower. Sequences and pin commands always use 'pin_map'.
+ */
+
+#include <stdio.h>
+#include "driver/gpio.h"
+#include "DAP_config.h"
+#include "DAP.h"
+#include "cmsis_dap_tcp.h"
+#include "pin_map.h"
+
+#if DAP_JTAG
+#define PIN_MAP_INIT(n) { PIN_MAP##n##_SWCLK_TCK, PIN_MAP##n##_SWDIO_TMS, \
+                          PIN_MAP##n##_TDI, PIN_MAP##n##_TDO }
+#else
+#define PIN_MAP_INIT(n) { PIN_MAP##n##_SWCLK_TCK, PIN_MAP##n##_SWDIO_TMS, \
+                          GPIO_NUM_NC, GPIO_NUM_NC }
+#endif
+
+#define PIN_MAP_TOTAL   (PIN_MAP_COUNT + PIN_MAP_RUNTIME)
+
+static const struct pin_map pin_maps[PIN_MAP_COUNT] = {
+    PIN_MAP_INIT(0),
+#if PIN_MAP_COUNT > 1
+    PIN_MAP_INIT(1),
+#endif
+};
+
+#if PIN_MAP_RUNTIME
+static struct pin_map runtime_map = PIN_MAP_INIT(0);
+#endif
+
+struct pin_map pin_map = PIN_MAP_INIT(0);
+uint32_t pin_map_index;
+
+// Called with the DAP lock held, so no command is using the pins.
+static int pin_map_select_locked(uint32_t index)
+{
+    if (index >= PIN_MAP_TOTAL) {
+        fprintf(stderr, "pin_map: no pin map %lu.\n", index);
+        return -1;
+    }
+
+    // The pins are configured when the debug port is connected, and
+    // released when it is disconnected.
+    if (DAP_Data.debug_port != DAP_PORT_DISABLED) {
+        fprintf(stderr, "pin_map: cannot change pins while the debug port "
+                "is connected.\n");
+        return -1;
+    }
+
+#if PIN_MAP_RUNTIME
+    if (index == PIN_MAP_RUNTIME_INDEX)
+        pin_map = runtime_map;
+    else
+#endif
+        pin_map = pin_maps[index];
+    pin_map_index = index;
+    return 0;
+}
+
+int pin_map_select(uint32_t index)
+{
+    cmsis_dap_lock();
+    int ret = pin_map_select_locked(index);
+    cmsis_dap_unlock();
+    return ret;
+}
+
+int pin_map_set_runtime(const struct pin_map *pins)
+{
+#if PIN_MAP_RUNTIME
+    const uint8_t outputs[] = { pins->swclk_tck, pins->swdio_tms,
+#if DAP_JTAG
+        pins->tdi
+#endif
+    };
+
+    for (int i = 0; i < sizeof(outputs); i++) {
+        if (!GPIO_IS_VALID_OUTPUT_GPIO(outputs[i])) {
+            fprintf(stderr, "pin_map: invalid GPIO %u.\n", outputs[i]);
+            return -1;
+        }
+    }
+#if DAP_JTAG
+    if (!GPIO_IS_VALID_GPIO(pins->tdo)) {
+        fprintf(stderr, "pin_map: invalid GPIO %u.\n", pins->tdo);
+        return -1;
+    }
+#endif
+
+    cmsis_dap_lock();
+    struct pin_map old = runtime_map;
+    runtime_map = *pins;
+    int ret = pin_map_select_locked(PIN_MAP_RUNTIME_INDEX);
+    if (ret < 0)
+        runtime_map = old;
+    cmsis_dap_unlock();
+    return ret;
+#else
+    fprintf(stderr, "pin_map: runtime pin map is not enabled.\n");
+    return -1;
+#endif
+}
+
+void pin_map_print_status(void)
+{
+    for (uint32_t i = 0; i < PIN_MAP_TOTAL; i++) {
+        const struct pin_map *m;
+#if PIN_MAP_RUNTIME
+        if (i == PIN_MAP_RUNTIME_INDEX)
+            m = &runtime_map;
+        else
+#endif
+            m = &pin_maps[i];
+
+        printf("%c pin map %lu%s: SWCLK/TCK %u, SWDIO/TMS %u",
+                i == pin_map_index ? '*' : ' ', i,
+                i >= PIN_MAP_COUNT ? " (runtime)" : "", m->swclk_tck,
+                m->swdio_tms);
+#if DAP_JTAG
+        printf(", TDI %u, TDO %u", m->tdi, m->tdo);
+#endif
+        printf("\n");
+    }
+}
@@ -0,0 +1,37 @@
+#ifndef PIN_MAP_H
+#define PIN_MAP_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// GPIO numbers of the bit-banged SWD/JTAG pins.
+struct pin_map {
+    uint8_t swclk_tck;
+    uint8_t swdio_tms;
+    uint8_t tdi;
+    uint8_t tdo;
+};
+
+// Active pin map and its index. Maps 0 .. PIN_MAP_COUNT-1 are fixed at compile
+// time. If enabled, the runtime map has index PIN_MAP_RUNTIME_INDEX.
+extern struct pin_map pin_map;
+extern uint32_t pin_map_index;
+
+// Select the pins used for SWD/JTAG. Only allowed while the debug port is
+// disconnected. Waits for the DAP command in progress, if any, to finish.
+// Returns 0 on success, -1 on failure.
+int pin_map_select(uint32_t index);
+
+// Set the GPIO numbers of the runtime map, and select it.
+int pin_map_set_runtime(const struct pin_map *pins);
+
+void pin_map_print_status(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // PIN_MAP_H
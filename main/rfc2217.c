@@ -0,0 +1,431 @@
+/*
+ * SPDX-FileCopyrightText: Brian Kuschak <bkuschak@gmail.com>
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * RFC 2217 (Telnet COM port control) for the UART bridge.
+ *
+ * With CONFIG_ESP_UART_BRIDGE_RFC2217 the bridge speaks Telnet instead of raw
+ * TCP, and the client can change the UART's baud rate, data bits, parity,
+ * stop bits and flow control at runtime, e.g. with pyserial:
+ *
+ *     python -m serial.tools.miniterm rfc2217://192.168.1.5:4442 921600
+ *
+ * The Telnet options BINARY, SUPPRESS-GO-AHEAD, ECHO (the target echoes) and
+ * COM-PORT-OPTION are accepted, all others refused. Line and modem state
+ * notifications are not sent. A break is generated by inverting the TX line.
+ * Settings are kept when the client disconnects. Each bridged UART has its
+ * own session.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "soc/soc_caps.h"
+#include "sdkconfig.h"
+#include "rfc2217.h"
+
+// Telnet commands.
+#define SE                  240
+#define SB                  250
+#define WILL                251
+#define WONT                252
+#define DO                  253
+#define DONT                254
+#define IAC                 255
+
+// Telnet options.
+#define OPT_BINARY          0
+#define OPT_ECHO            1
+#define OPT_SGA             3
+#define OPT_COM_PORT        44
+
+// COM-PORT-OPTION commands, client to server. The server's reply adds 100.
+#define CPO_SIGNATURE       0
+#define CPO_SET_BAUDRATE    1
+#define CPO_SET_DATASIZE    2
+#define CPO_SET_PARITY      3
+#define CPO_SET_STOPSIZE    4
+#define CPO_SET_CONTROL     5
+#define CPO_FLOW_SUSPEND    8
+#define CPO_FLOW_RESUME     9
+#define CPO_LINESTATE_MASK  10
+#define CPO_MODEMSTATE_MASK 11
+#define CPO_PURGE_DATA      12
+#define CPO_SERVER_OFFSET   100
+
+// SET-CONTROL values.
+#define CTL_FLOW_QUERY      0
+#define CTL_FLOW_NONE       1
+#define CTL_FLOW_HARDWARE   3
+#define CTL_BREAK_QUERY     4
+#define CTL_BREAK_ON        5
+#define CTL_BREAK_OFF       6
+#define CTL_RTS_QUERY       10
+#define CTL_RTS_ON          11
+#define CTL_RTS_OFF         12
+
+#define SIGNATURE           "cmsis_dap_tcp_esp32"
+#define MAX_SB              RFC2217_MAX_SB
+#define RX_FLOW_CTRL_THRESH 100     // Same as uart_bridge.c.
+
+enum {
+    STATE_DATA,
+    STATE_IAC,
+    STATE_OPTION,       // After WILL/WONT/DO/DONT.
+    STATE_SB,
+    STATE_SB_IAC,
+};
+
+void rfc2217_init(struct rfc2217 *s, uart_port_t port, rfc2217_reply_t reply,
+        void *ctx)
+{
+    s->port = port;
+    s->reply = reply;
+    s->ctx = ctx;
+    s->state = STATE_DATA;
+    s->sb_len = 0;
+    s->will = 0;
+    s->do_ = 0;
+    s->suspended = false;
+}
+
+bool rfc2217_suspended(const struct rfc2217 *s)
+{
+    return s->suspended;
+}
+
+size_t rfc2217_escape(const uint8_t *in, size_t len, uint8_t *out)
+{
+    size_t n = 0;
+
+    for(size_t i = 0; i < len; i++) {
+        out[n++] = in[i];
+        if(in[i] == IAC)
+            out[n++] = IAC;
+    }
+    return n;
+}
+
+static void send_option(struct rfc2217 *s, uint8_t cmd, uint8_t option)
+{
+    uint8_t buf[3] = { IAC, cmd, option };
+    s->reply(s->ctx, buf, sizeof(buf));
+}
+
+// Reply to a COM-PORT-OPTION command with a 'len' byte big endian 'value'.
+static void send_sb(struct rfc2217 *s, uint8_t cmd, uint32_t value, size_t len)
+{
+    uint8_t buf[4 + 2 * 4 + 2];
+    size_t n = 0;
+
+    buf[n++] = IAC;
+    buf[n++] = SB;
+    buf[n++] = OPT_COM_PORT;
+    buf[n++] = cmd + CPO_SERVER_OFFSET;
+    while(len-- > 0) {
+        buf[n++] = value >> (8 * len);
+        if(buf[n - 1] == IAC)
+            buf[n++] = IAC;
+    }
+    buf[n++] = IAC;
+    buf[n++] = SE;
+    s->reply(s->ctx, buf, n);
+}
+
+static void send_signature(struct rfc2217 *s)
+{
+    uint8_t buf[4 + sizeof(SIGNATURE) + 1];
+    size_t n = 0;
+
+    buf[n++] = IAC;
+    buf[n++] = SB;
+    buf[n++] = OPT_COM_PORT;
+    buf[n++] = CPO_SIGNATURE + CPO_SERVER_OFFSET;
+    memcpy(&buf[n], SIGNATURE, sizeof(SIGNATURE) - 1);
+    n += sizeof(SIGNATURE) - 1;
+    buf[n++] = IAC;
+    buf[n++] = SE;
+    s->reply(s->ctx, buf, n);
+}
+
+// Answer WILL/WONT/DO/DONT, only when our state changes, so the two sides
+// cannot loop.
+static void negotiate(struct rfc2217 *s, uint8_t cmd, uint8_t option)
+{
+    uint64_t bit = (option < 64) ? (1ULL << option) : 0;
+    bool supported = bit != 0 && (option == OPT_BINARY || option == OPT_SGA ||
+            option == OPT_ECHO || option == OPT_COM_PORT);
+
+    switch(cmd) {
+        case DO:
+            // Client asks us to enable an option. COM-PORT-OPTION is only
+            // enabled by the client.
+            if(supported && option != OPT_COM_PORT) {
+                if(!(s->will & bit)) {
+                    s->will |= bit;
+                    send_option(s, WILL, option);
+                }
+            }
+            else {
+                send_option(s, WONT, option);
+            }
+            break;
+        case DONT:
+            if(s->will & bit) {
+                s->will &= ~bit;
+                send_option(s, WONT, option);
+            }
+            break;
+        case WILL:
+            // Client offers to enable an option.
+            if(supported && option != OPT_ECHO) {
+                if(!(s->do_ & bit)) {
+                    s->do_ |= bit;
+                    send_option(s, DO, option);
+                }
+            }
+            else {
+                send_option(s, DONT, option);
+            }
+            break;
+        case WONT:
+            if(s->do_ & bit) {
+                s->do_ &= ~bit;
+                send_option(s, DONT, option);
+            }
+            break;
+    }
+}
+
+static uint32_t get_baudrate(struct rfc2217 *s)
+{
+    uint32_t baud = 0;
+    uart_get_baudrate(s->port, &baud);
+    return baud;
+}
+
+static uint8_t get_datasize(struct rfc2217 *s)
+{
+    uart_word_length_t bits = UART_DATA_8_BITS;
+    uart_get_word_length(s->port, &bits);
+    return 5 + (bits - UART_DATA_5_BITS);
+}
+
+static uint8_t get_parity(struct rfc2217 *s)
+{
+    uart_parity_t parity = UART_PARITY_DISABLE;
+    uart_get_parity(s->port, &parity);
+    if(parity == UART_PARITY_ODD)
+        return 2;
+    if(parity == UART_PARITY_EVEN)
+        return 3;
+    return 1;
+}
+
+static uint8_t get_stopsize(struct rfc2217 *s)
+{
+    uart_stop_bits_t stop = UART_STOP_BITS_1;
+    uart_get_stop_bits(s->port, &stop);
+    if(stop == UART_STOP_BITS_2)
+        return 2;
+    if(stop == UART_STOP_BITS_1_5)
+        return 3;
+    return 1;
+}
+
+static uint8_t get_flow(struct rfc2217 *s)
+{
+    uart_hw_flowcontrol_t flow = UART_HW_FLOWCTRL_DISABLE;
+    uart_get_hw_flow_ctrl(s->port, &flow);
+    return flow == UART_HW_FLOWCTRL_DISABLE ? CTL_FLOW_NONE :
+        CTL_FLOW_HARDWARE;
+}
+
+static void set_control(struct rfc2217 *s, uint8_t value)
+{
+    switch(value) {
+        case CTL_FLOW_NONE:
+            uart_set_hw_flow_ctrl(s->port, UART_HW_FLOWCTRL_DISABLE, 0);
+            break;
+#ifdef CONFIG_ESP_UART_BRIDGE_FLOW_CONTROL
+        case CTL_FLOW_HARDWARE:
+            uart_set_hw_flow_ctrl(s->port, UART_HW_FLOWCTRL_CTS_RTS,
+                    RX_FLOW_CTRL_THRESH);
+            break;
+#endif
+        case CTL_BREAK_ON:
+        case CTL_BREAK_OFF:
+            // An inverted idle TX line is a break.
+            s->brk = (value == CTL_BREAK_ON);
+            uart_set_line_inverse(s->port, s->brk ? UART_SIGNAL_TXD_INV :
+                    UART_SIGNAL_INV_DISABLE);
+            break;
+        case CTL_RTS_ON:
+        case CTL_RTS_OFF:
+            // Only has an effect without hardware flow control.
+            // uart_set_rts() takes the logical level: 1 asserts RTS, which
+            // drives the pin low.
+            s->rts_off = (value == CTL_RTS_OFF);
+            uart_set_rts(s->port, s->rts_off ? 0 : 1);
+            break;
+    }
+
+    // Reply with the resulting state of the group the value belongs to.
+    if(value <= CTL_FLOW_HARDWARE)
+        send_sb(s, CPO_SET_CONTROL, get_flow(s), 1);
+    else if(value <= CTL_BREAK_OFF)
+        send_sb(s, CPO_SET_CONTROL, s->brk ? CTL_BREAK_ON : CTL_BREAK_OFF, 1);
+    else if(value >= CTL_RTS_QUERY && value <= CTL_RTS_OFF)
+        send_sb(s, CPO_SET_CONTROL, s->rts_off ? CTL_RTS_OFF : CTL_RTS_ON, 1);
+    else
+        send_sb(s, CPO_SET_CONTROL, value, 1);     // DTR etc: not wired.
+}
+
+// Handle a COM-PORT-OPTION subnegotiation. Returns true if data already
+// decoded for the UART must be discarded.
+static bool com_port_option(struct rfc2217 *s)
+{
+    uint8_t cmd = s->sb[1];
+    const uint8_t *v = &s->sb[2];
+    size_t len = s->sb_len - 2;
+    uint8_t value = len > 0 ? v[0] : 0;
+
+    s->count_commands++;
+    switch(cmd) {
+        case CPO_SIGNATURE:
+            // An empty signature asks for ours.
+            if(len == 0)
+                send_signature(s);
+            break;
+        case CPO_SET_BAUDRATE:
+            if(len >= 4) {
+                uint32_t baud = ((uint32_t)v[0] << 24) | (v[1] << 16) |
+                    (v[2] << 8) | v[3];
+                if(baud != 0 && baud <= SOC_UART_BITRATE_MAX)
+                    uart_set_baudrate(s->port, baud);
+            }
+            send_sb(s, cmd, get_baudrate(s), 4);
+            break;
+        case CPO_SET_DATASIZE:
+            if(value >= 5 && value <= 8) {
+                uart_set_word_length(s->port,
+                        UART_DATA_5_BITS + (value - 5));
+            }
+            send_sb(s, cmd, get_datasize(s), 1);
+            break;
+        case CPO_SET_PARITY:
+            if(value == 1)
+                uart_set_parity(s->port, UART_PARITY_DISABLE);
+            else if(value == 2)
+                uart_set_parity(s->port, UART_PARITY_ODD);
+            else if(value == 3)
+                uart_set_parity(s->port, UART_PARITY_EVEN);
+            send_sb(s, cmd, get_parity(s), 1);     // MARK/SPACE unsupported.
+            break;
+        case CPO_SET_STOPSIZE:
+            if(value == 1)
+                uart_set_stop_bits(s->port, UART_STOP_BITS_1);
+            else if(value == 2)
+                uart_set_stop_bits(s->port, UART_STOP_BITS_2);
+            else if(value == 3)
+                uart_set_stop_bits(s->port, UART_STOP_BITS_1_5);
+            send_sb(s, cmd, get_stopsize(s), 1);
+            break;
+        case CPO_SET_CONTROL:
+            set_control(s, value);
+            break;
+        case CPO_FLOW_SUSPEND:
+        case CPO_FLOW_RESUME:
+            s->suspended = (cmd == CPO_FLOW_SUSPEND);
+            send_sb(s, cmd, 0, 0);
+            break;
+        case CPO_LINESTATE_MASK:
+        case CPO_MODEMSTATE_MASK:
+            send_sb(s, cmd, value, 1);
+            break;
+        case CPO_PURGE_DATA:
+            // 1: data from the target, 2: data for the target, 3: both.
+            if(value & 1)
+                uart_flush_input(s->port);
+            send_sb(s, cmd, value, 1);
+            return (value & 2) != 0;
+        default:
+            break;
+    }
+    return false;
+}
+
+size_t rfc2217_from_client(struct rfc2217 *s, uint8_t *data, size_t len)
+{
+    size_t n = 0;
+
+    for(size_t i = 0; i < len; i++) {
+        uint8_t c = data[i];
+
+        switch(s->state) {
+            case STATE_DATA:
+                if(c == IAC)
+                    s->state = STATE_IAC;
+                else
+                    data[n++] = c;
+                break;
+
+            case STATE_IAC:
+                s->state = STATE_DATA;
+                if(c == IAC) {
+                    data[n++] = IAC;
+                }
+                else if(c >= WILL && c <= DONT) {
+                    s->cmd = c;
+                    s->state = STATE_OPTION;
+                }
+                else if(c == SB) {
+                    s->sb_len = 0;
+                    s->state = STATE_SB;
+                }
+                // Other commands (NOP, AYT, ...) are ignored.
+                break;
+
+            case STATE_OPTION:
+                negotiate(s, s->cmd, c);
+                s->state = STATE_DATA;
+                break;
+
+            case STATE_SB:
+                if(c == IAC)
+                    s->state = STATE_SB_IAC;
+                else if(s->sb_len < MAX_SB)
+                    s->sb[s->sb_len++] = c;
+                break;
+
+            case STATE_SB_IAC:
+                if(c == IAC) {
+                    if(s->sb_len < MAX_SB)
+                        s->sb[s->sb_len++] = IAC;
+                    s->state = STATE_SB;
+                }
+                else {
+                    // SE, or a malformed subnegotiation.
+                    if(c == SE && s->sb_len >= 2 && s->sb[0] == OPT_COM_PORT &&
+                            com_port_option(s))
+                        n = 0;
+                    s->state = STATE_DATA;
+                }
+                break;
+        }
+    }
+    return n;
+}
+
+void rfc2217_print_status(struct rfc2217 *s)
+{
+    static const char parity[] = "?NOE";
+
+    if(s->port < 0)
+        return;
+    printf("UART bridge: RFC 2217, %lu baud %u%c%s%s, %lu COM port commands%s."
+            "\n", (unsigned long)get_baudrate(s), get_datasize(s),
+            parity[get_parity(s)],
+            get_stopsize(s) == 2 ? "2" : get_stopsize(s) == 3 ? "1.5" : "1",
+            get_flow(s) == CTL_FLOW_HARDWARE ? " RTS/CTS" : "",
+            s->count_commands, s->suspended ? ", suspended by client" : "");
+}
@@ -0,0 +1,57 @@
+#ifndef RFC2217_H
+#define RFC2217_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "driver/uart.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define RFC2217_MAX_SB      16
+
+// Sends Telnet replies to the client. 'ctx' is the one given to
+// rfc2217_init().
+typedef void (*rfc2217_reply_t)(void *ctx, const uint8_t *data, size_t len);
+
+// Telnet session state for one UART.
+struct rfc2217 {
+    uart_port_t port;
+    rfc2217_reply_t reply;
+    void *ctx;
+    uint8_t state;
+    uint8_t cmd;
+    uint8_t sb[RFC2217_MAX_SB];
+    uint8_t sb_len;
+    uint64_t will;      // Options we have agreed to enable.
+    uint64_t do_;       // Options we have asked the client to enable.
+    volatile bool suspended;
+    bool brk;
+    bool rts_off;
+    unsigned long count_commands;
+};
+
+// Start a new Telnet session on 'port', e.g. when a client connects.
+void rfc2217_init(struct rfc2217 *s, uart_port_t port, rfc2217_reply_t reply,
+        void *ctx);
+
+// Process 'len' bytes received from the client, in place. Telnet commands are
+// removed and applied. Returns the number of data bytes left for the UART.
+size_t rfc2217_from_client(struct rfc2217 *s, uint8_t *data, size_t len);
+
+// Escape data from the UART for the client. 'out' must hold 2 * len bytes.
+// Returns the escaped length.
+size_t rfc2217_escape(const uint8_t *in, size_t len, uint8_t *out);
+
+// True while the client has asked us to stop sending data.
+bool rfc2217_suspended(const struct rfc2217 *s);
+
+void rfc2217_print_status(struct rfc2217 *s);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // RFC2217_H
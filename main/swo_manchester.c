@@ -0,0 +1,316 @@
+/*
+ * SPDX-FileCopyrightText: Brian Kuschak <bkuschak@gmail.com>
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * SWO capture in Manchester mode with the RMT peripheral.
+ *
+ * An RMT RX channel on CONFIG_ESP_DAP_GPIO_SWO times the pulses between SWO
+ * edges. The RMT interrupt hands each block of captured pulses to a low
+ * priority task, which runs them through the Manchester decoder
+ * (manchester.c) and stores the bytes in the buffer armed with
+ * swo_manchester_receive(), i.e. in TraceBuf. SWO.c re-arms the next block
+ * of TraceBuf from the callback, the same way as in UART mode.
+ *
+ * The bit rate of every packet is measured from its start bit, so the rate
+ * set by the host does not need to match exactly. Where the RMT supports
+ * partial receive, a capture continues across long frames. The driver
+ * reuses its receive buffer for every part, so the interrupt copies each
+ * part to a ring of chunk buffers before the task decodes it. Otherwise a
+ * frame ends after CAPTURE_IDLE_NS of idle line, and the next packet is lost
+ * if it starts before the capture is re-armed.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "driver/rmt_rx.h"
+#include "esp_attr.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "soc/soc_caps.h"
+#include "DAP_config.h"
+#include "manchester.h"
+#include "swo_manchester.h"
+
+#define RMT_RESOLUTION_HZ   40000000    // 25 ns ticks.
+#define RMT_RX_SYMBOLS      512
+#define CAPTURE_GLITCH_NS   50
+#define CAPTURE_IDLE_NS     800000      // Below the RMT idle limit of 32767 ticks.
+#define MIN_HALF_TICKS      5           // About 4 MBd.
+#define MAX_HALF_TICKS      12000       // About 1.7 kBd, 2.5 half-bits < idle.
+#define CHUNK_QUEUE_LEN     8
+#define TASK_STACK          3072
+#define TASK_PRIORITY       2
+
+typedef struct {
+    rmt_symbol_word_t *symbols;
+    size_t num;
+    bool last;
+} rx_chunk_t;
+
+static rmt_channel_handle_t rx_channel;
+static rmt_symbol_word_t rx_symbols[RMT_RX_SYMBOLS];
+#if SOC_RMT_SUPPORT_RX_PINGPONG
+// One chunk more than the queue holds: the one being decoded.
+static rmt_symbol_word_t
+    chunk_symbols[CHUNK_QUEUE_LEN + 1][SOC_RMT_MEM_WORDS_PER_CHANNEL];
+static uint32_t chunk_head;
+#endif
+static rmt_receive_config_t rx_config = {
+    .signal_range_min_ns = CAPTURE_GLITCH_NS,
+    .signal_range_max_ns = CAPTURE_IDLE_NS,
+#if SOC_RMT_SUPPORT_RX_PINGPONG
+    .flags.en_partial_rx = true,
+#endif
+};
+static QueueHandle_t chunk_queue;
+static SemaphoreHandle_t lock;
+static manchester_decoder_t decoder;
+
+static swo_manchester_cb_t cb_event;
+static bool capturing;
+static bool rx_enabled;
+static uint32_t baudrate;
+static uint8_t *rx_buf;
+static uint32_t rx_num;
+static volatile uint32_t rx_cnt;
+static volatile bool rx_busy;
+
+static unsigned long count_rx;
+static unsigned long count_overflow;
+static volatile unsigned long count_lost_chunks;
+
+static bool IRAM_ATTR rx_done_isr(rmt_channel_handle_t channel,
+        const rmt_rx_done_event_data_t *edata, void *arg)
+{
+    BaseType_t woken = pdFALSE;
+    rx_chunk_t chunk = {
+        .symbols = edata->received_symbols,
+        .num = edata->num_symbols,
+#if SOC_RMT_SUPPORT_RX_PINGPONG
+        .last = edata->flags.is_last,
+#else
+        .last = true,
+#endif
+    };
+
+#if SOC_RMT_SUPPORT_RX_PINGPONG
+    // The queued chunks and the one being decoded are still in use, and
+    // they are the ones before chunk_head, so chunk_head is free unless
+    // the queue is full.
+    if(xQueueIsQueueFullFromISR(chunk_queue) || chunk.num >
+            SOC_RMT_MEM_WORDS_PER_CHANNEL) {
+        count_lost_chunks++;
+        return false;
+    }
+    memcpy(chunk_symbols[chunk_head], chunk.symbols,
+            chunk.num * sizeof(rmt_symbol_word_t));
+    chunk.symbols = chunk_symbols[chunk_head];
+    chunk_head = (chunk_head + 1) % (CHUNK_QUEUE_LEN + 1);
+#endif
+    if(xQueueSendFromISR(chunk_queue, &chunk, &woken) != pdTRUE)
+        count_lost_chunks++;
+    return woken == pdTRUE;
+}
+
+// Decode one pulse and store a completed byte. Called with 'lock' held,
+// which is released while the callback runs.
+static uint32_t decode_pulse(int level, uint32_t duration)
+{
+    int byte = manchester_decode_pulse(&decoder, level, duration);
+
+    if(byte == MANCHESTER_NO_BYTE || !rx_enabled)
+        return 0;
+    if(!rx_busy) {
+        count_overflow++;
+        return SWO_MANCHESTER_EVENT_OVERFLOW;
+    }
+    rx_buf[rx_cnt++] = byte;
+    count_rx++;
+    if(rx_cnt == rx_num) {
+        rx_busy = false;
+        swo_manchester_cb_t cb = cb_event;
+        xSemaphoreGive(lock);
+        if(cb != NULL)
+            cb(SWO_MANCHESTER_EVENT_RECEIVE_COMPLETE);
+        xSemaphoreTake(lock, portMAX_DELAY);
+    }
+    return 0;
+}
+
+static void swo_manchester_task(void *arg)
+{
+    rx_chunk_t chunk;
+
+    while(1) {
+        if(xQueueReceive(chunk_queue, &chunk, portMAX_DELAY) != pdTRUE)
+            continue;
+
+        xSemaphoreTake(lock, portMAX_DELAY);
+        uint32_t errors = decoder.errors;
+        uint32_t events = 0;
+        for(size_t i = 0; i < chunk.num; i++) {
+            const rmt_symbol_word_t *s = &chunk.symbols[i];
+            events |= decode_pulse(s->level0, s->duration0 ?
+                    s->duration0 : MANCHESTER_IDLE);
+            if(s->duration0 == 0)
+                break;
+            events |= decode_pulse(s->level1, s->duration1 ?
+                    s->duration1 : MANCHESTER_IDLE);
+            if(s->duration1 == 0)
+                break;
+        }
+        if(chunk.last) {
+            // The capture stopped on an idle line.
+            events |= decode_pulse(0, MANCHESTER_IDLE);
+            if(capturing)
+                rmt_receive(rx_channel, rx_symbols, sizeof(rx_symbols),
+                        &rx_config);
+        }
+        if(decoder.errors != errors && rx_enabled)
+            events |= SWO_MANCHESTER_EVENT_ERROR;
+        swo_manchester_cb_t cb = cb_event;
+        xSemaphoreGive(lock);
+
+        if(events != 0 && cb != NULL)
+            cb(events);
+    }
+}
+
+// Create the RMT channel and the decoder task, once.
+static int swo_manchester_install(void)
+{
+    rmt_rx_channel_config_t config = {
+        .gpio_num = CONFIG_ESP_DAP_GPIO_SWO,
+        .clk_src = RMT_CLK_SRC_DEFAULT,
+        .resolution_hz = RMT_RESOLUTION_HZ,
+        .mem_block_symbols = SOC_RMT_MEM_WORDS_PER_CHANNEL,
+    };
+    rmt_rx_event_callbacks_t callbacks = {
+        .on_recv_done = rx_done_isr,
+    };
+
+    if(rmt_new_rx_channel(&config, &rx_channel) != ESP_OK) {
+        fprintf(stderr, "SWO: failed to create RMT RX channel\n");
+        rx_channel = NULL;
+        return -1;
+    }
+    chunk_queue = xQueueCreate(CHUNK_QUEUE_LEN, sizeof(rx_chunk_t));
+    lock = xSemaphoreCreateMutex();
+    if(chunk_queue == NULL || lock == NULL ||
+            xTaskCreate(swo_manchester_task, "swo_manchester", TASK_STACK,
+                NULL, TASK_PRIORITY, NULL) != pdPASS) {
+        fprintf(stderr, "SWO: failed to create Manchester task\n");
+        abort();
+    }
+    ESP_ERROR_CHECK(rmt_rx_register_event_callbacks(rx_channel, &callbacks,
+                NULL));
+    fprintf(stdout, "SWO: Manchester capture on GPIO_NUM_%d.\n",
+            CONFIG_ESP_DAP_GPIO_SWO);
+    return 0;
+}
+
+int swo_manchester_start(swo_manchester_cb_t cb)
+{
+    if(rx_channel == NULL && swo_manchester_install() != 0)
+        return -1;
+
+    xSemaphoreTake(lock, portMAX_DELAY);
+    cb_event = cb;
+    rx_enabled = false;
+    rx_busy = false;
+    manchester_init(&decoder, MIN_HALF_TICKS, MAX_HALF_TICKS);
+    if(!capturing) {
+        if(rmt_enable(rx_channel) != ESP_OK ||
+                rmt_receive(rx_channel, rx_symbols, sizeof(rx_symbols),
+                    &rx_config) != ESP_OK) {
+            xSemaphoreGive(lock);
+            return -1;
+        }
+        capturing = true;
+    }
+    xSemaphoreGive(lock);
+    return 0;
+}
+
+void swo_manchester_stop(void)
+{
+    if(rx_channel == NULL)
+        return;
+
+    xSemaphoreTake(lock, portMAX_DELAY);
+    if(capturing) {
+        rmt_disable(rx_channel);
+        capturing = false;
+    }
+    rx_enabled = false;
+    rx_busy = false;
+    cb_event = NULL;
+    xSemaphoreGive(lock);
+}
+
+void swo_manchester_set_baudrate(uint32_t rate)
+{
+    baudrate = rate;
+}
+
+void swo_manchester_enable_rx(bool enable)
+{
+    xSemaphoreTake(lock, portMAX_DELAY);
+    rx_enabled = enable;
+    xSemaphoreGive(lock);
+}
+
+int swo_manchester_receive(uint8_t *buf, uint32_t num)
+{
+    if(buf == NULL || num == 0 || !capturing)
+        return -1;
+
+    // Called from the callback with 'lock' released by decode_pulse().
+    xSemaphoreTake(lock, portMAX_DELAY);
+    if(rx_busy) {
+        xSemaphoreGive(lock);
+        return -1;
+    }
+    rx_buf = buf;
+    rx_num = num;
+    rx_cnt = 0;
+    rx_busy = true;
+    xSemaphoreGive(lock);
+    return 0;
+}
+
+void swo_manchester_abort_receive(void)
+{
+    xSemaphoreTake(lock, portMAX_DELAY);
+    rx_busy = false;
+    xSemaphoreGive(lock);
+}
+
+bool swo_manchester_rx_busy(void)
+{
+    return rx_busy;
+}
+
+uint32_t swo_manchester_rx_count(void)
+{
+    return rx_cnt;
+}
+
+void swo_manchester_print_status(void)
+{
+    if(rx_channel == NULL || !capturing) {
+        printf("SWO Manchester: not capturing.\n");
+        return;
+    }
+
+    uint32_t half = decoder.last_half;
+    printf("SWO Manchester: host baud rate %lu, detected %lu. RX: %lu bytes, "
+            "%lu packets, %lu bad packets, %lu overflows, %lu lost captures.\n",
+            (unsigned long)baudrate,
+            half ? (unsigned long)(RMT_RESOLUTION_HZ * 8ULL / half) : 0UL,
+            count_rx, (unsigned long)decoder.packets,
+            (unsigned long)decoder.errors, count_overflow, count_lost_chunks);
+}
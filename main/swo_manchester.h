@@ -0,0 +1,43 @@
+#ifndef SWO_MANCHESTER_H
+#define SWO_MANCHESTER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Events passed to the callback, from the capture task.
+#define SWO_MANCHESTER_EVENT_RECEIVE_COMPLETE   (1U << 0)
+#define SWO_MANCHESTER_EVENT_OVERFLOW           (1U << 1)
+#define SWO_MANCHESTER_EVENT_ERROR              (1U << 2)
+
+typedef void (*swo_manchester_cb_t)(uint32_t event);
+
+// Start or stop capturing and decoding SWO. Returns 0 on success.
+int swo_manchester_start(swo_manchester_cb_t cb);
+void swo_manchester_stop(void);
+
+// Bit rate expected by the host. The decoder measures the actual bit rate
+// of every packet, this is only used for reporting.
+void swo_manchester_set_baudrate(uint32_t baudrate);
+
+// Deliver decoded bytes to the receive buffer, or discard them.
+void swo_manchester_enable_rx(bool enable);
+
+// Arm a receive buffer. Like ARM_USART Receive(), the callback gets
+// SWO_MANCHESTER_EVENT_RECEIVE_COMPLETE when 'num' bytes were stored.
+// Returns 0 on success.
+int swo_manchester_receive(uint8_t *buf, uint32_t num);
+void swo_manchester_abort_receive(void);
+bool swo_manchester_rx_busy(void);
+uint32_t swo_manchester_rx_count(void);
+
+void swo_manchester_print_status(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // SWO_MANCHESTER_H
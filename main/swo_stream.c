@@ -0,0 +1,282 @@
+/*
+ * SPDX-FileCopyrightText: Brian Kuschak <bkuschak@gmail.com>
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * SWO streaming trace over TCP/IP.
+ *
+ * When the host selects SWO transport 2 (streaming), SWO_Thread in SWO.c
+ * passes the captured trace to SWO_QueueTransfer() in blocks of up to 512
+ * bytes, or whatever is left after a 50 ms timeout. This module sends those
+ * blocks to a client connected to CONFIG_ESP_DAP_SWO_TCP_PORT, so the trace
+ * does not have to be polled with DAP_SWO_Data over the CMSIS-DAP
+ * connection. The trace is raw SWO data, e.g. ITM packets:
+ *
+ *     nc 192.168.1.5 4443 > trace.bin
+ *
+ * or, if the ITM decoder in itm.c is enabled, frames holding the data of the
+ * selected stimulus ports only.
+ *
+ * While no client is connected, the trace is discarded. If the client cannot
+ * keep up, the trace buffer fills and the host sees the overrun flag in
+ * DAP_SWO_Status / DAP_SWO_ExtendedStatus.
+ */
+
+#include "errno.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "netdb.h"
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/unistd.h>
+#include "DAP_config.h"
+#include "DAP.h"
+#include "dlog.h"
+#include "swo_stream.h"
+#ifdef CONFIG_ESP_DAP_SWO_ITM
+#include "itm.h"
+#endif
+
+#define SEND_CHUNK_SIZE     1460
+
+#ifdef CONFIG_LWIP_IPV6
+#define MAX_INET_ADDRSTRLEN     INET6_ADDRSTRLEN
+#else
+#define MAX_INET_ADDRSTRLEN     INET_ADDRSTRLEN
+#endif
+
+TaskHandle_t SWO_ThreadId;
+
+static const int listener_port = CONFIG_ESP_DAP_SWO_TCP_PORT;
+static TaskHandle_t stream_task;
+static SemaphoreHandle_t lock;
+static int client_fd = -1;
+static char client_ip_str[MAX_INET_ADDRSTRLEN];
+static int client_port;
+
+// Transfer queued by SWO_Thread.
+static uint8_t *pending_buf;
+static uint32_t pending_num;
+static volatile uint32_t transfer_id;  // Changed by each queue or abort.
+
+static unsigned long count_tx;
+static unsigned long count_dropped;
+
+#ifdef CONFIG_ESP_DAP_SWO_ITM
+static uint8_t itm_buf[1024];
+#endif
+
+void swo_stream_print_status(void)
+{
+    if(client_fd >= 0) {
+        printf("SWO stream: connected to client '%s:%d'. TX: %lu bytes, "
+                "dropped: %lu bytes.\n", client_ip_str, client_port,
+                count_tx, count_dropped);
+    }
+    else {
+        printf("SWO stream: listening on port %d. Dropped: %lu bytes.\n",
+                listener_port, count_dropped);
+    }
+}
+
+// Called by SWO_Thread with a block of TraceBuf to send. SWO_TransferComplete()
+// is called once the block is sent or discarded.
+void SWO_QueueTransfer(uint8_t *buf, uint32_t num)
+{
+    xSemaphoreTake(lock, portMAX_DELAY);
+    if(client_fd < 0) {
+        count_dropped += num;
+        xSemaphoreGive(lock);
+        SWO_TransferComplete();
+        return;
+    }
+    pending_buf = buf;
+    pending_num = num;
+    transfer_id++;
+    xSemaphoreGive(lock);
+    xTaskNotifyGive(stream_task);
+}
+
+// Called when the host clears the trace. The block being sent is dropped,
+// without calling SWO_TransferComplete().
+void SWO_AbortTransfer(void)
+{
+    xSemaphoreTake(lock, portMAX_DELAY);
+    pending_buf = NULL;
+    transfer_id++;
+    xSemaphoreGive(lock);
+}
+
+// Returns false if the connection failed.
+static bool send_all(int fd, const uint8_t *buf, size_t len)
+{
+    while(len > 0) {
+        int ret = send(fd, buf, len, 0);
+        if(ret < 0 && errno == EINTR)
+            continue;
+        if(ret <= 0) {
+            DLOG_ERROR(DLOG_TRACE, "SWO stream: send error: "
+                    "%s\n", strerror(errno));
+            return false;
+        }
+        buf += ret;
+        len -= ret;
+        count_tx += ret;
+    }
+    return true;
+}
+
+// Send the queued block, if any, or drop it if 'fd' is -1. Returns false if
+// the connection failed.
+static bool send_pending(int fd)
+{
+    bool ok = true;
+    uint32_t sent = 0;
+
+    xSemaphoreTake(lock, portMAX_DELAY);
+    uint8_t *buf = pending_buf;
+    uint32_t num = pending_num;
+    uint32_t id = transfer_id;
+    pending_buf = NULL;
+    xSemaphoreGive(lock);
+    if(buf == NULL)
+        return true;
+
+    while(fd >= 0 && sent < num && transfer_id == id) {
+        uint32_t n = num - sent;
+#ifdef CONFIG_ESP_DAP_SWO_ITM
+        if(itm_enabled()) {
+            size_t len;
+            n = itm_filter(buf + sent, n, itm_buf, sizeof(itm_buf), &len);
+            if(!send_all(fd, itm_buf, len)) {
+                ok = false;
+                break;
+            }
+            sent += n;
+            continue;
+        }
+#endif
+        if(n > SEND_CHUNK_SIZE)
+            n = SEND_CHUNK_SIZE;
+        if(!send_all(fd, buf + sent, n)) {
+            ok = false;
+            break;
+        }
+        sent += n;
+    }
+
+    xSemaphoreTake(lock, portMAX_DELAY);
+    if(transfer_id == id) {
+        count_dropped += num - sent;
+        SWO_TransferComplete();
+    }
+    xSemaphoreGive(lock);
+    return ok;
+}
+
+// Returns false if the client closed the connection. Anything it sends is
+// ignored.
+static bool client_alive(int fd)
+{
+    char buf[64];
+    int ret;
+
+    while((ret = recv(fd, buf, sizeof(buf), MSG_DONTWAIT)) > 0)
+        ;
+    return ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+}
+
+void swo_stream_task(void* __attribute__((unused)) arg)
+{
+    stream_task = xTaskGetCurrentTaskHandle();
+    lock = xSemaphoreCreateMutex();
+    if(lock == NULL || xTaskCreate(SWO_Thread, "swo_thread", 3072, NULL, 5,
+                &SWO_ThreadId) != pdPASS) {
+        DLOG_ERROR(DLOG_TRACE, "SWO stream: failed to create SWO thread\n");
+        vTaskDelete(NULL);
+        return;
+    }
+
+    int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if(listen_fd < 0) {
+        DLOG_ERROR(DLOG_TRACE, "SWO stream: failed to create socket: "
+                "%s\n", strerror(errno));
+        vTaskDelete(NULL);
+        return;
+    }
+
+    struct sockaddr_in server_addr;
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_addr.s_addr = INADDR_ANY;
+    server_addr.sin_port = htons(listener_port);
+    if(bind(listen_fd, (struct sockaddr*)&server_addr,
+                sizeof(server_addr)) < 0) {
+        DLOG_ERROR(DLOG_TRACE, "SWO stream: failed to bind socket: "
+                "%s\n", strerror(errno));
+        vTaskDelete(NULL);
+        return;
+    }
+    if(listen(listen_fd, 1) < 0) {
+        DLOG_ERROR(DLOG_TRACE, "SWO stream: failed to listen on socket: "
+                "%s\n", strerror(errno));
+        vTaskDelete(NULL);
+        return;
+    }
+
+    DLOG_INFO(DLOG_TRACE, "SWO stream: listening on port %d.\n",
+            listener_port);
+
+    while(1) {
+        struct sockaddr_in client_addr;
+        socklen_t addr_len = sizeof(client_addr);
+        int fd = accept(listen_fd, (struct sockaddr*)&client_addr, &addr_len);
+        if(fd < 0) {
+            DLOG_ERROR(DLOG_TRACE, "SWO stream: accept error: "
+                    "%s\n", strerror(errno));
+            vTaskDelay(pdMS_TO_TICKS(100));
+            continue;
+        }
+
+#ifdef CONFIG_ESP_DAP_TCP_KEEPALIVE_TIMEOUT
+        // Use TCP keepalives to detect dead clients while no trace flows.
+        int val = 1;
+        setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, &val, sizeof(val));
+        setsockopt(fd, IPPROTO_TCP, TCP_KEEPIDLE, &val, sizeof(val));
+        setsockopt(fd, IPPROTO_TCP, TCP_KEEPINTVL, &val, sizeof(val));
+        val = CONFIG_ESP_DAP_TCP_KEEPALIVE_TIMEOUT;
+        setsockopt(fd, IPPROTO_TCP, TCP_KEEPCNT, &val, sizeof(val));
+#endif
+
+        inet_ntop(AF_INET, &client_addr.sin_addr, client_ip_str,
+                sizeof(client_ip_str));
+        client_port = ntohs(client_addr.sin_port);
+        DLOG_INFO(DLOG_TRACE, "SWO stream: client connected %s:%d\n",
+                client_ip_str, client_port);
+        count_tx = 0;
+        count_dropped = 0;
+#ifdef CONFIG_ESP_DAP_SWO_ITM
+        // Trace sent to the previous client may have ended mid packet.
+        itm_reset();
+#endif
+
+        xSemaphoreTake(lock, portMAX_DELAY);
+        client_fd = fd;
+        xSemaphoreGive(lock);
+
+        while(1) {
+            ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(1000));
+            if(!send_pending(fd) || !client_alive(fd))
+                break;
+        }
+
+        xSemaphoreTake(lock, portMAX_DELAY);
+        client_fd = -1;
+        xSemaphoreGive(lock);
+        // Complete a block queued after the last send.
+        send_pending(-1);
+        close(fd);
+        DLOG_INFO(DLOG_TRACE, "SWO stream: client disconnected.\n");
+    }
+}
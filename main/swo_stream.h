@@ -0,0 +1,19 @@
+#ifndef SWO_STREAM_H
+#define SWO_STREAM_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// TCP server for SWO streaming trace. Also starts SWO_Thread.
+void swo_stream_task(void *arg);
+void swo_stream_print_status(void);
+
+// SWO.c thread that hands captured trace to SWO_QueueTransfer().
+void SWO_Thread(void *argument);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // SWO_STREAM_H
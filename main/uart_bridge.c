@@ -17,33 +17,148 @@
  *
  *     screen /tmp/tty_uart
  *
- * The UART number, baud rate, parity, and data/stop bits are fixed at build
- * time, and can be adjusted by these menuconfig options:
+ * The UART number is fixed at build time. The baud rate, parity, and
+ * data/stop bits are set at boot, and with CONFIG_ESP_UART_BRIDGE_RFC2217
+ * can be changed at runtime by the client (see below). These menuconfig
+ * options select them:
  *
  *     CONFIG_ESP_UART_BRIDGE_UART_NUM
  *     CONFIG_ESP_UART_BRIDGE_BAUD_RATE
  *     CONFIG_ESP_UART_BRIDGE_DATA_BITS
  *     CONFIG_ESP_UART_BRIDGE_PARITY
  *     CONFIG_ESP_UART_BRIDGE_STOP_BITS
+ *
+ * With CONFIG_ESP_UART_BRIDGE_SECOND, a second UART is bridged on its own
+ * port, CONFIG_ESP_UART_BRIDGE_SECOND_TCP_PORT, with its own pin and flow
+ * control options. At most two UARTs are bridged. Each bridged UART has a
+ * struct bridge, set up from an entry of configs[]. With
+ * CONFIG_ESP_UART_BRIDGE_MUX, all UARTs are also bridged together on
+ * CONFIG_ESP_UART_BRIDGE_MUX_TCP_PORT, in frames of:
+ *
+ *     to the host:   <UART> <length, 2 bytes> <time, 4 bytes> <data>
+ *     from the host: <UART> <length, 2 bytes> <data>
+ *
+ * Multi-byte fields are little endian. The time is the low 32 bits of
+ * esp_timer_get_time(), in microseconds, when the data was read from the
+ * UART driver. Frames for a UART that is not bridged are dropped.
+ *
+ * Received data is buffered in each UART driver's RX ring buffer, sized by
+ * CONFIG_ESP_UART_BRIDGE_RX_BUFFER_SIZE, which rides out WiFi stalls at high
+ * baud rates. One RX task waits on the event queues of all the drivers,
+ * through a queue set, reads the ring buffers in blocks of up to one TCP
+ * segment and copies them into the fan-out ring, of
+ * CONFIG_ESP_UART_BRIDGE_FANOUT_SIZE bytes, of each port that carries the
+ * UART. uart_bridge_task() runs one select() loop for all ports. It accepts
+ * clients and writes data from the writers into the TX ring buffers
+ * (CONFIG_ESP_UART_BRIDGE_TX_BUFFER_SIZE). Lost data is counted and shown by
+ * the 'status' command.
+ *
+ * Up to CONFIG_ESP_UART_BRIDGE_MAX_CLIENTS clients may connect to each port.
+ * The first one is the writer; the others are read-only observers, e.g. a
+ * log collector next to a human, whose input is discarded. When the writer
+ * disconnects, the next client to connect becomes the writer. Each client
+ * sends from the fan-out ring at its own position, so the data is stored
+ * once however many clients there are, and sends never block.
+ *
+ * Neither direction drops data while a writer is connected. Once a writer
+ * is a whole fan-out ring behind, no more data is read from the RX ring
+ * buffers of its UARTs, which keep filling; with
+ * CONFIG_ESP_UART_BRIDGE_FLOW_CONTROL, RTS then stops the target once the
+ * ring buffer and FIFO are full. An observer that falls a whole fan-out
+ * ring behind is disconnected instead, so it cannot stall the others. Data
+ * from a writer is only read when the previous block fits in the TX ring
+ * buffer, so TCP flow control stops the writer while the UART, or the
+ * target through CTS, is slow.
+ *
+ * uart_bridge_init() opens the UARTs and starts the RX task before WiFi is
+ * up. With CONFIG_ESP_UART_BRIDGE_HISTORY, the RX task also copies all data
+ * into a history ring per UART (uart_history.c), and replays part of it to
+ * each new client of the UART's own port before any new data. The replay
+ * is sent without blocking, like the fan-out ring, while new data queues in
+ * the ring behind it. An observer whose replay takes longer than
+ * REPLAY_TIMEOUT_MS is disconnected; a writer just skips the rest.
+ *
+ * With CONFIG_ESP_UART_BRIDGE_RFC2217 the UARTs' own ports use Telnet with
+ * the RFC 2217 COM port option (rfc2217.c), so the writer can change the
+ * line settings. Observers receive the same Telnet-escaped stream. Telnet
+ * replies are queued and sent to the writer by the RX task, the only task
+ * that sends to clients, when the writer has caught up with the fan-out
+ * ring. The multiplexed port carries the raw data.
+ *
+ * With CONFIG_ESP_UART_BRIDGE_TRIGGER, the RX task also looks for patterns
+ * in each block it reads, and halts the target on a match (uart_trigger.c).
+ * As the trigger only sees data when the RX task reads it, it can be late
+ * while a writer or RFC 2217 holds the data back.
+ *
+ * With CONFIG_ESP_UART_BRIDGE_TIMESTAMPS the UARTs' own ports send records
+ * instead of the raw data. Each record starts with an unsigned LEB128
+ * varint:
+ *
+ *     <delta << 1> <length> <data>         data received 'delta' us after
+ *                                          the previous record's time
+ *     <1> <time>                           sets the time, in us
+ *     <3> <time> <ticks> <ticks per s>     DAP TIMESTAMP_GET() at 'time'
+ *     <5> <length> <data>                  data replayed from the history
+ *
+ * All fields are varints. Times are esp_timer_get_time() values. A new
+ * client first receives a time record, and the clock records from the
+ * CMSIS-DAP task (cmsis_dap_get_clock()) map the times to DAP timestamps.
+ * The time of a block is that of its first byte. The driver does not tell
+ * when bytes arrive, so the RX task takes the time when the driver reports
+ * them, less one character time for each byte reported after them.
+ * host/uart_timestamps.py decodes the records.
  */
 
 #include "driver/gpio.h"
 #include "driver/uart.h"
-#include "driver/uart_vfs.h"
 #include "errno.h"
+#include "esp_timer.h"
 #include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
 #include "freertos/task.h"
 #include "netdb.h"
+#include <stdbool.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <sys/fcntl.h>
 #include <sys/select.h>
 #include <sys/socket.h>
 #include <sys/unistd.h>
+#include "dlog.h"
 #include "uart_bridge.h"
+#ifdef CONFIG_ESP_UART_BRIDGE_RFC2217
+#include "rfc2217.h"
+#endif
+#ifdef CONFIG_ESP_UART_BRIDGE_HISTORY
+#include "uart_history.h"
+#endif
+#ifdef CONFIG_ESP_UART_BRIDGE_TRIGGER
+#include "uart_trigger.h"
+#endif
+#ifdef CONFIG_ESP_UART_BRIDGE_TIMESTAMPS
+#include "cmsis_dap_tcp.h"
+#endif
 
 #define BUFFER_SIZE         512
-#define UART_BUFFER_SIZE    512
+#define SEND_BLOCK_SIZE     1460    // One TCP segment.
+#define EVENT_QUEUE_LEN     32
+#define RX_FULL_THRESHOLD   64      // Interrupt when the RX FIFO is half full.
+#define RX_TASK_STACK       3072
+#define RX_TASK_PRIO        5       // Same as uart_bridge_task.
+#define RETRY_MS            20      // Poll interval while a write is blocked.
+#define REPLAY_TIMEOUT_MS   5000    // Longest history replay to a client.
+#define MAX_CLIENTS         CONFIG_ESP_UART_BRIDGE_MAX_CLIENTS
+#define FANOUT_SIZE         CONFIG_ESP_UART_BRIDGE_FANOUT_SIZE
+#define RX_FLOW_CTRL_THRESH 100     // Deassert RTS at this RX FIFO level.
+#define MUX_RX_HEADER       7       // UART, length and time.
+#define MUX_TX_HEADER       3       // UART and length.
+#define RECORD_DATA         0       // Low bit of a record's first varint.
+#define RECORD_TIME         1
+#define RECORD_CLOCK        3
+#define RECORD_UNTIMED      5
+#define RECORD_MAX_HEADER   48      // Time, clock and data record headers.
 
 #if defined(CONFIG_ESP_UART_BRIDGE_PARITY_NONE)
 #define UART_PARITY  UART_PARITY_DISABLE
@@ -71,6 +186,20 @@
 #error "Invalid setting for CONFIG_ESP_UART_BRIDGE_STOP_BITS."
 #endif
 
+#if (FANOUT_SIZE & (FANOUT_SIZE - 1)) != 0
+#error "CONFIG_ESP_UART_BRIDGE_FANOUT_SIZE must be a power of 2."
+#endif
+
+#if defined(CONFIG_ESP_UART_BRIDGE_TIMESTAMPS) && \
+    defined(CONFIG_ESP_UART_BRIDGE_RFC2217)
+#error "UART bridge timestamps cannot be used with RFC 2217."
+#endif
+
+#if defined(CONFIG_ESP_UART_BRIDGE_SECOND) && \
+    CONFIG_ESP_UART_BRIDGE_SECOND_UART_NUM == CONFIG_ESP_UART_BRIDGE_UART_NUM
+#error "The second UART bridge cannot use the same UART as the first."
+#endif
+
 #ifndef MAX
 #define MAX(a,b) \
 ({ __typeof__ (a) _a = (a); \
@@ -84,240 +213,1274 @@
 #define MAX_INET_ADDRSTRLEN     INET_ADDRSTRLEN
 #endif
 
-static char buffer[BUFFER_SIZE];
-static char client_ip_str[MAX_INET_ADDRSTRLEN];
-static int client_port;
-static volatile bool client_connected;
-static const int listener_port = CONFIG_ESP_UART_BRIDGE_TCP_PORT;
-static unsigned long count_rx;
-static unsigned long count_tx;
+// A bridged UART. The pins are UART_PIN_NO_CHANGE to keep the defaults, or
+// without flow control.
+struct uart_bridge_config {
+    uart_port_t uart_num;
+    int tcp_port;
+    int baud_rate;
+    int txd_pin;
+    int rxd_pin;
+    int rts_pin;
+    int cts_pin;
+};
+
+static const struct uart_bridge_config configs[] = {
+    {
+        .uart_num   = CONFIG_ESP_UART_BRIDGE_UART_NUM,
+        .tcp_port   = CONFIG_ESP_UART_BRIDGE_TCP_PORT,
+        .baud_rate  = CONFIG_ESP_UART_BRIDGE_BAUD_RATE,
+#ifdef CONFIG_ESP_UART_BRIDGE_REMAP_PINS
+        .txd_pin    = CONFIG_ESP_UART_BRIDGE_TXD_PIN,
+        .rxd_pin    = CONFIG_ESP_UART_BRIDGE_RXD_PIN,
+#else
+        .txd_pin    = UART_PIN_NO_CHANGE,
+        .rxd_pin    = UART_PIN_NO_CHANGE,
+#endif
+#ifdef CONFIG_ESP_UART_BRIDGE_FLOW_CONTROL
+        .rts_pin    = CONFIG_ESP_UART_BRIDGE_RTS_PIN,
+        .cts_pin    = CONFIG_ESP_UART_BRIDGE_CTS_PIN,
+#else
+        .rts_pin    = UART_PIN_NO_CHANGE,
+        .cts_pin    = UART_PIN_NO_CHANGE,
+#endif
+    },
+#ifdef CONFIG_ESP_UART_BRIDGE_SECOND
+    {
+        .uart_num   = CONFIG_ESP_UART_BRIDGE_SECOND_UART_NUM,
+        .tcp_port   = CONFIG_ESP_UART_BRIDGE_SECOND_TCP_PORT,
+        .baud_rate  = CONFIG_ESP_UART_BRIDGE_SECOND_BAUD_RATE,
+#ifdef CONFIG_ESP_UART_BRIDGE_SECOND_REMAP_PINS
+        .txd_pin    = CONFIG_ESP_UART_BRIDGE_SECOND_TXD_PIN,
+        .rxd_pin    = CONFIG_ESP_UART_BRIDGE_SECOND_RXD_PIN,
+#else
+        .txd_pin    = UART_PIN_NO_CHANGE,
+        .rxd_pin    = UART_PIN_NO_CHANGE,
+#endif
+#ifdef CONFIG_ESP_UART_BRIDGE_SECOND_FLOW_CONTROL
+        .rts_pin    = CONFIG_ESP_UART_BRIDGE_SECOND_RTS_PIN,
+        .cts_pin    = CONFIG_ESP_UART_BRIDGE_SECOND_CTS_PIN,
+#else
+        .rts_pin    = UART_PIN_NO_CHANGE,
+        .cts_pin    = UART_PIN_NO_CHANGE,
+#endif
+    },
+#endif
+};
+
+#define NUM_BRIDGES     ((int)(sizeof(configs) / sizeof(configs[0])))
+#ifdef CONFIG_ESP_UART_BRIDGE_MUX
+#define NUM_STREAMS     (NUM_BRIDGES + 1)
+#else
+#define NUM_STREAMS     NUM_BRIDGES
+#endif
+
+// A connected client. Only uart_bridge_task sets 'fd' and 'writer', with
+// client_lock held.
+struct client {
+    int fd;                     // -1 if the slot is free.
+    bool writer;
+    bool fresh;                 // Not yet seen by the RX task.
+    bool dropped;               // Shut down by the RX task, not yet closed.
+    uint32_t pos;               // Next fan-out ring byte to send.
+#ifdef CONFIG_ESP_UART_BRIDGE_HISTORY
+    uint64_t replay_pos;        // Next history byte to replay.
+    uint64_t replay_end;        // History head when the client started.
+    uint32_t replay_len;        // History bytes in the block being sent,
+    uint32_t replay_sent;       // and how much of the block was sent.
+    TickType_t replay_since;
+#endif
+    unsigned long sent;
+    char ip_str[MAX_INET_ADDRSTRLEN];
+    int port;
+};
+
+// A listening port and its clients.
+struct stream {
+    int port;
+    int listen_fd;
+    struct bridge *bridge;      // NULL for the multiplexed port.
+    uint8_t *fanout;            // FANOUT_SIZE bytes.
+    uint32_t fanout_head;       // Bytes added since boot.
+    struct client clients[MAX_CLIENTS];
+    char buffer[BUFFER_SIZE];
+    size_t tx_offset;           // Writer data not yet written to the
+    size_t tx_pending;          // TX ring buffer.
+    unsigned long count_slow_observers;
+};
+
+#ifdef CONFIG_ESP_UART_BRIDGE_TIMESTAMPS
+// Data reported by a UART driver event.
+struct bridge_mark {
+    uint32_t pos;               // Low 32 bits of the first byte's position.
+    uint32_t len;
+    int64_t us;                 // When the first byte was received.
+};
+#endif
+
+struct bridge {
+    const struct uart_bridge_config *config;
+    QueueHandle_t queue;
+    struct stream stream;
+    unsigned long count_tx;
+    unsigned long count_rx_dropped;
+    unsigned long count_fifo_overflow;
+    unsigned long count_buffer_full;
+    unsigned long count_rx_errors;
+    unsigned long count_tx_dropped;
+#ifdef CONFIG_ESP_UART_BRIDGE_RFC2217
+    struct rfc2217 rfc;
+    uint8_t reply_buf[128];
+    size_t reply_len;           // Protected by client_lock.
+#endif
+#ifdef CONFIG_ESP_UART_BRIDGE_HISTORY
+    struct uart_history history;
+    unsigned long count_replayed;
+#endif
+#ifdef CONFIG_ESP_UART_BRIDGE_TRIGGER
+    struct uart_trigger_state trigger_state;
+#endif
+#ifdef CONFIG_ESP_UART_BRIDGE_TIMESTAMPS
+    struct bridge_mark marks[EVENT_QUEUE_LEN];
+    unsigned num_marks;         // Since boot.
+    uint32_t rx_reported;       // Bytes reported by the driver since boot.
+    uint32_t rx_read;           // Bytes read since boot.
+    uint32_t char_ns;           // Time of one character on the line.
+    int64_t record_us;          // Time of the last record.
+    uint32_t clock_seq;         // Of the last clock record.
+    bool time_pending;          // A client needs a time record.
+#endif
+};
+
+static struct bridge bridges[NUM_BRIDGES];
+static struct stream *streams[NUM_STREAMS];
+#ifdef CONFIG_ESP_UART_BRIDGE_MUX
+static struct stream mux;
+static uint8_t mux_header[MUX_TX_HEADER];  // Of the writer's current frame.
+static size_t mux_header_len;
+static size_t mux_left;                     // Data bytes left in the frame.
+static struct bridge *mux_target;           // NULL to drop them.
+static unsigned long count_mux_dropped;
+#endif
+static uint8_t rx_buffer[SEND_BLOCK_SIZE];
+#ifdef CONFIG_ESP_UART_BRIDGE_RFC2217
+static uint8_t rx_raw[SEND_BLOCK_SIZE / 2];    // Before Telnet escaping.
+static uint8_t *const rx_block = rx_raw;
+#define RX_BLOCK_SIZE   sizeof(rx_raw)
+#elif defined(CONFIG_ESP_UART_BRIDGE_TIMESTAMPS)
+static uint8_t *const rx_block = rx_buffer;
+#define RX_BLOCK_SIZE   (sizeof(rx_buffer) - RECORD_MAX_HEADER)
+#else
+static uint8_t *const rx_block = rx_buffer;
+#define RX_BLOCK_SIZE   sizeof(rx_buffer)
+#endif
+#ifdef CONFIG_ESP_UART_BRIDGE_HISTORY
+// A block of history, as sent to a client.
+static uint8_t replay_buffer[SEND_BLOCK_SIZE];
+#if defined(CONFIG_ESP_UART_BRIDGE_RFC2217) || \
+    defined(CONFIG_ESP_UART_BRIDGE_TIMESTAMPS)
+static uint8_t replay_raw[RX_BLOCK_SIZE];
+#else
+static uint8_t *const replay_raw = replay_buffer;
+#endif
+#endif
+static QueueSetHandle_t queue_set;
+static SemaphoreHandle_t client_lock;   // Held while sending to clients.
+
+static void uart_bridge_print_clients(const struct stream *s)
+{
+    int n = 0;
+
+    for(int i = 0; i < MAX_CLIENTS; i++) {
+        const struct client *c = &s->clients[i];
+        if(c->fd < 0)
+            continue;
+        n++;
+        printf("UART bridge: port %d connected to %s '%s:%d'. RX: %lu "
+                "bytes.\n", s->port, c->writer ? "client" : "observer",
+                c->ip_str, c->port, c->sent);
+    }
+    if(n < MAX_CLIENTS) {
+        printf("UART bridge: listening on port %d, %d of %d clients "
+                "connected.\n", s->port, n, MAX_CLIENTS);
+    }
+}
 
 void uart_bridge_print_status(void)
 {
-    if(client_connected) {
-        printf("UART bridge: connected to client '%s:%d'. TX: %lu bytes, RX: "
-                "%lu bytes.\n", client_ip_str, client_port, count_tx,
-                count_rx);
+    for(int i = 0; i < NUM_BRIDGES; i++) {
+        struct bridge *b = &bridges[i];
+
+        printf("UART bridge: UART%d TX: %lu bytes.\n", b->config->uart_num,
+                b->count_tx);
+        uart_bridge_print_clients(&b->stream);
+        printf("UART bridge: UART%d RX lost: %lu FIFO overflows, %lu ring "
+                "buffer full, %lu framing/parity errors, %lu bytes dropped. "
+                "TX dropped: %lu bytes. Slow observers dropped: %lu.\n",
+                b->config->uart_num, b->count_fifo_overflow,
+                b->count_buffer_full, b->count_rx_errors,
+                b->count_rx_dropped, b->count_tx_dropped,
+                b->stream.count_slow_observers);
+#ifdef CONFIG_ESP_UART_BRIDGE_HISTORY
+        printf("UART bridge: UART%d: %lu bytes replayed from history.\n",
+                b->config->uart_num, b->count_replayed);
+        uart_history_print_status(&b->history);
+#endif
+#ifdef CONFIG_ESP_UART_BRIDGE_RFC2217
+        rfc2217_print_status(&b->rfc);
+#endif
     }
-    else {
-        printf("UART bridge: listening on port %d.\n", listener_port);
+#ifdef CONFIG_ESP_UART_BRIDGE_MUX
+    uart_bridge_print_clients(&mux);
+    printf("UART bridge: multiplexed port: %lu bytes for unknown UARTs "
+            "dropped. Slow observers dropped: %lu.\n", count_mux_dropped,
+            mux.count_slow_observers);
+#endif
+}
+
+#ifdef CONFIG_ESP_UART_BRIDGE_HISTORY
+void uart_bridge_print_history(void)
+{
+    for(int i = 0; i < NUM_BRIDGES; i++) {
+        printf("UART%d: ", bridges[i].config->uart_num);
+        uart_history_print_status(&bridges[i].history);
     }
+    uart_history_print_replay();
 }
+#endif
 
-void uart_bridge_task(void* __attribute__((unused)) arg)
+static struct client *uart_bridge_writer(struct stream *s)
 {
-    int ret;
+    for(int i = 0; i < MAX_CLIENTS; i++) {
+        if(s->clients[i].fd >= 0 && s->clients[i].writer)
+            return &s->clients[i];
+    }
+    return NULL;
+}
+
+// Called by the RX task. Stop sending to a client and wake uart_bridge_task,
+// which closes the connection.
+static void uart_bridge_drop(struct client *c, const char *why)
+{
+    DLOG_WARN(DLOG_BRIDGE, "UART bridge: dropping client %s:%d: %s\n",
+            c->ip_str, c->port, why);
+    shutdown(c->fd, SHUT_RDWR);
+    c->dropped = true;
+}
+
+static inline bool uart_bridge_sending(const struct client *c)
+{
+    return c->fd >= 0 && !c->fresh && !c->dropped;
+}
+
+static bool uart_bridge_any_sending(const struct stream *s)
+{
+    for(int i = 0; i < MAX_CLIENTS; i++) {
+        if(uart_bridge_sending(&s->clients[i]))
+            return true;
+    }
+    return false;
+}
 
-    int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
-    if(listen_fd < 0) {
-        perror("UART bridge: Failed to create socket");
-        vTaskDelete(NULL);
+#ifdef CONFIG_ESP_UART_BRIDGE_HISTORY
+static inline bool uart_bridge_replaying(const struct client *c)
+{
+    return c->replay_pos != c->replay_end;
+}
+
+static bool uart_bridge_replay(struct stream *s, struct client *c);
+#endif
+
+// Send as much as each client accepts from its position in the fan-out ring,
+// without blocking. Called with client_lock held.
+static void uart_bridge_flush(struct stream *s)
+{
+    for(int i = 0; i < MAX_CLIENTS; i++) {
+        struct client *c = &s->clients[i];
+
+#ifdef CONFIG_ESP_UART_BRIDGE_HISTORY
+        // The history goes first.
+        if(uart_bridge_sending(c) && uart_bridge_replaying(c) &&
+                !uart_bridge_replay(s, c))
+            continue;
+#endif
+        while(uart_bridge_sending(c) && c->pos != s->fanout_head) {
+            uint32_t off = c->pos % FANOUT_SIZE;
+            uint32_t len = s->fanout_head - c->pos;
+            if(len > FANOUT_SIZE - off)
+                len = FANOUT_SIZE - off;
+
+            int ret = send(c->fd, s->fanout + off, len, MSG_DONTWAIT);
+            if(ret > 0) {
+                c->pos += ret;
+                c->sent += ret;
+            }
+            else {
+                if(ret < 0 && errno != EAGAIN && errno != EWOULDBLOCK &&
+                        errno != EINTR)
+                    uart_bridge_drop(c, strerror(errno));
+                break;
+            }
+        }
+
+#ifdef CONFIG_ESP_UART_BRIDGE_RFC2217
+        // Replies only go between blocks, never inside an escape sequence.
+        struct bridge *b = s->bridge;
+        if(b != NULL && c->writer && uart_bridge_sending(c) &&
+                c->pos == s->fanout_head && b->reply_len > 0) {
+            int ret = send(c->fd, b->reply_buf, b->reply_len, MSG_DONTWAIT);
+            if(ret > 0) {
+                memmove(b->reply_buf, b->reply_buf + ret,
+                        b->reply_len - ret);
+                b->reply_len -= ret;
+            }
+            else if(ret < 0 && errno != EAGAIN && errno != EWOULDBLOCK &&
+                    errno != EINTR) {
+                uart_bridge_drop(c, strerror(errno));
+            }
+        }
+#endif
+    }
+}
+
+// Drop the observers that adding 'len' bytes to the fan-out ring would
+// overrun. Called with client_lock held.
+static void uart_bridge_reserve(struct stream *s, uint32_t len)
+{
+    for(int i = 0; i < MAX_CLIENTS; i++) {
+        struct client *c = &s->clients[i];
+        if(uart_bridge_sending(c) && !c->writer &&
+                s->fanout_head + len - c->pos > FANOUT_SIZE) {
+            s->count_slow_observers++;
+            uart_bridge_drop(c, "too slow");
+        }
+    }
+}
+
+// Add data to the fan-out ring, after uart_bridge_reserve(). Called with
+// client_lock held.
+static void uart_bridge_fanout(struct stream *s, const uint8_t *data,
+        uint32_t len)
+{
+    uint32_t off = s->fanout_head % FANOUT_SIZE;
+    uint32_t n = FANOUT_SIZE - off;
+    if(n > len)
+        n = len;
+    memcpy(s->fanout + off, data, n);
+    memcpy(s->fanout, data + n, len - n);
+    s->fanout_head += len;
+}
+
+// Fan-out ring space the writer has already sent, or all of it without a
+// writer. Called with client_lock held.
+static uint32_t uart_bridge_room(struct stream *s)
+{
+    struct client *w = uart_bridge_writer(s);
+
+    if(w == NULL || !uart_bridge_sending(w))
+        return FANOUT_SIZE;
+    return FANOUT_SIZE - (s->fanout_head - w->pos);
+}
+
+#ifdef CONFIG_ESP_UART_BRIDGE_TIMESTAMPS
+static uint8_t *uart_bridge_varint(uint8_t *p, uint64_t v)
+{
+    while(v >= 0x80) {
+        *p++ = v | 0x80;
+        v >>= 7;
+    }
+    *p++ = v;
+    return p;
+}
+
+// Called by the RX task for each data event of a UART driver. The driver
+// reports the bytes as soon as the last one is received.
+static void uart_bridge_mark(struct bridge *b, size_t len)
+{
+    if(len == 0)
         return;
+    int64_t now = esp_timer_get_time();
+    struct bridge_mark *m = &b->marks[b->num_marks++ % EVENT_QUEUE_LEN];
+    m->pos = b->rx_reported;
+    m->len = len;
+    m->us = now - (int64_t)(len - 1) * b->char_ns / 1000;
+    b->rx_reported += len;
+}
+
+// When the next byte to read from a UART was received. Bytes not yet
+// reported, e.g. after events were lost, are assumed to have just arrived
+// back to back.
+static int64_t uart_bridge_rx_time(struct bridge *b, size_t buffered)
+{
+    unsigned n = b->num_marks < EVENT_QUEUE_LEN ? b->num_marks :
+            EVENT_QUEUE_LEN;
+
+    for(unsigned k = 1; k <= n; k++) {
+        const struct bridge_mark *m =
+                &b->marks[(b->num_marks - k) % EVENT_QUEUE_LEN];
+        uint32_t ahead = b->rx_read - m->pos;
+        if((int32_t)ahead < 0)
+            continue;
+        if(ahead < m->len)
+            return m->us + (int64_t)ahead * b->char_ns / 1000;
+        break;
     }
+    return esp_timer_get_time() -
+            (int64_t)(buffered - 1) * b->char_ns / 1000;
+}
 
-    // Set socket as non-blocking.
-    int flags = fcntl(listen_fd, F_GETFL, 0);
-    fcntl(listen_fd, F_SETFL, flags | O_NONBLOCK);
+// Build the records that go before 'len' bytes received at 'us' on a
+// UART's own port: a time record for new clients, a clock record for each
+// new sample of the CMSIS-DAP task, and the data record's header. Returns
+// the length, at most RECORD_MAX_HEADER. Called with client_lock held.
+static size_t uart_bridge_record_header(struct bridge *b, int64_t us,
+        size_t len, uint8_t *header)
+{
+    struct cmsis_dap_clock clock;
+    uint32_t seq = cmsis_dap_get_clock(&clock);
+    uint8_t *p = header;
 
-    // Bind server socket and listen.
-    struct sockaddr_in server_addr;
-    server_addr.sin_family = AF_INET;
-    server_addr.sin_addr.s_addr = INADDR_ANY;
-    server_addr.sin_port = htons(listener_port);
-    ret = bind(listen_fd, (struct sockaddr*)&server_addr, sizeof(server_addr));
-    if(ret < 0) {
-        perror("UART bridge: failed to bind socket");
-        vTaskDelete(NULL);
+    // Estimates may be out of order; deltas are never negative.
+    if(us < b->record_us)
+        us = b->record_us;
+    if(b->time_pending) {
+        p = uart_bridge_varint(p, RECORD_TIME);
+        p = uart_bridge_varint(p, us);
+        b->record_us = us;
+        b->clock_seq = 0;
+        b->time_pending = false;
+    }
+    if(seq != b->clock_seq) {
+        p = uart_bridge_varint(p, RECORD_CLOCK);
+        p = uart_bridge_varint(p, clock.us);
+        p = uart_bridge_varint(p, clock.ticks);
+        p = uart_bridge_varint(p, clock.hz);
+        b->clock_seq = seq;
+    }
+    p = uart_bridge_varint(p, (uint64_t)(us - b->record_us) << 1 |
+            RECORD_DATA);
+    p = uart_bridge_varint(p, len);
+    b->record_us = us;
+    return p - header;
+}
+#endif
+
+#ifdef CONFIG_ESP_UART_BRIDGE_HISTORY
+// Encode the block of history at the client's replay position into
+// replay_buffer. Returns its length, or 0 if the history has been
+// overwritten meanwhile. The same block is encoded again until it is sent.
+static size_t uart_bridge_replay_block(struct bridge *b, struct client *c)
+{
+    uint64_t pos = c->replay_pos;
+
+    if(c->replay_len == 0) {
+        uint64_t left = c->replay_end - c->replay_pos;
+        c->replay_len = left < RX_BLOCK_SIZE ? left : RX_BLOCK_SIZE;
+    }
+    size_t len = uart_history_read(&b->history, &pos, replay_raw,
+            c->replay_len);
+    if(len != c->replay_len || pos != c->replay_pos + len)
+        return 0;
+
+#if defined(CONFIG_ESP_UART_BRIDGE_RFC2217)
+    return rfc2217_escape(replay_raw, len, replay_buffer);
+#elif defined(CONFIG_ESP_UART_BRIDGE_TIMESTAMPS)
+    // The history only has coarse times.
+    uint8_t *p = uart_bridge_varint(replay_buffer, RECORD_UNTIMED);
+    p = uart_bridge_varint(p, len);
+    memcpy(p, replay_raw, len);
+    return p + len - replay_buffer;
+#else
+    return len;
+#endif
+}
+
+// Stop replaying to a client that is too slow: drop an observer, let the
+// writer continue with new data.
+static void uart_bridge_replay_give_up(struct stream *s, struct client *c,
+        const char *why)
+{
+    if(!c->writer) {
+        s->count_slow_observers++;
+        uart_bridge_drop(c, why);
         return;
     }
-    ret = listen(listen_fd, 1);
-    if(ret < 0) {
-        perror("UART bridge: failed to listen on socket");
-        vTaskDelete(NULL);
+    DLOG_WARN(DLOG_BRIDGE, "UART bridge: history replay to %s:%d cut "
+            "short: %s\n", c->ip_str, c->port, why);
+    c->replay_pos = c->replay_end;
+}
+
+// Send as much of the history as a client accepts, without blocking.
+// Returns true once the replay is done. Called with client_lock held.
+static bool uart_bridge_replay(struct stream *s, struct client *c)
+{
+    struct bridge *b = s->bridge;
+
+    while(uart_bridge_replaying(c)) {
+        if(xTaskGetTickCount() - c->replay_since >
+                pdMS_TO_TICKS(REPLAY_TIMEOUT_MS)) {
+            uart_bridge_replay_give_up(s, c, "replay too slow");
+            break;
+        }
+        size_t len = uart_bridge_replay_block(b, c);
+        if(len == 0) {
+            uart_bridge_replay_give_up(s, c, "history overwritten");
+            break;
+        }
+
+        int ret = send(c->fd, replay_buffer + c->replay_sent,
+                len - c->replay_sent, MSG_DONTWAIT);
+        if(ret <= 0) {
+            if(ret < 0 && errno != EAGAIN && errno != EWOULDBLOCK &&
+                    errno != EINTR)
+                uart_bridge_drop(c, strerror(errno));
+            return false;
+        }
+        c->sent += ret;
+        c->replay_sent += ret;
+        if(c->replay_sent == len) {
+            b->count_replayed += c->replay_len;
+            c->replay_pos += c->replay_len;
+            c->replay_len = 0;
+            c->replay_sent = 0;
+        }
+    }
+    return uart_bridge_sending(c);
+}
+#endif
+
+// Start sending to clients accepted since the last call, and reset the
+// counters of the RX task for a new writer. Called with client_lock held.
+static void uart_bridge_start_clients(struct stream *s)
+{
+    struct bridge *b = s->bridge;
+
+    for(int i = 0; i < MAX_CLIENTS; i++) {
+        struct client *c = &s->clients[i];
+        if(c->fd < 0 || !c->fresh)
+            continue;
+        c->fresh = false;
+        if(c->writer) {
+            s->count_slow_observers = 0;
+            if(b != NULL) {
+                b->count_rx_dropped = 0;
+                b->count_fifo_overflow = 0;
+                b->count_buffer_full = 0;
+                b->count_rx_errors = 0;
+#ifdef CONFIG_ESP_UART_BRIDGE_HISTORY
+                b->count_replayed = 0;
+#endif
+            }
+        }
+#ifdef CONFIG_ESP_UART_BRIDGE_HISTORY
+        // Data received from now on goes to the fan-out ring.
+        c->replay_pos = 0;
+        c->replay_end = 0;
+        c->replay_len = 0;
+        c->replay_sent = 0;
+        c->replay_since = xTaskGetTickCount();
+        if(b != NULL) {
+            c->replay_pos = uart_history_replay_start(&b->history);
+            c->replay_end = b->history.head;
+        }
+#endif
+#ifdef CONFIG_ESP_UART_BRIDGE_TIMESTAMPS
+        if(b != NULL)
+            b->time_pending = true;
+#endif
+        c->pos = s->fanout_head;
+    }
+}
+
+// Wait up to RETRY_MS for a client with unsent data to become writable.
+// Returns false at once if no client has unsent data.
+static bool uart_bridge_wait_writable(void)
+{
+    fd_set write_fds;
+    int max_fd = -1;
+
+    FD_ZERO(&write_fds);
+    xSemaphoreTake(client_lock, portMAX_DELAY);
+    for(int j = 0; j < NUM_STREAMS; j++) {
+        struct stream *s = streams[j];
+        for(int i = 0; i < MAX_CLIENTS; i++) {
+            struct client *c = &s->clients[i];
+            bool pending = c->pos != s->fanout_head;
+#ifdef CONFIG_ESP_UART_BRIDGE_HISTORY
+            pending = pending || uart_bridge_replaying(c);
+#endif
+#ifdef CONFIG_ESP_UART_BRIDGE_RFC2217
+            pending = pending || (c->writer && s->bridge != NULL &&
+                    s->bridge->reply_len > 0);
+#endif
+            if(uart_bridge_sending(c) && pending) {
+                FD_SET(c->fd, &write_fds);
+                max_fd = MAX(max_fd, c->fd);
+            }
+        }
+    }
+    xSemaphoreGive(client_lock);
+
+    if(max_fd < 0)
+        return false;
+
+    // A socket closed meanwhile just ends the wait early.
+    struct timeval tv = { .tv_sec = 0, .tv_usec = RETRY_MS * 1000 };
+    select(max_fd + 1, NULL, &write_fds, NULL, &tv);
+    return true;
+}
+
+// Write as much of 'len' bytes as fits in a UART's TX ring buffer, without
+// blocking. Returns the number of bytes written.
+static size_t uart_bridge_write_uart(struct bridge *b, const char *data,
+        size_t len)
+{
+    size_t room = 0;
+
+    uart_get_tx_buffer_free_size(b->config->uart_num, &room);
+    if(room > len)
+        room = len;
+    if(room == 0)
+        return 0;
+
+    int ret = uart_write_bytes(b->config->uart_num, data, room);
+    if(ret <= 0)
+        return 0;
+    b->count_tx += ret;
+    return ret;
+}
+
+#ifdef CONFIG_ESP_UART_BRIDGE_MUX
+static struct bridge *uart_bridge_find(int uart_num)
+{
+    for(int i = 0; i < NUM_BRIDGES; i++) {
+        if(bridges[i].config->uart_num == uart_num)
+            return &bridges[i];
+    }
+    return NULL;
+}
+
+// Split the multiplexed writer's data into frames and write them to their
+// UARTs, without blocking. A frame for a slow UART holds up the frames
+// behind it.
+static void uart_bridge_write_mux(struct stream *s)
+{
+    while(s->tx_pending > 0) {
+        if(mux_header_len < MUX_TX_HEADER) {
+            mux_header[mux_header_len++] = s->buffer[s->tx_offset++];
+            s->tx_pending--;
+            if(mux_header_len == MUX_TX_HEADER) {
+                mux_target = uart_bridge_find(mux_header[0]);
+                mux_left = mux_header[1] | (mux_header[2] << 8);
+                if(mux_left == 0)
+                    mux_header_len = 0;
+            }
+            continue;
+        }
+
+        size_t n = mux_left < s->tx_pending ? mux_left : s->tx_pending;
+        if(mux_target != NULL) {
+            n = uart_bridge_write_uart(mux_target, s->buffer + s->tx_offset,
+                    n);
+            if(n == 0)
+                break;
+        }
+        else {
+            count_mux_dropped += n;
+        }
+        s->tx_offset += n;
+        s->tx_pending -= n;
+        mux_left -= n;
+        if(mux_left == 0)
+            mux_header_len = 0;
+    }
+}
+#endif
+
+// Write as much pending writer data as fits in the TX ring buffers, without
+// blocking.
+static void uart_bridge_write_tx(struct stream *s)
+{
+#ifdef CONFIG_ESP_UART_BRIDGE_MUX
+    if(s->bridge == NULL) {
+        uart_bridge_write_mux(s);
         return;
     }
+#endif
+    size_t n = uart_bridge_write_uart(s->bridge, s->buffer + s->tx_offset,
+            s->tx_pending);
+    s->tx_offset += n;
+    s->tx_pending -= n;
+}
+
+// Wake the RX task.
+static void uart_bridge_wake_rx(void)
+{
+    uart_event_t event = { .type = UART_DATA, .size = 0 };
+
+    xQueueSend(bridges[0].queue, &event, 0);
+}
+
+#ifdef CONFIG_ESP_UART_BRIDGE_RFC2217
+// Called by rfc2217.c in uart_bridge_task. Queue a Telnet reply for the RX
+// task and wake it.
+static void uart_bridge_queue_reply(void *ctx, const uint8_t *data,
+        size_t len)
+{
+    struct bridge *b = ctx;
+
+    xSemaphoreTake(client_lock, portMAX_DELAY);
+    if(b->reply_len + len <= sizeof(b->reply_buf)) {
+        memcpy(b->reply_buf + b->reply_len, data, len);
+        b->reply_len += len;
+    }
+    xSemaphoreGive(client_lock);
+    uart_bridge_wake_rx();
+}
+#endif
+
+// Move data buffered by a UART driver into the fan-out rings, or drop it if
+// no client is connected, and send what the clients accept. Called with
+// client_lock held.
+static void uart_bridge_forward(struct bridge *b)
+{
+    struct stream *s = &b->stream;
+    size_t avail = 0;
+
+    while(uart_bridge_room(s) >= SEND_BLOCK_SIZE &&
+#ifdef CONFIG_ESP_UART_BRIDGE_MUX
+            uart_bridge_room(&mux) >= MUX_RX_HEADER + RX_BLOCK_SIZE &&
+#endif
+            uart_get_buffered_data_len(b->config->uart_num, &avail) ==
+                ESP_OK && avail > 0) {
+#ifdef CONFIG_ESP_UART_BRIDGE_RFC2217
+        // Leave the data in the ring buffer while the writer has suspended
+        // it, and until pending replies are sent.
+        if(uart_bridge_writer(s) != NULL &&
+                (rfc2217_suspended(&b->rfc) || b->reply_len > 0))
+            break;
+#endif
+#if defined(CONFIG_ESP_UART_BRIDGE_TIMESTAMPS)
+        int64_t t = uart_bridge_rx_time(b, avail);
+#elif defined(CONFIG_ESP_UART_BRIDGE_MUX)
+        int64_t t = esp_timer_get_time();
+#endif
+        if(avail > RX_BLOCK_SIZE)
+            avail = RX_BLOCK_SIZE;
+        int len = uart_read_bytes(b->config->uart_num, rx_block, avail, 0);
+        if(len <= 0)
+            break;
+#ifdef CONFIG_ESP_UART_BRIDGE_TIMESTAMPS
+        b->rx_read += len;
+#endif
+#ifdef CONFIG_ESP_UART_BRIDGE_TRIGGER
+        uart_trigger_feed(&b->trigger_state, b->config->uart_num, rx_block,
+                len);
+#endif
+#ifdef CONFIG_ESP_UART_BRIDGE_HISTORY
+        uart_history_write(&b->history, rx_block, len);
+#endif
+
+        bool any = false;
+#ifdef CONFIG_ESP_UART_BRIDGE_MUX
+        if(uart_bridge_any_sending(&mux)) {
+            uint8_t header[MUX_RX_HEADER] = {
+                b->config->uart_num, len & 0xff, len >> 8,
+                t & 0xff, (t >> 8) & 0xff, (t >> 16) & 0xff,
+                (t >> 24) & 0xff,
+            };
+            uart_bridge_reserve(&mux, sizeof(header) + len);
+            uart_bridge_fanout(&mux, header, sizeof(header));
+            uart_bridge_fanout(&mux, rx_block, len);
+            uart_bridge_flush(&mux);
+            any = true;
+        }
+#endif
+        if(uart_bridge_any_sending(s)) {
+#ifdef CONFIG_ESP_UART_BRIDGE_RFC2217
+            len = rfc2217_escape(rx_raw, len, rx_buffer);
+#endif
+#ifdef CONFIG_ESP_UART_BRIDGE_TIMESTAMPS
+            uint8_t header[RECORD_MAX_HEADER];
+            size_t n = uart_bridge_record_header(b, t, len, header);
+            uart_bridge_reserve(s, n + len);
+            uart_bridge_fanout(s, header, n);
+#else
+            uart_bridge_reserve(s, len);
+#endif
+            uart_bridge_fanout(s, rx_buffer, len);
+            uart_bridge_flush(s);
+            any = true;
+        }
+        if(!any)
+            b->count_rx_dropped += len;
+    }
+}
+
+static void uart_bridge_forward_rx(void)
+{
+    xSemaphoreTake(client_lock, portMAX_DELAY);
+    for(int i = 0; i < NUM_STREAMS; i++) {
+        uart_bridge_start_clients(streams[i]);
+        uart_bridge_flush(streams[i]);
+    }
+    for(int i = 0; i < NUM_BRIDGES; i++)
+        uart_bridge_forward(&bridges[i]);
+    xSemaphoreGive(client_lock);
+}
+
+// Wait for events from any UART driver, or for clients to accept more data,
+// and forward received data to the clients.
+static void uart_bridge_rx_task(void* __attribute__((unused)) arg)
+{
+    QueueSetMemberHandle_t member;
+    uart_event_t event;
+
+    while(1) {
+        // Also poll, in case events were lost because a queue was full.
+        TickType_t wait = pdMS_TO_TICKS(100);
+        if(uart_bridge_wait_writable())
+            wait = 0;
+
+        while((member = xQueueSelectFromSet(queue_set, wait)) != NULL) {
+            wait = 0;
+            struct bridge *b = NULL;
+            for(int i = 0; i < NUM_BRIDGES; i++) {
+                if(bridges[i].queue == member)
+                    b = &bridges[i];
+            }
+            if(b == NULL || xQueueReceive(member, &event, 0) != pdTRUE)
+                continue;
+
+            switch(event.type) {
+                case UART_FIFO_OVF:
+                    // The driver has already reset the FIFO.
+                    b->count_fifo_overflow++;
+                    break;
+                case UART_BUFFER_FULL:
+                    b->count_buffer_full++;
+#ifdef CONFIG_ESP_UART_BRIDGE_TIMESTAMPS
+                    // The driver keeps these bytes and adds them later.
+                    uart_bridge_mark(b, event.size);
+#endif
+                    break;
+#ifdef CONFIG_ESP_UART_BRIDGE_TIMESTAMPS
+                case UART_DATA:
+                    uart_bridge_mark(b, event.size);
+                    break;
+#endif
+                case UART_FRAME_ERR:
+                case UART_PARITY_ERR:
+                    b->count_rx_errors++;
+                    break;
+                default:
+                    break;
+            }
+        }
+        uart_bridge_forward_rx();
+    }
+}
+
+static int uart_bridge_init_stream(struct stream *s, int port,
+        struct bridge *b)
+{
+    s->port = port;
+    s->listen_fd = -1;
+    s->bridge = b;
+    for(int i = 0; i < MAX_CLIENTS; i++)
+        s->clients[i].fd = -1;
+    s->fanout = malloc(FANOUT_SIZE);
+    if(s->fanout == NULL) {
+        DLOG_ERROR(DLOG_BRIDGE, "UART bridge: failed to allocate %d bytes "
+                "for port %d\n", FANOUT_SIZE, port);
+        return -1;
+    }
+    return 0;
+}
+
+static int uart_bridge_init_uart(struct bridge *b)
+{
+    const struct uart_bridge_config *config = b->config;
+    uart_port_t uart_num = config->uart_num;
+    bool flow_ctrl = config->rts_pin != UART_PIN_NO_CHANGE;
+    esp_err_t ret;
 
     // Set up UART.
-    ret = uart_driver_install(CONFIG_ESP_UART_BRIDGE_UART_NUM,
-            UART_BUFFER_SIZE, UART_BUFFER_SIZE, 0, NULL, 0);
+    ret = uart_driver_install(uart_num, CONFIG_ESP_UART_BRIDGE_RX_BUFFER_SIZE,
+            CONFIG_ESP_UART_BRIDGE_TX_BUFFER_SIZE, EVENT_QUEUE_LEN,
+            &b->queue, 0);
     if(ret != ESP_OK) {
-        fprintf(stderr, "UART bridge: UART driver installation failed\n");
-        vTaskDelete(NULL);
-        return;
+        DLOG_ERROR(DLOG_BRIDGE, "UART bridge: UART%d driver installation "
+                "failed\n", uart_num);
+        return -1;
+    }
+    // Queues must be empty when added to a set, so add it before the UART
+    // is configured.
+    if(xQueueAddToSet(b->queue, queue_set) != pdPASS) {
+        DLOG_ERROR(DLOG_BRIDGE, "UART bridge: failed to add UART%d to the "
+                "queue set\n", uart_num);
+        return -1;
     }
-    uart_vfs_dev_register();
 
     uart_config_t uart_config = {
-        .baud_rate  = CONFIG_ESP_UART_BRIDGE_BAUD_RATE,
+        .baud_rate  = config->baud_rate,
         .data_bits  = UART_DATA_BITS,
         .parity     = UART_PARITY,
         .stop_bits  = UART_STOP_BITS,
-        .flow_ctrl  = UART_HW_FLOWCTRL_DISABLE,
+        .flow_ctrl  = flow_ctrl ? UART_HW_FLOWCTRL_CTS_RTS :
+                UART_HW_FLOWCTRL_DISABLE,
+        .rx_flow_ctrl_thresh = RX_FLOW_CTRL_THRESH,
         .source_clk = UART_SCLK_DEFAULT,
     };
-    ESP_ERROR_CHECK(uart_param_config(CONFIG_ESP_UART_BRIDGE_UART_NUM,
-                &uart_config));
+    ESP_ERROR_CHECK(uart_param_config(uart_num, &uart_config));
 
-#ifdef CONFIG_ESP_UART_BRIDGE_REMAP_PINS
-    fprintf(stderr, "UART bridge: remapping UART%d TX = GPIO_NUM_%u, RX = "
-            "GPIO_NUM_%u.\n", CONFIG_ESP_UART_BRIDGE_UART_NUM,
-            CONFIG_ESP_UART_BRIDGE_TXD_PIN,
-            CONFIG_ESP_UART_BRIDGE_RXD_PIN);
-    ESP_ERROR_CHECK(gpio_set_direction(CONFIG_ESP_UART_BRIDGE_RXD_PIN,
-                GPIO_MODE_INPUT));
-    ESP_ERROR_CHECK(gpio_set_direction(CONFIG_ESP_UART_BRIDGE_TXD_PIN,
-                GPIO_MODE_INPUT));
-    ESP_ERROR_CHECK(uart_set_pin(CONFIG_ESP_UART_BRIDGE_UART_NUM,
-                CONFIG_ESP_UART_BRIDGE_TXD_PIN, CONFIG_ESP_UART_BRIDGE_RXD_PIN,
-                UART_PIN_NO_CHANGE, UART_PIN_NO_CHANGE));
-#endif
-    uart_vfs_dev_use_driver(CONFIG_ESP_UART_BRIDGE_UART_NUM);
-
-    char uart_addr[32];
-    snprintf(uart_addr, sizeof(uart_addr), "/dev/uart/%u",
-            CONFIG_ESP_UART_BRIDGE_UART_NUM);
-
-    fprintf(stdout, "UART bridge: listening on port %d for UART%u.\n",
-            listener_port, CONFIG_ESP_UART_BRIDGE_UART_NUM);
-
-    // Select() loop blocks until activity on sockets or UART.
-    struct sockaddr_in client_addr;
-    int client_fd = -1;
-    int uart_fd = -1;
-    while (1) {
-        fd_set read_fds;
-        FD_ZERO(&read_fds);
+    if(config->txd_pin != UART_PIN_NO_CHANGE) {
+        DLOG_INFO(DLOG_BRIDGE, "UART bridge: remapping UART%d TX = "
+                "GPIO_NUM_%u, RX = GPIO_NUM_%u.\n", uart_num, config->txd_pin,
+                config->rxd_pin);
+        ESP_ERROR_CHECK(gpio_set_direction(config->rxd_pin,
+                    GPIO_MODE_INPUT));
+        ESP_ERROR_CHECK(gpio_set_direction(config->txd_pin,
+                    GPIO_MODE_INPUT));
+        ESP_ERROR_CHECK(uart_set_pin(uart_num, config->txd_pin,
+                    config->rxd_pin, UART_PIN_NO_CHANGE,
+                    UART_PIN_NO_CHANGE));
+    }
+    if(flow_ctrl) {
+        DLOG_INFO(DLOG_BRIDGE, "UART bridge: UART%d RTS = GPIO_NUM_%u, CTS = "
+                "GPIO_NUM_%u.\n", uart_num, config->rts_pin,
+                config->cts_pin);
+        ESP_ERROR_CHECK(uart_set_pin(uart_num, UART_PIN_NO_CHANGE,
+                    UART_PIN_NO_CHANGE, config->rts_pin, config->cts_pin));
+    }
+    // The default threshold leaves only a few byte times to empty the FIFO.
+    uart_set_rx_full_threshold(uart_num, RX_FULL_THRESHOLD);
+#ifdef CONFIG_ESP_UART_BRIDGE_TIMESTAMPS
+    int bits = 1 + CONFIG_ESP_UART_BRIDGE_DATA_BITS +
+            CONFIG_ESP_UART_BRIDGE_STOP_BITS +
+            (uart_config.parity != UART_PARITY_DISABLE);
+    b->char_ns = 1000000000ULL * bits / config->baud_rate;
+#endif
 
-        // Add listening socket and client socket to read_fds.
-        FD_SET(listen_fd, &read_fds);
-        if(client_fd >= 0)
-            FD_SET(client_fd, &read_fds);
-        if(uart_fd >= 0)
-            FD_SET(uart_fd, &read_fds);
-        int max_fd = MAX(listen_fd, MAX(client_fd, uart_fd));
+#ifdef CONFIG_ESP_UART_BRIDGE_HISTORY
+    // Without history the bridge still works.
+    uart_history_init(&b->history);
+#endif
+#ifdef CONFIG_ESP_UART_BRIDGE_RFC2217
+    rfc2217_init(&b->rfc, uart_num, uart_bridge_queue_reply, b);
+#endif
+    return 0;
+}
 
-        // Blocking call to select.
-        int activity = select(max_fd+1, &read_fds, NULL, NULL, NULL);
-        if (activity < 0) {
-            //ESP_LOGE(TAG, "select failed: errno %d", errno);
-            perror("UART bridge: select error");
+int uart_bridge_init(void)
+{
+    queue_set = xQueueCreateSet(NUM_BRIDGES * EVENT_QUEUE_LEN);
+    client_lock = xSemaphoreCreateMutex();
+    if(queue_set == NULL || client_lock == NULL) {
+        DLOG_ERROR(DLOG_BRIDGE, "UART bridge: out of memory\n");
+        return -1;
+    }
+
+    for(int i = 0; i < NUM_BRIDGES; i++) {
+        struct bridge *b = &bridges[i];
+        b->config = &configs[i];
+        streams[i] = &b->stream;
+        if(uart_bridge_init_stream(&b->stream, b->config->tcp_port, b) != 0 ||
+                uart_bridge_init_uart(b) != 0)
+            return -1;
+    }
+#ifdef CONFIG_ESP_UART_BRIDGE_TRIGGER
+    // Without the trigger the bridge still works.
+    uart_trigger_init();
+#endif
+#ifdef CONFIG_ESP_UART_BRIDGE_MUX
+    streams[NUM_BRIDGES] = &mux;
+    if(uart_bridge_init_stream(&mux, CONFIG_ESP_UART_BRIDGE_MUX_TCP_PORT,
+                NULL) != 0)
+        return -1;
+#endif
+
+    if(xTaskCreate(uart_bridge_rx_task, "uart_bridge_rx", RX_TASK_STACK,
+                NULL, RX_TASK_PRIO, NULL) != pdPASS) {
+        DLOG_ERROR(DLOG_BRIDGE, "UART bridge: failed to create RX task\n");
+        return -1;
+    }
+    return 0;
+}
+
+static int uart_bridge_listen(struct stream *s)
+{
+    int ret;
+
+    s->listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if(s->listen_fd < 0) {
+        DLOG_ERROR(DLOG_BRIDGE, "UART bridge: Failed to create socket: "
+                "%s\n", strerror(errno));
+        return -1;
+    }
+
+    // Set socket as non-blocking.
+    int flags = fcntl(s->listen_fd, F_GETFL, 0);
+    fcntl(s->listen_fd, F_SETFL, flags | O_NONBLOCK);
+
+    // Bind server socket and listen.
+    struct sockaddr_in server_addr;
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_addr.s_addr = INADDR_ANY;
+    server_addr.sin_port = htons(s->port);
+    ret = bind(s->listen_fd, (struct sockaddr*)&server_addr,
+            sizeof(server_addr));
+    if(ret < 0) {
+        DLOG_ERROR(DLOG_BRIDGE, "UART bridge: failed to bind socket: %s\n",
+                strerror(errno));
+        return -1;
+    }
+    ret = listen(s->listen_fd, MAX_CLIENTS);
+    if(ret < 0) {
+        DLOG_ERROR(DLOG_BRIDGE, "UART bridge: failed to listen on socket: "
+                "%s\n", strerror(errno));
+        return -1;
+    }
+
+    if(s->bridge != NULL) {
+        DLOG_INFO(DLOG_BRIDGE, "UART bridge: listening on port %d for "
+                "UART%u.\n", s->port, s->bridge->config->uart_num);
+    }
+    else {
+        DLOG_INFO(DLOG_BRIDGE, "UART bridge: listening on port %d for all "
+                "UARTs, multiplexed.\n", s->port);
+    }
+    return 0;
+}
+
+static void uart_bridge_accept(struct stream *s)
+{
+    struct sockaddr_in client_addr;
+    socklen_t addr_len = sizeof(client_addr);
+    int new_fd = accept(s->listen_fd, (struct sockaddr*)&client_addr,
+            &addr_len);
+    if(new_fd < 0) {
+        if(errno != EAGAIN && errno != EWOULDBLOCK) {
+            // Just ignore error for now.
+            DLOG_ERROR(DLOG_BRIDGE, "UART bridge: accept error: %s\n",
+                    strerror(errno));
+        }
+        return;
+    }
+
+    struct client *c = NULL;
+    for(int i = 0; i < MAX_CLIENTS; i++) {
+        if(s->clients[i].fd < 0) {
+            c = &s->clients[i];
             break;
         }
+    }
+    if(c == NULL) {
+        DLOG_WARN(DLOG_BRIDGE, "UART bridge: dropping new connection. %d "
+                "clients are already connected to port %d.\n", MAX_CLIENTS,
+                s->port);
+        close(new_fd);
+        return;
+    }
 
-        // Handle new connections.
-        if (FD_ISSET(listen_fd, &read_fds)) {
-            socklen_t addr_len = sizeof(client_addr);
-            int new_fd = accept(listen_fd, (struct sockaddr*)&client_addr,
-                    &addr_len);
-            if(new_fd < 0) {
-                if(errno != EAGAIN && errno != EWOULDBLOCK) {
-                    // Just ignore error for now.
-                    perror("UART bridge: accept error");
-                }
-            }
-            else {
-                if(client_fd < 0) {
-                    // New client.
-                    fcntl(new_fd, F_SETFL, O_NONBLOCK);
-                    client_fd = new_fd;
-                    inet_ntop(AF_INET, &client_addr.sin_addr, client_ip_str,
-                            sizeof(client_ip_str));
-                    client_port = ntohs(client_addr.sin_port);
-                    fprintf(stdout, "UART bridge: client connected %s:%d\n",
-                            client_ip_str, client_port);
+    // New client. All I/O uses MSG_DONTWAIT.
+    bool writer = (uart_bridge_writer(s) == NULL);
+    inet_ntop(AF_INET, &client_addr.sin_addr, c->ip_str, sizeof(c->ip_str));
+    c->port = ntohs(client_addr.sin_port);
+    DLOG_INFO(DLOG_BRIDGE, "UART bridge: %s connected %s:%d to port %d\n",
+            writer ? "client" : "observer", c->ip_str, c->port, s->port);
 
 #ifdef CONFIG_ESP_UART_BRIDGE_KEEPALIVE_TIMEOUT
-                    // Use TCP keepalives to detect dead clients.
-                    int val = 1;
-                    setsockopt(client_fd, SOL_SOCKET, SO_KEEPALIVE, &val,
-                            sizeof(val));
-                    // Seconds between probes (Linux and ESP32)
-                    val = 1;
-                    setsockopt(client_fd, IPPROTO_TCP, TCP_KEEPIDLE, &val,
-                            sizeof(val));
-                    setsockopt(client_fd, IPPROTO_TCP, TCP_KEEPINTVL, &val,
-                            sizeof(val));
-                    // Number of probes to send before closing the connection.
-                    val = CONFIG_ESP_UART_BRIDGE_KEEPALIVE_TIMEOUT;
-                    setsockopt(client_fd, IPPROTO_TCP, TCP_KEEPCNT, &val,
-                            sizeof(val));
-#endif
-
-                    // Open UART.
-                    uart_fd = open(uart_addr, O_RDWR);
-                    if(uart_fd < 0) {
-                        perror("UART bridge: failed opening UART");
-                        close(client_fd);
-                        client_fd = -1;
-                    }
-
-                    int flags = fcntl(uart_fd, F_GETFL, 0);
-                    fcntl(uart_fd, F_SETFL, flags | O_NONBLOCK);
-
-                    count_rx = 0;
-                    count_tx = 0;
-                    client_connected = true;
-
-                    // Restart select() loop.
-                    continue;
-                }
-                else {
-                    fprintf(stderr, "UART bridge: dropping new connection. "
-                            "Another client is already connected.\n");
-                    close(new_fd);
+    // Use TCP keepalives to detect dead clients.
+    int val = 1;
+    setsockopt(new_fd, SOL_SOCKET, SO_KEEPALIVE, &val, sizeof(val));
+    // Seconds between probes (Linux and ESP32)
+    val = 1;
+    setsockopt(new_fd, IPPROTO_TCP, TCP_KEEPIDLE, &val, sizeof(val));
+    setsockopt(new_fd, IPPROTO_TCP, TCP_KEEPINTVL, &val, sizeof(val));
+    // Number of probes to send before closing the connection.
+    val = CONFIG_ESP_UART_BRIDGE_KEEPALIVE_TIMEOUT;
+    setsockopt(new_fd, IPPROTO_TCP, TCP_KEEPCNT, &val, sizeof(val));
+#endif
+
+    // Counters of this task. The RX task resets its own when it starts
+    // sending to the writer.
+    struct bridge *b = s->bridge;
+    if(writer) {
+        if(b != NULL) {
+            b->count_tx = 0;
+            b->count_tx_dropped = 0;
+        }
+#ifdef CONFIG_ESP_UART_BRIDGE_MUX
+        else {
+            mux_header_len = 0;
+            count_mux_dropped = 0;
+        }
+#endif
+    }
+
+    // The RX task starts sending to the new client.
+    xSemaphoreTake(client_lock, portMAX_DELAY);
+#ifdef CONFIG_ESP_UART_BRIDGE_RFC2217
+    if(writer && b != NULL) {
+        b->reply_len = 0;
+        rfc2217_init(&b->rfc, b->config->uart_num, uart_bridge_queue_reply,
+                b);
+    }
+#endif
+    c->writer = writer;
+    c->fresh = true;
+    c->dropped = false;
+    c->sent = 0;
+    c->fd = new_fd;
+    xSemaphoreGive(client_lock);
+    uart_bridge_wake_rx();
+}
+
+// Read from a client. Returns false if it has disconnected, or the RX task
+// dropped it.
+static bool uart_bridge_read(struct stream *s, struct client *c,
+        bool readable)
+{
+    int ret;
+
+    if(readable) {
+        if(c->writer) {
+            ret = recv(c->fd, s->buffer, sizeof(s->buffer), MSG_DONTWAIT);
+        }
+        else {
+            // Observers are read-only. Discard their input.
+            char discard[64];
+            ret = recv(c->fd, discard, sizeof(discard), MSG_DONTWAIT);
+        }
+    }
+    else if(c->writer && s->tx_pending > 0) {
+        // The writer is not read while data is pending, so check whether it
+        // has gone.
+        char ch;
+        ret = recv(c->fd, &ch, 1, MSG_PEEK | MSG_DONTWAIT);
+        if(ret > 0)
+            return true;
+    }
+    else {
+        return true;
+    }
+
+    if(ret == 0 ||
+      (ret < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+        return false;
+
+    if(ret > 0 && c->writer) {
+#ifdef CONFIG_ESP_UART_BRIDGE_RFC2217
+        // Apply Telnet commands and keep only the data.
+        if(s->bridge != NULL) {
+            ret = rfc2217_from_client(&s->bridge->rfc, (uint8_t *)s->buffer,
+                    ret);
+        }
+#endif
+        s->tx_offset = 0;
+        s->tx_pending = ret;
+    }
+    return true;
+}
+
+static void uart_bridge_close(struct stream *s, struct client *c)
+{
+    DLOG_INFO(DLOG_BRIDGE, "UART bridge: %s disconnected %s:%d from port %d\n",
+            c->writer ? "client" : "observer", c->ip_str, c->port, s->port);
+    xSemaphoreTake(client_lock, portMAX_DELAY);
+    close(c->fd);
+    c->fd = -1;
+#ifdef CONFIG_ESP_UART_BRIDGE_RFC2217
+    if(c->writer && s->bridge != NULL)
+        s->bridge->reply_len = 0;
+#endif
+    xSemaphoreGive(client_lock);
+    if(!c->writer)
+        return;
+    if(s->bridge != NULL)
+        s->bridge->count_tx_dropped += s->tx_pending;
+#ifdef CONFIG_ESP_UART_BRIDGE_MUX
+    else
+        count_mux_dropped += s->tx_pending;
+#endif
+    s->tx_pending = 0;
+}
+
+void uart_bridge_task(void* __attribute__((unused)) arg)
+{
+    for(int j = 0; j < NUM_STREAMS; j++) {
+        if(uart_bridge_listen(streams[j]) != 0) {
+            vTaskDelete(NULL);
+            return;
+        }
+    }
+
+    // Select() loop blocks until activity on sockets, or polls the TX ring
+    // buffers while writer data is pending.
+    while (1) {
+        fd_set read_fds;
+        FD_ZERO(&read_fds);
+        int max_fd = -1;
+        bool pending = false;
+
+        // Add listening sockets and client sockets to read_fds. A writer is
+        // not read until its previous data has been written to the UART.
+        for(int j = 0; j < NUM_STREAMS; j++) {
+            struct stream *s = streams[j];
+            FD_SET(s->listen_fd, &read_fds);
+            max_fd = MAX(max_fd, s->listen_fd);
+            for(int i = 0; i < MAX_CLIENTS; i++) {
+                struct client *c = &s->clients[i];
+                if(c->fd >= 0 && (!c->writer || s->tx_pending == 0)) {
+                    FD_SET(c->fd, &read_fds);
+                    max_fd = MAX(max_fd, c->fd);
                 }
             }
+            pending = pending || s->tx_pending > 0;
         }
 
-        // Handle client socket.
-        if(client_fd > 0 && FD_ISSET(client_fd, &read_fds)) {
-            ret = recv(client_fd, buffer, sizeof(buffer)-1, 0);
-            if(ret == 0 ||
-              (ret < 0 && (errno == ECONNABORTED || errno == ENOTCONN))) {
-                // Client has disconnected.
-                fprintf(stdout, "UART bridge: client disconnected.\n");
-                close(client_fd);
-                close(uart_fd);
-                client_fd = -1;
-                uart_fd = -1;
-                count_rx = 0;
-                count_tx = 0;
-                client_connected = false;
-                continue;       // restart select() loop
-            }
-            else if(ret < 0) {
-                if(errno != EAGAIN && errno != EWOULDBLOCK)
-                    perror("UART bridge: socket read error");
-            }
-            else {
-                write(uart_fd, buffer, ret);
-                count_tx += ret;
-            }
+        struct timeval tv = { .tv_sec = 0, .tv_usec = RETRY_MS * 1000 };
+        int activity = select(max_fd+1, &read_fds, NULL, NULL,
+                pending ? &tv : NULL);
+        if (activity < 0) {
+            //ESP_LOGE(TAG, "select failed: errno %d", errno);
+            DLOG_ERROR(DLOG_BRIDGE, "UART bridge: select error: %s\n",
+                    strerror(errno));
+            break;
         }
 
-        // Handle UART.
-        if(uart_fd > 0 && FD_ISSET(uart_fd, &read_fds)) {
-            ret = read(uart_fd, buffer, sizeof(buffer)-1);
-            if(ret <= 0) {
-                if(errno != EAGAIN && errno != EWOULDBLOCK)
-                    perror("UART bridge: UART read error");
-            }
-            else {
-                count_rx += ret;
-                send(client_fd, buffer, ret, 0);
+        for(int j = 0; j < NUM_STREAMS; j++) {
+            struct stream *s = streams[j];
+
+            // Handle client sockets, then new connections.
+            for(int i = 0; i < MAX_CLIENTS; i++) {
+                struct client *c = &s->clients[i];
+                if(c->fd >= 0 &&
+                        !uart_bridge_read(s, c, FD_ISSET(c->fd, &read_fds)))
+                    uart_bridge_close(s, c);
             }
+            if (FD_ISSET(s->listen_fd, &read_fds))
+                uart_bridge_accept(s);
+
+            // Handle UART.
+            if(s->tx_pending > 0)
+                uart_bridge_write_tx(s);
         }
     }
 
-    fprintf(stdout, "UART bridge: shutting down.\n");
-    client_connected = false;
-    count_rx = 0;
-    count_tx = 0;
+    DLOG_INFO(DLOG_BRIDGE, "UART bridge: shutting down.\n");
 
-    if(client_fd >= 0)
-        close(client_fd);
-    if(uart_fd >= 0)
-        close(uart_fd);
-    close(listen_fd);
+    xSemaphoreTake(client_lock, portMAX_DELAY);
+    for(int j = 0; j < NUM_STREAMS; j++) {
+        struct stream *s = streams[j];
+        for(int i = 0; i < MAX_CLIENTS; i++) {
+            if(s->clients[i].fd >= 0)
+                close(s->clients[i].fd);
+            s->clients[i].fd = -1;
+        }
+        close(s->listen_fd);
+    }
+    xSemaphoreGive(client_lock);
     vTaskDelete(NULL);
 }
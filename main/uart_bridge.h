@@ -5,8 +5,10 @@
 extern "C" {
 #endif
 
+int uart_bridge_init(void);
 void uart_bridge_task(void* arg);
 void uart_bridge_print_status(void);
+void uart_bridge_print_history(void);
 
 #ifdef __cplusplus
 }
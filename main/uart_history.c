@@ -0,0 +1,180 @@
+/*
+ * SPDX-FileCopyrightText: Brian Kuschak <bkuschak@gmail.com>
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * UART bridge history.
+ *
+ * Everything received by the UART bridge is copied into a ring of
+ * CONFIG_ESP_UART_BRIDGE_HISTORY_SIZE KiB, in PSRAM if there is any, whether
+ * or not a client is connected. A connecting client first receives the last
+ * few KiB of the ring, or everything received since a given time, so output
+ * printed while nobody was connected, such as the boot log after an
+ * unattended reset, is not lost.
+ *
+ * Positions are byte counts since boot. To find a time, the ring keeps a
+ * small index holding the position of the first byte received in each
+ * second that had traffic, 8 bytes per entry.
+ *
+ * Each bridged UART has its own history. uart_history_write() and
+ * uart_history_read() are only called by the UART bridge RX task, so they
+ * need no locking.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "esp_heap_caps.h"
+#include "esp_timer.h"
+#include "sdkconfig.h"
+#include "uart_history.h"
+
+#define HISTORY_SIZE        (CONFIG_ESP_UART_BRIDGE_HISTORY_SIZE * 1024)
+#define INDEX_ENTRIES       UART_HISTORY_INDEX
+#define INDEX_INTERVAL_MS   1000
+
+static volatile unsigned replay_kib = CONFIG_ESP_UART_BRIDGE_HISTORY_REPLAY;
+static volatile unsigned replay_seconds;
+
+static inline uint32_t now_ms(void)
+{
+    return (uint32_t)(esp_timer_get_time() / 1000);
+}
+
+static inline uint64_t oldest(const struct uart_history *h)
+{
+    return h->head > HISTORY_SIZE ? h->head - HISTORY_SIZE : 0;
+}
+
+bool uart_history_init(struct uart_history *h)
+{
+    h->buf = heap_caps_malloc(HISTORY_SIZE, MALLOC_CAP_SPIRAM);
+    h->psram = h->buf != NULL;
+    if(h->buf == NULL)
+        h->buf = heap_caps_malloc(HISTORY_SIZE, MALLOC_CAP_8BIT);
+    if(h->buf == NULL) {
+        fprintf(stderr, "UART history: failed to allocate %d bytes\n",
+                HISTORY_SIZE);
+        return false;
+    }
+    return true;
+}
+
+void uart_history_write(struct uart_history *h, const uint8_t *data,
+        size_t len)
+{
+    if(h->buf == NULL || len == 0)
+        return;
+
+    uint32_t ms = now_ms();
+    unsigned last = (h->index_count - 1) % INDEX_ENTRIES;
+    if(h->index_count == 0 || ms - h->index[last].ms >= INDEX_INTERVAL_MS) {
+        unsigned i = h->index_count++ % INDEX_ENTRIES;
+        h->index[i].ms = ms;
+        h->index[i].pos = (uint32_t)h->head;
+    }
+
+    // Only the end of a block larger than the ring is kept.
+    if(len > HISTORY_SIZE) {
+        h->head += len - HISTORY_SIZE;
+        data += len - HISTORY_SIZE;
+        len = HISTORY_SIZE;
+    }
+    size_t off = h->head % HISTORY_SIZE;
+    size_t n = HISTORY_SIZE - off;
+    if(n > len)
+        n = len;
+    memcpy(h->buf + off, data, n);
+    memcpy(h->buf, data + n, len - n);
+    h->head += len;
+}
+
+void uart_history_set_replay(unsigned kib, unsigned seconds)
+{
+    replay_kib = kib;
+    replay_seconds = seconds;
+}
+
+// Position of the first byte received at or after 'ms', rounded down to the
+// start of its second.
+static uint64_t position_at(const struct uart_history *h, uint32_t ms)
+{
+    unsigned n = h->index_count < INDEX_ENTRIES ? h->index_count :
+            INDEX_ENTRIES;
+
+    // Bytes received a second or more after the newest entry would have
+    // started a new one, so nothing was received since 'ms'.
+    if(n > 0 && (int32_t)(h->index[(h->index_count - 1) % INDEX_ENTRIES].ms +
+                INDEX_INTERVAL_MS - ms) <= 0)
+        return h->head;
+
+    for(unsigned k = 1; k <= n; k++) {
+        unsigned i = (h->index_count - k) % INDEX_ENTRIES;
+        if((int32_t)(h->index[i].ms - ms) <= 0) {
+            // The distance from head fits in 32 bits, as the index covers
+            // at most INDEX_ENTRIES seconds of traffic.
+            uint64_t pos = h->head -
+                    (uint32_t)((uint32_t)h->head - h->index[i].pos);
+            return pos > oldest(h) ? pos : oldest(h);
+        }
+    }
+    // Older than the index.
+    return oldest(h);
+}
+
+uint64_t uart_history_replay_start(const struct uart_history *h)
+{
+    if(h->buf == NULL)
+        return h->head;
+    if(replay_seconds != 0)
+        return position_at(h, now_ms() - replay_seconds * 1000);
+
+    uint64_t n = (uint64_t)replay_kib * 1024;
+    if(n > h->head - oldest(h))
+        return oldest(h);
+    return h->head - n;
+}
+
+size_t uart_history_read(const struct uart_history *h, uint64_t *pos,
+        uint8_t *buf, size_t len)
+{
+    if(*pos < oldest(h))
+        *pos = oldest(h);
+    if(len > h->head - *pos)
+        len = h->head - *pos;
+    if(len == 0)
+        return 0;
+
+    size_t off = *pos % HISTORY_SIZE;
+    size_t n = HISTORY_SIZE - off;
+    if(n > len)
+        n = len;
+    memcpy(buf, h->buf + off, n);
+    memcpy(buf + n, h->buf, len - n);
+    *pos += len;
+    return len;
+}
+
+void uart_history_print_status(const struct uart_history *h)
+{
+    if(h->buf == NULL) {
+        printf("UART history: not allocated.\n");
+        return;
+    }
+
+    printf("UART history: %d KiB in %s, holding %lu of %llu bytes received.\n",
+            CONFIG_ESP_UART_BRIDGE_HISTORY_SIZE,
+            h->psram ? "PSRAM" : "internal RAM",
+            (unsigned long)(h->head - oldest(h)),
+            (unsigned long long)h->head);
+}
+
+void uart_history_print_replay(void)
+{
+    if(replay_seconds != 0) {
+        printf("UART history: replaying the last %u seconds on connect.\n",
+                replay_seconds);
+    }
+    else {
+        printf("UART history: replaying the last %u KiB on connect.\n",
+                replay_kib);
+    }
+}
@@ -0,0 +1,53 @@
+#ifndef UART_HISTORY_H
+#define UART_HISTORY_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define UART_HISTORY_INDEX  256
+
+struct uart_history {
+    uint8_t *buf;
+    bool psram;
+    uint64_t head;                  // Bytes written since boot.
+    struct {
+        uint32_t ms;                // Time of the first byte, wraps after
+                                    // 49 days.
+        uint32_t pos;               // Low 32 bits of its position.
+    } index[UART_HISTORY_INDEX];
+    unsigned index_count;           // Entries written since boot.
+};
+
+// Allocate the history ring. Returns false if there is not enough memory.
+bool uart_history_init(struct uart_history *h);
+
+// Append data received from the UART.
+void uart_history_write(struct uart_history *h, const uint8_t *data,
+        size_t len);
+
+// Select what a connecting client receives from any history: the last 'kib'
+// KiB, or, if 'seconds' is not 0, everything received in the last 'seconds'
+// seconds.
+void uart_history_set_replay(unsigned kib, unsigned seconds);
+
+// Position of the first byte to replay to a new client.
+uint64_t uart_history_replay_start(const struct uart_history *h);
+
+// Copy up to 'len' bytes from position '*pos' and advance it. Data that has
+// been overwritten is skipped. Returns 0 once '*pos' has caught up.
+size_t uart_history_read(const struct uart_history *h, uint64_t *pos,
+        uint8_t *buf, size_t len);
+
+void uart_history_print_status(const struct uart_history *h);
+void uart_history_print_replay(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // UART_HISTORY_H
@@ -0,0 +1,345 @@
+/*
+ * SPDX-FileCopyrightText: Brian Kuschak <bkuschak@gmail.com>
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * UART pattern trigger.
+ *
+ * Halts the target when it prints one of a few byte patterns, such as a
+ * fault banner, on a bridged UART. A host script watching the bridge only
+ * sees the banner a network round trip later, when the target has long
+ * moved on. Here the UART bridge RX task matches each block as it reads it
+ * from the UART driver, and a task of higher priority than the CMSIS-DAP
+ * task writes DHCSR.C_HALT through the DAP engine (DAP_HaltCore()) at once.
+ * It only waits for a DAP command already running to finish.
+ *
+ * All patterns are matched together with the Shift-And algorithm. Each
+ * pattern byte is one bit of a 64-bit state, so the patterns may be up to 64
+ * bytes long in total, and each received byte costs a shift, an OR and an
+ * AND however many patterns there are.
+ *
+ * The trigger disarms itself when it fires, so a repeated banner does not
+ * halt the target again once the host resumes it. The match and halt times
+ * of the last few events, in esp_timer microseconds, are shown by the
+ * 'trigger' console command.
+ */
+
+#include <ctype.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "sdkconfig.h"
+#include "DAP.h"
+#include "cmsis_dap_tcp.h"
+#include "dlog.h"
+#include "uart_trigger.h"
+
+#define MAX_BITS            64      // Pattern bytes in total.
+#define MAX_PATTERNS        8
+#define MAX_EVENTS          8
+#define PATTERN_STR_LEN     (MAX_BITS * 4 + 1)  // With \xHH escapes.
+#define TASK_STACK          3072
+#ifndef MIN
+#define MIN(a, b)           ((a) < (b) ? (a) : (b))
+#endif
+
+#define TASK_PRIO           MIN(CONFIG_ESP_DAP_TASK_PRIORITY + 1, \
+                                configMAX_PRIORITIES - 1)
+
+struct event {
+    int64_t match_us;
+    int64_t halt_us;            // 0 until the halt has been attempted.
+    uint32_t dhcsr;
+    uint8_t uart;
+    uint8_t pattern;
+    uint8_t ack;
+};
+
+// Matcher tables, protected by 'lock'.
+static uint64_t masks[256];     // Bits of the pattern bytes equal to a byte.
+static uint64_t starts;         // First bit of each pattern.
+static uint64_t ends;           // Last bit of each pattern.
+static struct {
+    uint8_t first;
+    uint8_t len;
+} patterns[MAX_PATTERNS];
+static uint8_t pattern_bytes[MAX_BITS];
+static unsigned num_patterns;
+static unsigned num_bits;
+static unsigned generation;     // Changed with the patterns.
+
+static struct event events[MAX_EVENTS];
+static unsigned num_events;     // Since boot.
+static unsigned long count_matches;
+static volatile bool armed;
+static SemaphoreHandle_t lock;
+static TaskHandle_t trigger_task;
+
+// Pattern 'i' with escapes, as it is entered.
+static void format_pattern(unsigned i, char *buf, size_t size)
+{
+    size_t n = 0;
+
+    buf[0] = '\0';
+    for(unsigned j = 0; j < patterns[i].len && n < size; j++) {
+        uint8_t c = pattern_bytes[patterns[i].first + j];
+        if(c == '\\' || c == '|' || c == '"')
+            n += snprintf(buf + n, size - n, "\\%c", c);
+        else if(isprint(c))
+            n += snprintf(buf + n, size - n, "%c", c);
+        else if(c == '\n')
+            n += snprintf(buf + n, size - n, "\\n");
+        else if(c == '\r')
+            n += snprintf(buf + n, size - n, "\\r");
+        else
+            n += snprintf(buf + n, size - n, "\\x%02x", c);
+    }
+}
+
+static void print_pattern(unsigned i)
+{
+    char buf[PATTERN_STR_LEN];
+
+    format_pattern(i, buf, sizeof(buf));
+    printf("\"%s\"", buf);
+}
+
+// Called by the trigger task, which must not wait for the console.
+static void log_event(const struct event *e, const char *pattern)
+{
+    if(e->ack == DAP_TRANSFER_OK)
+        DLOG_WARN(DLOG_BRIDGE, "UART trigger: UART%u pattern \"%s\", halted "
+                "%lu us later, DHCSR 0x%08lx.\n", e->uart, pattern,
+                (unsigned long)(e->halt_us - e->match_us),
+                (unsigned long)e->dhcsr);
+    else if(e->ack == DAP_TRANSFER_ERROR)
+        DLOG_WARN(DLOG_BRIDGE, "UART trigger: UART%u pattern \"%s\", not "
+                "halted: SWD not connected.\n", e->uart, pattern);
+    else
+        DLOG_WARN(DLOG_BRIDGE, "UART trigger: UART%u pattern \"%s\", not "
+                "halted: ACK %u.\n", e->uart, pattern, e->ack);
+}
+
+static void print_event(const struct event *e)
+{
+    printf("UART trigger: UART%u pattern ", e->uart);
+    print_pattern(e->pattern);
+    printf(" at %" PRId64 " us", e->match_us);
+    if(e->halt_us == 0)
+        printf(", halting.\n");
+    else if(e->ack == DAP_TRANSFER_OK)
+        printf(", halted %" PRId64 " us later, DHCSR 0x%08" PRIx32 ".\n",
+                e->halt_us - e->match_us, e->dhcsr);
+    else if(e->ack == DAP_TRANSFER_ERROR)
+        printf(", not halted: SWD not connected.\n");
+    else
+        printf(", not halted: ACK %u.\n", e->ack);
+}
+
+void uart_trigger_print_status(void)
+{
+    if(lock == NULL) {
+        printf("UART trigger: not running.\n");
+        return;
+    }
+    xSemaphoreTake(lock, portMAX_DELAY);
+    printf("UART trigger: %s, %u patterns, %lu matches, AP %d.\n",
+            armed ? "armed" : "disarmed", num_patterns, count_matches,
+            CONFIG_ESP_UART_BRIDGE_TRIGGER_APSEL);
+    for(unsigned i = 0; i < num_patterns; i++) {
+        printf("  ");
+        print_pattern(i);
+        printf("\n");
+    }
+    unsigned n = num_events < MAX_EVENTS ? num_events : MAX_EVENTS;
+    for(unsigned k = n; k > 0; k--)
+        print_event(&events[(num_events - k) % MAX_EVENTS]);
+    xSemaphoreGive(lock);
+}
+
+// Halt the target for each match reported by uart_trigger_feed().
+static void uart_trigger_task(void* __attribute__((unused)) arg)
+{
+    while(1) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+        uint32_t dhcsr = 0;
+        cmsis_dap_lock();
+        uint8_t ack = DAP_HaltCore(CONFIG_ESP_UART_BRIDGE_TRIGGER_APSEL,
+                &dhcsr);
+        cmsis_dap_unlock();
+        int64_t now = esp_timer_get_time();
+
+        xSemaphoreTake(lock, portMAX_DELAY);
+        struct event *e = &events[(num_events - 1) % MAX_EVENTS];
+        e->halt_us = now;
+        e->dhcsr = dhcsr;
+        e->ack = ack;
+        struct event copy = *e;
+        char pattern[DLOG_STR_LEN];
+        format_pattern(e->pattern, pattern, sizeof(pattern));
+        xSemaphoreGive(lock);
+        log_event(&copy, pattern);
+    }
+}
+
+// Called with 'lock' held.
+static void uart_trigger_fire(int uart_num, uint64_t matched)
+{
+    count_matches++;
+    if(!armed)
+        return;
+    armed = false;
+
+    // Several patterns may end at the same byte. Report the first.
+    unsigned bit = __builtin_ctzll(matched);
+    unsigned i = 0;
+    while(patterns[i].first + patterns[i].len - 1 != bit)
+        i++;
+
+    struct event *e = &events[num_events++ % MAX_EVENTS];
+    e->match_us = esp_timer_get_time();
+    e->halt_us = 0;
+    e->uart = uart_num;
+    e->pattern = i;
+    xTaskNotifyGive(trigger_task);
+}
+
+void uart_trigger_feed(struct uart_trigger_state *state, int uart_num,
+        const uint8_t *data, size_t len)
+{
+    if(starts == 0)
+        return;
+
+    xSemaphoreTake(lock, portMAX_DELAY);
+    // Partial matches of the old patterns mean nothing for the new ones.
+    if(state->generation != generation) {
+        state->bits = 0;
+        state->generation = generation;
+    }
+    uint64_t s = state->bits;
+    for(size_t i = 0; i < len; i++) {
+        s = ((s << 1) | starts) & masks[data[i]];
+        if(s & ends)
+            uart_trigger_fire(uart_num, s & ends);
+    }
+    state->bits = s;
+    xSemaphoreGive(lock);
+}
+
+// Add the pattern of 'n' characters at 's', with escapes.
+static bool uart_trigger_add_n(const char *s, size_t n)
+{
+    uint8_t bytes[MAX_BITS];
+    size_t len = 0;
+
+    for(size_t i = 0; i < n; i++) {
+        uint8_t c = s[i];
+        if(c == '\\' && i + 1 < n) {
+            c = s[++i];
+            if(c == 'n') {
+                c = '\n';
+            }
+            else if(c == 'r') {
+                c = '\r';
+            }
+            else if(c == 't') {
+                c = '\t';
+            }
+            else if(c == 'x' && i + 2 < n && isxdigit((uint8_t)s[i + 1]) &&
+                    isxdigit((uint8_t)s[i + 2])) {
+                char hex[3] = { s[i + 1], s[i + 2], '\0' };
+                c = strtoul(hex, NULL, 16);
+                i += 2;
+            }
+        }
+        if(len == MAX_BITS)
+            return false;
+        bytes[len++] = c;
+    }
+
+    if(lock == NULL)
+        return false;
+    xSemaphoreTake(lock, portMAX_DELAY);
+    bool ok = len > 0 && num_patterns < MAX_PATTERNS &&
+            num_bits + len <= MAX_BITS;
+    if(ok) {
+        patterns[num_patterns].first = num_bits;
+        patterns[num_patterns].len = len;
+        num_patterns++;
+        for(size_t j = 0; j < len; j++) {
+            masks[bytes[j]] |= 1ULL << (num_bits + j);
+            pattern_bytes[num_bits + j] = bytes[j];
+        }
+        starts |= 1ULL << num_bits;
+        ends |= 1ULL << (num_bits + len - 1);
+        num_bits += len;
+        generation++;
+    }
+    xSemaphoreGive(lock);
+    return ok;
+}
+
+bool uart_trigger_add(const char *pattern)
+{
+    return uart_trigger_add_n(pattern, strlen(pattern));
+}
+
+void uart_trigger_clear(void)
+{
+    if(lock == NULL)
+        return;
+    xSemaphoreTake(lock, portMAX_DELAY);
+    memset(masks, 0, sizeof(masks));
+    starts = 0;
+    ends = 0;
+    num_patterns = 0;
+    num_bits = 0;
+    generation++;
+    xSemaphoreGive(lock);
+}
+
+void uart_trigger_arm(bool on)
+{
+    armed = on;
+}
+
+bool uart_trigger_init(void)
+{
+    SemaphoreHandle_t mutex = xSemaphoreCreateMutex();
+    if(mutex == NULL)
+        return false;
+    if(xTaskCreate(uart_trigger_task, "uart_trigger", TASK_STACK, NULL,
+                TASK_PRIO, &trigger_task) != pdPASS) {
+        DLOG_ERROR(DLOG_BRIDGE, "UART trigger: failed to create task\n");
+        vSemaphoreDelete(mutex);
+        return false;
+    }
+    lock = mutex;
+
+    // Patterns are separated by '|'.
+    const char *s = CONFIG_ESP_UART_BRIDGE_TRIGGER_PATTERNS;
+    while(*s != '\0') {
+        size_t n = 0;
+        while(s[n] != '\0' && s[n] != '|') {
+            if(s[n] == '\\' && s[n + 1] != '\0')
+                n++;
+            n++;
+        }
+        if(n > 0 && !uart_trigger_add_n(s, n)) {
+            char pattern[DLOG_STR_LEN];
+            snprintf(pattern, sizeof(pattern), "%.*s", (int)n, s);
+            DLOG_ERROR(DLOG_BRIDGE, "UART trigger: pattern '%s' does not "
+                    "fit\n", pattern);
+        }
+        s += n;
+        if(*s == '|')
+            s++;
+    }
+    armed = num_patterns > 0;
+    return true;
+}
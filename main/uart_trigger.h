@@ -0,0 +1,42 @@
+#ifndef UART_TRIGGER_H
+#define UART_TRIGGER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Load the patterns from menuconfig and start the trigger task. Must be
+// called before the CMSIS-DAP task is started.
+bool uart_trigger_init(void);
+
+// Matcher state of one UART, zeroed initially.
+struct uart_trigger_state {
+    uint64_t bits;
+    unsigned generation;        // Of the patterns the bits belong to.
+};
+
+// Match data received from a UART, and halt the target on a match.
+void uart_trigger_feed(struct uart_trigger_state *state, int uart_num,
+        const uint8_t *data, size_t len);
+
+// Add a pattern, with \n, \r, \t, \xHH, \| and \\ escapes. Returns false if
+// it is empty, or there is no room for it.
+bool uart_trigger_add(const char *pattern);
+
+// Remove all patterns.
+void uart_trigger_clear(void);
+
+// Arm or disarm the trigger. It disarms itself when it fires.
+void uart_trigger_arm(bool armed);
+
+void uart_trigger_print_status(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // UART_TRIGGER_H
@@ -0,0 +1,620 @@
+/*
+ * SPDX-FileCopyrightText: Brian Kuschak <bkuschak@gmail.com>
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * CMSIS-Driver USART (ARM_DRIVER_USART) on top of the ESP-IDF UART driver.
+ *
+ * SWO.c captures the trace with Driver_USART0, and UART.c connects the
+ * CMSIS-DAP UART communication port to Driver_USART1. Only asynchronous mode
+ * is implemented. Driver_USART0 only receives.
+ *
+ * The ESP-IDF UART interrupt moves received bytes from the UART FIFO to the
+ * driver's RX ring buffer. A receive task waits on the driver's event queue
+ * and copies the bytes from the ring buffer straight into the buffer passed
+ * to Receive(), i.e. into TraceBuf, then signals
+ * ARM_USART_EVENT_RECEIVE_COMPLETE. SWO.c re-arms Receive() from the callback
+ * with the next block of TraceBuf. While no receive is armed, for example
+ * while TraceBuf is full, bytes accumulate in the ring buffer. When the ring
+ * buffer or the UART FIFO overflows, ARM_USART_EVENT_RX_OVERFLOW is signalled.
+ *
+ * Send() hands the block to a transmit task, which copies it into the
+ * driver's TX ring buffer in small pieces, so GetTxCount() advances and
+ * ARM_USART_ABORT_SEND takes effect quickly. The UART interrupt drains the ring
+ * buffer into the FIFO. ARM_USART_EVENT_SEND_COMPLETE is signalled once the
+ * whole block is in the ring buffer.
+ *
+ * The ESP-IDF UART driver does not use DMA, so the ring buffers take its
+ * place. The callbacks run in the receive and transmit tasks, not in an
+ * interrupt.
+ */
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "driver/uart.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "DAP_config.h"
+#include "Driver_USART.h"
+#include "dlog.h"
+#include "usart_esp32.h"
+
+#define USART_DRV_VERSION       ARM_DRIVER_VERSION_MAJOR_MINOR(1, 0)
+#define USART_RX_RING_SIZE      4096
+#define USART_EVENT_QUEUE_LEN   16
+#define USART_TASK_STACK        3072
+#define USART_TX_CHUNK          128
+
+#if (SWO_UART != 0) && defined(CONFIG_ESP_UART_BRIDGE_ENABLED)
+#if CONFIG_ESP_DAP_SWO_UART_NUM == CONFIG_ESP_UART_BRIDGE_UART_NUM
+#error "SWO and the UART bridge cannot use the same UART."
+#endif
+#endif
+#if (DAP_UART != 0) && defined(CONFIG_ESP_UART_BRIDGE_ENABLED)
+#if CONFIG_ESP_DAP_UART_NUM == CONFIG_ESP_UART_BRIDGE_UART_NUM
+#error "The DAP UART and the UART bridge cannot use the same UART."
+#endif
+#endif
+#if (SWO_UART != 0) && defined(CONFIG_ESP_UART_BRIDGE_SECOND)
+#if CONFIG_ESP_DAP_SWO_UART_NUM == CONFIG_ESP_UART_BRIDGE_SECOND_UART_NUM
+#error "SWO and the second UART bridge cannot use the same UART."
+#endif
+#endif
+#if (DAP_UART != 0) && defined(CONFIG_ESP_UART_BRIDGE_SECOND)
+#if CONFIG_ESP_DAP_UART_NUM == CONFIG_ESP_UART_BRIDGE_SECOND_UART_NUM
+#error "The DAP UART and the second UART bridge cannot use the same UART."
+#endif
+#endif
+#if (DAP_UART != 0) && (SWO_UART != 0)
+#if CONFIG_ESP_DAP_UART_NUM == CONFIG_ESP_DAP_SWO_UART_NUM
+#error "The DAP UART and SWO cannot use the same UART."
+#endif
+#endif
+
+typedef struct {
+    // Constant configuration.
+    const char *name;
+    uart_port_t port;
+    int tx_pin;             // UART_PIN_NO_CHANGE: receive only.
+    int rx_pin;
+    int tx_ring_size;
+
+    // Driver state.
+    ARM_USART_SignalEvent_t cb_event;
+    QueueHandle_t queue;
+    SemaphoreHandle_t lock;
+    TaskHandle_t task;
+    TaskHandle_t tx_task;
+    bool installed;
+    bool powered;
+    bool rx_enabled;
+    bool tx_enabled;
+    uint32_t baudrate;
+
+    // Current receive operation.
+    uint8_t *rx_buf;
+    uint32_t rx_num;
+    volatile uint32_t rx_cnt;
+    volatile bool rx_busy;
+    ARM_USART_STATUS status;
+
+    // Current send operation.
+    const uint8_t *tx_buf;
+    uint32_t tx_num;
+    volatile uint32_t tx_cnt;
+    volatile bool tx_busy;
+    uint32_t tx_id;         // Changed by each Send() or abort.
+
+    // Statistics.
+    unsigned long count_rx;
+    unsigned long count_tx;
+    unsigned long count_overflow;
+    unsigned long count_break;
+    unsigned long count_errors;
+} usart_info_t;
+
+static const ARM_DRIVER_VERSION usart_driver_version = {
+    ARM_USART_API_VERSION,
+    USART_DRV_VERSION
+};
+
+static const ARM_USART_CAPABILITIES usart_capabilities = {
+    .asynchronous = 1,
+};
+
+// Copy buffered bytes into the armed receive buffer. Signals
+// ARM_USART_EVENT_RECEIVE_COMPLETE when it is full, and continues with the
+// buffer armed by the callback, if any.
+static void usart_rx_drain(usart_info_t *usart)
+{
+    while(1) {
+        size_t avail = 0;
+        bool done = false;
+        int len = 0;
+
+        xSemaphoreTake(usart->lock, portMAX_DELAY);
+        if(!usart->rx_enabled) {
+            // Receiver disabled: discard.
+            uart_flush_input(usart->port);
+        }
+        else if(usart->rx_busy &&
+                uart_get_buffered_data_len(usart->port, &avail) == ESP_OK &&
+                avail > 0) {
+            uint32_t num = usart->rx_num - usart->rx_cnt;
+            if(num > avail)
+                num = avail;
+            len = uart_read_bytes(usart->port, usart->rx_buf + usart->rx_cnt,
+                    num, 0);
+            if(len > 0) {
+                usart->rx_cnt += len;
+                usart->count_rx += len;
+                if(usart->rx_cnt == usart->rx_num) {
+                    usart->rx_busy = false;
+                    done = true;
+                }
+            }
+        }
+        ARM_USART_SignalEvent_t cb_event = usart->cb_event;
+        xSemaphoreGive(usart->lock);
+
+        if(!done)
+            return;
+        if(cb_event != NULL)
+            cb_event(ARM_USART_EVENT_RECEIVE_COMPLETE);
+    }
+}
+
+static void usart_rx_task(void *arg)
+{
+    usart_info_t *usart = arg;
+    uart_event_t event;
+
+    while(1) {
+        if(xQueueReceive(usart->queue, &event, portMAX_DELAY) != pdTRUE)
+            continue;
+
+        uint32_t flags = 0;
+        switch(event.type) {
+            case UART_FIFO_OVF:
+                // The FIFO contents are unreliable after an overflow.
+                uart_flush_input(usart->port);
+                xQueueReset(usart->queue);
+                // Fall through.
+            case UART_BUFFER_FULL:
+                flags = ARM_USART_EVENT_RX_OVERFLOW;
+                usart->status.rx_overflow = 1;
+                usart->count_overflow++;
+                break;
+            case UART_BREAK:
+                flags = ARM_USART_EVENT_RX_BREAK;
+                usart->status.rx_break = 1;
+                usart->count_break++;
+                break;
+            case UART_FRAME_ERR:
+                flags = ARM_USART_EVENT_RX_FRAMING_ERROR;
+                usart->status.rx_framing_error = 1;
+                usart->count_errors++;
+                break;
+            case UART_PARITY_ERR:
+                flags = ARM_USART_EVENT_RX_PARITY_ERROR;
+                usart->status.rx_parity_error = 1;
+                usart->count_errors++;
+                break;
+            default:
+                break;
+        }
+        if(flags != 0 && usart->rx_enabled && usart->cb_event != NULL)
+            usart->cb_event(flags);
+
+        usart_rx_drain(usart);
+    }
+}
+
+static void usart_tx_task(void *arg)
+{
+    usart_info_t *usart = arg;
+
+    while(1) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+        while(1) {
+            xSemaphoreTake(usart->lock, portMAX_DELAY);
+            if(!usart->tx_busy) {
+                xSemaphoreGive(usart->lock);
+                break;
+            }
+            const uint8_t *buf = usart->tx_buf + usart->tx_cnt;
+            uint32_t num = usart->tx_num - usart->tx_cnt;
+            uint32_t id = usart->tx_id;
+            xSemaphoreGive(usart->lock);
+
+            if(num > USART_TX_CHUNK)
+                num = USART_TX_CHUNK;
+            // Blocks while the TX ring buffer is full.
+            int len = uart_write_bytes(usart->port, buf, num);
+
+            bool done = false;
+            xSemaphoreTake(usart->lock, portMAX_DELAY);
+            if(usart->tx_busy && usart->tx_id == id && len > 0) {
+                usart->tx_cnt += len;
+                usart->count_tx += len;
+                if(usart->tx_cnt == usart->tx_num) {
+                    usart->tx_busy = false;
+                    done = true;
+                }
+            }
+            ARM_USART_SignalEvent_t cb_event = usart->cb_event;
+            xSemaphoreGive(usart->lock);
+
+            // The callback may call Send() for the next block.
+            if(done && cb_event != NULL)
+                cb_event(ARM_USART_EVENT_SEND_COMPLETE);
+        }
+    }
+}
+
+// Wake the receive task, e.g. after Receive() armed a new buffer while data
+// is already waiting in the ring buffer.
+static void usart_rx_kick(usart_info_t *usart)
+{
+    uart_event_t event = { .type = UART_DATA, .size = 0 };
+
+    if(xTaskGetCurrentTaskHandle() == usart->task)
+        return;     // Called from the callback, usart_rx_drain() continues.
+    xQueueSend(usart->queue, &event, 0);
+}
+
+static int32_t usart_initialize(usart_info_t *usart,
+        ARM_USART_SignalEvent_t cb_event)
+{
+    usart->cb_event = cb_event;
+    return ARM_DRIVER_OK;
+}
+
+static int32_t usart_uninitialize(usart_info_t *usart)
+{
+    if(usart->lock != NULL)
+        xSemaphoreTake(usart->lock, portMAX_DELAY);
+    usart->cb_event = NULL;
+    if(usart->lock != NULL)
+        xSemaphoreGive(usart->lock);
+    return ARM_DRIVER_OK;
+}
+
+static int32_t usart_power_control(usart_info_t *usart, ARM_POWER_STATE state)
+{
+    switch(state) {
+        case ARM_POWER_FULL:
+            // The ESP-IDF driver and the receive task are kept once
+            // installed; powering off only stops reception.
+            if(!usart->installed) {
+                if(uart_driver_install(usart->port, USART_RX_RING_SIZE,
+                            usart->tx_ring_size, USART_EVENT_QUEUE_LEN,
+                            &usart->queue, 0) != ESP_OK) {
+                    DLOG_ERROR(DLOG_DAP, "%s: UART%d driver installation "
+                            "failed\n", usart->name, usart->port);
+                    return ARM_DRIVER_ERROR;
+                }
+                if(uart_set_pin(usart->port, usart->tx_pin, usart->rx_pin,
+                            UART_PIN_NO_CHANGE, UART_PIN_NO_CHANGE) != ESP_OK) {
+                    uart_driver_delete(usart->port);
+                    return ARM_DRIVER_ERROR;
+                }
+                usart->lock = xSemaphoreCreateMutex();
+                if(usart->lock == NULL ||
+                        xTaskCreate(usart_rx_task, usart->name,
+                            USART_TASK_STACK, usart,
+                            CONFIG_ESP_DAP_TASK_PRIORITY,
+                            &usart->task) != pdPASS) {
+                    DLOG_ERROR(DLOG_DAP, "%s: failed to create task\n",
+                            usart->name);
+                    abort();
+                }
+                if(usart->tx_pin != UART_PIN_NO_CHANGE &&
+                        xTaskCreate(usart_tx_task, usart->name,
+                            USART_TASK_STACK, usart,
+                            CONFIG_ESP_DAP_TASK_PRIORITY,
+                            &usart->tx_task) != pdPASS) {
+                    DLOG_ERROR(DLOG_DAP, "%s: failed to create task\n",
+                            usart->name);
+                    abort();
+                }
+                usart->installed = true;
+                if(usart->tx_task != NULL) {
+                    DLOG_INFO(DLOG_DAP, "%s: using UART%d, TX = GPIO_NUM_%d, "
+                            "RX = GPIO_NUM_%d.\n", usart->name, usart->port,
+                            usart->tx_pin, usart->rx_pin);
+                }
+                else {
+                    DLOG_INFO(DLOG_DAP, "%s: using UART%d, RX = GPIO_NUM_%d.\n",
+                            usart->name, usart->port, usart->rx_pin);
+                }
+            }
+            usart->powered = true;
+            return ARM_DRIVER_OK;
+
+        case ARM_POWER_OFF:
+            if(usart->installed) {
+                xSemaphoreTake(usart->lock, portMAX_DELAY);
+                usart->rx_enabled = false;
+                usart->rx_busy = false;
+                usart->tx_enabled = false;
+                usart->tx_busy = false;
+                usart->tx_id++;
+                uart_flush_input(usart->port);
+                xSemaphoreGive(usart->lock);
+            }
+            usart->powered = false;
+            return ARM_DRIVER_OK;
+
+        default:
+            return ARM_DRIVER_ERROR_UNSUPPORTED;
+    }
+}
+
+static int32_t usart_receive(usart_info_t *usart, void *data, uint32_t num)
+{
+    if(data == NULL || num == 0)
+        return ARM_DRIVER_ERROR_PARAMETER;
+    if(!usart->powered)
+        return ARM_DRIVER_ERROR;
+
+    xSemaphoreTake(usart->lock, portMAX_DELAY);
+    if(usart->rx_busy) {
+        xSemaphoreGive(usart->lock);
+        return ARM_DRIVER_ERROR_BUSY;
+    }
+    usart->rx_buf = data;
+    usart->rx_num = num;
+    usart->rx_cnt = 0;
+    usart->rx_busy = true;
+    usart->status.rx_overflow = 0;
+    usart->status.rx_break = 0;
+    usart->status.rx_framing_error = 0;
+    usart->status.rx_parity_error = 0;
+    xSemaphoreGive(usart->lock);
+
+    usart_rx_kick(usart);
+    return ARM_DRIVER_OK;
+}
+
+static int32_t usart_send(usart_info_t *usart, const void *data,
+        uint32_t num)
+{
+    if(data == NULL || num == 0)
+        return ARM_DRIVER_ERROR_PARAMETER;
+    if(usart->tx_task == NULL)
+        return ARM_DRIVER_ERROR_UNSUPPORTED;
+    if(!usart->powered || !usart->tx_enabled)
+        return ARM_DRIVER_ERROR;
+
+    xSemaphoreTake(usart->lock, portMAX_DELAY);
+    if(usart->tx_busy) {
+        xSemaphoreGive(usart->lock);
+        return ARM_DRIVER_ERROR_BUSY;
+    }
+    usart->tx_buf = data;
+    usart->tx_num = num;
+    usart->tx_cnt = 0;
+    usart->tx_busy = true;
+    usart->tx_id++;
+    xSemaphoreGive(usart->lock);
+
+    xTaskNotifyGive(usart->tx_task);
+    return ARM_DRIVER_OK;
+}
+
+static int32_t usart_configure(usart_info_t *usart, uint32_t control,
+        uint32_t baudrate)
+{
+    uart_config_t config = {
+        .baud_rate  = baudrate,
+        .flow_ctrl  = UART_HW_FLOWCTRL_DISABLE,
+        .source_clk = UART_SCLK_DEFAULT,
+    };
+
+    if(baudrate == 0 || baudrate > SOC_UART_BITRATE_MAX)
+        return ARM_USART_ERROR_BAUDRATE;
+
+    switch(control & ARM_USART_DATA_BITS_Msk) {
+        case ARM_USART_DATA_BITS_5: config.data_bits = UART_DATA_5_BITS; break;
+        case ARM_USART_DATA_BITS_6: config.data_bits = UART_DATA_6_BITS; break;
+        case ARM_USART_DATA_BITS_7: config.data_bits = UART_DATA_7_BITS; break;
+        case ARM_USART_DATA_BITS_8: config.data_bits = UART_DATA_8_BITS; break;
+        default: return ARM_USART_ERROR_DATA_BITS;
+    }
+    switch(control & ARM_USART_PARITY_Msk) {
+        case ARM_USART_PARITY_NONE: config.parity = UART_PARITY_DISABLE; break;
+        case ARM_USART_PARITY_EVEN: config.parity = UART_PARITY_EVEN; break;
+        case ARM_USART_PARITY_ODD:  config.parity = UART_PARITY_ODD; break;
+        default: return ARM_USART_ERROR_PARITY;
+    }
+    switch(control & ARM_USART_STOP_BITS_Msk) {
+        case ARM_USART_STOP_BITS_1:   config.stop_bits = UART_STOP_BITS_1; break;
+        case ARM_USART_STOP_BITS_1_5: config.stop_bits = UART_STOP_BITS_1_5; break;
+        case ARM_USART_STOP_BITS_2:   config.stop_bits = UART_STOP_BITS_2; break;
+        default: return ARM_USART_ERROR_STOP_BITS;
+    }
+    if((control & ARM_USART_FLOW_CONTROL_Msk) != ARM_USART_FLOW_CONTROL_NONE)
+        return ARM_USART_ERROR_FLOW_CONTROL;
+
+    if(uart_param_config(usart->port, &config) != ESP_OK)
+        return ARM_DRIVER_ERROR;
+    usart->baudrate = baudrate;
+    return ARM_DRIVER_OK;
+}
+
+static int32_t usart_control(usart_info_t *usart, uint32_t control,
+        uint32_t arg)
+{
+    if(!usart->powered)
+        return ARM_DRIVER_ERROR;
+
+    switch(control & ARM_USART_CONTROL_Msk) {
+        case ARM_USART_MODE_ASYNCHRONOUS:
+            return usart_configure(usart, control, arg);
+
+        case ARM_USART_CONTROL_RX:
+            xSemaphoreTake(usart->lock, portMAX_DELAY);
+            if(arg != 0 && !usart->rx_enabled)
+                uart_flush_input(usart->port);  // Drop stale bytes.
+            usart->rx_enabled = (arg != 0);
+            xSemaphoreGive(usart->lock);
+            if(arg != 0)
+                usart_rx_kick(usart);
+            return ARM_DRIVER_OK;
+
+        case ARM_USART_CONTROL_TX:
+            if(arg != 0 && usart->tx_task == NULL)
+                return ARM_DRIVER_ERROR_UNSUPPORTED;
+            usart->tx_enabled = (arg != 0);
+            return ARM_DRIVER_OK;
+
+        case ARM_USART_ABORT_SEND:
+            // Bytes already in the TX ring buffer are still sent.
+            xSemaphoreTake(usart->lock, portMAX_DELAY);
+            usart->tx_busy = false;
+            usart->tx_id++;
+            xSemaphoreGive(usart->lock);
+            return ARM_DRIVER_OK;
+
+        case ARM_USART_ABORT_RECEIVE:
+            xSemaphoreTake(usart->lock, portMAX_DELAY);
+            usart->rx_busy = false;
+            xSemaphoreGive(usart->lock);
+            return ARM_DRIVER_OK;
+
+        case ARM_USART_MODE_SYNCHRONOUS_MASTER:
+        case ARM_USART_MODE_SYNCHRONOUS_SLAVE:
+        case ARM_USART_MODE_SINGLE_WIRE:
+        case ARM_USART_MODE_IRDA:
+        case ARM_USART_MODE_SMART_CARD:
+            return ARM_USART_ERROR_MODE;
+
+        default:
+            return ARM_DRIVER_ERROR_UNSUPPORTED;
+    }
+}
+
+static ARM_USART_STATUS usart_get_status(usart_info_t *usart)
+{
+    ARM_USART_STATUS status = usart->status;
+
+    status.tx_busy = usart->tx_busy;
+    status.rx_busy = usart->rx_busy;
+    return status;
+}
+
+static void usart_print_status(usart_info_t *usart)
+{
+    if(!usart->installed) {
+        printf("%s: not in use.\n", usart->name);
+        return;
+    }
+    printf("%s: UART%d %s at %lu baud. RX: %lu bytes, %lu overflows, "
+            "%lu breaks, %lu framing/parity errors.", usart->name,
+            usart->port, usart->rx_enabled ? "receiving" : "idle",
+            (unsigned long)usart->baudrate, usart->count_rx,
+            usart->count_overflow, usart->count_break, usart->count_errors);
+    if(usart->tx_task != NULL)
+        printf(" TX: %lu bytes.", usart->count_tx);
+    printf("\n");
+}
+
+static ARM_DRIVER_VERSION usart_get_version(void)
+{
+    return usart_driver_version;
+}
+
+static ARM_USART_CAPABILITIES usart_get_capabilities(void)
+{
+    return usart_capabilities;
+}
+
+static int32_t usart_transfer(const void *data_out, void *data_in,
+        uint32_t num)
+{
+    return ARM_DRIVER_ERROR_UNSUPPORTED;
+}
+
+static int32_t usart_set_modem_control(ARM_USART_MODEM_CONTROL control)
+{
+    return ARM_DRIVER_ERROR_UNSUPPORTED;
+}
+
+static ARM_USART_MODEM_STATUS usart_get_modem_status(void)
+{
+    ARM_USART_MODEM_STATUS status = { 0 };
+    return status;
+}
+
+// Instantiate Driver_USART<n> for the usart_info_t 'info'.
+#define USART_DRIVER(n, info)                                               \
+static int32_t USART##n##_Initialize(ARM_USART_SignalEvent_t cb_event)      \
+    { return usart_initialize(&info, cb_event); }                           \
+static int32_t USART##n##_Uninitialize(void)                                \
+    { return usart_uninitialize(&info); }                                   \
+static int32_t USART##n##_PowerControl(ARM_POWER_STATE state)               \
+    { return usart_power_control(&info, state); }                           \
+static int32_t USART##n##_Send(const void *data, uint32_t num)              \
+    { return usart_send(&info, data, num); }                                \
+static int32_t USART##n##_Receive(void *data, uint32_t num)                 \
+    { return usart_receive(&info, data, num); }                             \
+static uint32_t USART##n##_GetTxCount(void)                                 \
+    { return info.tx_cnt; }                                                 \
+static uint32_t USART##n##_GetRxCount(void)                                 \
+    { return info.rx_cnt; }                                                 \
+static int32_t USART##n##_Control(uint32_t control, uint32_t arg)           \
+    { return usart_control(&info, control, arg); }                          \
+static ARM_USART_STATUS USART##n##_GetStatus(void)                          \
+    { return usart_get_status(&info); }                                     \
+ARM_DRIVER_USART Driver_USART##n = {                                        \
+    usart_get_version,                                                      \
+    usart_get_capabilities,                                                 \
+    USART##n##_Initialize,                                                  \
+    USART##n##_Uninitialize,                                                \
+    USART##n##_PowerControl,                                                \
+    USART##n##_Send,                                                        \
+    USART##n##_Receive,                                                     \
+    usart_transfer,                                                         \
+    USART##n##_GetTxCount,                                                  \
+    USART##n##_GetRxCount,                                                  \
+    USART##n##_Control,                                                     \
+    USART##n##_GetStatus,                                                   \
+    usart_set_modem_control,                                                \
+    usart_get_modem_status,                                                 \
+};
+
+#if (SWO_UART != 0)
+static usart_info_t usart_swo = {
+    .name   = "SWO",
+    .port   = CONFIG_ESP_DAP_SWO_UART_NUM,
+    .tx_pin = UART_PIN_NO_CHANGE,
+    .rx_pin = CONFIG_ESP_DAP_GPIO_SWO,
+};
+USART_DRIVER(0, usart_swo)
+#endif
+
+#if (DAP_UART != 0)
+static usart_info_t usart_dap = {
+    .name   = "DAP UART",
+    .port   = CONFIG_ESP_DAP_UART_NUM,
+    .tx_pin = CONFIG_ESP_DAP_GPIO_UART_TX,
+    .rx_pin = CONFIG_ESP_DAP_GPIO_UART_RX,
+    .tx_ring_size = DAP_UART_TX_BUFFER_SIZE,
+};
+USART_DRIVER(1, usart_dap)
+#endif
+
+void usart_esp32_print_status(void)
+{
+#if (SWO_UART != 0)
+    usart_print_status(&usart_swo);
+#endif
+#if (DAP_UART != 0)
+    usart_print_status(&usart_dap);
+#endif
+}
@@ -0,0 +1,15 @@
+#ifndef USART_ESP32_H
+#define USART_ESP32_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Print byte and error counters of the CMSIS-Driver USART instances.
+void usart_esp32_print_status(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // USART_ESP32_H
@@ -0,0 +1,204 @@
+/*
+ * SPDX-FileCopyrightText: Brian Kuschak <bkuschak@gmail.com>
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Adaptive backoff for SWD/JTAG WAIT responses.
+ *
+ * A target answers WAIT while the previous AP access is still in progress,
+ * for example while flash is busy. DAP.c retries up to retry_count times.
+ * Retrying back to back wastes a full transfer per retry and keeps the
+ * target's debug bus busy. Instead, idle cycles are clocked before each
+ * retry. The first retry waits about half the time the current AP needed
+ * on average, and each further retry doubles the wait, up to
+ * CONFIG_ESP_DAP_WAIT_BACKOFF_MAX idle cycles.
+ *
+ * The current AP is taken from the APSEL field of the last DP SELECT write.
+ * WAIT counts and latencies are also collected per DAP command, and shown
+ * by the 'status' console command.
+ */
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <inttypes.h>
+#include "DAP_config.h"
+#include "DAP.h"
+#include "wait_backoff.h"
+
+#define BACKOFF_MAX         CONFIG_ESP_DAP_WAIT_BACKOFF_MAX
+#define AP_SLOTS            8       // APs tracked at the same time.
+
+#define REQUEST_ADDR_MASK   (DAP_TRANSFER_APnDP | DAP_TRANSFER_RnW | \
+                             DAP_TRANSFER_A2 | DAP_TRANSFER_A3)
+
+struct ap_wait {
+    bool     used;
+    uint8_t  apsel;
+    uint32_t avg_cycles;    // Average clock cycles spent waiting per access.
+    uint32_t accesses;      // Accesses that got at least one WAIT.
+    uint32_t waits;
+};
+
+struct cmd_wait {
+    const char *name;
+    uint32_t accesses;
+    uint32_t waits;
+    uint64_t total_latency; // CPU cycles from first WAIT to completion.
+    uint32_t max_latency;
+};
+
+// WAIT responses to the request currently being retried.
+struct wait_streak {
+    bool     active;
+    uint32_t request;
+    uint32_t attempts;
+    uint32_t idle;          // Idle cycles before the last retry.
+    uint32_t cycles;        // Clock cycles since the first WAIT.
+    uint32_t start;         // Timestamp of the first WAIT.
+    struct ap_wait *ap;
+};
+
+static struct ap_wait aps[AP_SLOTS] = {
+    [0] = { .used = true, .apsel = 0 },
+};
+static struct ap_wait *current_ap = &aps[0];
+
+enum { CMD_TRANSFER, CMD_TRANSFER_BLOCK, CMD_WRITE_ABORT, CMD_OTHER, CMD_MAX };
+static struct cmd_wait cmds[CMD_MAX] = {
+    [CMD_TRANSFER]       = { .name = "DAP_Transfer" },
+    [CMD_TRANSFER_BLOCK] = { .name = "DAP_TransferBlock" },
+    [CMD_WRITE_ABORT]    = { .name = "DAP_WriteABORT" },
+    [CMD_OTHER]          = { .name = "Other commands" },
+};
+static struct cmd_wait *current_cmd = &cmds[CMD_OTHER];
+
+static struct wait_streak streak;
+
+static void select_ap(uint8_t apsel)
+{
+    struct ap_wait *ap = &aps[apsel % AP_SLOTS];
+
+    if (!ap->used || ap->apsel != apsel) {
+        *ap = (struct ap_wait) { .used = true, .apsel = apsel };
+    }
+    current_ap = ap;
+}
+
+// The request succeeded, failed, or was abandoned by DAP.c.
+static void streak_end(void)
+{
+    struct ap_wait *ap = streak.ap;
+    uint32_t latency = TIMESTAMP_GET() - streak.start;
+
+    // Moving average with weight 1/4.
+    ap->avg_cycles = (uint32_t)((int32_t)ap->avg_cycles +
+            ((int32_t)(streak.cycles - ap->avg_cycles) / 4));
+    ap->accesses++;
+
+    current_cmd->accesses++;
+    current_cmd->total_latency += latency;
+    if (latency > current_cmd->max_latency)
+        current_cmd->max_latency = latency;
+
+    streak.active = false;
+}
+
+uint32_t wait_backoff_before(uint32_t request)
+{
+    if (!streak.active)
+        return 0;
+
+    if (request != streak.request) {
+        streak_end();
+        return 0;
+    }
+
+    uint32_t idle;
+    if (streak.attempts == 1) {
+        idle = streak.ap->avg_cycles / 2;
+        if (idle == 0)
+            idle = 1;
+    }
+    else {
+        idle = streak.idle * 2;
+    }
+    if (idle > BACKOFF_MAX)
+        idle = BACKOFF_MAX;
+
+    streak.idle = idle;
+    streak.cycles += idle;
+    return idle;
+}
+
+void wait_backoff_after(uint32_t request, const uint32_t *data, uint32_t ack,
+        uint32_t bits)
+{
+    if (ack == DAP_TRANSFER_WAIT) {
+        if (!streak.active) {
+            streak = (struct wait_streak) {
+                .active = true,
+                .request = request,
+                .start = TIMESTAMP_GET(),
+                .ap = current_ap,
+            };
+        }
+        streak.attempts++;
+        streak.cycles += bits;
+        streak.ap->waits++;
+        current_cmd->waits++;
+        return;
+    }
+
+    if (streak.active) {
+        streak_end();
+    }
+    else {
+        // Let the average follow a target that got faster. Rounded up, so
+        // that it reaches 0 and the first retry no longer idles.
+        current_ap->avg_cycles -= (current_ap->avg_cycles + 63) >> 6;
+    }
+
+    if (ack == DAP_TRANSFER_OK && data != NULL &&
+            (request & REQUEST_ADDR_MASK) == DP_SELECT) {
+        select_ap((uint8_t)(*data >> 24));
+    }
+}
+
+void wait_backoff_command(uint8_t id)
+{
+    if (streak.active)
+        streak_end();
+
+    switch (id) {
+        case ID_DAP_Transfer:       current_cmd = &cmds[CMD_TRANSFER]; break;
+        case ID_DAP_TransferBlock:  current_cmd = &cmds[CMD_TRANSFER_BLOCK];
+                                    break;
+        case ID_DAP_WriteABORT:     current_cmd = &cmds[CMD_WRITE_ABORT]; break;
+        default:                    current_cmd = &cmds[CMD_OTHER]; break;
+    }
+}
+
+void wait_backoff_print_status(void)
+{
+    const uint32_t cycles_per_us = CPU_CLOCK / 1000000;
+
+    printf("WAIT backoff: up to %d idle cycles between retries.\n",
+            BACKOFF_MAX);
+    for (int i = 0; i < AP_SLOTS; i++) {
+        const struct ap_wait *ap = &aps[i];
+        if (!ap->used || ap->waits == 0)
+            continue;
+        printf("  AP %u: %"PRIu32" WAITs in %"PRIu32" accesses, average wait "
+                "%"PRIu32" clock cycles.\n", ap->apsel, ap->waits,
+                ap->accesses, ap->avg_cycles);
+    }
+    for (int i = 0; i < CMD_MAX; i++) {
+        const struct cmd_wait *c = &cmds[i];
+        if (c->accesses == 0)
+            continue;
+        printf("  %s: %"PRIu32" WAITs in %"PRIu32" accesses, latency "
+                "average %"PRIu32" us, max %"PRIu32" us.\n", c->name,
+                c->waits, c->accesses,
+                (uint32_t)(c->total_latency / c->accesses / cycles_per_us),
+                c->max_latency / cycles_per_us);
+    }
+}
@@ -0,0 +1,28 @@
+#ifndef WAIT_BACKOFF_H
+#define WAIT_BACKOFF_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Called by SWD_Transfer / JTAG_Transfer before each transfer. Returns the
+// number of idle cycles to clock before it, which is non-zero only when the
+// transfer retries a request that was answered with WAIT.
+uint32_t wait_backoff_before(uint32_t request);
+
+// Called after each transfer of 'bits' clock cycles with its ACK.
+void wait_backoff_after(uint32_t request, const uint32_t *data, uint32_t ack,
+        uint32_t bits);
+
+// Called at the start of each DAP command, for per-command statistics.
+void wait_backoff_command(uint8_t id);
+
+void wait_backoff_print_status(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // WAIT_BACKOFF_H